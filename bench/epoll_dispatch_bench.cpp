@@ -0,0 +1,133 @@
+/*
+ * cost per dispatched event of EpollEvent::Wait
+ *
+ *   ./epoll_dispatch_bench [fds] [rounds]
+ *
+ * every fd is an always readable eventfd (level triggered), so each Wait
+ * dispatches fds events. "map" replays the old dispatch, one std::map
+ * lookup per event, on the same epoll set as reference.
+ */
+
+#include "epoll_event.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+using namespace dc;
+
+static uint64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class CountHandler : public EventHandler {
+public:
+    CountHandler() : count_(0) {}
+
+    virtual void OnRead(int fd, uint32_t events) { (void)fd; (void)events; count_++; }
+    virtual void OnWrite(int fd, uint32_t events) { (void)fd; (void)events; }
+    virtual void OnError(int fd, uint32_t events, int err, std::string& error) {
+        (void)fd; (void)events; (void)err; (void)error;
+    }
+
+    uint64_t count_;
+};
+
+int main(int argc, char** argv) {
+    int nfds = argc > 1 ? atoi(argv[1]) : 512;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20000;
+
+    std::vector<int> fds;
+    for (int i = 0; i < nfds; i++) {
+        int fd = eventfd(1, EFD_NONBLOCK);
+        if (fd < 0) {
+            perror("eventfd");
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+
+    // slab dispatch, EpollEvent(true) is level triggered
+    CountHandler handler;
+    EpollEvent ee(true);
+    if (ee.Initialize() != 0) {
+        return 1;
+    }
+    for (int i = 0; i < nfds; i++) {
+        ee.AddEvent(fds[i], &handler, EPOLLIN);
+    }
+
+    uint64_t begin = NowNs();
+    for (int r = 0; r < rounds; r++) {
+        ee.Wait(0);
+    }
+    uint64_t slab_ns = NowNs() - begin;
+    uint64_t slab_events = handler.count_;
+
+    // reference: same epoll set, map lookup per event as before
+    struct EH {
+        epoll_event ee;
+        EventHandler* efd;
+    };
+    std::map<int, EH> fd_eh;
+    CountHandler map_handler;
+    int epfd = epoll_create(1024);
+    for (int i = 0; i < nfds; i++) {
+        EH eh;
+        eh.ee.events = EPOLLIN;
+        eh.ee.data.fd = fds[i];
+        eh.efd = &map_handler;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &eh.ee);
+        fd_eh[fds[i]] = eh;
+    }
+
+    std::vector<epoll_event> events(1024);
+    begin = NowNs();
+    for (int r = 0; r < rounds; r++) {
+        int n = epoll_wait(epfd, &events[0], events.size(), 0);
+        for (int i = 0; i < n; i++) {
+            std::map<int, EH>::iterator it = fd_eh.find(events[i].data.fd);
+            if (events[i].events & EPOLLIN) {
+                if (it != fd_eh.end() && it->second.efd) {
+                    it->second.efd->OnRead(it->second.ee.data.fd, events[i].events);
+                }
+            }
+            if (events[i].events & EPOLLOUT) {
+                it = fd_eh.find(events[i].data.fd);
+                if (it != fd_eh.end() && it->second.efd) {
+                    it->second.efd->OnWrite(it->second.ee.data.fd, events[i].events);
+                }
+            }
+        }
+    }
+    uint64_t map_ns = NowNs() - begin;
+    uint64_t map_events = map_handler.count_;
+
+    // floor: epoll_wait alone
+    begin = NowNs();
+    uint64_t raw_events = 0;
+    for (int r = 0; r < rounds; r++) {
+        raw_events += epoll_wait(epfd, &events[0], events.size(), 0);
+    }
+    uint64_t raw_ns = NowNs() - begin;
+
+    printf("fds:%d rounds:%d\n", nfds, rounds);
+    printf("%-12s %12s %12s\n", "dispatch", "events", "ns/event");
+    printf("%-12s %12llu %12.2f\n", "epoll_wait", (unsigned long long)raw_events, (double)raw_ns / raw_events);
+    printf("%-12s %12llu %12.2f\n", "map", (unsigned long long)map_events, (double)map_ns / map_events);
+    printf("%-12s %12llu %12.2f\n", "slab", (unsigned long long)slab_events, (double)slab_ns / slab_events);
+
+    close(epfd);
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,447 @@
+/*
+ * end to end commit path of a 3 / 5 node cluster, in one process
+ *
+ *   ./raft_cluster_bench [nodes] [size] [concurrency] [seconds] [dir] [port] [codec]
+ *
+ * every node is laid out like Config::self_ / others_ (dc::Node, 127.0.0.1,
+ * port + id) with its own SocketEvent loop thread, LogStore under
+ * dir/<pid>/node<id> and real fdatasync. node 1 is leader of term 1, no
+ * election: the leader runs ProposalQueue -> LogStore -> LogReplicate,
+ * followers append, flush once per loop tick (group commit) and answer.
+ *
+ * concurrency proposals of size bytes are kept outstanding (closed loop
+ * clients), a committed one is replaced by a new one. commit latency is
+ * from Propose() until LogReplicate::CommitIndex() covers the index, on
+ * the leader. the first second is warm up and not counted.
+ *
+ * payloads are JSON like records. codec ("none", "lz4") is what the leader
+ * compresses batches with, followers announce theirs in MSG_HELLO on accept.
+ */
+
+#include "socket_event.h"
+#include "metrics.h"
+#include "common.h"
+#include "file_util.h"
+#include "log_store.h"
+#include "log_replicate.h"
+#include "proposal_queue.h"
+#include "message.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+
+using namespace dc;
+using namespace dcraft;
+
+#define BENCH_TERM 1
+#define BENCH_WARMUP_US 1000000
+
+static uint64_t NowMs() {
+    return NowUs() / 1000;
+}
+
+class BenchNode;
+
+class PeerConn : public SocketFdHandler {
+public:
+    PeerConn(BenchNode* node, SocketEvent* se, int fd = -1)
+        : SocketFdHandler(0, 0, se, fd), node_(node) {}
+
+    virtual void OnMessage(const MessageView& msg);
+    virtual void OnError(int fd, int err, std::string& error) {
+        fprintf(stderr, "PeerConn, error fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+    }
+
+    int fd() const { return fd_; }
+
+private:
+    BenchNode* node_;
+};
+
+class BenchNode : public SocketEvent {
+public:
+    BenchNode(const Node& self, const std::vector<Node>& others, const std::string& dir)
+        : SocketEvent(SOCKET_TCP, true)      // true: EPOLLET
+        , self_(self)
+        , others_(others)
+        , store_(dir)
+        , replicate_(&store_, self.id)
+        , proposals_(&store_, &replicate_)
+        , leader_(self.role == LEADER)
+        , listen_fd_(-1)
+        , size_(0)
+        , concurrency_(0)
+        , running_(false)
+        , stop_(false)
+        , begin_us_(0)
+        , end_us_(0)
+        , committed_(0) {
+    }
+
+    virtual ~BenchNode() {
+        // handlers go before SocketEvent clears their send queues
+        for (size_t i = 0; i < conns_.size(); i++) {
+            DelSocket(conns_[i]->fd());
+            delete conns_[i];
+        }
+        if (listen_fd_ >= 0) {
+            DelSocket(listen_fd_);
+        }
+    }
+
+    int Start(uint32_t size, uint32_t concurrency, int codec) {
+        size_ = size;
+        concurrency_ = concurrency;
+        while (payload_.size() < size) {
+            char record[128];
+            snprintf(record, sizeof(record), "{\"op\":\"put\",\"key\":\"user:%zu\",\"value\":{\"age\":%zu,\"tags\":[\"a\",\"b\"]}}",
+                     payload_.size() * 7919 % 100000, payload_.size() % 97);
+            payload_.append(record);
+        }
+        payload_.resize(size);
+
+        if (Initialize() != 0 || store_.Initialize() != 0) {
+            return -1;
+        }
+
+        listen_fd_ = AddListenSocket(self_.ip_str, self_.port);
+        if (listen_fd_ < 0) {
+            return -1;
+        }
+
+        if (leader_) {
+            replicate_.set_slab(slab());
+            replicate_.set_compress(codec);
+            if (proposals_.Initialize(event_loop()) != 0) {
+                return -1;
+            }
+            for (size_t i = 0; i < others_.size(); i++) {
+                PeerConn* conn = new PeerConn(this, this);
+                if (AddConnection(others_[i].ip_str, others_[i].port, conn, SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR) == -1) {
+                    delete conn;
+                    return -1;
+                }
+                conns_.push_back(conn);
+                replicate_.AddFollower(others_[i].id, conn, others_[i].max_inflight_msgs, others_[i].max_inflight_bytes);
+            }
+            replicate_.Reset(BENCH_TERM);
+        }
+
+        thread_ = std::thread(&BenchNode::Run, this);
+        return 0;
+    }
+
+    // leader, clients start proposing
+    void Go() { running_ = true; }
+    void Stop() { stop_ = true; }
+    void Join() { thread_.join(); }
+
+    virtual void OnAccept(int fd, uint32_t ip, int port) {
+        (void)ip;
+        (void)port;
+        PeerConn* conn = new PeerConn(this, this, fd);
+        if (AddSocket(fd, conn, SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR) != 0) {
+            close(fd);
+            delete conn;
+            return;
+        }
+        conns_.push_back(conn);
+
+        Hello hello = {self_.id, SupportedCompressors()};
+        std::string out;
+        EncodeHello(hello, &out);
+        conn->Send(out);
+    }
+
+    void OnMessage(PeerConn* conn, const MessageView& msg) {
+        if (msg.header.type == MSG_APPEND_ENTRIES) {
+            OnAppendEntries(conn, msg);
+        } else if (msg.header.type == MSG_APPEND_ENTRIES_RESP) {
+            AppendEntriesResponse resp;
+            if (DecodeAppendEntriesResp(msg, &resp) == 0) {
+                replicate_.OnAppendEntriesResponse(resp);
+            }
+        } else if (msg.header.type == MSG_HELLO) {
+            Hello hello;
+            if (DecodeHello(msg, &hello) == 0) {
+                replicate_.OnHello(hello);
+            }
+        }
+    }
+
+    Histogram& latency() { return latency_; }
+    uint64_t committed() const { return committed_; }
+    uint64_t elapsed_us() const { return end_us_ - begin_us_; }
+
+private:
+    struct Reply {
+        PeerConn* conn;
+        AppendEntriesResponse resp;
+    };
+
+    struct Stamp {
+        uint64_t index;
+        uint64_t us;
+    };
+
+    void OnAppendEntries(PeerConn* conn, const MessageView& msg) {
+        AppendEntriesView& req = recvView_;
+        if (DecodeAppendEntries(msg, &req) != 0) {
+            return;
+        }
+
+        Reply r;
+        r.conn = conn;
+        r.resp.term = BENCH_TERM;
+        r.resp.from_id = self_.id;
+        r.resp.prev_log_index = req.prev_log_index;
+        r.resp.match_index = 0;
+        r.resp.hint_index = store_.last_index();
+        r.resp.read_seq = req.read_seq;
+        r.resp.success = false;
+
+        if (req.prev_log_index > store_.last_index()
+            || (req.prev_log_index > 0 && store_.Term(req.prev_log_index) != req.prev_log_term)) {
+            replies_.push_back(r);
+            return;
+        }
+
+        for (size_t i = 0; i < req.entries.size(); i++) {
+            const EntryView& e = req.entries[i];
+            if (e.index <= store_.last_index()) {
+                if (store_.Term(e.index) == e.term) {
+                    continue;
+                }
+                store_.TruncateSuffix(e.index);
+            }
+            store_.Append(e.term, e.data, e.len, e.crc);
+        }
+
+        r.resp.success = true;
+        r.resp.match_index = req.prev_log_index + req.entries.size();
+        replies_.push_back(r);
+    }
+
+    // follower: one fdatasync for everything received this tick
+    void FollowerTick() {
+        if (replies_.empty()) {
+            return;
+        }
+        if (store_.Flush() != 0) {
+            fprintf(stderr, "BenchNode, flush fail, id:%" PRIu64 "\n", self_.id);
+        }
+
+        std::string out;
+        for (size_t i = 0; i < replies_.size(); i++) {
+            out.clear();
+            EncodeAppendEntriesResp(replies_[i].resp, &out);
+            replies_[i].conn->Send(out);
+        }
+        replies_.clear();
+    }
+
+    void LeaderTick() {
+        uint64_t commit = replicate_.CommitIndex();
+        uint64_t now = NowUs();
+
+        while (!stamps_.empty() && stamps_.front().index <= commit) {
+            if (stamps_.front().us >= begin_us_) {
+                latency_.Record(now - stamps_.front().us);
+                committed_++;
+            }
+            stamps_.pop_front();
+        }
+
+        if (!running_) {
+            return;
+        }
+        if (begin_us_ == 0) {
+            begin_us_ = now + BENCH_WARMUP_US;
+        }
+        end_us_ = now;
+
+        while (!stop_ && stamps_.size() < concurrency_) {
+            uint64_t index = proposals_.Propose(BENCH_TERM, payload_.data(), payload_.size());
+            if (index == 0) {
+                break;
+            }
+            Stamp s = {index, now};
+            stamps_.push_back(s);
+        }
+
+        proposals_.Tick();
+    }
+
+    void Run() {
+        slab()->Bind();
+        while (!stop_) {
+            Wait(NowMs(), 1);
+            if (leader_) {
+                LeaderTick();
+            } else {
+                FollowerTick();
+            }
+        }
+    }
+
+    Node self_;
+    std::vector<Node> others_;
+
+    LogStore store_;
+    LogReplicate replicate_;
+    ProposalQueue proposals_;
+    bool leader_;
+
+    int listen_fd_;
+    std::vector<PeerConn*> conns_;
+    std::vector<Reply> replies_;
+    AppendEntriesView recvView_;
+
+    uint32_t size_;
+    uint32_t concurrency_;
+    std::string payload_;
+    std::deque<Stamp> stamps_;
+
+    std::atomic<bool> running_;
+    std::atomic<bool> stop_;
+    std::thread thread_;
+
+    uint64_t begin_us_;             // after warm up
+    uint64_t end_us_;
+    uint64_t committed_;
+    Histogram latency_;
+};
+
+void PeerConn::OnMessage(const MessageView& msg) {
+    node_->OnMessage(this, msg);
+}
+
+static void RemoveDir(const std::string& dir) {
+    std::vector<std::string> names;
+    if (ListDir(dir, &names) == 0) {
+        for (size_t i = 0; i < names.size(); i++) {
+            unlink((dir + "/" + names[i]).c_str());
+        }
+    }
+    rmdir(dir.c_str());
+}
+
+static void PrintHistogram(const char* name, const std::string& labels) {
+    Histogram* h = RAFT_METRICS()->GetHistogram(name, labels);
+    printf("%-36s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+           (std::string(name) + (labels.empty() ? "" : "{" + labels + "}")).c_str(),
+           h->count(), h->Percentile(0.5), h->Percentile(0.99), h->Percentile(0.999));
+}
+
+int main(int argc, char** argv) {
+    int nodes = argc > 1 ? atoi(argv[1]) : 3;
+    uint32_t size = argc > 2 ? atoi(argv[2]) : 256;
+    uint32_t concurrency = argc > 3 ? atoi(argv[3]) : 64;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    std::string dir = argc > 5 ? argv[5] : "/tmp/raft_cluster_bench";
+    int port = argc > 6 ? atoi(argv[6]) : 18870;
+    int codec = CompressorType(argc > 7 ? argv[7] : "none");
+
+    if (nodes < 1 || concurrency < 1 || codec < 0) {
+        fprintf(stderr, "usage: %s [nodes] [size] [concurrency] [seconds] [dir] [port] [codec]\n", argv[0]);
+        return 1;
+    }
+
+    char pid[32];
+    snprintf(pid, sizeof(pid), "/%d", getpid());
+    dir += pid;
+
+    // the cluster section of Config, one view per node
+    std::vector<Node> cluster;
+    for (int i = 1; i <= nodes; i++) {
+        Node n;
+        n.ip = 0;
+        n.ip_str = "127.0.0.1";
+        n.port = port + i;
+        n.id = i;
+        n.role = i == 1 ? LEADER : FOLLOWER;
+        n.max_inflight_msgs = 0;
+        n.max_inflight_bytes = 0;
+        cluster.push_back(n);
+    }
+
+    std::vector<BenchNode*> bench;
+    for (int i = 0; i < nodes; i++) {
+        std::vector<Node> others;
+        for (int j = 0; j < nodes; j++) {
+            if (j != i) {
+                others.push_back(cluster[j]);
+            }
+        }
+
+        char node_dir[64];
+        snprintf(node_dir, sizeof(node_dir), "/node%d", i + 1);
+        if (MakeDirs(dir + node_dir) != 0) {
+            fprintf(stderr, "mkdir %s%s fail\n", dir.c_str(), node_dir);
+            return 1;
+        }
+        bench.push_back(new BenchNode(cluster[i], others, dir + node_dir));
+    }
+
+    // followers listen before the leader connects
+    for (int i = nodes - 1; i >= 0; i--) {
+        if (bench[i]->Start(size, concurrency, codec) != 0) {
+            fprintf(stderr, "node %d start fail\n", i + 1);
+            return 1;
+        }
+    }
+
+    bench[0]->Go();
+    sleep(seconds + 1);
+    for (int i = 0; i < nodes; i++) {
+        bench[i]->Stop();
+    }
+    for (int i = 0; i < nodes; i++) {
+        bench[i]->Join();
+    }
+
+    BenchNode* leader = bench[0];
+    double secs = leader->elapsed_us() / 1e6;
+    Histogram& lat = leader->latency();
+    printf("nodes:%d size:%u concurrency:%u seconds:%d codec:%s\n", nodes, size, concurrency, seconds,
+           codec ? GetCompressor(codec)->name() : "none");
+    printf("%12s %12s %10s %10s %10s %10s\n", "committed", "ops/s", "MB/s", "p50_us", "p99_us", "p999_us");
+    printf("%12" PRIu64 " %12.0f %10.2f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+           leader->committed(), leader->committed() / secs,
+           leader->committed() * (double)size / secs / (1024 * 1024),
+           lat.Percentile(0.5), lat.Percentile(0.99), lat.Percentile(0.999));
+
+    // built in metrics of all nodes, warm up included
+    printf("\n%-36s %10s %10s %10s %10s\n", "metric", "count", "p50", "p99", "p999");
+    PrintHistogram("raft_fsync_us", "file=\"segment\"");
+    for (int i = 2; i <= nodes; i++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "peer=\"%d\"", i);
+        PrintHistogram("raft_append_rtt_us", labels);
+    }
+    PrintHistogram("dc_epoll_events_per_wakeup", "");
+
+    printf("\n%-36s %10" PRIu64 "\n", "raft_peer_sent_bytes{peer=\"2\"}",
+           RAFT_METRICS()->GetCounter("raft_peer_sent_bytes", "peer=\"2\"")->value());
+    uint64_t raw = RAFT_METRICS()->GetCounter("dc_compress_raw_bytes")->value();
+    if (raw) {
+        printf("%-36s %10.3f\n", "compressed / raw", (double)RAFT_METRICS()->GetCounter("dc_compress_out_bytes")->value() / raw);
+    }
+
+    for (int i = 0; i < nodes; i++) {
+        delete bench[i];
+        char node_dir[64];
+        snprintf(node_dir, sizeof(node_dir), "/node%d", i + 1);
+        RemoveDir(dir + node_dir);
+    }
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * SocketEvent send / recv path over loopback tcp, one loop thread
+ *
+ *   ./socket_event_bench [size] [frames] [port]
+ *
+ *   stream   : frames of size bytes are queued (pooled Buffer + Send(IoChain))
+ *              while the send queue is under STREAM_QUEUE_BYTES, the other
+ *              end cuts them (DecodeFrame) and counts OnMessage() calls
+ *   pingpong : one frame at a time, echoed back, round trip per frame
+ *
+ * both ends live on the same SocketEvent, so every byte crosses
+ * OnWrite (sendmsg) and OnRead (recv into the RingBuffer) once per hop.
+ */
+
+#include "socket_event.h"
+#include "metrics.h"
+#include "codec.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <string>
+
+using namespace dc;
+
+#define BENCH_MSG 100
+#define STREAM_QUEUE_BYTES (1024 * 1024)
+
+class BenchConn : public SocketFdHandler {
+public:
+    BenchConn(SocketEvent* se, bool echo, int fd = -1)
+        : SocketFdHandler(0, 0, se, fd), echo_(echo), frames_(0), bytes_(0) {}
+
+    virtual void OnMessage(const MessageView& msg) {
+        frames_++;
+        bytes_ += msg.length;
+        if (echo_) {
+            std::string out;
+            EncodeFrameHeader(BENCH_MSG, 0, msg.length, &out);
+            out.append(msg.body, msg.length);
+            Send(out);
+        }
+    }
+
+    virtual void OnError(int fd, int err, std::string& error) {
+        fprintf(stderr, "BenchConn, error fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+    }
+
+    // one frame, header and body in one pooled Buffer like the raft encoders
+    void SendFrame(const std::string& body, Slab* slab) {
+        Buffer* buf = Buffer::Create(sizeof(FrameHeader) + body.size(), slab);
+        EncodeFrameHeader(BENCH_MSG, 0, body.size(), buf->data());
+        memcpy(buf->data() + sizeof(FrameHeader), body.data(), body.size());
+        chain_.Append(buf, 0, buf->size());
+        buf->Release();
+        Send(chain_);
+    }
+
+    int fd() const { return fd_; }
+
+    bool echo_;
+    uint64_t frames_;
+    uint64_t bytes_;
+
+private:
+    IoChain chain_;
+};
+
+class BenchEvent : public SocketEvent {
+public:
+    BenchEvent()
+        : SocketEvent(SOCKET_TCP, true)     // true: EPOLLET
+        , server_(NULL)
+        , echo_(false) {
+    }
+
+    virtual ~BenchEvent() {
+        if (server_) {
+            DelSocket(server_->fd());
+            delete server_;
+        }
+    }
+
+    virtual void OnAccept(int fd, uint32_t ip, int port) {
+        (void)ip;
+        (void)port;
+        server_ = new BenchConn(this, echo_, fd);
+        if (AddSocket(fd, server_, SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR) != 0) {
+            close(fd);
+            delete server_;
+            server_ = NULL;
+        }
+    }
+
+    BenchConn* server_;
+    bool echo_;
+};
+
+static void Connect(BenchEvent* se, BenchConn* client, int port) {
+    std::string ip = "127.0.0.1";
+    se->AddConnection(ip, port, client, SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR);
+    while (!se->server_) {
+        se->Wait(NowUs() / 1000, 1);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint32_t size = argc > 1 ? atoi(argv[1]) : 256;
+    uint64_t frames = argc > 2 ? atoll(argv[2]) : 1000000;
+    int port = argc > 3 ? atoi(argv[3]) : 18860;
+
+    std::string body(size, 'x');
+    std::string ip = "127.0.0.1";
+
+    // stream
+    uint64_t stream_us = 0;
+    uint64_t stream_frames = 0;
+    uint64_t wakeups = 0;
+    {
+        BenchEvent se;
+        if (se.Initialize() != 0 || se.AddListenSocket(ip, port) < 0) {
+            fprintf(stderr, "listen on %d fail\n", port);
+            return 1;
+        }
+        se.slab()->Bind();
+
+        BenchConn* client = new BenchConn(&se, false);
+        Connect(&se, client, port);
+
+        Counter* epoll_wakeups = RAFT_METRICS()->GetCounter("dc_epoll_wakeups");
+        uint64_t wakeups_begin = epoll_wakeups->value();
+        uint64_t sent = 0;
+        uint64_t begin = NowUs();
+        while (se.server_->frames_ < frames) {
+            while (sent < frames && client->sendChain().bytes() < STREAM_QUEUE_BYTES) {
+                client->SendFrame(body, se.slab());
+                sent++;
+            }
+            se.Wait(NowUs() / 1000, 1);
+        }
+        stream_us = NowUs() - begin;
+        stream_frames = se.server_->frames_;
+        wakeups = epoll_wakeups->value() - wakeups_begin;
+
+        printf("size:%u frames:%" PRIu64 "\n", size, frames);
+        printf("%-10s %12s %10s %12s %12s %10s\n", "mode", "frames/s", "MB/s", "ns/frame", "frames/wake", "slab_hit");
+        printf("%-10s %12.0f %10.2f %12.1f %12.1f %10.3f\n", "stream",
+               stream_frames * 1e6 / stream_us, stream_frames * (double)size / stream_us * 1e6 / (1024 * 1024),
+               stream_us * 1000.0 / stream_frames, (double)stream_frames / wakeups, se.slab()->hit_rate());
+
+        se.DelSocket(client->fd());
+        delete client;
+    }
+
+    // pingpong, fewer rounds, one frame per round trip
+    {
+        BenchEvent se;
+        se.echo_ = true;
+        if (se.Initialize() != 0 || se.AddListenSocket(ip, port + 1) < 0) {
+            fprintf(stderr, "listen on %d fail\n", port + 1);
+            return 1;
+        }
+        se.slab()->Bind();
+
+        BenchConn* client = new BenchConn(&se, false);
+        Connect(&se, client, port + 1);
+
+        uint64_t rounds = frames / 10 ? frames / 10 : 1;
+        Histogram rtt;
+        uint64_t begin = NowUs();
+        for (uint64_t i = 0; i < rounds; i++) {
+            uint64_t start = NowUs();
+            client->SendFrame(body, se.slab());
+            while (client->frames_ <= i) {
+                se.Wait(NowUs() / 1000, 1);
+            }
+            rtt.Record(NowUs() - start);
+        }
+        uint64_t us = NowUs() - begin;
+
+        printf("%-10s %12.0f %10.2f %12.1f %12s %10.3f\n", "pingpong",
+               rounds * 1e6 / us, rounds * (double)size / us * 1e6 / (1024 * 1024),
+               us * 1000.0 / rounds, "-", se.slab()->hit_rate());
+        printf("pingpong rtt us p50:%" PRIu64 " p99:%" PRIu64 " p999:%" PRIu64 " max:%" PRIu64 "\n",
+               rtt.Percentile(0.5), rtt.Percentile(0.99), rtt.Percentile(0.999), rtt.max());
+
+        se.DelSocket(client->fd());
+        delete client;
+    }
+
+    return 0;
+}
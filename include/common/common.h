@@ -18,6 +18,9 @@ struct Node {
     uint64_t        id;
     RaftRole        role;
     std::string     role_str;       // Leader, Follower, Condidate, ""
+
+    uint32_t        max_inflight_msgs;      // replication window to this node, 0 = default
+    uint64_t        max_inflight_bytes;
 };
 
 }   // namespace dc
@@ -6,6 +6,14 @@
 #include <memory>
 #include <rapidjson/document.h>
 #include "log.h"
+#include "event_loop.h"
+#include "compress.h"
+#include "log_store.h"
+#include "tail_cache.h"
+#include "log_replicate.h"
+#include "proposal_queue.h"
+#include "apply_pipeline.h"
+#include "shared_wal.h"
 
 /*
 {
@@ -17,7 +25,11 @@
         "others":[
         {
             "ip":"1.1.1.2",
-            "port":17873
+            "port":17873,
+            "window":{
+                "msgs":64,
+                "bytes":"8M"
+            }
         },
         {
             "ip":"1.1.1.3",
@@ -27,7 +39,40 @@
     },
     "raft":{
         "data_dir":"/data/.raft/data",
-        "snapshot":"snapshot"
+        "segment_size":"64M",
+        "tail_cache":"64M",
+        "snapshot":"snapshot",
+        "snapshot_entries":100000,
+        "election_timeout_ms":1000,
+        "pre_vote":true,
+        "check_quorum":true,
+        "read":"lease",
+        "apply":{
+            "ring":4096,
+            "workers":0
+        },
+        "recover":{
+            "threads":4,
+            "verify":false
+        },
+        "groups":1,
+        "wal_dir":"/data/.raft/wal",
+        "wal_segment_size":"64M",
+        "batch":{
+            "entries":256,
+            "bytes":"1M",
+            "linger_us":200,
+            "adaptive":true
+        },
+        "compress":{
+            "codec":"lz4",
+            "min_bytes":4096
+        },
+        "io":"epoll"
+    },
+    "metrics":{
+        "ip":"0.0.0.0",
+        "port":17874
     },
     "log":{
         "dir":"/data/.raft/log",
@@ -42,10 +87,18 @@ namespace dcraft {
 
 #define DEFAULT_RAFT_PORT 17873
 #define DEFAULT_DATA_DIR "data/.raft/data"
+// the defaults of the modules are in their headers: DEFAULT_SEGMENT_SIZE,
+// DEFAULT_PROPOSAL_*, DEFAULT_APPLY_RING, DEFAULT_RECOVER_THREADS ...
 #define DEFAULT_SNAPSHOT "snapshot"
 #define DEFAULT_SNAPSHOT_FILE "snapshot.dat"
+#define DEFAULT_SNAPSHOT_ENTRIES 100000
+#define DEFAULT_ELECTION_TIMEOUT_MS 1000
+#define DEFAULT_APPLY_WORKERS 0
+#define DEFAULT_GROUPS 1
+#define DEFAULT_WAL_DIR "/data/.raft/wal"
+#define DEFAULT_METRICS_IP "0.0.0.0"
+#define DEFAULT_METRICS_PORT 0
 #define DEFAULT_LOG_DIR "/data/.raft/log"
-#define DEFAULT_LOG_FILE "raft.log"
 #define DEFAULT_LOG_SIZE 100 * 1024 * 1024
 #define DEFAULT_LOG_NUM 100
 
@@ -53,19 +106,42 @@ class Config {
 public:
     Config(std::string& path)
         : log_dir_(DEFAULT_LOG_DIR)
-        , log_file_(DEFAULT_LOG_FILE)
+        , log_file_(DEFAULT_LOG_FILE_NAME)
         , log_size_(DEFAULT_LOG_SIZE)
         , log_num_(DEFAULT_LOG_NUM)
         , data_dir_(DEFAULT_DATA_DIR)
+        , segment_size_(DEFAULT_SEGMENT_SIZE)
+        , tail_cache_size_(DEFAULT_TAIL_CACHE_BYTES)
+        , batch_entries_(DEFAULT_PROPOSAL_ENTRIES)
+        , batch_bytes_(DEFAULT_PROPOSAL_BYTES)
+        , batch_linger_us_(DEFAULT_PROPOSAL_LINGER_US)
+        , batch_adaptive_(true)
+        , compress_type_(dc::COMPRESS_NONE)
+        , compress_min_bytes_(DEFAULT_COMPRESS_MIN_BYTES)
+        , io_backend_(dc::LOOP_EPOLL)
         , snapshot_dir_(DEFAULT_SNAPSHOT)
-        , snapshot_file_(DEFAULT_SNAPSHOT_FILE) {
+        , snapshot_file_(DEFAULT_SNAPSHOT_FILE)
+        , snapshot_entries_(DEFAULT_SNAPSHOT_ENTRIES)
+        , election_timeout_ms_(DEFAULT_ELECTION_TIMEOUT_MS)
+        , pre_vote_(true)
+        , check_quorum_(true)
+        , read_lease_(false)
+        , apply_ring_(DEFAULT_APPLY_RING)
+        , apply_workers_(DEFAULT_APPLY_WORKERS)
+        , recover_threads_(DEFAULT_RECOVER_THREADS)
+        , recover_verify_(false)
+        , groups_(DEFAULT_GROUPS)
+        , wal_dir_(DEFAULT_WAL_DIR)
+        , wal_segment_size_(DEFAULT_WAL_SEGMENT_SIZE)
+        , metrics_ip_(DEFAULT_METRICS_IP)
+        , metrics_port_(DEFAULT_METRICS_PORT) {
         conf_file_ = path;
     }
 
     int Initialize() {
         std::shared_ptr<FILE> f_ptr = make_shared<FILE>(fopen(path.c_str(), "r"), [f]() { if (f) { fclose(f); } });
         if (!f_ptr.get()) {
-            fprintf(stderr, "open conf file error!\n");
+            LOG_ERROR(dc::RAFT_LOG(), "open conf file error!\n");
             return -1;
         }
 
@@ -74,7 +150,7 @@ public:
         newDoc.ParseStream<0>(inputStream);
 
         if (document.HasParseError()) {
-            fprintf(stderr, "Json Parse error: %d\n", document.GetParseError());
+            LOG_ERROR(dc::RAFT_LOG(), "Json Parse error: %d\n", document.GetParseError());
             return -1;
         }
 
@@ -97,7 +173,7 @@ public:
         }
 
         // init log     
-        RAFT_LOG_INIT(file_size_, file_num);
+        RAFT_LOG_INIT(log_size_, log_num_, log_dir_, log_file_);
     
         if (!document.HasMember("clusters")) {
             RAFT_LOG()->Error("Json conf has no clusters.\n");
@@ -122,7 +198,7 @@ public:
             return -1;
         }
         uint32_t port = jself.HasMember("port") ? jself["port"].asInt() : DEFAULT_RAFT_PORT;
-        self_ = {ip, ip_str, port, IdByIpPort(ip, port), RaftRole::DEFAULT, ""};
+        self_ = {ip, ip_str, port, IdByIpPort(ip, port), RaftRole::DEFAULT, "", 0, 0};
 
         if (!jclusters.HasMember("others")) {
             RAFT_LOG()->Error("Json conf has no others.\n");
@@ -143,7 +219,16 @@ public:
                 return -1;
             }
             uint32_t port = jitem.HasMember("port") ? jitem["port"].asInt() : DEFAULT_RAFT_PORT;
-            Node other = {ip, ip_str, port, IdByIpPort(ip, port), RaftRole::DEFAULT, ""};
+            Node other = {ip, ip_str, port, IdByIpPort(ip, port), RaftRole::DEFAULT, "", 0, 0};
+            if (jitem.HasMember("window")) {
+                rapidjson::Value& jwindow = jitem["window"];
+                if (jwindow.HasMember("msgs")) {
+                    other.max_inflight_msgs = jwindow["msgs"].asInt();
+                }
+                if (jwindow.HasMember("bytes") && !jwindow["bytes"].asString().empty()) {
+                    other.max_inflight_bytes = ParseSize(jwindow["bytes"].asString());
+                }
+            }
 
             others_.push_back(other);
         }
@@ -153,18 +238,144 @@ public:
             if (jraft.HasMember("dir") && !jraft["dir"].asString().empty()) {
                data_dir_ = jraft["dir"].asString();
             }
+            if (jraft.HasMember("segment_size") && !jraft["segment_size"].asString().empty()) {
+                segment_size_ = ParseSize(jraft["segment_size"].asString());
+            }
+            if (jraft.HasMember("tail_cache") && !jraft["tail_cache"].asString().empty()) {
+                tail_cache_size_ = ParseSize(jraft["tail_cache"].asString());
+            }
+            if (jraft.HasMember("batch")) {
+                rapidjson::Value& jbatch = jraft["batch"];
+                if (jbatch.HasMember("entries")) {
+                    batch_entries_ = jbatch["entries"].asInt();
+                }
+                if (jbatch.HasMember("bytes") && !jbatch["bytes"].asString().empty()) {
+                    batch_bytes_ = ParseSize(jbatch["bytes"].asString());
+                }
+                if (jbatch.HasMember("linger_us")) {
+                    batch_linger_us_ = jbatch["linger_us"].asInt();
+                }
+                if (jbatch.HasMember("adaptive")) {
+                    batch_adaptive_ = jbatch["adaptive"].asBool();
+                }
+            }
+            if (jraft.HasMember("compress")) {
+                rapidjson::Value& jcompress = jraft["compress"];
+                if (jcompress.HasMember("codec")) {
+                    int type = dc::CompressorType(jcompress["codec"].asString());
+                    if (type < 0) {
+                        LOG_ERROR(dc::RAFT_LOG(), "unknown compress codec:%s\n", jcompress["codec"].asString().c_str());
+                        return -1;
+                    }
+                    compress_type_ = type;
+                }
+                if (jcompress.HasMember("min_bytes")) {
+                    compress_min_bytes_ = jcompress["min_bytes"].asInt();
+                }
+            }
+            if (jraft.HasMember("io") && jraft["io"].asString() == "io_uring") {
+                io_backend_ = dc::LOOP_URING;
+            }
             if (jraft.HasMember("snapshot") && !jraft["snapshot"].asString().empty()) {
                snapshot_dir__ = jraft["snapshot"].asString();
             }
+            if (jraft.HasMember("snapshot_entries")) {
+                snapshot_entries_ = jraft["snapshot_entries"].asInt();
+            }
+            if (jraft.HasMember("election_timeout_ms")) {
+                election_timeout_ms_ = jraft["election_timeout_ms"].asInt();
+            }
+            if (jraft.HasMember("pre_vote")) {
+                pre_vote_ = jraft["pre_vote"].asBool();
+            }
+            if (jraft.HasMember("check_quorum")) {
+                check_quorum_ = jraft["check_quorum"].asBool();
+            }
+            if (jraft.HasMember("read") && jraft["read"].asString() == "lease") {
+                read_lease_ = true;
+            }
+            if (read_lease_ && !check_quorum_) {
+                // a deposed leader could serve stale reads until its lease runs out
+                LOG_ERROR(dc::RAFT_LOG(), "read lease needs check_quorum\n");
+                return -1;
+            }
+            if (jraft.HasMember("apply")) {
+                rapidjson::Value& japply = jraft["apply"];
+                if (japply.HasMember("ring")) {
+                    apply_ring_ = japply["ring"].asInt();
+                }
+                if (japply.HasMember("workers")) {
+                    apply_workers_ = japply["workers"].asInt();
+                }
+            }
+            if (jraft.HasMember("recover")) {
+                rapidjson::Value& jrecover = jraft["recover"];
+                if (jrecover.HasMember("threads")) {
+                    recover_threads_ = jrecover["threads"].asInt();
+                }
+                if (jrecover.HasMember("verify")) {
+                    recover_verify_ = jrecover["verify"].asBool();
+                }
+            }
+            if (jraft.HasMember("groups")) {
+                groups_ = jraft["groups"].asInt();
+            }
+            if (jraft.HasMember("wal_dir") && !jraft["wal_dir"].asString().empty()) {
+                wal_dir_ = jraft["wal_dir"].asString();
+            }
+            if (jraft.HasMember("wal_segment_size") && !jraft["wal_segment_size"].asString().empty()) {
+                wal_segment_size_ = ParseSize(jraft["wal_segment_size"].asString());
+            }
+        }
+
+        if (document.HasMember("metrics")) {
+            rapidjson::Value& jmetrics = document["metrics"];
+            if (jmetrics.HasMember("ip") && !jmetrics["ip"].asString().empty()) {
+                metrics_ip_ = jmetrics["ip"].asString();
+            }
+            if (jmetrics.HasMember("port")) {
+                metrics_port_ = jmetrics["port"].asInt();
+            }
         }
     }
     
+    // "64M" -> bytes in 64 bits, unit K / M / G, none: M
+    static uint64_t ParseSize(const std::string& s) {
+        char* end = NULL;
+        uint64_t n = std::strtoull(s.c_str(), &end, 10);
+        switch (*end) {
+        case 'K':
+        case 'k':
+            return n << 10;
+        case 'G':
+        case 'g':
+            return n << 30;
+        default:
+            return n << 20;
+        }
+    }
+
     std::string log_dir_;
     std::string log_file_;
     uint32_t log_size_;
     uint32_t log_num_;
 
     std::string data_dir_;
+    uint64_t segment_size_;         // LogStore segment file size
+    uint64_t tail_cache_size_;      // last entries kept in memory, 0: no TailCache
+
+    // leader proposal batching, flush on entries / bytes / linger timer
+    uint32_t batch_entries_;
+    uint64_t batch_bytes_;
+    uint32_t batch_linger_us_;      // 0: flush every event loop tick
+    bool batch_adaptive_;
+
+    // AppendEntries / snapshot chunks to peers that support the codec, "none": off
+    int compress_type_;             // dc::COMPRESS_TYPE
+    uint32_t compress_min_bytes_;   // smaller batches go plain
+
+    // "epoll" / "io_uring", io_uring falls back to epoll if not usable
+    dc::EVENT_LOOP_TYPE io_backend_;
 
     Node self_;
     std::vector<Node> others_;
@@ -173,6 +384,33 @@ public:
     std::string snapshot_dir_;        // 相对于data_dir_的路径, 文件名snapshot.dat
     std::string snapshot_file_;
 
+    uint64_t snapshot_entries_;     // entries applied between two background snapshots
+
+    uint32_t election_timeout_ms_;
+    // a timed out node campaigns only if a majority would vote for it, the leader
+    // steps down without a majority, followers in touch with it ignore votes
+    bool pre_vote_;
+    bool check_quorum_;
+    // "index": every read waits for a heartbeat round, "lease": the leader lease skips it, needs check_quorum
+    bool read_lease_;
+
+    // committed entries queued to the apply thread, workers > 0: parallel apply by Fsm::Key()
+    uint32_t apply_ring_;
+    uint32_t apply_workers_;
+
+    // restart: segments validated by threads at once, verify: sealed ones entry by entry too
+    uint32_t recover_threads_;
+    bool recover_verify_;
+
+    // raft groups hosted by MultiRaft, > 1: their logs share one wal under wal_dir_
+    uint32_t groups_;
+    std::string wal_dir_;
+    uint64_t wal_segment_size_;
+
+    // GET /metrics (dc::MetricsServer) on the raft event loop, port 0: off
+    std::string metrics_ip_;
+    int metrics_port_;
+
     std::string conf_file_;
 };
 
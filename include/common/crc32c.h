@@ -0,0 +1,28 @@
+#ifndef __DC_RAFT_COMMON_CRC32C_H__
+#define __DC_RAFT_COMMON_CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC32C (Castagnoli), the checksum of log entries, wal records and
+ * snapshot files
+ *
+ * the crc32 instruction of SSE4.2 (x86_64) or of the ARMv8 CRC extension
+ * when the cpu has it, checked once at first use, else a slicing-by-8
+ * table. the hardware path runs 3 independent streams over long inputs
+ * and joins them with shift tables. chained: Crc32c(Crc32c(0, a), b) == crc
+ * of a then b.
+ */
+
+namespace dc {
+
+// crc of [data, data + len) continuing crc, 0 to start
+uint32_t Crc32c(uint32_t crc, const void* data, size_t len);
+
+// "sse4.2", "armv8" or "software"
+const char* Crc32cImpl();
+
+}   // namespace dc
+
+#endif  //  __DC_RAFT_COMMON_CRC32C_H__
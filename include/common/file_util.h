@@ -0,0 +1,25 @@
+#ifndef __DC_RAFT_COMMON_FILE_UTIL_H__
+#define __DC_RAFT_COMMON_FILE_UTIL_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dc {
+
+// mkdir -p
+int MakeDirs(const std::string& path);
+
+// fsync the directory so that created / renamed / unlinked entries are durable
+int FsyncDir(const std::string& dir);
+
+// names of regular files in dir, sorted
+int ListDir(const std::string& dir, std::vector<std::string>* names);
+
+// write all / read all, retry on EINTR and short io
+int WriteFull(int fd, const void* buf, size_t len);
+int PreadFull(int fd, void* buf, size_t len, uint64_t offset);
+
+}   // namespace dc
+
+#endif  //  __DC_RAFT_COMMON_FILE_UTIL_H__
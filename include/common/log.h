@@ -1,13 +1,82 @@
 #ifndef __DC_RAFT_COMMON_LOG_H__
 #define __DC_RAFT_COMMON_LOG_H__
 
+#include <stdint.h>
 #include <string.h>
+#include <string>
+#include <atomic>
+
+/*
+ * asynchronous logger
+ *
+ *   caller  : LOG_INFO(log, fmt, ...) formats the message only, on its
+ *             stack, and copies it into a ring of the calling thread
+ *             (single producer, lock free, no allocation) with level and
+ *             clock. time, level and thread text are rendered later by
+ *             the flusher. a full ring drops the record and counts it,
+ *             never blocks
+ *   flusher : one background thread drains every ring (each LOG_FLUSH_MS,
+ *             or early when a ring is half full), appends to
+ *             log_dir/file and rotates at file_size: file -> file.1 ...
+ *             up to file_num files. before RAFT_LOG_INIT() with a dir,
+ *             lines go to stderr
+ *
+ * compile time elision: levels below DC_LOG_LEVEL (-DDC_LOG_LEVEL=0 to
+ * keep trace) compile to nothing, arguments are not evaluated. the rest
+ * is also checked against Log::level() at run time.
+ *
+ * Fatal is flushed before the call returns.
+ */
 
 namespace dc {
 
-void RAFT_LOG_INIT(uint32_t file_size, uint32_t file_num);
+#define DC_LOG_TRACE 0
+#define DC_LOG_DEBUG 1
+#define DC_LOG_INFO 2
+#define DC_LOG_WARNING 3
+#define DC_LOG_ERROR 4
+#define DC_LOG_FATAL 5
+
+#ifndef DC_LOG_LEVEL
+#define DC_LOG_LEVEL DC_LOG_INFO
+#endif
+
+#define DEFAULT_LOG_FILE_NAME "raft.log"
+#define LOG_THREAD_BUFFER (1024 * 1024)     // ring of each logging thread
+#define LOG_MAX_LINE 4096                   // longer messages are cut
+#define LOG_FLUSH_MS 10
+
+class Log;
+
+/*
+ * file_size bytes per file, file_num files kept, dir "": stderr, file is
+ * the name of RAFT_LOG(""). starts the flusher, call again to change
+ */
+void RAFT_LOG_INIT(uint32_t file_size, uint32_t file_num,
+                   const std::string& dir = "", const std::string& file = DEFAULT_LOG_FILE_NAME);
+// drain every ring, stop the flusher, close the files
 void RAFT_LOG_CLEAN();
-Log* RAFT_LOG(std::string& id = "");
+// write out what is queued now, return when it is on the files
+void RAFT_LOG_FLUSH();
+// the log of file id under the log dir, "" is the default one. errno is kept
+Log* RAFT_LOG(const std::string& id = "");
+
+#define DC_LOG(log, lvl, fmt, ...)                                          \
+    do {                                                                    \
+        if ((lvl) >= DC_LOG_LEVEL) {                                        \
+            dc::Log* dc_log_ = (log);                                       \
+            if ((lvl) >= dc_log_->level()) {                                \
+                dc_log_->Printf((lvl), fmt, ##__VA_ARGS__);                 \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+#define LOG_TRACE(log, fmt, ...) DC_LOG(log, DC_LOG_TRACE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(log, fmt, ...) DC_LOG(log, DC_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(log, fmt, ...) DC_LOG(log, DC_LOG_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(log, fmt, ...) DC_LOG(log, DC_LOG_WARNING, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(log, fmt, ...) DC_LOG(log, DC_LOG_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_FATAL(log, fmt, ...) DC_LOG(log, DC_LOG_FATAL, fmt, ##__VA_ARGS__)
 
 class Log {
 public:
@@ -15,18 +84,46 @@ public:
     static uint32_t s_file_num_;
 
 public:
-    Log(std::string& name, uint32_t f_size, uint32_t f_num);
+    Log(const std::string& name, uint32_t f_size, uint32_t f_num);
     virtual ~Log();
 
-    virtual void Trace(string& s);
-    virtual void Debug(string& s);
-    virtual void Info(string& s);
-    virtual void Warning(string& s);
-    virtual void Error(string& s);
-    virtual void Fatal(string& s);
+    virtual void Trace(const std::string& s);
+    virtual void Debug(const std::string& s);
+    virtual void Info(const std::string& s);
+    virtual void Warning(const std::string& s);
+    virtual void Error(const std::string& s);
+    virtual void Fatal(const std::string& s);
+
+    // any thread, see the macros above
+    void Printf(int level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+    void Write(int level, const char* data, size_t len);
+
+    // run time threshold, default DC_LOG_LEVEL
+    int level() const { return level_.load(std::memory_order_relaxed); }
+    void set_level(int level) { level_.store(level, std::memory_order_relaxed); }
+
+    const std::string& name() const { return name_; }
+
+    // flusher side, under the drain lock
+    std::string& pending() { return pending_; }
+    void WritePending();
+    void Open(const std::string& dir, uint32_t f_size, uint32_t f_num);
+    void Close();
 
 private:
+    void Rotate();
+
     std::string name_;
+    uint32_t file_size_;
+    uint32_t file_num_;
+    std::atomic<int> level_;
+
+    std::string pending_;       // rendered lines not written yet
+
+    std::string dir_;
+    std::string path_;
+    int fd_;                    // -1: stderr
+    uint64_t written_;          // bytes in the current file
 };
 
 }  // namespace dc
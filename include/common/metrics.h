@@ -0,0 +1,120 @@
+#ifndef __DC_RAFT_COMMON_METRICS_H__
+#define __DC_RAFT_COMMON_METRICS_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+/*
+ * built in metrics, cheap enough to stay on in production
+ *
+ *   Counter   : one relaxed atomic add, any thread
+ *   Histogram : log linear buckets (HDR style), 16 sub buckets per power
+ *               of two, ~6% relative error from 0 to 2^64. Record() is a
+ *               few relaxed atomic adds, no lock, any thread
+ *   registry  : name + labels -> metric, created once under a lock (cold
+ *               path), the pointer stays valid for the life of the process,
+ *               callers look it up at construction and keep it.
+ *               Render() writes the prometheus text format, a histogram
+ *               as a summary (p50 p90 p99 p999, _sum _count _max)
+ *
+ * values are read without stopping writers, a scrape may see a histogram
+ * a few records ahead of its count.
+ */
+
+namespace dc {
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+// monotonic clock, us
+inline uint64_t NowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+class Counter {
+public:
+    Counter() : value_(0) {}
+
+    void Add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+class Histogram {
+public:
+    Histogram();
+
+    void Record(uint64_t v);
+
+    // q in [0, 1], upper bound of the bucket holding that rank, 0 if empty
+    uint64_t Percentile(double q) const;
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    static uint32_t Bucket(uint64_t v);
+    static uint64_t BucketMax(uint32_t bucket);
+
+private:
+    Histogram(const Histogram&);
+    Histogram& operator=(const Histogram&);
+
+    std::atomic<uint64_t> buckets_[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+    virtual ~MetricsRegistry();
+
+    /*
+     * labels in prometheus form without braces, e.g. peer="2", "" for none.
+     * the same name + labels return the same metric. a name already used by
+     * the other type is logged and gets a shared dummy, never rendered, so
+     * callers need no NULL check
+     */
+    Counter* GetCounter(const std::string& name, const std::string& labels = "");
+    Histogram* GetHistogram(const std::string& name, const std::string& labels = "");
+
+    // every metric in the prometheus text format, appended to out
+    void Render(std::string* out);
+
+private:
+    struct Entry {
+        std::string name;
+        std::string labels;
+        Counter* counter;       // one of the two
+        Histogram* histogram;
+    };
+
+    MetricsRegistry(const MetricsRegistry&);
+    MetricsRegistry& operator=(const MetricsRegistry&);
+
+    // NULL if name is taken by the other type
+    Entry* Find(const std::string& name, const std::string& labels, bool counter);
+
+    std::mutex mutex_;
+    std::vector<Entry*> entries_;
+    Counter dummy_counter_;
+    Histogram dummy_histogram_;
+};
+
+// the registry of the process, every built in metric is in it
+MetricsRegistry* RAFT_METRICS();
+
+}   // namespace dc
+
+#endif  //  __DC_RAFT_COMMON_METRICS_H__
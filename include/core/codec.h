@@ -0,0 +1,59 @@
+#ifndef __DC_CODEC_H__
+#define __DC_CODEC_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "ring_buffer.h"
+
+/*
+ * frame = [FrameHeader][body, length bytes]
+ *
+ * all fields little endian, body layout depends on type
+ */
+
+namespace dc {
+
+#define FRAME_MAGIC 0x46524344          // "DCRF"
+#define MAX_FRAME_LENGTH (64 * 1024 * 1024)
+#define FRAME_FLAG_COMPRESS_MASK 0x000f  // COMPRESS_TYPE of the body, compress.h
+
+struct FrameHeader {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;         // FRAME_FLAG_*
+    uint32_t length;        // body length
+    uint32_t reserved;
+    uint64_t term;
+    uint64_t group;         // raft group, 0 if the process runs one
+};
+
+/*
+ * one complete frame, body points into the connection RingBuffer and
+ * is valid only during the OnMessage() call
+ */
+struct MessageView {
+    FrameHeader header;
+    const char* body;
+    uint32_t length;
+};
+
+void EncodeFrameHeader(uint16_t type, uint64_t term, uint32_t length, std::string* out, uint64_t group = 0);
+// into sizeof(FrameHeader) bytes at out, e.g. a pooled Buffer
+void EncodeFrameHeader(uint16_t type, uint64_t term, uint32_t length, char* out, uint64_t group = 0);
+
+enum DECODE_RESULT {
+    DECODE_OK = 0,
+    DECODE_AGAIN,           // need more bytes
+    DECODE_ERROR            // bad magic / too long, close the connection
+};
+
+/*
+ * parse one frame at the head of buf, nothing is consumed, the caller
+ * Consume(sizeof(FrameHeader) + msg->length) after use
+ */
+DECODE_RESULT DecodeFrame(const RingBuffer& buf, MessageView* msg);
+
+}   // namespace dc
+
+#endif  //  __DC_CODEC_H__
@@ -0,0 +1,91 @@
+#ifndef __DC_COMPRESS_H__
+#define __DC_COMPRESS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#include "codec.h"
+#include "io_chain.h"
+
+/*
+ * frame body compression
+ *
+ * a compressed frame has the COMPRESS_TYPE in the FRAME_FLAG_COMPRESS_MASK
+ * bits of FrameHeader::flags and the body
+ *
+ *     [u32 raw length][raw body compressed]
+ *
+ * Compressors are registered by type, COMPRESS_LZ4 (the LZ4 block format)
+ * is built in, others can be added with RegisterCompressor() before any
+ * loop runs. a peer only gets a type it has announced it can decompress
+ * (SupportedCompressors(), exchanged in MSG_HELLO).
+ */
+
+namespace dc {
+
+#define COMPRESS_MIN_GAIN 8          // a body saving less than 1/8 is sent plain
+
+enum COMPRESS_TYPE {
+    COMPRESS_NONE = 0,
+    COMPRESS_LZ4 = 1,
+    COMPRESS_ZSTD = 2,              // reserved, not built in
+    COMPRESS_TYPE_MAX = 16          // fits FRAME_FLAG_COMPRESS_MASK
+};
+
+class Compressor {
+public:
+    virtual ~Compressor() {}
+
+    virtual COMPRESS_TYPE type() const = 0;
+    virtual const char* name() const = 0;
+
+    // dst size Compress() needs for len bytes
+    virtual size_t Bound(size_t len) const = 0;
+
+    // return bytes written to dst, 0 if fail. thread safe
+    virtual size_t Compress(const char* src, size_t len, char* dst) const = 0;
+
+    // dst has exactly raw_len bytes, return 0 if ok, -1 if src is broken
+    virtual int Decompress(const char* src, size_t len, char* dst, size_t raw_len) const = 0;
+};
+
+// LZ4 block format, greedy matcher with a 4K entry hash table on the stack
+class Lz4Compressor : public Compressor {
+public:
+    virtual COMPRESS_TYPE type() const { return COMPRESS_LZ4; }
+    virtual const char* name() const { return "lz4"; }
+
+    virtual size_t Bound(size_t len) const { return len + len / 255 + 16; }
+    virtual size_t Compress(const char* src, size_t len, char* dst) const;
+    virtual int Decompress(const char* src, size_t len, char* dst, size_t raw_len) const;
+};
+
+// c is owned from now on, replaces the one of the same type
+void RegisterCompressor(Compressor* c);
+// NULL if none or COMPRESS_NONE
+const Compressor* GetCompressor(int type);
+// "none", "lz4" ... -> type, -1 if unknown
+int CompressorType(const std::string& name);
+// bit i set: type i can be decompressed here
+uint32_t SupportedCompressors();
+
+/*
+ * frame of type with body [raw, raw + len) compressed by c, header and
+ * body in one Buffer of slab (NULL: heap) appended to out.
+ * return 0, -1 if the body does not shrink by COMPRESS_MIN_GAIN, nothing
+ * is appended then
+ */
+int EncodeCompressedFrame(const Compressor* c, uint16_t type, uint64_t term, const char* raw, uint32_t len,
+                          IoChain* out, Slab* slab, uint64_t group = 0);
+
+/*
+ * body of msg as the decoders read it: msg.body itself if not compressed,
+ * else decompressed into plain (reused across calls).
+ * return 0 if ok, -1 if the type is unknown or the body broken
+ */
+int DecompressBody(const MessageView& msg, std::string* plain, const char** body, uint32_t* length);
+
+}   // namespace dc
+
+#endif  //  __DC_COMPRESS_H__
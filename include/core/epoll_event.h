@@ -5,34 +5,34 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
-#include <map>
 
-namespace dc {
+#include "fd_slab.h"
+#include "event_loop.h"
+#include "metrics.h"
 
-class EventHandler {
-public:
-    virtual void OnRead(int fd, uint32_t events) = 0;
-    virtual void OnWrite(int fd, uint32_t events) = 0;
-    virtual void OnError(int fd, uint32_t events, int err, std::string& error) = 0;
-};
+namespace dc {
 
-class EpollEvent {
+class EpollEvent : public EventLoop {
 public:
     EpollEvent(bool isEPOLLET);
     virtual ~EpollEvent();
 
-    int Initialize();
+    virtual int Initialize();
+
+    virtual int AddEvent(int fd, EventHandler* efd, uint32_t events);
+    virtual int ModEvent(int fd, uint32_t events);
+    virtual int RemodEvent(int fd);
+    virtual int DelEvent(int fd);
 
-    int AddEvent(int fd, EventHandler* efd, uint32_t events);
-    int ModEvent(int fd, uint32_t events);
-    int RemodEvent(int fd);
-    int DelEvent(int fd);
+    // return events dispatched, -1 if epoll_wait fail
+    virtual int Wait(int timeout);
 
-    int Wait(int timeout);
+    virtual EVENT_LOOP_TYPE type() const { return LOOP_EPOLL; }
 
     struct EH {
-        epoll_event ee;
-        EventHandler* efd;
+        int fd;
+        epoll_event ee;         // ee.data.ptr = this EH
+        EventHandler* efd;      // NULL: slot free
     };
 
 private:
@@ -40,8 +40,11 @@ private:
     epoll_event* events_;       // 接收事件
     bool isEPOLLET_;
 
-    // <fd, EH>
-    std::map<int, EH> fd_eh_;
+    // fd -> EH, epoll returns the EH pointer, no lookup when dispatching
+    FdSlab<EH> fd_eh_;
+
+    Counter* wakeups_;              // epoll_wait returns, timeouts included
+    Histogram* wakeup_events_;      // events per return
 };
 
 }
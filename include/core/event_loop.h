@@ -0,0 +1,54 @@
+#ifndef __DC_EVENT_LOOP_H__
+#define __DC_EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * readiness loop used by SocketEvent, the backend is chosen at runtime
+ *
+ *   LOOP_EPOLL : EpollEvent
+ *   LOOP_URING : UringEvent, falls back to epoll if io_uring is not usable
+ */
+
+namespace dc {
+
+class EventHandler {
+public:
+    virtual void OnRead(int fd, uint32_t events) = 0;
+    virtual void OnWrite(int fd, uint32_t events) = 0;
+    virtual void OnError(int fd, uint32_t events, int err, std::string& error) = 0;
+};
+
+enum EVENT_LOOP_TYPE {
+    LOOP_EPOLL = 0,
+    LOOP_URING
+};
+
+class EventLoop {
+public:
+    virtual ~EventLoop() {}
+
+    virtual int Initialize() = 0;
+
+    // events are EPOLLIN / EPOLLOUT / EPOLLERR | EPOLLHUP
+    virtual int AddEvent(int fd, EventHandler* efd, uint32_t events) = 0;
+    virtual int ModEvent(int fd, uint32_t events) = 0;
+    virtual int RemodEvent(int fd) = 0;         // re-arm, report again if still ready
+    virtual int DelEvent(int fd) = 0;
+
+    // return events dispatched, -1 if fail
+    virtual int Wait(int timeout) = 0;
+
+    virtual EVENT_LOOP_TYPE type() const = 0;
+};
+
+/*
+ * initialized loop, NULL if fail. LOOP_URING gives an epoll loop if
+ * io_uring can not be set up on this kernel
+ */
+EventLoop* CreateEventLoop(EVENT_LOOP_TYPE type, bool isEPOLLET);
+
+}   // namespace dc
+
+#endif  //  __DC_EVENT_LOOP_H__
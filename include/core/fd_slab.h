@@ -0,0 +1,65 @@
+#ifndef __DC_FD_SLAB_H__
+#define __DC_FD_SLAB_H__
+
+#include <stddef.h>
+#include <vector>
+
+/*
+ * dense table indexed by fd, replaces std::map<int, T> on the hot path
+ *
+ * slots are allocated in chunks that never move, so a T* can be kept in
+ * epoll_event.data.ptr and stays valid until the slab is destroyed.
+ */
+
+namespace dc {
+
+#define FD_SLAB_CHUNK_SHIFT 10
+#define FD_SLAB_CHUNK_SIZE (1 << FD_SLAB_CHUNK_SHIFT)
+
+template <typename T>
+class FdSlab {
+public:
+    FdSlab() {
+    }
+
+    virtual ~FdSlab() {
+        for (size_t i = 0; i < chunks_.size(); i++) {
+            delete [] chunks_[i];
+        }
+    }
+
+    // slot of fd, NULL if never allocated
+    T* Get(int fd) {
+        size_t c = static_cast<size_t>(fd) >> FD_SLAB_CHUNK_SHIFT;
+        if (fd < 0 || c >= chunks_.size()) {
+            return NULL;
+        }
+        return &chunks_[c][fd & (FD_SLAB_CHUNK_SIZE - 1)];
+    }
+
+    // slot of fd, chunk allocated (value initialized) if needed
+    T* Slot(int fd) {
+        if (fd < 0) {
+            return NULL;
+        }
+
+        size_t c = static_cast<size_t>(fd) >> FD_SLAB_CHUNK_SHIFT;
+        while (chunks_.size() <= c) {
+            chunks_.push_back(new T[FD_SLAB_CHUNK_SIZE]());
+        }
+        return &chunks_[c][fd & (FD_SLAB_CHUNK_SIZE - 1)];
+    }
+
+    // fd upper bound, for iterating all slots
+    int limit() const { return chunks_.size() << FD_SLAB_CHUNK_SHIFT; }
+
+private:
+    FdSlab(const FdSlab&);
+    FdSlab& operator=(const FdSlab&);
+
+    std::vector<T*> chunks_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_FD_SLAB_H__
@@ -0,0 +1,96 @@
+#ifndef __DC_IO_CHAIN_H__
+#define __DC_IO_CHAIN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <string>
+#include <deque>
+#include <atomic>
+
+#include "slab.h"
+
+/*
+ * Buffer  : refcounted bytes, can adopt a std::string without copy, or
+ *           stand for an open file whose bytes are never read in. with a
+ *           Slab the Buffer and its bytes are one block of the pool, the
+ *           last Release() (any thread) gives it back
+ * IoChain : list of (Buffer, offset, len) slices, flushed by writev/sendmsg,
+ *           file slices by sendfile(), a partial send only moves the
+ *           offset of the first slice
+ */
+
+namespace dc {
+
+class Buffer {
+public:
+    // refcount is 1, Release() when done. slab NULL: new/delete
+    static Buffer* Create(size_t size, Slab* slab = NULL);
+    static Buffer* Adopt(std::string& s);       // s is swapped in, left empty
+    static Buffer* File(int fd);                // fd is owned, closed with the Buffer
+
+    void AddRef() { ref_.fetch_add(1, std::memory_order_relaxed); }
+    void Release() {
+        if (ref_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Destroy();
+        }
+    }
+
+    char* data() { return data_; }
+    size_t size() const { return size_; }
+    int fd() const { return fd_; }              // -1: bytes in memory
+
+private:
+    Buffer() : ref_(1), data_(NULL), size_(0), fd_(-1), pooled_(false) {}
+    ~Buffer();
+
+    void Destroy();
+
+    std::atomic<int> ref_;
+    char* data_;
+    size_t size_;
+    std::string str_;           // Adopt() / no slab
+    int fd_;
+    bool pooled_;               // from a Slab, bytes follow the object
+};
+
+struct BufferSlice {
+    Buffer* buf;
+    size_t offset;
+    size_t len;
+};
+
+class IoChain {
+public:
+    IoChain();
+    virtual ~IoChain();
+
+    // buf gets one more ref
+    void Append(Buffer* buf, size_t offset, size_t len);
+    // copy into a new Buffer, for small or short lived data
+    void Append(const char* data, size_t len, Slab* slab = NULL);
+    // move all slices of other to the tail, no copy
+    void Splice(IoChain& other);
+
+    // iovec of the first max slices, stops before a file slice, return count
+    int FillIovec(struct iovec* iov, int max) const;
+    // the first slice is of a file Buffer, for sendfile()
+    bool FrontFile(int* fd, uint64_t* offset, size_t* len) const;
+    // n bytes are sent
+    void Consume(size_t n);
+    void Clear();
+
+    bool empty() const { return slices_.empty(); }
+    size_t bytes() const { return bytes_; }
+
+private:
+    IoChain(const IoChain&);
+    IoChain& operator=(const IoChain&);
+
+    std::deque<BufferSlice> slices_;
+    size_t bytes_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_IO_CHAIN_H__
@@ -0,0 +1,64 @@
+#ifndef __DC_METRICS_SERVER_H__
+#define __DC_METRICS_SERVER_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "socket_event.h"
+#include "timer_wheel.h"
+#include "metrics.h"
+
+/*
+ * pull endpoint of the metrics registry, on the loop of a SocketEvent
+ *
+ * a second listen socket of that SocketEvent (AddListenSocket() with this
+ * as Acceptor), every request on it "GET /metrics" gets
+ * MetricsRegistry::Render() as text/plain, anything else 404, then the
+ * connection is closed. e.g.
+ *
+ *     curl http://ip:port/metrics
+ *
+ * loop thread only. connections are dropped once the answer is sent or
+ * after METRICS_IDLE_MS without a full request, by a timer of the loop.
+ */
+
+namespace dc {
+
+#define METRICS_REAP_MS 200
+#define METRICS_IDLE_MS 10000
+#define METRICS_MAX_REQUEST 8192
+
+class MetricsServer : public Acceptor {
+public:
+    // registry NULL: RAFT_METRICS()
+    MetricsServer(SocketEvent* se, MetricsRegistry* registry = NULL);
+    virtual ~MetricsServer();       // closes the listen fd and the connections
+
+    int Listen(std::string& ip_str, int port);
+
+    virtual void OnAccept(int fd, uint32_t ip, int port);
+
+    size_t connections() const { return conns_.size(); }
+
+private:
+    class Conn;
+    class ReapTimer;
+
+    MetricsServer(const MetricsServer&);
+    MetricsServer& operator=(const MetricsServer&);
+
+    void Reap();
+    void Close(Conn* conn);
+
+    SocketEvent* se_;
+    MetricsRegistry* registry_;
+    int listen_fd_;
+
+    std::vector<Conn*> conns_;
+    ReapTimer* timer_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_METRICS_SERVER_H__
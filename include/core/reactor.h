@@ -0,0 +1,98 @@
+#ifndef __DC_REACTOR_H__
+#define __DC_REACTOR_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "socket_event.h"
+#include "task_queue.h"
+
+/*
+ * Reactor     : one SocketEvent loop on its own thread, optionally pinned
+ *               to a cpu, other threads talk to it only through Post()
+ * ReactorPool : N Reactors, accepted / outbound connections are spread
+ *               round robin
+ *
+ * a SocketFdHandler belongs to the loop it was added to, Send() on it
+ * must run on that loop, from elsewhere wrap it in a Task and Post().
+ */
+
+namespace dc {
+
+#define REACTOR_WAIT_MS 10
+
+class Reactor : public EventHandler {
+public:
+    // se is not owned, cpu -1: not pinned
+    Reactor(SocketEvent* se, int cpu = -1);
+    virtual ~Reactor();
+
+    int Initialize();
+
+    int Start();
+    void Stop();        // from any thread
+    void Join();
+
+    // any thread, task is deleted after Run() on the loop
+    void Post(Task* task);
+
+    // any thread, sfd is moved to this loop
+    void AddSocket(int fd, SocketFdHandler* sfd);
+    void AddConnection(const std::string& ip_str, int port, SocketFdHandler* sfd);
+
+    bool InLoop() const { return std::this_thread::get_id() == thread_id_.load(std::memory_order_acquire); }
+
+    SocketEvent* socket_event() { return se_; }
+
+    // eventfd wake up
+    virtual void OnRead(int fd, uint32_t events);
+    virtual void OnWrite(int fd, uint32_t events);
+    virtual void OnError(int fd, uint32_t events, int err, std::string& error);
+
+private:
+    void Run();
+    void RunTasks();
+
+    SocketEvent* se_;
+    int cpu_;
+
+    int wake_fd_;
+    std::atomic<bool> wakeup_;      // an eventfd write is pending
+    TaskQueue tasks_;
+
+    std::atomic<bool> stop_;
+    std::thread thread_;
+    std::atomic<std::thread::id> thread_id_;    // set by the loop thread itself in Run()
+};
+
+class ReactorPool {
+public:
+    ReactorPool();
+    virtual ~ReactorPool();
+
+    // before Start(), se is not owned, cpu -1: not pinned
+    int AddReactor(SocketEvent* se, int cpu = -1);
+
+    int Start();
+    void Stop();
+
+    // round robin, any thread
+    Reactor* Next();
+    Reactor* Get(size_t i) { return reactors_[i]; }
+    size_t size() const { return reactors_.size(); }
+
+    // spread connections over the loops
+    Reactor* AddSocket(int fd, SocketFdHandler* sfd);
+    Reactor* AddConnection(const std::string& ip_str, int port, SocketFdHandler* sfd);
+
+private:
+    std::vector<Reactor*> reactors_;
+    std::atomic<uint32_t> next_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_REACTOR_H__
@@ -0,0 +1,51 @@
+#ifndef __DC_RING_BUFFER_H__
+#define __DC_RING_BUFFER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * growable ring buffer, the memory is mapped twice back to back
+ *
+ *   [ page 0 ... page n-1 ][ page 0 ... page n-1 ]
+ *
+ * so readable and writable bytes are always one contiguous range, a frame
+ * that wraps around the end can still be parsed in place.
+ */
+
+namespace dc {
+
+#define RING_BUFFER_INIT_SIZE (64 * 1024)
+
+class RingBuffer {
+public:
+    RingBuffer(size_t init_size = RING_BUFFER_INIT_SIZE);
+    virtual ~RingBuffer();
+
+    // make sure Writable() >= n, grow if needed, mapped lazily at first call
+    int Reserve(size_t n);
+
+    char* WritePtr() { return base_ + write_; }
+    size_t Writable() const { return capacity_ - (write_ - read_); }
+    void Produce(size_t n) { write_ += n; }
+
+    const char* ReadPtr() const { return base_ + read_; }
+    size_t Readable() const { return write_ - read_; }
+    void Consume(size_t n);
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    static char* Map(size_t size);
+    static void Unmap(char* base, size_t size);
+
+    size_t init_size_;
+    char* base_;
+    size_t capacity_;
+    size_t read_;           // < capacity_
+    size_t write_;          // read_ <= write_ <= read_ + capacity_
+};
+
+}   // namespace dc
+
+#endif  //  __DC_RING_BUFFER_H__
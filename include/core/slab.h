@@ -0,0 +1,105 @@
+#ifndef __DC_SLAB_H__
+#define __DC_SLAB_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+/*
+ * size class pool for the buffers of one event loop (reactor)
+ *
+ *   classes : 64 B .. 64 KB, powers of two, a block is carved from a
+ *             SLAB_CHUNK_SIZE chunk of its class and never goes back to
+ *             malloc, bigger requests are plain malloc()
+ *   owner   : Alloc() only on the thread the slab is bound to, no lock.
+ *             Free() from any thread, a block freed elsewhere (e.g. the
+ *             apply thread) is pushed on a lock free list of its class
+ *             and taken back by the owner when the local list runs dry
+ *
+ * stats are relaxed counters, readable from any thread.
+ */
+
+namespace dc {
+
+#define SLAB_MIN_SHIFT 6                // 64 B
+#define SLAB_MAX_SHIFT 16               // 64 KB
+#define SLAB_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SLAB_CHUNK_SIZE (1024 * 1024)
+
+struct SlabStats {
+    uint64_t allocs;
+    uint64_t hits;              // reused a freed block
+    uint64_t misses;            // carved a new block
+    uint64_t large;             // > 64 KB, malloc()
+    uint64_t remote_frees;      // freed off the owner thread
+    uint64_t chunks;
+    uint64_t in_use;            // blocks not freed, large included
+};
+
+class Slab {
+public:
+    Slab(size_t chunk_size = SLAB_CHUNK_SIZE);
+    virtual ~Slab();            // every block must be freed before
+
+    // the calling thread owns the slab from now on, e.g. at loop thread start
+    void Bind() { owner_ = std::this_thread::get_id(); }
+
+    // owner thread, 16 byte aligned, NULL if out of memory
+    void* Alloc(size_t size);
+    // any thread, p from any Slab or NULL
+    static void Free(void* p);
+
+    SlabStats stats() const;
+    // hits / (hits + misses), 0 before the first Alloc()
+    double hit_rate() const;
+
+private:
+    struct Block {
+        Slab* slab;
+        uint32_t cls;           // SLAB_CLASSES: large
+        uint32_t reserved;
+        // user bytes follow
+    };
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Class {
+        FreeNode* local;        // owner only
+        std::atomic<FreeNode*> remote;
+        char* carve;            // rest of the current chunk
+        char* carve_end;
+    };
+
+    Slab(const Slab&);
+    Slab& operator=(const Slab&);
+
+    void Release(Block* b);
+    Block* Carve(uint32_t cls);
+
+    static void Bump(std::atomic<uint64_t>& c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    size_t chunk_size_;
+    std::thread::id owner_;
+
+    Class classes_[SLAB_CLASSES];
+    std::vector<char*> chunks_;
+
+    // owner thread writes, any thread reads
+    std::atomic<uint64_t> allocs_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> large_;
+    std::atomic<uint64_t> chunks_count_;
+    std::atomic<uint64_t> frees_;       // by the owner, large included
+    std::atomic<uint64_t> remote_frees_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_SLAB_H__
@@ -1,16 +1,24 @@
 #ifndef __DC_SOCKET_EVENT_H__
 #define __DC_SOCKET_EVENT_H__
 
-#include "epoll_event.h"
+#include "event_loop.h"
+#include "fd_slab.h"
+#include "ring_buffer.h"
+#include "codec.h"
+#include "io_chain.h"
+#include "timer_wheel.h"
+#include "metrics.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <queue>
 
 #define LISTENQUEUE 20
 #define CONNECT_TIMEOUT_MS 500
+#define RECV_CHUNK_SIZE 16 * 1024
+#define URING_RECV_BUFFERS 64       // LOOP_URING, RECV_CHUNK_SIZE each, the kernel receives into them
+#define SEND_IOV_MAX 64
 
 namespace dc {
 
@@ -40,6 +48,7 @@ enum SOCKET_STATE {
 };
 
 class SocketEvent;
+class UringEvent;
 
 class SocketFdHandler {
 public:
@@ -50,34 +59,82 @@ public:
         : fd_(fd)
         , ip_(ip)
         , port_(port)
-        , se_(se) {
+        , se_(se)
+        , sent_bytes_(NULL)
+        , recv_bytes_(NULL) {
     }
 
     virtual ~SocketFdHandler() {
     }
 
-    virtual void OnRecv(std::string& recveBuf) = 0;
+    /*
+     * bytes arrived in recvBuf, the default cuts frames (codec.h) and calls
+     * OnMessage() for every complete one, raw protocols override it.
+     * return -1 to close the connection
+     */
+    virtual int OnRecv(RingBuffer& recvBuf);
+    virtual void OnMessage(const MessageView& msg);
     virtual void OnError(int fd, int err, std::string& error) = 0;
 
+    // sendBuf is copied once into the send queue, a block of the loop's Slab
     void Send(std::string& sendBuf);
+    // slices are moved to the send queue, no copy, chain is left empty
+    void Send(IoChain& chain);
+    /*
+     * write the send queue to the socket now instead of at the next
+     * OnWrite(), e.g. before blocking on a local fsync. what the socket
+     * does not take is left to OnWrite()
+     */
+    void SendNow();
 
     void SetFd(int fd);
+    void SetSocketEvent(SocketEvent* se) { se_ = se; }
+
+    // bytes moved on this connection are added to them, NULL: not counted
+    void SetCounters(Counter* sent, Counter* recv) { sent_bytes_ = sent; recv_bytes_ = recv; }
+    Counter* sent_bytes() { return sent_bytes_; }
+    Counter* recv_bytes() { return recv_bytes_; }
 
-    std::string& sendBuf() { return sendBuf_; };        // for SocketEvent use when OnWrite
+    IoChain& sendChain() { return sendChain_; };        // for SocketEvent use when OnWrite
+    RingBuffer& recvBuf() { return recvBuf_; };         // for SocketEvent use when OnRead
 
 protected:
-    std::string sendBuf_;
+    IoChain sendChain_;
+    RingBuffer recvBuf_;
 
     int fd_;
     uint32_t ip_;
     int port_;
 
     SocketEvent* se_;
+
+    Counter* sent_bytes_;
+    Counter* recv_bytes_;
 };
 
-class SocketEvent : public EventHandler {
+// takes the fds accepted on a listen socket, see AddListenSocket()
+class Acceptor {
 public:
-    SocketEvent(TCP_UDP type = SOCKET_TCP, bool isEPOLLET = true);
+    virtual ~Acceptor() {}
+
+    // ip in network order, port in host order
+    virtual void OnAccept(int fd, uint32_t ip, int port) = 0;
+};
+
+/*
+ * LOOP_EPOLL : readiness, recv / sendmsg / accept when the fd is ready
+ * LOOP_URING : completion, a multishot Accept per listen fd, a multishot
+ *              Recv per connection into the ring's provided buffers, and
+ *              one Sendmsg in flight per connection. they are submitted
+ *              with the rest of the tick (LogStore::FlushAsync() too) by
+ *              the io_uring_enter() of the next Wait(). a write poll is
+ *              kept only to resume after EAGAIN and for sendfile() of
+ *              file slices, which have no socket op
+ */
+class SocketEvent : public EventHandler, public Acceptor {
+public:
+    // loop_type LOOP_URING falls back to epoll if io_uring is not usable
+    SocketEvent(TCP_UDP type = SOCKET_TCP, bool isEPOLLET = true, EVENT_LOOP_TYPE loop_type = LOOP_EPOLL);
     virtual ~SocketEvent();
 
     int Initialize();
@@ -88,48 +145,103 @@ public:
 
     virtual void OnAccept(int fd, uint32_t ip, int port) = 0;
 
+    /*
+     * accepted fds go to acceptor, NULL: this->OnAccept(). a second port
+     * (e.g. MetricsServer) is served by the same loop with its own acceptor
+     * return the listen fd, DelSocket() it to stop, -1 if fail
+     */
+    int AddListenSocket(std::string& ip_str, int port, uint32_t events = SOCKET_READ|SOCKET_ERROR,
+                        Acceptor* acceptor = NULL);
     /*
      * delete sfd after DelSocket from SocketEvent
      */
-    int AddListenSocket(std::string& ip_str, int port, uint32_t events = SOCKET_READ|SOCKET_ERROR);
     int AddConnection(std::string& ip_str, int port, SocketFdHandler* sfd, uint32_t events = SOCKET_READ|SOCKET_ERROR);
     int DelSocket(int fd);
 
+    /*
+     * fire due timers, then wait on the loop no longer than the next deadline
+     * return events dispatched, -1 if the loop fail
+     */
     int Wait(uint64_t now_ms, int timeout_ms = 0);
 
+    // connect timeouts, and election / heartbeat / linger timers of the loop
+    TimerWheel* timer_wheel() { return &timer_wheel_; }
+    uint64_t now_ms() const { return now_ms_; }
+
     SocketFdHandler* GetHandler(int fd);
 
     int RemodSocketEvent(int fd);
+    // SocketFdHandler::SendNow()
+    void SendNow(int fd);
+
+    /*
+     * add an accepted fd, from OnAccept() or a Reactor task
+     * delete sfd after DelSocket from SocketEvent
+     */
+    int AddSocket(int fd, SocketFdHandler* sfd, uint32_t events = SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR);
+
+    // for other EventHandler (timerfd, eventfd) and completion io on the same loop
+    EventLoop* event_loop() { return loop_; }
+
+    /*
+     * buffer pool of this loop: Send() copies, AppendEntries meta and
+     * entries, the apply ring. bound to the thread running Wait()
+     */
+    Slab* slab() { return &slab_; }
+
+    class UringSocket;
 
     struct SocketInfo {
         int fd;
         SOCKET_TYPE type;
         SOCKET_STATE state;
         SocketFdHandler* handler; 
-        uint64_t expired_time_ms;       // 只有connect fd 会用到
+        Timer* connect_timer;           // 只有connect fd 会用到
+        uint32_t events;                // connect fd 连接成功后注册的事件
+        Acceptor* acceptor;             // 只有listen fd 会用到
+        UringSocket* uring;             // LOOP_URING: ops of the fd, NULL: readiness
     };
 
-protected:
-    /*
-     * delete sfd after DelSocket from SocketEvent
-     */
-    int AddSocket(int fd, SocketFdHandler* sfd, uint32_t events = SOCKET_READ|SOCKET_WRITE|SOCKET_ERROR);
-
 private:
+    class ConnectTimer;
+
     int SetNonBlocking(int fd);
+    int SetNoDelay(int fd);
+    void OnConnect(int fd, SocketInfo* info);
+    void OnConnectTimeout(int fd);
+    int SendFileSlices(int fd, IoChain& chain, uint64_t* sent);
+
+    // LOOP_URING
+    uint32_t PollEvents(uint32_t events) const;
+    int UringStart(int fd, SocketInfo* info);
+    void UringClose(SocketInfo* info);
+    bool UringQueueSend(int fd, SocketInfo* info);
+    void UringSend(int fd, SocketInfo* info);
+    void OnUringComplete(UringSocket* us, int op, int res, uint32_t flags);
+    void OnUringAccept(int fd, SocketInfo* info, int res);
+    void OnUringRecv(int fd, SocketInfo* info, int res, uint32_t flags);
+    void OnUringSend(int fd, SocketInfo* info, int res);
 
     TCP_UDP socket_type_;
+    bool isEPOLLET_;
+    EVENT_LOOP_TYPE loop_type_;
 
-    EpollEvent epoll_event_;
+    // first, destroyed after every handler's send queue is cleared
+    Slab slab_;
 
-    //<fd, SocketInfo>
-    std::map<int, SocketInfo> fd_si_;
+    EventLoop* loop_;
+    UringEvent* ring_;              // loop_ if sockets do completion io, NULL: readiness
+    int uring_sockets_;             // UringSocket alive, some after DelSocket()
 
-    std::string recvBuf_;
+    // fd -> SocketInfo, state STATE_DEFAULT: slot free
+    FdSlab<SocketInfo> fd_si_;
 
-    uint64_t timeout_ms_;
     uint64_t now_ms_;
-    std::queue<int> connect_fds_;
+    TimerWheel timer_wheel_;
+
+    // every connection of the loop, per peer ones are in the handlers
+    Counter* sent_bytes_;
+    Counter* recv_bytes_;
 };
 
 }   // namespace dc
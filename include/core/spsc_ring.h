@@ -0,0 +1,99 @@
+#ifndef __DC_SPSC_RING_H__
+#define __DC_SPSC_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+/*
+ * bounded single producer single consumer ring of T slots
+ *
+ * slots are reused, never constructed per item: the producer fills
+ * Reserve() in place and publishes it with Commit(), the consumer reads
+ * At(i) in place and gives slots back with Pop(n). head and tail sit on
+ * their own cache lines, each side caches the other's index and only
+ * reloads it when the ring looks full / empty.
+ */
+
+namespace dc {
+
+#define SPSC_CACHE_LINE 64
+
+template <typename T>
+class SpscRing {
+public:
+    // capacity rounded up to a power of 2
+    explicit SpscRing(size_t capacity)
+        : head_(0)
+        , tail_cache_(0)
+        , tail_(0)
+        , head_cache_(0) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    virtual ~SpscRing() {
+    }
+
+    // producer: free slot to fill, NULL if full
+    T* Reserve() {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return NULL;
+            }
+        }
+        return &slots_[tail & mask_];
+    }
+
+    // producer: publish the slot of the last Reserve()
+    void Commit() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer: slots ready to read
+    size_t Readable() {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (tail_cache_ == head) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        }
+        return tail_cache_ - head;
+    }
+
+    // consumer: i < Readable()
+    T* At(size_t i) {
+        return &slots_[(head_.load(std::memory_order_relaxed) + i) & mask_];
+    }
+
+    // consumer: n <= Readable(), the producer may reuse them
+    void Pop(size_t n) {
+        head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // either side, a snapshot
+    size_t Size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_;
+
+    alignas(SPSC_CACHE_LINE) std::atomic<uint64_t> head_;   // consumer
+    uint64_t tail_cache_;
+
+    alignas(SPSC_CACHE_LINE) std::atomic<uint64_t> tail_;   // producer
+    uint64_t head_cache_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_SPSC_RING_H__
@@ -0,0 +1,49 @@
+#ifndef __DC_TASK_QUEUE_H__
+#define __DC_TASK_QUEUE_H__
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * lock free multi producer single consumer queue of intrusive Task
+ * (Vyukov), Push() from any thread, Pop() only from the owner loop
+ */
+
+namespace dc {
+
+class Task {
+public:
+    Task() : next_(NULL) {}
+    virtual ~Task() {}
+
+    virtual void Run() = 0;
+
+private:
+    friend class TaskQueue;
+    std::atomic<Task*> next_;
+};
+
+class TaskQueue {
+public:
+    TaskQueue();
+    virtual ~TaskQueue();
+
+    void Push(Task* task);
+
+    // NULL if empty (or a producer is half way, try again later)
+    Task* Pop();
+
+private:
+    class StubTask : public Task {
+    public:
+        virtual void Run() {}
+    };
+
+    std::atomic<Task*> head_;       // producers
+    Task* tail_;                    // consumer
+    StubTask stub_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_TASK_QUEUE_H__
@@ -0,0 +1,88 @@
+#ifndef __DC_TIMER_WHEEL_H__
+#define __DC_TIMER_WHEEL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * hierarchical timer wheel, 1ms tick
+ *
+ *   level 0 : 256 slots x 1ms          (256ms)
+ *   level 1 :  64 slots x 256ms        (16s)
+ *   level 2 :  64 slots x 16s          (17min)
+ *   level 3 :  64 slots x 17min        (18h, longer is clamped and re-added)
+ *
+ * Add / Cancel are O(1), a timer is moved down a level at most 3 times.
+ * Advance() jumps over empty level 0 slots with a bitmap, and
+ * NextTimeout() tells how long the loop may sleep, so idle timers cost
+ * nothing while epoll_wait sleeps.
+ */
+
+namespace dc {
+
+#define TW_L0_BITS 8
+#define TW_LN_BITS 6
+#define TW_L0_SIZE (1 << TW_L0_BITS)
+#define TW_LN_SIZE (1 << TW_LN_BITS)
+#define TW_LEVELS 4
+
+class TimerWheel;
+
+class Timer {
+public:
+    Timer();
+    virtual ~Timer();           // cancel if pending
+
+    virtual void OnTimer() = 0;
+
+    bool pending() const { return wheel_ != NULL; }
+    uint64_t expire_ms() const { return expire_ms_; }
+
+private:
+    friend class TimerWheel;
+
+    Timer* prev_;
+    Timer* next_;
+    Timer** head_;              // head of the slot list it is in
+    int l0_index_;              // level 0 slot, -1 if upper level
+    uint64_t expire_ms_;
+    TimerWheel* wheel_;
+};
+
+class TimerWheel {
+public:
+    TimerWheel();
+    virtual ~TimerWheel();
+
+    void Initialize(uint64_t now_ms);
+
+    // re-add a pending timer moves it, expire in the past fires at next Advance()
+    void Add(Timer* timer, uint64_t expire_ms);
+    void Cancel(Timer* timer);
+
+    // fire every timer with expire_ms <= now_ms
+    void Advance(uint64_t now_ms);
+
+    // ms until the next timer may fire, -1 if none
+    int NextTimeout(uint64_t now_ms);
+
+    size_t size() const { return count_; }
+
+private:
+    void Link(Timer* timer);
+    void Unlink(Timer* timer);
+    void Cascade(int level, int index);
+    int NextL0Slot(int from);
+
+    uint64_t cur_ms_;                   // next ms not processed yet
+    size_t count_;
+
+    Timer* l0_[TW_L0_SIZE];
+    Timer* ln_[TW_LEVELS - 1][TW_LN_SIZE];
+    uint64_t l0_bitmap_[TW_L0_SIZE / 64];
+    Timer* firing_;                     // slot being fired by Advance()
+};
+
+}   // namespace dc
+
+#endif  //  __DC_TIMER_WHEEL_H__
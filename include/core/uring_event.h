@@ -0,0 +1,147 @@
+#ifndef __DC_URING_EVENT_H__
+#define __DC_URING_EVENT_H__
+
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "fd_slab.h"
+#include "event_loop.h"
+
+/*
+ * io_uring loop, raw syscalls (no liburing)
+ *
+ * readiness : EventLoop interface, one multishot POLL_ADD per fd, so
+ *             SocketEvent / timerfd / eventfd handlers run unchanged.
+ *             a poll is edge like, handlers must drain to EAGAIN
+ * completion: Writev / Fsync (LogStore::FlushAsync()), Sendmsg / multishot
+ *             Accept / multishot Recv into a provided buffer ring
+ *             (SocketEvent), result goes to a Completion
+ *
+ * every sqe prepared between two Wait() is submitted by the one
+ * io_uring_enter() of the next Wait(), which also waits for completions.
+ * single threaded, like EpollEvent.
+ */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace dc {
+
+class Completion {
+public:
+    virtual ~Completion() {}
+
+    /*
+     * res  : cqe res, bytes / fd / -errno
+     * flags: cqe flags, IORING_CQE_F_MORE if a multishot op stays armed,
+     *        IORING_CQE_F_BUFFER if a provided buffer was used
+     */
+    virtual void OnComplete(int res, uint32_t flags) = 0;
+};
+
+class UringEvent : public EventLoop {
+public:
+    UringEvent(uint32_t entries = 1024);
+    virtual ~UringEvent();
+
+    // -1 if io_uring is not usable, use EpollEvent then
+    virtual int Initialize();
+
+    virtual int AddEvent(int fd, EventHandler* efd, uint32_t events);
+    virtual int ModEvent(int fd, uint32_t events);
+    virtual int RemodEvent(int fd);
+    virtual int DelEvent(int fd);
+
+    // submit queued sqes, dispatch completions, -1 if io_uring_enter fail
+    virtual int Wait(int timeout);
+
+    virtual EVENT_LOOP_TYPE type() const { return LOOP_URING; }
+
+    /*
+     * link: the next op starts only after this one succeeded (IOSQE_IO_LINK),
+     *       e.g. Writev(link) then Fsync, one submission
+     * buffers (iov, msg) must stay valid until OnComplete()
+     * return 0 if queued
+     */
+    int Writev(int fd, const iovec* iov, int iovcnt, uint64_t offset, Completion* c, bool link = false);
+    int Fsync(int fd, bool datasync, Completion* c, bool link = false);
+    int Sendmsg(int fd, const msghdr* msg, int flags, Completion* c);
+
+    // multishot, res is the accepted fd (nonblocking)
+    int Accept(int listen_fd, Completion* c);
+    // multishot, data lands in a buffer of the ring, RecycleBuffer() it after use
+    int Recv(int fd, Completion* c);
+    int Cancel(Completion* c);
+
+    // hand the queued sqes to the kernel now instead of at the next Wait()
+    int Submit();
+
+    /*
+     * provided buffer ring for Recv, count is a power of 2, once
+     */
+    int SetupBufferRing(uint32_t count, uint32_t size);
+    char* BufferOf(uint32_t cqe_flags, uint16_t* bid);
+    void RecycleBuffer(uint16_t bid);
+
+    uint64_t submitted() const { return submitted_; }
+    uint64_t enters() const { return enters_; }
+
+    struct EH {
+        int fd;
+        uint32_t events;
+        uint32_t gen;               // bumped on every re-arm, stale cqes are dropped
+        bool armed;
+        EventHandler* efd;          // NULL: slot free
+    };
+
+private:
+    ::io_uring_sqe* GetSqe();
+    int Enter(uint32_t submit, uint32_t wait, int timeout);
+    int Arm(EH* eh);
+    int Disarm(EH* eh);
+    void Dispatch(uint64_t user_data, int res, uint32_t flags);
+    void DispatchPoll(EH* eh, int res, uint32_t flags);
+
+    uint32_t entries_;
+    int ring_fd_;
+
+    void* sq_ptr_;
+    size_t sq_len_;
+    void* cq_ptr_;
+    size_t cq_len_;
+    ::io_uring_sqe* sqes_;
+    size_t sqes_len_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sq_local_tail_;
+    uint32_t to_submit_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    ::io_uring_cqe* cqes_;
+
+    // provided buffer ring
+    ::io_uring_buf_ring* buf_ring_;
+    size_t buf_ring_len_;
+    char* bufs_;
+    uint32_t buf_count_;
+    uint32_t buf_size_;
+
+    FdSlab<EH> fd_eh_;
+
+    uint64_t submitted_;
+    uint64_t enters_;
+};
+
+}   // namespace dc
+
+#endif  //  __DC_URING_EVENT_H__
@@ -0,0 +1,140 @@
+#ifndef __DC_RAFT_APPLY_PIPELINE_H__
+#define __DC_RAFT_APPLY_PIPELINE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "event_loop.h"
+#include "spsc_ring.h"
+#include "io_chain.h"
+#include "fsm.h"
+#include "log_store.h"
+#include "read_index.h"
+#include "snapshotter.h"
+#include "metrics.h"
+
+/*
+ * committed entries -> Fsm::Apply(), off the raft event loop
+ *
+ *   loop thread : Submit(commit_index) reads committed entries from the
+ *                 LogStore into Buffers of the loop's Slab and queues them
+ *                 on a bounded SPSC ring, as many as fit. a full ring only
+ *                 stops Submit(), heartbeats and replication go on
+ *   apply thread: drains the ring into Fsm::Apply(), sleeps on an eventfd
+ *                 when it is empty, publishes applied_index after every
+ *                 entry and wakes the loop through a second eventfd
+ *                 (ReadIndex::OnApplied()), one write() per wakeup.
+ *                 applied Buffers are released there, back to the Slab's
+ *                 remote free list
+ *
+ * workers > 0 (parallel apply): the apply thread cuts the ring into
+ * batches at FSM_KEY_BARRIER entries, hands each key to worker
+ * key % workers and waits for the batch, a barrier entry is applied alone
+ * after it. applied_index moves once per batch.
+ *
+ * background snapshots are started by the apply thread between two
+ * entries (batches), every snapshot_entries applied.
+ *
+ * raft_commit_apply_us: Submit() -> entry applied, ring wait included.
+ */
+
+namespace dcraft {
+
+#define DEFAULT_APPLY_RING 4096
+#define APPLY_BATCH_ENTRIES 256         // parallel apply, entries per batch
+
+class ApplyPipeline : public dc::EventHandler {
+public:
+    // workers 0: one apply thread, in log order
+    ApplyPipeline(Fsm* fsm, LogStore* store,
+                  uint32_t ring_size = DEFAULT_APPLY_RING,
+                  uint32_t workers = 0);
+    virtual ~ApplyPipeline();       // Stop()
+
+    // optional, before Initialize()
+    void SetReadIndex(ReadIndex* reads) { reads_ = reads; }
+    void SetSlab(dc::Slab* slab) { slab_ = slab; }     // NULL: heap Buffers
+    void SetSnapshotter(Snapshotter* snapshotter, uint64_t snapshot_entries);
+
+    // applied_index: already in the Fsm (snapshot loaded), starts the threads
+    int Initialize(dc::EventLoop* ee, uint64_t applied_index);
+
+    /*
+     * loop thread, queue entries up to commit_index
+     * return entries queued, 0 if the ring is full or nothing is new
+     */
+    uint64_t Submit(uint64_t commit_index);
+
+    void Stop();
+
+    virtual void OnRead(int fd, uint32_t events);
+    virtual void OnWrite(int fd, uint32_t events);
+    virtual void OnError(int fd, uint32_t events, int err, std::string& error);
+
+    uint64_t submitted_index() const { return submitted_index_; }
+    uint64_t applied_index() const { return applied_index_.load(std::memory_order_acquire); }
+    size_t queued() const { return ring_.Size(); }
+
+private:
+    struct Item {
+        uint64_t index;
+        uint64_t term;
+        dc::Buffer* data;
+        uint64_t submit_us;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::vector<const Item*> entries;
+    };
+
+    void Run();
+    void ApplyOne(const Item& item);
+    void ApplySerial(size_t n);
+    size_t ApplyParallel(size_t n);
+    void Retire(size_t n);
+    void RunWorker(Worker* w);
+    void Publish(uint64_t index, uint64_t term);
+    void Wake(int fd);
+
+    Fsm* fsm_;
+    LogStore* store_;
+    ReadIndex* reads_;
+    Snapshotter* snapshotter_;
+    uint64_t snapshot_entries_;
+    dc::EventLoop* ee_;
+    dc::Slab* slab_;
+
+    dc::SpscRing<Item> ring_;
+    uint64_t submitted_index_;      // loop thread
+
+    int apply_fd_;                  // loop -> apply thread, blocking read
+    int done_fd_;                   // apply thread -> loop
+    std::atomic<bool> sleeping_;    // apply thread waits on apply_fd_
+    std::atomic<bool> notified_;    // done_fd_ written, loop not woken yet
+    std::atomic<bool> stop_;
+
+    std::thread thread_;
+    std::atomic<uint64_t> applied_index_;
+    uint64_t snapshot_index_;       // apply thread, last snapshot started
+
+    // parallel apply
+    std::vector<Worker*> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    uint64_t batch_gen_;
+    uint32_t batch_left_;           // workers not done with the batch
+    bool workers_stop_;
+
+    dc::Histogram* apply_us_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_APPLY_PIPELINE_H__
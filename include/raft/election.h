@@ -0,0 +1,157 @@
+#ifndef __DC_RAFT_ELECTION_H__
+#define __DC_RAFT_ELECTION_H__
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+#include "log_store.h"
+#include "log_replicate.h"
+#include "message.h"
+#include "metrics.h"
+
+/*
+ * leader election: term, vote and role, with Pre-Vote and CheckQuorum
+ *
+ * follower     : no word from a leader for a random [timeout, 2 * timeout)
+ *                campaigns
+ * pre-candidate: (pre_vote) asks everyone whether they would vote for it
+ *                at term + 1, its term and theirs do not move. only a
+ *                majority of yes makes it a candidate, so a node that was
+ *                partitioned or paused and cannot win never bumps the term
+ *                of the cluster and never deposes a working leader
+ * candidate    : term + 1, votes for itself, RequestVote to everyone
+ * leader       : (check_quorum) every election timeout it must have heard
+ *                from a majority (OnPeerActive()) since the last check,
+ *                else it steps down without a new term
+ *
+ * with check_quorum a node that heard from a leader within the election
+ * timeout ignores (pre-)votes of a higher term, so a node rejoining with
+ * a higher term can not force an election either. that is also what the
+ * ReadIndex lease relies on.
+ *
+ * term and vote go to dir/raft.meta, two alternating crc checked slots,
+ * fdatasync'ed before any vote or RequestVote is sent. connections are
+ * the LogReplicate followers'. single threaded, driven from the raft
+ * event loop.
+ */
+
+namespace dcraft {
+
+#define ELECTION_META_FILE "raft.meta"
+#define ELECTION_META_MAGIC 0x4154454d       // "META"
+#define ELECTION_META_SLOT 512               // one sector per slot
+
+class ElectionListener {
+public:
+    virtual ~ElectionListener() {}
+
+    // LogReplicate::Reset(), ReadIndex::BecomeLeader() ...
+    virtual void OnBecomeLeader(uint64_t term) = 0;
+    // leader_id 0: not known yet
+    virtual void OnBecomeFollower(uint64_t term, uint64_t leader_id) = 0;
+};
+
+class Election {
+public:
+    enum Role {
+        ROLE_FOLLOWER = 0,
+        ROLE_PRE_CANDIDATE,
+        ROLE_CANDIDATE,
+        ROLE_LEADER
+    };
+
+    Election(LogStore* store, LogReplicate* replicate, uint64_t self_id, const std::string& dir,
+             uint32_t election_timeout_ms, bool pre_vote = true, bool check_quorum = true);
+    virtual ~Election();
+
+    // not owned, before Initialize()
+    void SetListener(ElectionListener* listener) { listener_ = listener; }
+
+    // voters but self, their connections are replicate's followers'
+    void AddPeer(uint64_t id);
+    void RemovePeer(uint64_t id);
+
+    // load term and vote, start as a follower
+    int Initialize(uint64_t now_ms);
+
+    /*
+     * term of any other message from a peer. from_leader: the sender, if
+     * it is an AppendEntries / heartbeat / snapshot chunk, else 0.
+     * a higher term makes this node a follower at it.
+     * return -1 if term is stale, reject with term()
+     */
+    int OnMessageTerm(uint64_t term, uint64_t from_leader, uint64_t now_ms);
+
+    // answered on the candidate's connection, or ignored in the lease
+    void OnRequestVote(const RequestVoteRequest& req, uint64_t now_ms);
+    void OnRequestVoteResponse(const RequestVoteResponse& resp, uint64_t now_ms);
+
+    // leader: any response of id in this term, counts for CheckQuorum
+    void OnPeerActive(uint64_t id);
+
+    // once per event loop tick: election timer, CheckQuorum
+    void Tick(uint64_t now_ms);
+
+    Role role() const { return role_; }
+    bool leader() const { return role_ == ROLE_LEADER; }
+    uint64_t term() const { return term_; }
+    uint64_t vote() const { return vote_; }
+    uint64_t leader_id() const { return leader_id_; }
+
+private:
+    struct Peer {
+        bool active;                // heard from since the last CheckQuorum
+        int vote;                   // this round: 1 granted, -1 rejected, 0 no answer
+    };
+
+    void Campaign(uint64_t now_ms);
+    void StartElection(uint64_t now_ms);
+    void BecomeFollower(uint64_t term, uint64_t leader_id, uint64_t now_ms);
+    void BecomeLeader(uint64_t now_ms);
+    void SendRequestVote(bool pre_vote, uint64_t term);
+    void Tally(uint64_t now_ms);
+    void ResetTimer(uint64_t now_ms);
+
+    bool InLease(uint64_t now_ms) const;
+    bool LogUpToDate(uint64_t last_index, uint64_t last_term);
+    uint32_t Quorum() const { return (peers_.size() + 1) / 2 + 1; }
+
+    int LoadMeta();
+    int SaveMeta();
+
+    LogStore* store_;
+    LogReplicate* replicate_;
+    ElectionListener* listener_;
+    uint64_t self_id_;
+    std::string path_;
+    uint32_t timeout_ms_;
+    bool pre_vote_;
+    bool check_quorum_;
+
+    Role role_;
+    uint64_t term_;
+    uint64_t vote_;                 // 0: none in term_
+    uint64_t leader_id_;
+
+    uint64_t timer_start_ms_;       // follower / candidates: campaign at + timer_ms_
+    uint32_t timer_ms_;
+    uint64_t leader_seen_ms_;       // last word of the leader, the leader's last quorum check
+    unsigned int seed_;
+
+    // <id, Peer>
+    std::map<uint64_t, Peer> peers_;
+
+    int fd_;                        // raft.meta
+    uint64_t meta_seq_;
+
+    std::string sendBuf_;
+
+    dc::Counter* elections_;        // terms started
+    dc::Counter* pre_vote_fails_;   // campaigns stopped by Pre-Vote
+    dc::Counter* quorum_losses_;    // leader steps down by CheckQuorum
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_ELECTION_H__
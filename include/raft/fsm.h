@@ -0,0 +1,65 @@
+#ifndef __DC_RAFT_FSM_H__
+#define __DC_RAFT_FSM_H__
+
+#include <stdint.h>
+
+/*
+ * state machine
+ *
+ * committed entries reach Apply() on the apply thread (ApplyPipeline),
+ * never on the raft event loop. with parallel apply, Key() spreads them
+ * over workers: entries of one key are applied in log order by one
+ * worker, FSM_KEY_BARRIER waits for every worker and runs alone.
+ *
+ * a snapshot is taken while Apply() goes on, two ways:
+ *   Checkpoint() returns a point in time view (MVCC version, copy on write
+ *   tree ...), it is serialized on a background thread.
+ *   Checkpoint() returns NULL, the process is fork()'ed and the child
+ *   serializes its copy on write image with SaveSnapshot().
+ */
+
+namespace dcraft {
+
+#define FSM_KEY_BARRIER UINT64_MAX
+
+class FsmView {
+public:
+    virtual ~FsmView() {}
+
+    // background thread, write the view to fd, return 0 if ok
+    virtual int Save(int fd) = 0;
+};
+
+class Fsm {
+public:
+    virtual ~Fsm() {}
+
+    // apply thread, or a worker with parallel apply, return 0 if ok
+    virtual int Apply(uint64_t index, const char* data, uint32_t len) = 0;
+
+    /*
+     * parallel apply only, called on the apply thread before the entry is
+     * handed to a worker, must not depend on state Apply() changes
+     */
+    virtual uint64_t Key(const char* data, uint32_t len) {
+        (void)data;
+        (void)len;
+        return FSM_KEY_BARRIER;
+    }
+
+    /*
+     * called in the forked child only, the parent keeps applying.
+     * the child has one thread, do not take locks other threads may hold
+     */
+    virtual int SaveSnapshot(int fd) = 0;
+
+    // replace the state with a snapshot, fd is past the SnapshotHeader, VerifySnapshot()'ed
+    virtual int LoadSnapshot(int fd) = 0;
+
+    // on the apply thread, between two entries, NULL: use fork()
+    virtual FsmView* Checkpoint() { return NULL; }
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_FSM_H__
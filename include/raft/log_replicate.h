@@ -0,0 +1,213 @@
+#ifndef __DC_RAFT_LOG_REPLICATE_H__
+#define __DC_RAFT_LOG_REPLICATE_H__
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+
+#include "log_store.h"
+#include "message.h"
+#include "snapshot.h"
+#include "socket_event.h"
+
+/*
+ * leader side replication, one Follower per node in Config::others_
+ *
+ *   PROBE    : one AppendEntries in flight, find the match point
+ *   PIPELINE : keep sending without waiting for ack, until the in-flight
+ *              window (msgs / bytes) of the follower is full
+ *   SNAPSHOT : next_index is compacted, the latest snapshot is streamed
+ *              (SnapshotSender), back to PROBE after it is installed
+ *
+ * any reject (or connection reset) goes back to PROBE.
+ *
+ * every AppendEntries carries read_seq, the follower echoes it. the
+ * highest read_seq acked by a majority confirms that this node was still
+ * leader when that round was sent (ReadIndex).
+ *
+ * with set_compress() batches of at least min_bytes entry data (and
+ * snapshot chunks) are compressed for followers whose MSG_HELLO says they
+ * can read that type, OnHello(). a new connection is plain until its hello.
+ *
+ * metrics (dc::RAFT_METRICS()): AppendEntries round trip and bytes on the
+ * connection per peer, proposal -> commit for indexes stamped by Proposed().
+ */
+
+namespace dcraft {
+
+#define DEFAULT_INFLIGHT_MSGS 64
+#define DEFAULT_INFLIGHT_BYTES (8 * 1024 * 1024)
+#define DEFAULT_BATCH_ENTRIES 256
+#define DEFAULT_BATCH_BYTES (1024 * 1024)
+#define PROPOSAL_STAMPS_MAX (64 * 1024)     // more proposals uncommitted are not timed
+#define DEFAULT_COMPRESS_MIN_BYTES 4096
+
+// coalesces the heartbeats of many groups into one frame per node (MultiRaft)
+class HeartbeatBatcher {
+public:
+    virtual ~HeartbeatBatcher() {}
+
+    virtual void AddHeartbeat(uint64_t to_id, const HeartbeatItem& item) = 0;
+};
+
+class LogReplicate {
+public:
+    enum FollowerState {
+        STATE_PROBE = 0,
+        STATE_PIPELINE,
+        STATE_SNAPSHOT
+    };
+
+    struct Inflight {
+        uint64_t last_index;
+        uint64_t bytes;
+        uint64_t send_us;
+    };
+
+    struct Follower {
+        uint64_t id;
+        dc::SocketFdHandler* conn;
+
+        FollowerState state;
+        uint64_t next_index;        // next entry to send
+        uint64_t match_index;       // acked
+        uint64_t probe_prev;        // prev_log_index of the last sent
+        uint64_t read_seq;          // highest read_seq echoed in this term
+
+        uint32_t max_inflight_msgs;
+        uint64_t max_inflight_bytes;
+        uint64_t inflight_bytes;
+        std::deque<Inflight> inflight;
+
+        SnapshotSender* snapshot;   // STATE_SNAPSHOT only
+        uint32_t codecs;            // of its MSG_HELLO on conn, 0 before
+        const dc::Compressor* compressor;   // NULL: plain
+
+        dc::Histogram* rtt_us;      // AppendEntries sent -> acked
+        dc::Counter* sent_bytes;    // on conn
+        dc::Counter* recv_bytes;
+    };
+
+    LogReplicate(LogStore* store, uint64_t self_id,
+                 uint32_t batch_entries = DEFAULT_BATCH_ENTRIES,
+                 uint64_t batch_bytes = DEFAULT_BATCH_BYTES);
+    virtual ~LogReplicate();
+
+    /*
+     * conn is not owned, window 0 means default
+     */
+    int AddFollower(uint64_t id, dc::SocketFdHandler* conn,
+                    uint32_t max_inflight_msgs = DEFAULT_INFLIGHT_MSGS,
+                    uint64_t max_inflight_bytes = DEFAULT_INFLIGHT_BYTES);
+    int RemoveFollower(uint64_t id);
+
+    // connection rebuilt, messages in flight are lost
+    void ResetFollower(uint64_t id, dc::SocketFdHandler* conn);
+
+    // become leader at term
+    void Reset(uint64_t term);
+
+    /*
+     * send new entries to every follower as far as its window allows,
+     * call it after LogStore::Append() in the same event loop tick. the
+     * entries need not be durable here, the frames are written to the
+     * sockets before it returns, so they travel while the caller fsyncs
+     */
+    void Replicate();
+
+    void OnAppendEntriesResponse(const AppendEntriesResponse& resp);
+
+    /*
+     * empty AppendEntries to every follower not streaming a snapshot,
+     * prev is match_index so it is not mistaken for a probe.
+     * with a HeartbeatBatcher an item per follower goes to it instead
+     */
+    void Heartbeat();
+    void OnHeartbeatResponse(uint64_t from_id, const HeartbeatRespItem& resp);
+
+    // stamped on every AppendEntries sent from now on
+    void set_read_seq(uint64_t seq) { read_seq_ = seq; }
+
+    // MultiRaft: frames carry group, heartbeats are coalesced by batcher
+    void set_group(uint64_t group) { group_ = group; }
+    uint64_t group() const { return group_; }
+    void set_heartbeat_batcher(HeartbeatBatcher* batcher) { batcher_ = batcher; }
+
+    // entries are read into Buffers of slab (the loop's SocketEvent::slab())
+    void set_slab(dc::Slab* slab) { slab_ = slab; }
+
+    // dc::COMPRESS_TYPE to use with followers that support it, COMPRESS_NONE: off
+    void set_compress(int type, uint32_t min_bytes = DEFAULT_COMPRESS_MIN_BYTES);
+    // the follower's MSG_HELLO, on every new connection
+    void OnHello(const Hello& hello);
+
+    // highest read_seq acked by a majority, the leader counts with its own
+    uint64_t ReadQuorumSeq();
+
+    /*
+     * latest snapshot on disk, sent to followers whose next entry is
+     * compacted. transfers already running keep their file
+     */
+    void SetSnapshot(const std::string& path, uint64_t last_index, uint64_t last_term);
+    void OnInstallSnapshotResponse(const InstallSnapshotResponse& resp);
+
+    /*
+     * highest index on a majority (leader counts with durable_index),
+     * never past durable_index however far the followers are, only
+     * entries of the current term are committed by counting
+     */
+    uint64_t CommitIndex();
+
+    uint64_t commit_index() const { return commit_index_; }
+
+    // index was proposed now (ProposalQueue), timed until it is committed
+    void Proposed(uint64_t index);
+
+    Follower* GetFollower(uint64_t id);
+
+private:
+    void SendTo(Follower* f);
+    // -1: prev compacted, send a snapshot. -2: entries unreadable, nothing sent
+    int SendBatch(Follower* f);
+    int StartSnapshot(Follower* f);
+    void SetCompressor(Follower* f);
+    void StopSnapshot(Follower* f);
+
+    struct Stamp {
+        uint64_t index;
+        uint64_t us;
+    };
+
+    LogStore* store_;
+    uint64_t self_id_;
+    uint64_t term_;
+    uint64_t commit_index_;
+    uint64_t read_seq_;
+    uint64_t group_;
+    HeartbeatBatcher* batcher_;
+    dc::Slab* slab_;
+
+    uint32_t batch_entries_;
+    uint64_t batch_bytes_;
+
+    int compress_type_;
+    uint32_t compress_min_bytes_;
+
+    std::string snapshot_path_;
+    uint64_t snapshot_index_;
+    uint64_t snapshot_term_;
+
+    // <id, Follower>
+    std::map<uint64_t, Follower> followers_;
+
+    dc::IoChain sendChain_;
+    std::vector<EntryBuffer> sendEntries_;
+    std::string compressScratch_;
+
+    std::deque<Stamp> proposed_;
+    dc::Histogram* commit_us_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_LOG_REPLICATE_H__
@@ -0,0 +1,254 @@
+#ifndef __DC_RAFT_LOG_STORE_H__
+#define __DC_RAFT_LOG_STORE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * data_dir_/
+ *     00000000000000000001.seg
+ *     00000000000000000001.idx
+ *     00000000000000131073.seg        <- file name is the first index in it
+ *     00000000000000131073.idx
+ *     ...
+ *
+ * segment = [EntryHeader][data][EntryHeader][data]...
+ * index   = [IndexItem][IndexItem]...[0...]   fixed width, mmap'd, term 0 = end
+ * sealed  = [IndexItem][IndexItem]...[seal]   exact size, seal = {segment size, INDEX_SEALED_TERM}
+ *
+ * Get()/Term() is one IndexItem dereference. restart only mmaps the index
+ * files that end with their seal record, it is written after the records
+ * were synced. any other idx (rolled over but not sealed before a crash,
+ * holes, lost) is rebuilt from its segment. the last segment may hold torn
+ * writes, it is parsed and stops at the first entry that is short or fails
+ * its crc. segments are recovered on set_recover() threads at once, the
+ * last one first, it takes longest.
+ *
+ * every EntryHeader has the CRC32C of the entry (EntryCrc()), computed once
+ * by Append() and carried along: TailCache, SharedWal record, AppendEntries
+ * on the wire. it is checked by the recovery scan, by Get() of an entry read
+ * from disk and by DecodeAppendEntries().
+ *
+ * Append() only fills the pending batch in memory, Flush() writes it with
+ * one write() and one fdatasync(), so all Apply() in the same event loop
+ * tick share the fsync (group commit).
+ *
+ * FlushAsync() does the same through io_uring, the batch becomes inflight
+ * and Append() goes on while the kernel writes it.
+ *
+ * SetTailCache(): the last entries stay in memory as refcounted Buffers,
+ * Get() of a recent entry (replication, apply) shares one, no disk read.
+ *
+ * SetWal(): entries also go to a SharedWal, whose one fdatasync() covers
+ * every group of the process, the segments are only written (page cache)
+ * and synced when they are sealed or the WAL checkpoints (Sync()).
+ */
+
+namespace dc {
+class UringEvent;
+class Slab;
+class Buffer;
+class Histogram;
+}
+
+namespace dcraft {
+
+class SharedWal;
+class TailCache;
+
+#define DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define LOG_SEGMENT_SUFFIX ".seg"
+#define LOG_INDEX_SUFFIX ".idx"
+#define INDEX_INIT_CAPACITY (16 * 1024)     // IndexItem count, doubled when full
+#define INDEX_SEALED_TERM UINT64_MAX        // term of the seal record closing a sealed idx
+#define DEFAULT_RECOVER_THREADS 4
+
+struct EntryHeader {
+    uint64_t index;
+    uint64_t term;
+    uint32_t len;           // data len
+    uint32_t crc;           // EntryCrc()
+};
+
+// CRC32C of index, term, len (EntryHeader before crc) and data
+uint32_t EntryCrc(uint64_t index, uint64_t term, const char* data, uint32_t len);
+
+struct LogEntry {
+    uint64_t index;
+    uint64_t term;
+    std::string data;
+};
+
+class LogStore {
+public:
+    LogStore(const std::string& dir, uint64_t segment_size = DEFAULT_SEGMENT_SIZE);
+    virtual ~LogStore();
+
+    /*
+     * open dir, recover the segments, the torn tail of the last segment
+     * is truncated
+     */
+    int Initialize();
+
+    // before Initialize(), registers the store with wal under group
+    int SetWal(SharedWal* wal, uint64_t group);
+
+    /*
+     * before Initialize(), threads recover segments at once. verify:
+     * sealed segments are crc checked entry by entry too, not only the
+     * tail of their idx, a bad one fails Initialize()
+     */
+    void set_recover(uint32_t threads, bool verify) { recover_threads_ = threads; recover_verify_ = verify; }
+
+    /*
+     * optional, not owned. Append() copies each entry into a Buffer of
+     * slab and puts it in cache, Get() tries cache before the segments
+     */
+    void SetTailCache(TailCache* cache, dc::Slab* slab);
+
+    /*
+     * append to the pending batch, not durable until Flush()
+     * term must > 0, return index of the entry, 0 if fail
+     */
+    uint64_t Append(uint64_t term, const char* data, uint32_t len);
+    // follower: crc of an EntryView checked by DecodeAppendEntries(), index must be last_index() + 1
+    uint64_t Append(uint64_t term, const char* data, uint32_t len, uint32_t crc);
+
+    /*
+     * group commit, one write() + one fdatasync() for everything appended
+     * since last Flush(), call it once per event loop tick
+     */
+    int Flush();
+
+    /*
+     * write + fdatasync of every segment with pending data, linked and
+     * submitted by the next ring->Wait(), durable_index() moves when the
+     * last one completes. one async flush at a time, Flush() and
+     * TruncateSuffix() fail while it is in flight, drain before destroy.
+     * return 0 if submitted or nothing to flush, 1 if one is in flight
+     */
+    int FlushAsync(dc::UringEvent* ring);
+    bool flushing() const { return inflight_ops_ > 0; }
+
+    // fdatasync the written but unsynced segments, SharedWal checkpoint
+    int Sync();
+
+    /*
+     * SharedWal replay only, not logged again: the entry is appended if
+     * the store lost it, a different term at index truncates first
+     */
+    int Replay(uint64_t index, uint64_t term, const char* data, uint32_t len);
+    int ReplayTruncate(uint64_t index);
+
+    int Get(uint64_t index, LogEntry* entry);
+
+    /*
+     * data read straight into a Buffer of slab (NULL: heap), refcount 1,
+     * the caller Release()s it. crc: EntryCrc() of it, for the wire
+     */
+    int Get(uint64_t index, dc::Slab* slab, uint64_t* term, dc::Buffer** data, uint32_t* crc = NULL);
+
+    // 0 if index not in store
+    uint64_t Term(uint64_t index);
+
+    // remove entries >= index, for follower log conflict
+    int TruncateSuffix(uint64_t index);
+
+    /*
+     * a snapshot covers entries <= index, drop the segments entirely
+     * inside it (the one holding index is kept), Term(index) answers term
+     * from now on. if index is beyond last_index(), the log restarts
+     * empty at index + 1 (follower installed a snapshot).
+     * idempotent, call it again with the snapshot meta after restart
+     */
+    int Compact(uint64_t index, uint64_t term);
+
+    uint64_t first_index() const { return first_index_; }
+    uint64_t last_index() const { return last_index_; }         // appended, maybe not durable
+    uint64_t durable_index() const { return durable_index_; }   // fdatasync'ed
+
+    bool HasPending() const { return durable_index_ < last_index_; }
+
+    struct IndexItem {
+        uint64_t offset;
+        uint64_t term;
+    };
+
+    struct Segment {
+        uint64_t first_index;
+        int fd;
+        uint64_t file_size;         // bytes on disk
+        std::string path;
+        std::string inflight;       // FlushAsync() writing, begin at file_size
+        std::string pending;        // not yet written, begin after inflight
+
+        int idx_fd;
+        IndexItem* index;           // mmap of idx file
+        uint64_t count;             // entries, include pending
+        uint64_t capacity;          // IndexItem the idx file can hold
+        std::string idx_path;
+        bool sealed;                // idx msync'ed and closed by its seal record, no more append
+        bool torn;                  // recovery: unsealed, bytes after the last good entry
+    };
+
+private:
+    class FlushOp;
+
+    void OnFlushOp(bool ok);
+    void FinishFlush();
+
+    Segment* FindSegment(uint64_t index);
+    Segment* NewSegment(uint64_t first_index);
+    void CloseSegment(Segment* seg);
+
+    int OpenIndex(Segment* seg, bool create);
+    int GrowIndex(Segment* seg);
+    int SealSegment(Segment* seg);
+
+    int RecoverSegment(Segment* seg, bool is_last);
+    int RecoverTornSegments();
+    int CheckIndexTail(Segment* seg);
+    int ScanSegment(Segment* seg, uint64_t offset);
+    int VerifySegment(Segment* seg);
+    // entry read from disk is index and matches its crc
+    int CheckEntry(Segment* seg, uint64_t index, const EntryHeader& header, const char* data);
+    int FlushSegment(Segment* seg);
+
+    std::string SegmentPath(uint64_t first_index, const char* suffix);
+
+    std::string dir_;
+    uint64_t segment_size_;
+
+    std::vector<Segment*> segments_;    // order by first_index
+
+    uint64_t first_index_;
+    uint64_t last_index_;
+    uint64_t durable_index_;
+
+    uint64_t base_index_;               // last index of the snapshot, 0 if none
+    uint64_t base_term_;
+
+    bool dir_dirty_;                    // segment created, fsync dir at next Flush()
+
+    uint32_t recover_threads_;
+    bool recover_verify_;
+
+    SharedWal* wal_;                    // NULL: fdatasync our own segments
+    uint64_t group_;
+    bool replaying_;
+
+    TailCache* cache_;                  // NULL: every Get() reads the segments
+    dc::Slab* cache_slab_;
+
+    uint32_t inflight_ops_;             // FlushAsync() sqes not completed
+    uint64_t inflight_index_;           // durable when they are
+    bool inflight_failed_;              // redo the inflight batch with pwrite()
+    uint64_t inflight_us_;              // FlushAsync() started
+
+    dc::Histogram* fsync_us_;           // write + fdatasync of a batch
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_LOG_STORE_H__
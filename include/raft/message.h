@@ -0,0 +1,257 @@
+#ifndef __DC_RAFT_MESSAGE_H__
+#define __DC_RAFT_MESSAGE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log_store.h"
+#include "codec.h"
+#include "compress.h"
+#include "io_chain.h"
+
+namespace dcraft {
+
+enum MessageType {
+    MSG_APPEND_ENTRIES = 1,
+    MSG_APPEND_ENTRIES_RESP,
+    MSG_REQUEST_VOTE,
+    MSG_REQUEST_VOTE_RESP,
+    MSG_INSTALL_SNAPSHOT,
+    MSG_INSTALL_SNAPSHOT_RESP,
+    MSG_READ_INDEX,
+    MSG_READ_INDEX_RESP,
+    MSG_HEARTBEAT_BATCH,
+    MSG_HEARTBEAT_BATCH_RESP,
+    MSG_HELLO
+};
+
+struct AppendEntriesRequest {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t prev_log_index;
+    uint64_t prev_log_term;
+    uint64_t leader_commit;
+    uint64_t read_seq;              // ReadIndex round, echoed back
+    std::vector<LogEntry> entries;
+};
+
+// decoded in place, data points into the frame body
+struct EntryView {
+    uint64_t index;
+    uint64_t term;
+    const char* data;
+    uint32_t len;
+    uint32_t crc;                   // EntryCrc(), checked by DecodeAppendEntries()
+};
+
+// leader send path, data in a refcounted (pooled) Buffer, LogStore::Get()
+struct EntryBuffer {
+    uint64_t index;
+    uint64_t term;
+    dc::Buffer* data;
+    uint32_t crc;                   // from LogStore::Get(), sent as is
+};
+
+struct AppendEntriesView {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t prev_log_index;
+    uint64_t prev_log_term;
+    uint64_t leader_commit;
+    uint64_t read_seq;
+    std::vector<EntryView> entries;
+    std::string plain;              // body of a compressed frame, entries point into it
+};
+
+struct AppendEntriesResponse {
+    uint64_t term;
+    uint64_t from_id;
+    uint64_t prev_log_index;        // of the request answered
+    uint64_t match_index;           // success: last index of the request
+    uint64_t hint_index;            // reject: follower last index
+    uint64_t read_seq;              // of the request answered
+    bool success;
+};
+
+// one chunk [offset, offset + len) of the snapshot file
+struct InstallSnapshotRequest {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t last_index;            // snapshot covers entries <= last_index
+    uint64_t last_term;
+    uint64_t total;                 // file size
+    uint64_t offset;
+    uint32_t seq;                   // transfer restarted by the leader, echoed back
+    uint32_t len;
+};
+
+struct InstallSnapshotView {
+    uint64_t term;
+    uint64_t leader_id;
+    uint64_t last_index;
+    uint64_t last_term;
+    uint64_t total;
+    uint64_t offset;
+    uint32_t seq;
+    const char* data;
+    uint32_t len;
+    std::string plain;              // body of a compressed frame, data points into it
+};
+
+struct InstallSnapshotResponse {
+    uint64_t term;
+    uint64_t from_id;
+    uint64_t last_index;            // of the snapshot answered
+    uint64_t next_offset;           // bytes the follower has synced, resume here
+    uint32_t seq;
+    bool success;                   // false: offset is not next_offset
+    bool done;                      // whole file received and in place
+};
+
+/*
+ * pre_vote: "would you vote for me at term", nobody changes term or vote
+ * for it, term is the candidate's own + 1 (Election)
+ */
+struct RequestVoteRequest {
+    uint64_t term;
+    uint64_t candidate_id;
+    uint64_t last_log_index;
+    uint64_t last_log_term;
+    bool pre_vote;
+};
+
+struct RequestVoteResponse {
+    uint64_t term;                  // voter's, the request's for a granted pre-vote
+    uint64_t from_id;
+    bool granted;
+    bool pre_vote;
+};
+
+// follower asks the leader for a read index, ctx is its own
+struct ReadIndexRequest {
+    uint64_t term;
+    uint64_t from_id;
+    uint64_t ctx;
+};
+
+struct ReadIndexResponse {
+    uint64_t term;
+    uint64_t from_id;
+    uint64_t ctx;
+    uint64_t read_index;            // leadership confirmed, read after applied >= it
+    bool success;
+};
+
+/*
+ * coalesced heartbeats (MultiRaft): one frame per node pair and tick
+ * carries an item for every group the sender leads there. commit is
+ * capped at the follower's match_index, so no log check is needed.
+ * frame group and term are 0
+ */
+struct HeartbeatItem {
+    uint64_t group;
+    uint64_t term;
+    uint64_t commit;
+    uint64_t read_seq;
+};
+
+struct HeartbeatRespItem {
+    uint64_t group;
+    uint64_t term;                  // follower's, > item term: step down
+    uint64_t read_seq;
+    bool success;
+};
+
+struct HeartbeatBatch {
+    uint64_t from_id;
+    std::vector<HeartbeatItem> items;
+};
+
+struct HeartbeatBatchResp {
+    uint64_t from_id;
+    std::vector<HeartbeatRespItem> items;
+};
+
+/*
+ * first frame each end sends on a new connection (frame group and term 0).
+ * codecs: bit i set, frames compressed with dc::COMPRESS_TYPE i can be
+ * read here (dc::SupportedCompressors()). until it arrives the peer is
+ * sent nothing compressed
+ */
+struct Hello {
+    uint64_t from_id;
+    uint32_t codecs;
+};
+
+/*
+ * Encode appends a whole frame (dc::FrameHeader + body) to out, term and
+ * group go into the frame header. body fields are fixed width little endian,
+ * entries = [index][term][len][data]...
+ * Decode return 0 if ok, -1 if the body is short or broken
+ */
+void EncodeAppendEntries(const AppendEntriesRequest& req, std::string* out, uint64_t group = 0);
+/*
+ * scatter/gather form, req.entries is not used: the data of entries[i]
+ * is appended as its own slice (one more ref), frame header, fixed fields
+ * and entry headers go to one Buffer of slab (NULL: heap)
+ */
+void EncodeAppendEntries(const AppendEntriesRequest& req, const std::vector<EntryBuffer>& entries,
+                         dc::IoChain* out, dc::Slab* slab, uint64_t group = 0);
+/*
+ * compressed form, the body is built in scratch and compressed by c into
+ * one Buffer of slab. falls back to the scatter/gather form if it does not
+ * shrink, return 1 if compressed, 0 if not
+ */
+int EncodeAppendEntries(const AppendEntriesRequest& req, const std::vector<EntryBuffer>& entries,
+                        const dc::Compressor* c, std::string* scratch,
+                        dc::IoChain* out, dc::Slab* slab, uint64_t group = 0);
+// compressed frames are decompressed into req->plain
+int DecodeAppendEntries(const dc::MessageView& msg, AppendEntriesView* req);
+
+void EncodeAppendEntriesResp(const AppendEntriesResponse& resp, std::string* out, uint64_t group = 0);
+int DecodeAppendEntriesResp(const dc::MessageView& msg, AppendEntriesResponse* resp);
+
+/*
+ * frame header and fixed fields only, the frame length counts req.len
+ * more bytes, the caller appends the chunk (a file slice) right after
+ */
+void EncodeInstallSnapshot(const InstallSnapshotRequest& req, std::string* out, uint64_t group = 0);
+/*
+ * whole frame, fixed fields and the chunk [data, data + req.len) compressed
+ * by c, built in scratch. return 0, -1 if it does not shrink (nothing
+ * appended, send the plain form)
+ */
+int EncodeInstallSnapshot(const InstallSnapshotRequest& req, const char* data,
+                          const dc::Compressor* c, std::string* scratch,
+                          dc::IoChain* out, dc::Slab* slab, uint64_t group = 0);
+// compressed frames are decompressed into req->plain
+int DecodeInstallSnapshot(const dc::MessageView& msg, InstallSnapshotView* req);
+
+void EncodeInstallSnapshotResp(const InstallSnapshotResponse& resp, std::string* out, uint64_t group = 0);
+int DecodeInstallSnapshotResp(const dc::MessageView& msg, InstallSnapshotResponse* resp);
+
+void EncodeRequestVote(const RequestVoteRequest& req, std::string* out, uint64_t group = 0);
+int DecodeRequestVote(const dc::MessageView& msg, RequestVoteRequest* req);
+
+void EncodeRequestVoteResp(const RequestVoteResponse& resp, std::string* out, uint64_t group = 0);
+int DecodeRequestVoteResp(const dc::MessageView& msg, RequestVoteResponse* resp);
+
+void EncodeReadIndex(const ReadIndexRequest& req, std::string* out, uint64_t group = 0);
+int DecodeReadIndex(const dc::MessageView& msg, ReadIndexRequest* req);
+
+void EncodeReadIndexResp(const ReadIndexResponse& resp, std::string* out, uint64_t group = 0);
+int DecodeReadIndexResp(const dc::MessageView& msg, ReadIndexResponse* resp);
+
+void EncodeHeartbeatBatch(const HeartbeatBatch& batch, std::string* out);
+int DecodeHeartbeatBatch(const dc::MessageView& msg, HeartbeatBatch* batch);
+
+void EncodeHeartbeatBatchResp(const HeartbeatBatchResp& batch, std::string* out);
+int DecodeHeartbeatBatchResp(const dc::MessageView& msg, HeartbeatBatchResp* batch);
+
+void EncodeHello(const Hello& hello, std::string* out);
+int DecodeHello(const dc::MessageView& msg, Hello* hello);
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_MESSAGE_H__
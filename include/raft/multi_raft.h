@@ -0,0 +1,116 @@
+#ifndef __DC_RAFT_MULTI_RAFT_H__
+#define __DC_RAFT_MULTI_RAFT_H__
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <unordered_map>
+
+#include "codec.h"
+#include "message.h"
+#include "log_replicate.h"
+#include "socket_event.h"
+
+/*
+ * many raft groups (shards) in one process
+ *
+ *   connections: one SocketFdHandler per peer node, shared by every group.
+ *                frames carry FrameHeader::group, Dispatch() hands them
+ *                to the group
+ *   heartbeats : a group's LogReplicate::Heartbeat() adds an item here
+ *                (HeartbeatBatcher), FlushHeartbeats() sends one
+ *                MSG_HEARTBEAT_BATCH per node with the items of all
+ *                groups, answered by one MSG_HEARTBEAT_BATCH_RESP
+ *   timers     : one Tick() drives every group, no timer per group
+ *   disk       : the groups' LogStores share a SharedWal
+ *   hello      : AddPeer() / ResetPeer() send MSG_HELLO on the connection,
+ *                the peer's is kept (PeerCodecs()) and handed to every
+ *                group, whose LogReplicate::OnHello() picks the compressor
+ *
+ * single threaded, on the raft event loop.
+ */
+
+namespace dcraft {
+
+// one group hosted by MultiRaft, implemented by Raft
+class RaftGroup {
+public:
+    virtual ~RaftGroup() {}
+
+    // any frame of the group but heartbeat batches, and every MSG_HELLO. valid during the call
+    virtual void OnMessage(uint64_t from_id, const dc::MessageView& msg) = 0;
+
+    // follower side of a coalesced heartbeat, resp->group is set
+    virtual void OnHeartbeat(uint64_t from_id, const HeartbeatItem& item, HeartbeatRespItem* resp) = 0;
+
+    // leader side, LogReplicate::OnHeartbeatResponse() and term check
+    virtual void OnHeartbeatResponse(uint64_t from_id, const HeartbeatRespItem& resp) = 0;
+
+    // election timeout, heartbeat interval, ReadIndex::Tick() ...
+    virtual void OnTick(uint64_t now_ms) = 0;
+};
+
+class MultiRaft : public HeartbeatBatcher {
+public:
+    MultiRaft(uint64_t self_id);
+    virtual ~MultiRaft();
+
+    // the connection to node_id, not owned
+    int AddPeer(uint64_t node_id, dc::SocketFdHandler* conn);
+    void ResetPeer(uint64_t node_id, dc::SocketFdHandler* conn);
+    dc::SocketFdHandler* GetPeer(uint64_t node_id);
+    // codecs of the peer's hello on the current connection, 0 before
+    uint32_t PeerCodecs(uint64_t node_id);
+
+    /*
+     * g is not owned. its LogReplicate is expected to set_group(group) and
+     * set_heartbeat_batcher(this), its LogStore SetWal() on the shared wal
+     */
+    int AddGroup(uint64_t group, RaftGroup* g);
+    int RemoveGroup(uint64_t group);
+    RaftGroup* GetGroup(uint64_t group);
+
+    // a frame received from node from_id
+    void Dispatch(uint64_t from_id, const dc::MessageView& msg);
+
+    virtual void AddHeartbeat(uint64_t to_id, const HeartbeatItem& item);
+
+    // every group's OnTick(), then FlushHeartbeats()
+    void Tick(uint64_t now_ms);
+    void FlushHeartbeats();
+
+    size_t groups() const { return groups_.size(); }
+    uint64_t heartbeat_frames() const { return heartbeat_frames_; }
+    uint64_t heartbeat_items() const { return heartbeat_items_; }
+
+private:
+    struct Peer {
+        dc::SocketFdHandler* conn;
+        uint32_t codecs;
+        HeartbeatBatch batch;       // items queued this tick
+    };
+
+    void SendHello(dc::SocketFdHandler* conn);
+    void OnHello(uint64_t from_id, const dc::MessageView& msg);
+    void OnHeartbeatBatch(uint64_t from_id, const dc::MessageView& msg);
+    void OnHeartbeatBatchResp(uint64_t from_id, const dc::MessageView& msg);
+
+    uint64_t self_id_;
+
+    // <node id, Peer>
+    std::map<uint64_t, Peer> peers_;
+    // <group, RaftGroup>
+    std::unordered_map<uint64_t, RaftGroup*> groups_;
+
+    HeartbeatBatch recvBatch_;
+    HeartbeatBatchResp recvResp_;
+    HeartbeatBatchResp sendResp_;
+    std::string sendBuf_;
+
+    uint64_t heartbeat_frames_;
+    uint64_t heartbeat_items_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_MULTI_RAFT_H__
@@ -0,0 +1,97 @@
+#ifndef __DC_RAFT_PROPOSAL_QUEUE_H__
+#define __DC_RAFT_PROPOSAL_QUEUE_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "event_loop.h"
+#include "uring_event.h"
+#include "log_store.h"
+#include "log_replicate.h"
+
+/*
+ * leader side batching in front of the log
+ *
+ * Propose() appends to the LogStore pending batch (memory only), the batch
+ * is replicated as one AppendEntries and written + fsync'ed when
+ *     - max_entries or max_bytes is reached, or
+ *     - the linger timer (timerfd, us) fires on the event loop, or
+ *     - Tick() is called after Wait() and no linger is running
+ *
+ * adaptive: when the recent batches hold ~1 proposal there is no
+ * concurrency to wait for, linger is skipped and the tick flushes.
+ *
+ * disk and network in parallel: the batch goes to the followers' sockets
+ * first, then the local write starts. the leader's fsync is one more ack
+ * (LogStore::durable_index() in LogReplicate::CommitIndex()), not a step
+ * before replication. on a LOOP_URING loop the write + fsync is
+ * FlushAsync(), the loop keeps serving acks while it runs, a batch cut
+ * during it is flushed by the first Tick() after it completes.
+ */
+
+namespace dcraft {
+
+#define DEFAULT_PROPOSAL_ENTRIES 256
+#define DEFAULT_PROPOSAL_BYTES (1024 * 1024)
+#define DEFAULT_PROPOSAL_LINGER_US 200
+
+class ProposalQueue : public dc::EventHandler {
+public:
+    ProposalQueue(LogStore* store, LogReplicate* replicate,
+                  uint32_t max_entries = DEFAULT_PROPOSAL_ENTRIES,
+                  uint64_t max_bytes = DEFAULT_PROPOSAL_BYTES,
+                  uint32_t linger_us = DEFAULT_PROPOSAL_LINGER_US,
+                  bool adaptive = true);
+    virtual ~ProposalQueue();
+
+    // timerfd on ee, linger_us 0 needs no timer
+    int Initialize(dc::EventLoop* ee);
+
+    /*
+     * return index of the proposal, 0 if fail
+     */
+    uint64_t Propose(uint64_t term, const char* data, uint32_t len);
+
+    // replicate the batch, then write + fdatasync it (async on io_uring)
+    int Flush();
+
+    // call after each EventLoop/SocketEvent Wait()
+    void Tick();
+
+    virtual void OnRead(int fd, uint32_t events);
+    virtual void OnWrite(int fd, uint32_t events);
+    virtual void OnError(int fd, uint32_t events, int err, std::string& error);
+
+    void set_max_entries(uint32_t n) { max_entries_ = n; }
+    void set_max_bytes(uint64_t n) { max_bytes_ = n; }
+    void set_linger_us(uint32_t us) { linger_us_ = us; }
+
+    uint32_t avg_batch() const { return avg_batch_x8_ >> 3; }
+
+private:
+    int ArmTimer();
+    void DisarmTimer();
+    bool UseLinger() const;
+
+    LogStore* store_;
+    LogReplicate* replicate_;
+    dc::EventLoop* ee_;
+    dc::UringEvent* ring_;      // LOOP_URING: FlushAsync()
+
+    uint32_t max_entries_;
+    uint64_t max_bytes_;
+    uint32_t linger_us_;
+    bool adaptive_;
+
+    int timer_fd_;
+    bool timer_armed_;
+
+    uint32_t entries_;          // in the current batch
+    uint64_t bytes_;
+    uint32_t avg_batch_x8_;     // ewma of entries per batch, << 3
+    bool deferred_;             // replicated, local flush waits for the one in flight
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_PROPOSAL_QUEUE_H__
@@ -3,12 +3,27 @@
 #include <cstdlib>
 #include <string>
 #include "common.h"
+#include "log_store.h"
+#include "tail_cache.h"
+#include "log_replicate.h"
+#include "proposal_queue.h"
+#include "apply_pipeline.h"
+#include "read_index.h"
+#include "multi_raft.h"
+#include "shared_wal.h"
+#include "snapshot.h"
+#include "snapshotter.h"
+#include "recovery.h"
+#include "election.h"
+#include "fsm.h"
+#include "metrics_server.h"
 
 namespace dcraft {
 
 class Raft {
 public:
-    Raft(Config& c);
+    // group 0 and no host: the only group of the process, own connections and timer
+    Raft(Config& c, uint64_t group = 0, MultiRaft* host = NULL, SharedWal* wal = NULL);
     virtual ~Raft();
 
     virtual int Apply(void* data) = 0;
@@ -21,11 +36,23 @@ private:
     void RunFollower();
     void RunCondidate();
 
+    uint64_t group_;
+    MultiRaft* host_;               // connections, heartbeat batches and Tick() shared by the groups
     Cluster* cluster_;
-    LogStore* store_;
-    LogReplicate* replicate_ 
+    LogStore* store_;               // Apply() -> Append(), Flush() once per event loop tick, SetWal() if hosted
+    Recovery* recovery_;            // restart: snapshot load and store_ validation at once, then
+                                    // apply_ starts at the snapshot and RunFollower() right away
+    Election* election_;            // term, vote and role, Tick() runs RunFollower() / RunCondidate(),
+                                    // Config::pre_vote_ and Config::check_quorum_
+    TailCache* tail_cache_;         // Config::tail_cache_size_, in front of store_ for replication and apply
+    LogReplicate* replicate_;       // window per follower from Config::others_, set_compress() from Config::compress_type_
+    ProposalQueue* proposals_;
+    ReadIndex* reads_;              // Tick() each loop tick, OnApplied() after Apply()
     Fsm* fsm_;
-    SnapShot* snap_shot_;
+    ApplyPipeline* apply_;          // Submit(commit_index) each loop tick, Fsm::Apply() on its threads
+    Snapshotter* snapshotter_;      // every Config::snapshot_entries_ applied, Poll() each loop tick
+    SnapshotReceiver* snapshot_recv_;   // follower, InstallSnapshot chunks into Config::snapshot_dir_
+    dc::MetricsServer* metrics_;    // Config::metrics_port_, on the loop of host_ / the raft SocketEvent
     Log* log_; 
 
     Node self_;
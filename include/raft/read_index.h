@@ -0,0 +1,153 @@
+#ifndef __DC_RAFT_READ_INDEX_H__
+#define __DC_RAFT_READ_INDEX_H__
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "log_store.h"
+#include "log_replicate.h"
+#include "message.h"
+#include "socket_event.h"
+
+/*
+ * linearizable reads without a log entry
+ *
+ * leader  : ReadIndex, a read takes the commit index once the leader is
+ *           confirmed by a heartbeat round sent after the read arrived.
+ *           all reads queued in one loop tick share the next round, so
+ *           one heartbeat serves any number of them.
+ *           lease, when enabled, a majority ack of a round sent at T keeps
+ *           the leader sure of its term until T + election timeout minus
+ *           drift, reads in that window skip the round. it relies on
+ *           followers not voting within an election timeout of hearing
+ *           from the leader (Election, check_quorum).
+ * follower: the reads of one tick ask the leader for one read index
+ *           (MSG_READ_INDEX), then wait for the local apply to reach it.
+ *
+ * the leader answers only after an entry of its own term is committed,
+ * before that its commit index may be behind the previous leader's.
+ * single threaded, driven from the raft event loop.
+ */
+
+namespace dcraft {
+
+#define READ_ERR_NOT_LEADER -1      // leader unknown or lost, retry
+#define READ_ERR_TIMEOUT -2
+
+#define DEFAULT_READ_TIMEOUT_MS 3000
+#define READ_LEASE_DRIFT_PERCENT 10 // clock rate drift allowed between nodes
+
+class ReadCallback {
+public:
+    virtual ~ReadCallback() {}
+
+    // applied >= read_index, read the Fsm now
+    virtual void OnReadReady(uint64_t read_index) = 0;
+    virtual void OnReadFail(int err) = 0;
+};
+
+class ReadIndex {
+public:
+    /*
+     * replicate is the leader's, also used for its followers' connections
+     * lease: serve reads from the leader lease when it is valid
+     */
+    ReadIndex(LogStore* store, LogReplicate* replicate, uint64_t self_id,
+              uint32_t election_timeout_ms, bool lease,
+              uint32_t timeout_ms = DEFAULT_READ_TIMEOUT_MS);
+    virtual ~ReadIndex();
+
+    // reads waiting for a leader fail, those with a read index keep waiting for apply
+    void BecomeLeader(uint64_t term);
+    void BecomeFollower(uint64_t term, dc::SocketFdHandler* leader_conn);
+
+    /*
+     * cb is not owned, called once from Tick() / OnApplied() / a response
+     * return 0 if queued, -1 if no leader is known (cb not called)
+     */
+    int Read(ReadCallback* cb, uint64_t now_ms);
+
+    // leader: a follower's batch, answered once confirmed
+    void OnReadIndexRequest(const ReadIndexRequest& req, uint64_t now_ms);
+    // follower
+    void OnReadIndexResponse(const ReadIndexResponse& resp);
+
+    /*
+     * once per event loop tick, after the responses of the tick:
+     * leader starts a round for the reads queued since the last one and
+     * releases confirmed reads, follower sends its batch. times out reads
+     */
+    void Tick(uint64_t now_ms);
+
+    // the Fsm has applied up to index
+    void OnApplied(uint64_t applied_index);
+
+    bool leader() const { return leader_; }
+    bool lease_valid(uint64_t now_ms) const { return lease_ && now_ms < lease_expire_ms_; }
+    uint64_t pending() const;
+
+private:
+    struct Pending {
+        uint64_t seq;               // round that confirms it
+        uint64_t deadline_ms;
+        ReadCallback* cb;           // NULL: a follower's batch
+        uint64_t from_id;
+        uint64_t ctx;
+    };
+
+    struct Forward {
+        uint64_t deadline_ms;
+        std::vector<ReadCallback*> cbs;
+    };
+
+    struct Waiting {
+        uint64_t read_index;
+        ReadCallback* cb;
+    };
+
+    struct Round {
+        uint64_t seq;
+        uint64_t sent_ms;
+    };
+
+    bool CommittedInTerm() const;
+    void Confirm();
+    void Release(const Pending& p, uint64_t read_index);
+    void Reply(uint64_t from_id, uint64_t ctx, uint64_t read_index, bool success);
+    void StartRound(uint64_t now_ms);
+    void Ready();
+    void FailAll(int err);
+
+    LogStore* store_;
+    LogReplicate* replicate_;
+    uint64_t self_id_;
+    uint32_t timeout_ms_;
+    bool lease_;
+    uint64_t lease_ms_;
+
+    bool leader_;
+    uint64_t term_;
+    dc::SocketFdHandler* leader_conn_;  // follower, NULL if unknown
+
+    // leader
+    uint64_t read_seq_;             // last round started
+    uint64_t lease_expire_ms_;
+    std::deque<Pending> pending_;   // by seq
+    std::deque<Round> rounds_;      // started, not acked by a majority
+
+    // follower
+    uint64_t ctx_;
+    std::vector<ReadCallback*> unsent_;
+    std::map<uint64_t, Forward> forwards_;  // <ctx, reads>
+
+    uint64_t applied_index_;
+    std::deque<Waiting> waiting_;   // read index known, apply is behind
+
+    std::string sendBuf_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_READ_INDEX_H__
@@ -0,0 +1,65 @@
+#ifndef __DC_RAFT_RECOVERY_H__
+#define __DC_RAFT_RECOVERY_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "fsm.h"
+#include "log_store.h"
+
+/*
+ * restart of one raft group from data_dir_, what does not depend on each
+ * other runs at once
+ *
+ *   snapshot thread: the snapshot file is VerifySnapshot()'ed, then
+ *                    Fsm::LoadSnapshot()'ed
+ *   caller thread  : LogStore::Initialize(), the segments are validated
+ *                    on LogStore::set_recover() threads
+ *
+ * when both are done the log is cut to the snapshot (LogStore::Compact()),
+ * a log whose term at the snapshot index differs restarts after it.
+ *
+ * the entries between the snapshot and the commit index are not applied
+ * here: ApplyPipeline::Initialize(ee, snapshot_index()) starts at the
+ * snapshot and the apply thread replays them as the leader's commit index
+ * comes in. raft is a follower meanwhile (appends, votes), reads wait in
+ * ReadIndex until applied_index() gets there.
+ *
+ * with a SharedWal its host Initialize()s it after every group ran this,
+ * the records inside the snapshot are skipped by LogStore::Replay().
+ */
+
+namespace dcraft {
+
+class Recovery {
+public:
+    // snapshot_path: Snapshotter::path(), need not exist
+    Recovery(Fsm* fsm, LogStore* store, const std::string& snapshot_path);
+    virtual ~Recovery();
+
+    // 0 if fsm holds the snapshot and store the log after it
+    int Run();
+
+    uint64_t snapshot_index() const { return snapshot_index_; }     // 0 if none
+    uint64_t snapshot_term() const { return snapshot_term_; }
+    uint64_t snapshot_us() const { return snapshot_us_; }           // verify + load
+    uint64_t log_us() const { return log_us_; }                     // LogStore::Initialize()
+
+private:
+    // snapshot thread, 0 if loaded or there is none
+    int LoadSnapshot();
+    int CutLog();
+
+    Fsm* fsm_;
+    LogStore* store_;
+    std::string snapshot_path_;
+
+    uint64_t snapshot_index_;
+    uint64_t snapshot_term_;
+    uint64_t snapshot_us_;
+    uint64_t log_us_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_RECOVERY_H__
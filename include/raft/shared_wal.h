@@ -0,0 +1,104 @@
+#ifndef __DC_RAFT_SHARED_WAL_H__
+#define __DC_RAFT_SHARED_WAL_H__
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+#include "log_store.h"
+#include "metrics.h"
+
+/*
+ * one write ahead log for every raft group of the process (MultiRaft)
+ *
+ * wal_dir/
+ *     00000000000000000001.wal
+ *     00000000000000000002.wal       <- file name is a sequence number
+ *
+ * file = [WalRecord][data][WalRecord][data]...
+ *
+ * WalRecord::crc covers the record fields and chains the entry crc
+ * (EntryCrc()), so data is not hashed twice; replay stops at the first
+ * record that does not match, like at a torn tail.
+ *
+ * a LogStore attached with SetWal() copies every Append() / TruncateSuffix()
+ * here and no longer fdatasync()s its own segments: its Flush() first
+ * calls Flush() here, the first group to flush in a tick writes and syncs
+ * the records of all groups, the others find nothing left to sync.
+ * one fsync stream for the node instead of one per group.
+ *
+ * when the file passes segment_size a new one is started, every store
+ * is flushed and synced (Sync()) and the older files are deleted, they
+ * hold nothing a store does not have on disk.
+ *
+ * restart: Initialize() replays the files into the registered stores,
+ * entries a store lost in the crash are appended again, then checkpoints.
+ */
+
+namespace dcraft {
+
+#define DEFAULT_WAL_SEGMENT_SIZE (64 * 1024 * 1024)
+#define WAL_FILE_SUFFIX ".wal"
+#define WAL_MAGIC 0x4c415744             // "DWAL"
+
+struct WalRecord {
+    uint32_t magic;
+    uint32_t len;           // data len
+    uint64_t group;
+    uint64_t index;
+    uint64_t term;          // 0: truncate the log of group from index
+    uint32_t crc;           // WalRecordCrc()
+    uint32_t reserved;
+};
+
+class SharedWal {
+public:
+    SharedWal(const std::string& dir, uint64_t segment_size = DEFAULT_WAL_SEGMENT_SIZE);
+    virtual ~SharedWal();
+
+    // by LogStore::SetWal(), store is not owned
+    int Register(uint64_t group, LogStore* store);
+    void Unregister(uint64_t group);
+
+    /*
+     * after every store is registered and Initialize()'d:
+     * replay, then start a new file
+     */
+    int Initialize();
+
+    // entry_crc: EntryCrc() of the entry, computed once by LogStore::Append()
+    void Append(uint64_t group, uint64_t index, uint64_t term, const char* data, uint32_t len, uint32_t entry_crc);
+    void Truncate(uint64_t group, uint64_t index);
+
+    // one write() + one fdatasync() for the records of all groups, 0 if nothing to do
+    int Flush();
+
+    bool HasPending() const { return !pending_.empty(); }
+    uint64_t syncs() const { return syncs_; }
+    uint64_t file_size() const { return file_size_; }
+
+private:
+    int Replay(const std::string& path);
+    int OpenFile(uint64_t seq);
+    int Checkpoint();
+    std::string FilePath(uint64_t seq);
+
+    std::string dir_;
+    uint64_t segment_size_;
+
+    int fd_;
+    uint64_t seq_;                  // of the file written
+    uint64_t file_size_;
+    std::string pending_;           // records since the last Flush()
+
+    // <group, LogStore>
+    std::map<uint64_t, LogStore*> stores_;
+
+    bool checkpointing_;            // stores' Flush() call back into Flush()
+    uint64_t syncs_;
+    dc::Histogram* fsync_us_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_SHARED_WAL_H__
@@ -0,0 +1,156 @@
+#ifndef __DC_RAFT_SNAPSHOT_H__
+#define __DC_RAFT_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <string>
+
+#include "message.h"
+#include "io_chain.h"
+#include "socket_event.h"
+
+/*
+ * InstallSnapshot, streamed in chunks
+ *
+ * leader  : SnapshotSender, the file is opened once and every chunk is a
+ *           file slice of the connection's send chain, sendfile() moves it
+ *           from the page cache to the socket. at most window chunks are
+ *           not acked, so a slow follower never makes the leader read or
+ *           buffer the file. with a Compressor set the chunk is read
+ *           instead and sent compressed, unless it does not shrink.
+ * follower: SnapshotReceiver, chunks are pwrite()'d into
+ *           <file>.<index>_<term>.partial and fdatasync'ed before the ack,
+ *           the acked offset survives a restart or a new connection and
+ *           the leader resumes there. the last chunk renames it to <file>.
+ *
+ * a chunk at another offset than the follower has is rejected with its
+ * next_offset, the leader rewinds there and bumps seq, so rejects of
+ * chunks that were already in flight are dropped.
+ *
+ * SnapshotHeader::crc covers the whole payload, the leader never reads
+ * the chunks it sendfile()s, so the follower checks the file once it is
+ * complete, a mismatch truncates the partial file and rejects with
+ * next_offset 0.
+ */
+
+namespace dcraft {
+
+#define SNAPSHOT_MAGIC 0x504e5344         // "DSNP"
+#define SNAPSHOT_CHUNK_SIZE (1024 * 1024)
+#define SNAPSHOT_WINDOW 4                   // chunks not acked
+#define SNAPSHOT_PARTIAL_SUFFIX ".partial"
+
+// head of snapshot.dat, the Fsm payload follows
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t crc;               // CRC32C of the payload, SealSnapshot()
+    uint64_t last_index;
+    uint64_t last_term;
+};
+
+// 0 if path is a snapshot, header filled
+int ReadSnapshotHeader(const std::string& path, SnapshotHeader* header);
+
+// payload written after the header: put its crc in the header, no heap, fork child safe
+int SealSnapshot(int fd);
+// 0 if the payload matches the crc in the header, before Fsm::LoadSnapshot()
+int VerifySnapshot(int fd);
+
+class SnapshotSender {
+public:
+    SnapshotSender(uint64_t self_id,
+                   uint32_t chunk_size = SNAPSHOT_CHUNK_SIZE,
+                   uint32_t window = SNAPSHOT_WINDOW);
+    virtual ~SnapshotSender();
+
+    /*
+     * the transfer keeps the fd, a newer snapshot renamed over path does
+     * not break chunks already queued
+     */
+    int Open(const std::string& path, uint64_t last_index, uint64_t last_term);
+
+    /*
+     * queue chunks on conn until window chunks are not acked
+     * return chunks queued
+     */
+    int Pump(dc::SocketFdHandler* conn, uint64_t term);
+
+    // return 1 if the follower has installed the file, 0 going on, -1 if not ours
+    int OnResponse(const InstallSnapshotResponse& resp);
+
+    // connection rebuilt, chunks in flight are lost, resend from the acked offset
+    void Rewind();
+
+    void set_group(uint64_t group) { group_ = group; }
+
+    // chunks sent from now on, c NULL: file slices. compressed frames go to Buffers of slab
+    void set_compressor(const dc::Compressor* c, dc::Slab* slab) { compressor_ = c; slab_ = slab; }
+
+    uint64_t last_index() const { return last_index_; }
+    uint64_t last_term() const { return last_term_; }
+    uint64_t size() const { return size_; }
+    uint64_t acked_offset() const { return acked_offset_; }
+
+private:
+    // chunk read and compressed, -1 if that fails or does not pay
+    int SendCompressed(const InstallSnapshotRequest& req, dc::SocketFdHandler* conn);
+
+    uint64_t self_id_;
+    uint64_t group_;
+    uint32_t chunk_size_;
+    uint32_t window_;
+
+    dc::Buffer* file_;              // file Buffer, fd owned
+    uint64_t size_;
+    uint64_t last_index_;
+    uint64_t last_term_;
+
+    uint64_t next_offset_;          // next byte to queue
+    uint64_t acked_offset_;         // synced on the follower
+    bool tail_sent_;                // chunk reaching size_ is queued
+    uint32_t seq_;
+
+    const dc::Compressor* compressor_;
+    dc::Slab* slab_;
+    std::string chunk_;             // compressed sends only
+    std::string scratch_;
+
+    std::string meta_;
+    dc::IoChain chain_;
+};
+
+class SnapshotReceiver {
+public:
+    // snapshot installs to dir/file
+    SnapshotReceiver(const std::string& dir, const std::string& file);
+    virtual ~SnapshotReceiver();
+
+    /*
+     * resp is filled for the leader in any case
+     * return 1 if the snapshot is complete and in place, 0 going on,
+     * -1 if io fail (resp rejects, the leader retries)
+     */
+    int OnChunk(const InstallSnapshotView& req, uint64_t self_id, InstallSnapshotResponse* resp);
+
+    std::string path() const { return dir_ + "/" + file_; }
+
+private:
+    int OpenPartial(uint64_t last_index, uint64_t last_term);
+    void ClosePartial();
+    void RemoveStalePartials(const std::string& keep);
+
+    std::string dir_;
+    std::string file_;
+
+    int fd_;                        // partial file, -1 if none
+    std::string partial_path_;
+    uint64_t last_index_;
+    uint64_t last_term_;
+    uint64_t size_;                 // bytes synced in the partial file
+
+    uint64_t installed_index_;      // last snapshot renamed into place
+    uint64_t installed_term_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_SNAPSHOT_H__
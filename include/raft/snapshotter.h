@@ -0,0 +1,75 @@
+#ifndef __DC_RAFT_SNAPSHOTTER_H__
+#define __DC_RAFT_SNAPSHOTTER_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "fsm.h"
+#include "log_store.h"
+#include "snapshot.h"
+
+/*
+ * background snapshot of the Fsm into dir/file, Apply() is not stopped
+ *
+ *   Start() : apply thread, between two entries. takes Fsm::Checkpoint()
+ *             and serializes it on a thread, or fork()s and the child
+ *             writes its copy on write image. either way it returns at once
+ *   Poll()  : event loop tick. when the writer is done the file is synced,
+ *             renamed over the old snapshot, and the LogStore prefix is
+ *             compacted, keep_entries behind the snapshot stay in the log
+ *             so a follower a little behind still gets AppendEntries
+ */
+
+namespace dcraft {
+
+#define SNAPSHOT_KEEP_ENTRIES 10000
+#define SNAPSHOT_TMP_SUFFIX ".tmp"
+
+class Snapshotter {
+public:
+    Snapshotter(Fsm* fsm, LogStore* store, const std::string& dir, const std::string& file,
+                uint64_t keep_entries = SNAPSHOT_KEEP_ENTRIES);
+    virtual ~Snapshotter();         // waits for the writer
+
+    // index / term: last entry applied, return 0 started, 1 one is running, -1 fail
+    int Start(uint64_t index, uint64_t term);
+
+    // return 1 if a snapshot was just installed, 0 nothing new, -1 it failed
+    int Poll();
+
+    bool running() const { return running_.load(std::memory_order_acquire); }
+
+    std::string path() const { return dir_ + "/" + file_; }
+    uint64_t last_index() const { return last_index_; }     // of the installed snapshot
+    uint64_t last_term() const { return last_term_; }
+
+private:
+    int Finish(bool ok);
+    void Abort();
+
+    Fsm* fsm_;
+    LogStore* store_;
+    std::string dir_;
+    std::string file_;
+    uint64_t keep_entries_;
+
+    std::atomic<bool> running_;     // Start() may run on the apply thread, Poll() on the loop
+    int fd_;                        // tmp file being written
+    uint64_t index_;                // of the running one
+    uint64_t term_;
+    uint64_t start_ms_;
+
+    pid_t pid_;                     // fork writer, -1 if none
+    std::thread thread_;            // FsmView writer
+    std::atomic<int> result_;       // thread writer: 1 running, 0 ok, -1 fail
+
+    uint64_t last_index_;
+    uint64_t last_term_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_SNAPSHOTTER_H__
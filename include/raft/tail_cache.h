@@ -0,0 +1,98 @@
+#ifndef __DC_RAFT_TAIL_CACHE_H__
+#define __DC_RAFT_TAIL_CACHE_H__
+
+#include <stdint.h>
+#include <atomic>
+
+#include "io_chain.h"
+
+/*
+ * the last entries of the log in memory, in front of LogStore
+ *
+ * a ring of max_entries slots (power of two) holding [first, last], slot
+ * of index is index & mask. LogStore::Append() puts every entry, the
+ * oldest ones are evicted past max_bytes or max_entries, Get() of a
+ * follower slightly behind or of the apply stage is then a hit.
+ *
+ * only the raft event loop touches the ring, no lock. an entry is a
+ * refcounted Buffer, a hit hands out one more ref, so an entry evicted
+ * while the apply thread or a send queue still holds it stays valid.
+ * stats are relaxed counters, readable from any thread.
+ */
+
+namespace dcraft {
+
+#define DEFAULT_TAIL_CACHE_BYTES (64 * 1024 * 1024)
+#define DEFAULT_TAIL_CACHE_ENTRIES (64 * 1024)
+
+struct TailCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t hit_bytes;         // served from memory instead of disk
+    uint64_t evictions;
+    uint64_t entries;           // cached now
+    uint64_t bytes;
+};
+
+class TailCache {
+public:
+    // max_entries rounded up to a power of two
+    TailCache(uint64_t max_bytes = DEFAULT_TAIL_CACHE_BYTES,
+              uint32_t max_entries = DEFAULT_TAIL_CACHE_ENTRIES);
+    virtual ~TailCache();
+
+    /*
+     * data gets one more ref. index not last + 1 (log restarted after
+     * a snapshot) empties the cache first. crc: EntryCrc(), kept so a
+     * hit goes on the wire without being hashed again
+     */
+    void Put(uint64_t index, uint64_t term, dc::Buffer* data, uint32_t crc = 0);
+
+    // hit: true, *data gets one more ref, the caller Release()s it
+    bool Get(uint64_t index, uint64_t* term, dc::Buffer** data, uint32_t* crc = NULL);
+
+    // drop entries >= index, follower log conflict
+    void Truncate(uint64_t index);
+    // drop entries <= index, compacted
+    void Compact(uint64_t index);
+    void Clear();
+
+    TailCacheStats stats() const;
+    // hits / (hits + misses), 0 before the first Get()
+    double hit_rate() const;
+
+private:
+    struct Slot {
+        uint64_t term;
+        dc::Buffer* data;
+        uint32_t crc;
+    };
+
+    TailCache(const TailCache&);
+    TailCache& operator=(const TailCache&);
+
+    void PopFront();
+    void PopBack();
+
+    static void Bump(std::atomic<uint64_t>& c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t max_bytes_;
+    Slot* slots_;
+    uint64_t mask_;
+
+    uint64_t first_;            // first cached index, empty if first_ > last_
+    uint64_t last_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> hit_bytes_;
+    std::atomic<uint64_t> evictions_;
+    std::atomic<uint64_t> entries_;
+    std::atomic<uint64_t> bytes_;
+};
+
+}   // namespace dcraft
+
+#endif  //  __DC_RAFT_TAIL_CACHE_H__
@@ -0,0 +1,278 @@
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace dc {
+
+#define CRC32C_POLY 0x82f63b78          // reflected 0x1edc6f41
+#define CRC32C_LONG 8192                // hardware: 3 streams of LONG / SHORT bytes
+#define CRC32C_SHORT 256                //   in flight, the crc32 latency is hidden
+
+// the crc register times the 32x32 gf(2) matrix mat
+static uint32_t MatrixTimes(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void MatrixSquare(uint32_t* square, const uint32_t* mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = MatrixTimes(mat, mat[n]);
+    }
+}
+
+// shift[][] of the operator appending len (power of 2) zero bytes to the register
+static void ZerosTable(uint32_t shift[4][256], size_t len) {
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    // one zero bit
+    odd[0] = CRC32C_POLY;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    MatrixSquare(even, odd);        // 2 bits
+    MatrixSquare(odd, even);        // 4 bits
+
+    const uint32_t* op = NULL;
+    do {
+        MatrixSquare(even, odd);    // 1 byte, 4 bytes ...
+        len >>= 1;
+        op = even;
+        if (len == 0) {
+            break;
+        }
+        MatrixSquare(odd, even);    // 2 bytes, 8 bytes ...
+        len >>= 1;
+        op = odd;
+    } while (len);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        shift[0][n] = MatrixTimes(op, n);
+        shift[1][n] = MatrixTimes(op, n << 8);
+        shift[2][n] = MatrixTimes(op, n << 16);
+        shift[3][n] = MatrixTimes(op, n << 24);
+    }
+}
+
+static inline uint32_t Shift(const uint32_t shift[4][256], uint32_t crc) {
+    return shift[0][crc & 0xff] ^ shift[1][(crc >> 8) & 0xff] ^ shift[2][(crc >> 16) & 0xff] ^ shift[3][crc >> 24];
+}
+
+struct Crc32cTable {
+    uint32_t t[8][256];
+    uint32_t long_shift[4][256];
+    uint32_t short_shift[4][256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+            }
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+        ZerosTable(long_shift, CRC32C_LONG);
+        ZerosTable(short_shift, CRC32C_SHORT);
+    }
+};
+
+static const Crc32cTable* Table() {
+    static const Crc32cTable* table = new Crc32cTable;
+    return table;
+}
+
+// slicing by 8, 8 table lookups per 8 bytes
+static uint32_t Crc32cSoftware(uint32_t crc, const uint8_t* p, size_t len) {
+    const Crc32cTable* table = Table();
+    const uint32_t (*t)[256] = table->t;
+
+    crc = ~crc;
+    while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, sizeof(lo));
+        memcpy(&hi, p + 4, sizeof(hi));
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+              ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+
+// 3 streams of block bytes, joined by shifting, p and len advanced
+__attribute__((target("sse4.2")))
+static inline uint64_t Crc32cBlocks(uint64_t c, const uint8_t** p, size_t* len, size_t block,
+                                    const uint32_t shift[4][256]) {
+    while (*len >= block * 3) {
+        const uint8_t* q = *p;
+        const uint8_t* end = q + block;
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        do {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, q, sizeof(v0));
+            memcpy(&v1, q + block, sizeof(v1));
+            memcpy(&v2, q + block * 2, sizeof(v2));
+            c = _mm_crc32_u64(c, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+            q += 8;
+        } while (q < end);
+        c = Shift(shift, static_cast<uint32_t>(c)) ^ c1;
+        c = Shift(shift, static_cast<uint32_t>(c)) ^ c2;
+        *p += block * 3;
+        *len -= block * 3;
+    }
+    return c;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cHardware(uint32_t crc, const uint8_t* p, size_t len) {
+    uint64_t c = ~crc;
+    while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+        len--;
+    }
+    if (len >= CRC32C_SHORT * 3) {
+        const Crc32cTable* table = Table();
+        c = Crc32cBlocks(c, &p, &len, CRC32C_LONG, table->long_shift);
+        c = Crc32cBlocks(c, &p, &len, CRC32C_SHORT, table->short_shift);
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+    }
+    return ~static_cast<uint32_t>(c);
+}
+
+static bool HasHardware() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#define CRC32C_HARDWARE "sse4.2"
+
+#elif defined(__aarch64__)
+
+__attribute__((target("+crc")))
+static inline uint32_t Crc32cBlocks(uint32_t c, const uint8_t** p, size_t* len, size_t block,
+                                    const uint32_t shift[4][256]) {
+    while (*len >= block * 3) {
+        const uint8_t* q = *p;
+        const uint8_t* end = q + block;
+        uint32_t c1 = 0;
+        uint32_t c2 = 0;
+        do {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, q, sizeof(v0));
+            memcpy(&v1, q + block, sizeof(v1));
+            memcpy(&v2, q + block * 2, sizeof(v2));
+            c = __crc32cd(c, v0);
+            c1 = __crc32cd(c1, v1);
+            c2 = __crc32cd(c2, v2);
+            q += 8;
+        } while (q < end);
+        c = Shift(shift, c) ^ c1;
+        c = Shift(shift, c) ^ c2;
+        *p += block * 3;
+        *len -= block * 3;
+    }
+    return c;
+}
+
+__attribute__((target("+crc")))
+static uint32_t Crc32cHardware(uint32_t crc, const uint8_t* p, size_t len) {
+    uint32_t c = ~crc;
+    while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        c = __crc32cb(c, *p++);
+        len--;
+    }
+    if (len >= CRC32C_SHORT * 3) {
+        const Crc32cTable* table = Table();
+        c = Crc32cBlocks(c, &p, &len, CRC32C_LONG, table->long_shift);
+        c = Crc32cBlocks(c, &p, &len, CRC32C_SHORT, table->short_shift);
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = __crc32cd(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c = __crc32cb(c, *p++);
+    }
+    return ~c;
+}
+
+static bool HasHardware() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#define CRC32C_HARDWARE "armv8"
+
+#else
+
+static uint32_t Crc32cHardware(uint32_t crc, const uint8_t* p, size_t len) {
+    return Crc32cSoftware(crc, p, len);
+}
+
+static bool HasHardware() {
+    return false;
+}
+
+#define CRC32C_HARDWARE "software"
+
+#endif
+
+typedef uint32_t (*Crc32cFunc)(uint32_t crc, const uint8_t* p, size_t len);
+
+static Crc32cFunc Impl() {
+    static const Crc32cFunc func = HasHardware() ? Crc32cHardware : Crc32cSoftware;
+    return func;
+}
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t len) {
+    return Impl()(crc, static_cast<const uint8_t*>(data), len);
+}
+
+const char* Crc32cImpl() {
+    return Impl() == Crc32cHardware && HasHardware() ? CRC32C_HARDWARE : "software";
+}
+
+}   // namespace dc
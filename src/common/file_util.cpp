@@ -0,0 +1,109 @@
+#include "file_util.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace dc {
+
+// errors go to stderr, not RAFT_LOG(): the logger calls MakeDirs() holding its mutex
+int MakeDirs(const std::string& path) {
+    if (path.empty()) {
+        return -1;
+    }
+
+    std::string cur;
+    size_t pos = 0;
+    while (pos != std::string::npos) {
+        pos = path.find('/', pos + 1);
+        cur = path.substr(0, pos);
+        if (cur.empty() || cur == "/") {
+            continue;
+        }
+        if (mkdir(cur.c_str(), 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "MakeDirs, mkdir fail, path:%s, errno:%d, error:%s\n", cur.c_str(), errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int FsyncDir(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        fprintf(stderr, "FsyncDir, open fail, dir:%s, errno:%d, error:%s\n", dir.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    int ret = fsync(fd);
+    if (ret != 0) {
+        fprintf(stderr, "FsyncDir, fsync fail, dir:%s, errno:%d, error:%s\n", dir.c_str(), errno, strerror(errno));
+    }
+    close(fd);
+
+    return ret;
+}
+
+int ListDir(const std::string& dir, std::vector<std::string>* names) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        fprintf(stderr, "ListDir, opendir fail, dir:%s, errno:%d, error:%s\n", dir.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        names->push_back(ent->d_name);
+    }
+    closedir(d);
+
+    std::sort(names->begin(), names->end());
+    return 0;
+}
+
+int WriteFull(int fd, const void* buf, size_t len) {
+    const char* p = static_cast<const char*>(buf);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int PreadFull(int fd, void* buf, size_t len, uint64_t offset) {
+    char* p = static_cast<char*>(buf);
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (n == 0) {    // EOF
+            return -1;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+}   // namespace dc
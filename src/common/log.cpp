@@ -0,0 +1,571 @@
+#include "log.h"
+#include "file_util.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <inttypes.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace dc {
+
+uint32_t Log::s_file_size_ = 100 * 1024 * 1024;
+uint32_t Log::s_file_num_ = 10;
+
+namespace {
+
+const char* kLevelName[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "FATAL"};
+
+// one record in a ThreadRing, the message follows, len is 8 byte aligned
+struct Record {
+    uint32_t len;           // whole record
+    uint32_t level;
+    Log* log;               // NULL: padding up to the end of the ring
+    uint64_t ts_ns;         // CLOCK_REALTIME
+    uint32_t msg_len;
+    uint32_t reserved;
+};
+
+struct ThreadRing {
+    char* buf;
+    uint64_t mask;
+    std::atomic<uint64_t> head;         // flusher
+    std::atomic<uint64_t> tail;         // owner thread
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> dead;             // thread exited, free once drained
+    pid_t tid;
+};
+
+class Logger {
+public:
+    Logger()
+        : file_(DEFAULT_LOG_FILE_NAME)
+        , default_(NULL)
+        , running_(false)
+        , stopped_(false)
+        , wake_(false) {
+    }
+
+    ThreadRing* NewRing();
+    void Wake();
+    Log* Get(const std::string& id);
+    void Init(uint32_t file_size, uint32_t file_num, const std::string& dir, const std::string& file);
+    void Flush();
+    void Clean();
+
+    bool stopped() const { return stopped_.load(std::memory_order_acquire); }
+
+private:
+    void StartLocked();
+    void Run();
+    void Drain();               // under drain_mutex_
+    void DrainRing(ThreadRing* r);
+    void Render(const Record& rec, const char* msg, pid_t tid);
+
+    std::mutex mutex_;          // rings_, logs_, dir_, file_, before wake_mutex_
+    std::vector<ThreadRing*> rings_;
+    std::map<std::string, Log*> logs_;
+    std::string dir_;
+    std::string file_;
+    std::atomic<Log*> default_;
+
+    std::mutex drain_mutex_;    // one consumer of the rings at a time
+    time_t rendered_sec_;
+    char rendered_time_[32];    // "YYYY-mm-dd HH:MM:SS" of rendered_sec_
+    std::vector<Log*> touched_; // with pending lines
+
+    std::thread flusher_;
+    bool running_;              // wake_mutex_
+    std::atomic<bool> stopped_; // after Clean(): write through to stderr
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<bool> wake_;
+};
+
+// never destroyed, threads may log while the process exits
+Logger* g_logger = new Logger();
+
+struct RingHolder {
+    ThreadRing* ring;
+    ~RingHolder() {
+        if (ring) {
+            ring->dead.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local RingHolder t_ring = {NULL};
+
+uint64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void CleanAtExit() {
+    g_logger->Clean();
+}
+
+ThreadRing* Logger::NewRing() {
+    ThreadRing* r = new ThreadRing();
+    r->buf = static_cast<char*>(malloc(LOG_THREAD_BUFFER));
+    r->mask = LOG_THREAD_BUFFER - 1;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->dead = false;
+    r->tid = syscall(SYS_gettid);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(r);
+    StartLocked();
+    return r;
+}
+
+void Logger::StartLocked() {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    if (running_ || stopped()) {
+        return;
+    }
+    running_ = true;
+    rendered_sec_ = 0;
+    flusher_ = std::thread(&Logger::Run, this);
+
+    static bool registered = false;
+    if (!registered) {
+        registered = true;
+        atexit(CleanAtExit);
+    }
+}
+
+void Logger::Wake() {
+    if (!wake_.exchange(true)) {
+        wake_cv_.notify_one();
+    }
+}
+
+Log* Logger::Get(const std::string& id) {
+    if (id.empty()) {
+        Log* log = default_.load(std::memory_order_acquire);
+        if (log) {
+            return log;
+        }
+    }
+
+    int saved_errno = errno;    // callers log strerror(errno) after us
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string& name = id.empty() ? file_ : id;
+    std::map<std::string, Log*>::iterator it = logs_.find(name);
+    if (it != logs_.end()) {
+        return it->second;
+    }
+
+    Log* log = new Log(name, Log::s_file_size_, Log::s_file_num_);
+    log->Open(dir_, Log::s_file_size_, Log::s_file_num_);
+    logs_[name] = log;
+    if (id.empty()) {
+        default_.store(log, std::memory_order_release);
+    }
+    errno = saved_errno;
+    return log;
+}
+
+void Logger::Init(uint32_t file_size, uint32_t file_num, const std::string& dir, const std::string& file) {
+    std::lock_guard<std::mutex> drain(drain_mutex_);
+    Drain();        // what was logged before goes where it was meant to
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Log::s_file_size_ = file_size;
+    Log::s_file_num_ = file_num ? file_num : 1;
+    dir_ = dir;
+    if (!file.empty() && file != file_) {
+        file_ = file;
+        default_.store(NULL, std::memory_order_release);
+    }
+
+    std::map<std::string, Log*>::iterator it;
+    for (it = logs_.begin(); it != logs_.end(); it++) {
+        it->second->Close();
+        it->second->Open(dir_, Log::s_file_size_, Log::s_file_num_);
+    }
+
+    stopped_.store(false, std::memory_order_release);
+    StartLocked();
+}
+
+void Logger::Run() {
+    for (;;) {
+        bool running;
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MS),
+                              [this]() { return wake_.load() || !running_; });
+            wake_ = false;
+            running = running_;
+        }
+
+        std::lock_guard<std::mutex> drain(drain_mutex_);
+        Drain();
+        if (!running) {
+            return;
+        }
+    }
+}
+
+void Logger::Flush() {
+    std::lock_guard<std::mutex> drain(drain_mutex_);
+    Drain();
+}
+
+void Logger::Clean() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    wake_cv_.notify_one();
+    flusher_.join();
+
+    // from now on Write() goes straight to stderr
+    stopped_.store(true, std::memory_order_release);
+
+    std::lock_guard<std::mutex> drain(drain_mutex_);
+    Drain();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, Log*>::iterator it;
+    for (it = logs_.begin(); it != logs_.end(); it++) {
+        it->second->Close();
+    }
+}
+
+void Logger::Drain() {
+    std::vector<ThreadRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings = rings_;
+    }
+
+    std::vector<ThreadRing*> done;
+    for (size_t i = 0; i < rings.size(); i++) {
+        // dead first: nothing is appended after we see it
+        bool dead = rings[i]->dead.load(std::memory_order_acquire);
+        DrainRing(rings[i]);
+        if (dead) {
+            done.push_back(rings[i]);
+        }
+    }
+
+    for (size_t i = 0; i < touched_.size(); i++) {
+        touched_[i]->WritePending();
+    }
+    touched_.clear();
+
+    if (!done.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < done.size(); i++) {
+            for (size_t j = 0; j < rings_.size(); j++) {
+                if (rings_[j] == done[i]) {
+                    rings_.erase(rings_.begin() + j);
+                    break;
+                }
+            }
+            free(done[i]->buf);
+            delete done[i];
+        }
+    }
+}
+
+void Logger::DrainRing(ThreadRing* r) {
+    uint64_t head = r->head.load(std::memory_order_relaxed);
+    uint64_t tail = r->tail.load(std::memory_order_acquire);
+    uint64_t cap = r->mask + 1;
+
+    while (head < tail) {
+        uint64_t pos = head & r->mask;
+        if (cap - pos < sizeof(Record)) {
+            head += cap - pos;      // too short for a header, skipped by the writer too
+            continue;
+        }
+
+        Record rec;
+        memcpy(&rec, r->buf + pos, sizeof(rec));
+        if (rec.log) {
+            Render(rec, r->buf + pos + sizeof(rec), r->tid);
+        }
+        head += rec.len;
+    }
+    r->head.store(head, std::memory_order_release);
+
+    uint64_t dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        char msg[64];
+        int n = snprintf(msg, sizeof(msg), "log ring full, dropped %" PRIu64 " records", dropped);
+        Record rec = {0, DC_LOG_WARNING, NULL, NowNs(), static_cast<uint32_t>(n), 0};
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::map<std::string, Log*>::iterator it = logs_.find(file_);
+            rec.log = it == logs_.end() ? NULL : it->second;
+        }
+        if (rec.log) {
+            Render(rec, msg, r->tid);
+        }
+    }
+}
+
+void Logger::Render(const Record& rec, const char* msg, pid_t tid) {
+    time_t sec = rec.ts_ns / 1000000000;
+    if (sec != rendered_sec_) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(rendered_time_, sizeof(rendered_time_), "%Y-%m-%d %H:%M:%S", &tm);
+        rendered_sec_ = sec;
+    }
+
+    char prefix[80];
+    int n = snprintf(prefix, sizeof(prefix), "%s.%06u %s %d ", rendered_time_,
+                     static_cast<uint32_t>(rec.ts_ns % 1000000000 / 1000),
+                     kLevelName[rec.level <= DC_LOG_FATAL ? rec.level : DC_LOG_FATAL], tid);
+
+    std::string& out = rec.log->pending();
+    if (out.empty()) {
+        touched_.push_back(rec.log);
+    }
+    out.append(prefix, n);
+    out.append(msg, rec.msg_len);
+    if (rec.msg_len == 0 || msg[rec.msg_len - 1] != '\n') {
+        out.push_back('\n');
+    }
+}
+
+}   // namespace
+
+void RAFT_LOG_INIT(uint32_t file_size, uint32_t file_num, const std::string& dir, const std::string& file) {
+    g_logger->Init(file_size, file_num, dir, file);
+}
+
+void RAFT_LOG_CLEAN() {
+    g_logger->Clean();
+}
+
+void RAFT_LOG_FLUSH() {
+    g_logger->Flush();
+}
+
+Log* RAFT_LOG(const std::string& id) {
+    return g_logger->Get(id);
+}
+
+Log::Log(const std::string& name, uint32_t f_size, uint32_t f_num)
+    : name_(name)
+    , file_size_(f_size)
+    , file_num_(f_num)
+    , level_(DC_LOG_LEVEL)
+    , fd_(-1)
+    , written_(0) {
+}
+
+Log::~Log() {
+    Close();
+}
+
+void Log::Trace(const std::string& s) {
+    Write(DC_LOG_TRACE, s.data(), s.size());
+}
+
+void Log::Debug(const std::string& s) {
+    Write(DC_LOG_DEBUG, s.data(), s.size());
+}
+
+void Log::Info(const std::string& s) {
+    Write(DC_LOG_INFO, s.data(), s.size());
+}
+
+void Log::Warning(const std::string& s) {
+    Write(DC_LOG_WARNING, s.data(), s.size());
+}
+
+void Log::Error(const std::string& s) {
+    Write(DC_LOG_ERROR, s.data(), s.size());
+}
+
+void Log::Fatal(const std::string& s) {
+    Write(DC_LOG_FATAL, s.data(), s.size());
+}
+
+void Log::Printf(int level, const char* fmt, ...) {
+    char line[LOG_MAX_LINE];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (n < 0) {
+        return;
+    }
+    Write(level, line, static_cast<size_t>(n) < sizeof(line) ? n : sizeof(line) - 1);
+}
+
+void Log::Write(int level, const char* data, size_t len) {
+    if (level < this->level()) {
+        return;
+    }
+    if (len > LOG_MAX_LINE) {
+        len = LOG_MAX_LINE;
+    }
+
+    if (g_logger->stopped()) {
+        fprintf(stderr, "%.*s%s", static_cast<int>(len), data, len > 0 && data[len - 1] == '\n' ? "" : "\n");
+        return;
+    }
+
+    ThreadRing* r = t_ring.ring;
+    if (!r) {
+        r = g_logger->NewRing();
+        t_ring.ring = r;
+    }
+
+    uint64_t cap = r->mask + 1;
+    uint64_t need = (sizeof(Record) + len + 7) & ~static_cast<uint64_t>(7);
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    uint64_t head = r->head.load(std::memory_order_acquire);
+    uint64_t pos = tail & r->mask;
+    uint64_t pad = cap - pos < need ? cap - pos : 0;        // records never wrap
+
+    if (tail + pad + need - head > cap) {
+        r->dropped.fetch_add(1, std::memory_order_relaxed);
+        g_logger->Wake();
+        return;
+    }
+
+    if (pad > 0) {
+        if (pad >= sizeof(Record)) {
+            Record skip = {static_cast<uint32_t>(pad), 0, NULL, 0, 0, 0};
+            memcpy(r->buf + pos, &skip, sizeof(skip));
+        }
+        tail += pad;
+        pos = 0;
+    }
+
+    Record rec = {static_cast<uint32_t>(need), static_cast<uint32_t>(level), this, NowNs(), static_cast<uint32_t>(len), 0};
+    memcpy(r->buf + pos, &rec, sizeof(rec));
+    memcpy(r->buf + pos + sizeof(rec), data, len);
+    r->tail.store(tail + need, std::memory_order_release);
+
+    if (level >= DC_LOG_FATAL) {
+        RAFT_LOG_FLUSH();
+    } else if (tail + need - head > cap / 2) {
+        g_logger->Wake();
+    }
+}
+
+void Log::Open(const std::string& dir, uint32_t f_size, uint32_t f_num) {
+    file_size_ = f_size;
+    file_num_ = f_num ? f_num : 1;
+    dir_ = dir;
+    written_ = 0;
+
+    if (dir_.empty()) {
+        fd_ = -1;
+        return;
+    }
+
+    path_ = dir_ + "/" + name_;
+    if (MakeDirs(dir_) != 0) {
+        fd_ = -1;
+        return;
+    }
+
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        fprintf(stderr, "Log, open fail, path:%s, errno:%d, error:%s\n", path_.c_str(), errno, strerror(errno));
+        fd_ = -1;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) == 0) {
+        written_ = st.st_size;
+    }
+}
+
+void Log::Close() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void Log::Rotate() {
+    Close();
+
+    // file.(n-2) -> file.(n-1) ... file -> file.1, the oldest is overwritten
+    for (uint32_t i = file_num_ - 1; i > 0; i--) {
+        std::string from = i == 1 ? path_ : path_ + "." + std::to_string(i - 1);
+        std::string to = path_ + "." + std::to_string(i);
+        rename(from.c_str(), to.c_str());
+    }
+    if (file_num_ <= 1) {
+        unlink(path_.c_str());
+    }
+
+    Open(dir_, file_size_, file_num_);
+}
+
+void Log::WritePending() {
+    if (pending_.empty()) {
+        return;
+    }
+
+    if (fd_ == -1) {
+        WriteFull(2, pending_.data(), pending_.size());
+        pending_.clear();
+        return;
+    }
+
+    // cut at the last whole line that fits, rotate, go on with the rest
+    size_t begin = 0;
+    while (begin < pending_.size() && fd_ != -1) {
+        size_t len = pending_.size() - begin;
+        bool full = false;
+        if (file_size_ > 0 && written_ + len >= file_size_) {
+            size_t room = written_ < file_size_ ? file_size_ - written_ : 0;
+            size_t cut = room > 0 ? pending_.rfind('\n', begin + room - 1) : std::string::npos;
+            if (cut == std::string::npos || cut < begin) {
+                cut = pending_.find('\n', begin);      // a line longer than the room left
+            }
+            len = cut == std::string::npos ? len : cut + 1 - begin;
+            full = true;
+        }
+
+        if (WriteFull(fd_, pending_.data() + begin, len) != 0) {
+            fprintf(stderr, "Log, write fail, path:%s, errno:%d, error:%s\n", path_.c_str(), errno, strerror(errno));
+        }
+        written_ += len;
+        begin += len;
+
+        if (full) {
+            Rotate();
+        }
+    }
+
+    if (begin < pending_.size()) {
+        WriteFull(2, pending_.data() + begin, pending_.size() - begin);     // reopen failed
+    }
+    pending_.clear();
+}
+
+}   // namespace dc
@@ -0,0 +1,198 @@
+#include "metrics.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+
+namespace dc {
+
+Histogram::Histogram()
+    : count_(0)
+    , sum_(0)
+    , max_(0) {
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t Histogram::Bucket(uint64_t v) {
+    if (v < HISTOGRAM_SUB) {
+        return static_cast<uint32_t>(v);
+    }
+    // e: highest bit, the next HISTOGRAM_SUB_BITS bits pick the sub bucket
+    uint32_t e = 63 - __builtin_clzll(v);
+    return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB
+           + static_cast<uint32_t>((v >> (e - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB);
+}
+
+uint64_t Histogram::BucketMax(uint32_t bucket) {
+    if (bucket < HISTOGRAM_SUB) {
+        return bucket;
+    }
+    uint32_t e = bucket / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+    uint64_t m = bucket % HISTOGRAM_SUB + HISTOGRAM_SUB;
+    // the last bucket wraps to UINT64_MAX
+    return ((m + 1) << (e - HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void Histogram::Record(uint64_t v) {
+    buckets_[Bucket(v)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(v, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (v > max && !max_.compare_exchange_weak(max, v, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::Percentile(double q) const {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += buckets_[i].load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(q * total + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    } else if (rank > total) {
+        rank = total;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(BucketMax(i), max());
+        }
+    }
+    return max();
+}
+
+MetricsRegistry::MetricsRegistry() {
+}
+
+MetricsRegistry::~MetricsRegistry() {
+    for (size_t i = 0; i < entries_.size(); i++) {
+        delete entries_[i]->counter;
+        delete entries_[i]->histogram;
+        delete entries_[i];
+    }
+}
+
+MetricsRegistry::Entry* MetricsRegistry::Find(const std::string& name, const std::string& labels, bool counter) {
+    for (size_t i = 0; i < entries_.size(); i++) {
+        if (entries_[i]->name != name) {
+            continue;
+        }
+        // a family has one type, whatever its labels
+        if ((entries_[i]->counter != NULL) != counter) {
+            return NULL;
+        }
+        if (entries_[i]->labels == labels) {
+            return entries_[i];
+        }
+    }
+
+    Entry* e = new Entry;
+    e->name = name;
+    e->labels = labels;
+    e->counter = NULL;
+    e->histogram = NULL;
+    entries_.push_back(e);
+    return e;
+}
+
+Counter* MetricsRegistry::GetCounter(const std::string& name, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = Find(name, labels, true);
+    if (!e) {
+        LOG_ERROR(RAFT_LOG(), "MetricsRegistry, %s is a histogram, %s{%s} not rendered\n", name.c_str(), name.c_str(), labels.c_str());
+        return &dummy_counter_;
+    }
+    if (!e->counter) {
+        e->counter = new Counter;
+    }
+    return e->counter;
+}
+
+Histogram* MetricsRegistry::GetHistogram(const std::string& name, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = Find(name, labels, false);
+    if (!e) {
+        LOG_ERROR(RAFT_LOG(), "MetricsRegistry, %s is a counter, %s{%s} not rendered\n", name.c_str(), name.c_str(), labels.c_str());
+        return &dummy_histogram_;
+    }
+    if (!e->histogram) {
+        e->histogram = new Histogram;
+    }
+    return e->histogram;
+}
+
+static bool EntryLess(const std::pair<std::string, size_t>& a, const std::pair<std::string, size_t>& b) {
+    return a < b;
+}
+
+void MetricsRegistry::Render(std::string* out) {
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+    std::vector<Entry*> entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = entries_;
+    }
+
+    // a family must be contiguous, sort by name, keep the creation order inside
+    std::vector<std::pair<std::string, size_t> > order;
+    for (size_t i = 0; i < entries.size(); i++) {
+        order.push_back(std::make_pair(entries[i]->name, i));
+    }
+    std::sort(order.begin(), order.end(), EntryLess);
+
+    char buf[512];
+    std::string last;
+    for (size_t k = 0; k < order.size(); k++) {
+        const Entry* e = entries[order[k].second];
+        const char* name = e->name.c_str();
+        const char* labels = e->labels.c_str();
+        const char* sep = e->labels.empty() ? "" : ",";
+
+        if (e->name != last) {
+            snprintf(buf, sizeof(buf), "# TYPE %s %s\n", name, e->counter ? "counter" : "summary");
+            out->append(buf);
+            last = e->name;
+        }
+
+        if (e->counter) {
+            snprintf(buf, sizeof(buf), e->labels.empty() ? "%s%s %" PRIu64 "\n" : "%s{%s} %" PRIu64 "\n",
+                     name, labels, e->counter->value());
+            out->append(buf);
+            continue;
+        }
+
+        const Histogram* h = e->histogram;
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+            snprintf(buf, sizeof(buf), "%s{%s%squantile=\"%g\"} %" PRIu64 "\n",
+                     name, labels, sep, quantiles[i], h->Percentile(quantiles[i]));
+            out->append(buf);
+        }
+        const char* fmt = e->labels.empty() ? "%s_%s%s %" PRIu64 "\n" : "%s_%s{%s} %" PRIu64 "\n";
+        snprintf(buf, sizeof(buf), fmt, name, "sum", labels, h->sum());
+        out->append(buf);
+        snprintf(buf, sizeof(buf), fmt, name, "count", labels, h->count());
+        out->append(buf);
+        snprintf(buf, sizeof(buf), fmt, name, "max", labels, h->max());
+        out->append(buf);
+    }
+}
+
+MetricsRegistry* RAFT_METRICS() {
+    // never destroyed, metrics may be touched by threads outliving main()
+    static MetricsRegistry* registry = new MetricsRegistry;
+    return registry;
+}
+
+}   // namespace dc
@@ -0,0 +1,46 @@
+#include "codec.h"
+
+#include <string.h>
+
+namespace dc {
+
+void EncodeFrameHeader(uint16_t type, uint64_t term, uint32_t length, std::string* out, uint64_t group) {
+    char buf[sizeof(FrameHeader)];
+    EncodeFrameHeader(type, term, length, buf, group);
+    out->append(buf, sizeof(buf));
+}
+
+void EncodeFrameHeader(uint16_t type, uint64_t term, uint32_t length, char* out, uint64_t group) {
+    FrameHeader header;
+    header.magic = FRAME_MAGIC;
+    header.type = type;
+    header.flags = 0;
+    header.length = length;
+    header.reserved = 0;
+    header.term = term;
+    header.group = group;
+
+    memcpy(out, &header, sizeof(header));
+}
+
+DECODE_RESULT DecodeFrame(const RingBuffer& buf, MessageView* msg) {
+    size_t readable = buf.Readable();
+    if (readable < sizeof(FrameHeader)) {
+        return DECODE_AGAIN;
+    }
+
+    memcpy(&msg->header, buf.ReadPtr(), sizeof(FrameHeader));
+    if (msg->header.magic != FRAME_MAGIC || msg->header.length > MAX_FRAME_LENGTH) {
+        return DECODE_ERROR;
+    }
+
+    if (readable < sizeof(FrameHeader) + msg->header.length) {
+        return DECODE_AGAIN;
+    }
+
+    msg->body = buf.ReadPtr() + sizeof(FrameHeader);
+    msg->length = msg->header.length;
+    return DECODE_OK;
+}
+
+}   // namespace dc
@@ -0,0 +1,327 @@
+#include "compress.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <string.h>
+
+namespace dc {
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_LOG 12
+#define LZ4_MFLIMIT 12              // no match starts in the last 12 bytes
+#define LZ4_LAST_LITERALS 5         // the block ends with 5 literals at least
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_SKIP_SHIFT 6            // no match for a while: step over more bytes
+
+static inline uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t Read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t Hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// bytes equal at p and ref, p stops before limit
+static inline size_t MatchLength(const uint8_t* p, const uint8_t* ref, const uint8_t* limit) {
+    const uint8_t* start = p;
+    while (p + sizeof(uint64_t) <= limit) {
+        uint64_t diff = Read64(p) ^ Read64(ref);
+        if (diff) {
+            return p - start + (__builtin_ctzll(diff) >> 3);     // little endian
+        }
+        p += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return p - start;
+}
+
+// the part of a literal / match length over 15
+static inline uint8_t* PutLength(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+static inline int GetLength(const uint8_t** ip, const uint8_t* iend, size_t* len) {
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+static inline uint8_t* PutLiterals(uint8_t* op, uint8_t* token, const uint8_t* anchor, size_t lit) {
+    if (lit >= 15) {
+        *token = 15 << 4;
+        op = PutLength(op, lit - 15);
+    } else {
+        *token = static_cast<uint8_t>(lit << 4);
+    }
+    memcpy(op, anchor, lit);
+    return op + lit;
+}
+
+size_t Lz4Compressor::Compress(const char* src, size_t len, char* dst) const {
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    const uint8_t* end = base + len;
+    uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+
+    if (len > LZ4_MFLIMIT) {
+        // offsets from base, 0 is a valid first guess, every match is verified
+        uint32_t table[1 << LZ4_HASH_LOG];
+        memset(table, 0, sizeof(table));
+
+        const uint8_t* mflimit = end - LZ4_MFLIMIT;
+        const uint8_t* matchlimit = end - LZ4_LAST_LITERALS;
+        uint32_t misses = 1 << LZ4_SKIP_SHIFT;
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = Read32(ip);
+            uint32_t h = Hash(seq);
+            const uint8_t* ref = base + table[h];
+            table[h] = static_cast<uint32_t>(ip - base);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || Read32(ref) != seq) {
+                ip += misses++ >> LZ4_SKIP_SHIFT;
+                continue;
+            }
+            misses = 1 << LZ4_SKIP_SHIFT;
+
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t ml = LZ4_MIN_MATCH + MatchLength(ip + LZ4_MIN_MATCH, ref + LZ4_MIN_MATCH, matchlimit);
+
+            uint8_t* token = op++;
+            op = PutLiterals(op, token, anchor, ip - anchor);
+
+            uint32_t offset = static_cast<uint32_t>(ip - ref);
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+
+            size_t extra = ml - LZ4_MIN_MATCH;
+            if (extra >= 15) {
+                *token |= 15;
+                op = PutLength(op, extra - 15);
+            } else {
+                *token |= static_cast<uint8_t>(extra);
+            }
+
+            ip += ml;
+            anchor = ip;
+            if (ip < mflimit) {
+                table[Hash(Read32(ip - 2))] = static_cast<uint32_t>(ip - 2 - base);
+            }
+        }
+    }
+
+    uint8_t* token = op++;
+    op = PutLiterals(op, token, anchor, end - anchor);
+
+    return op - reinterpret_cast<uint8_t*>(dst);
+}
+
+int Lz4Compressor::Decompress(const char* src, size_t len, char* dst, size_t raw_len) const {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* iend = ip + len;
+    uint8_t* base = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* op = base;
+    uint8_t* oend = base + raw_len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && GetLength(&ip, iend, &lit) != 0) {
+            return -1;
+        }
+        if (lit > static_cast<size_t>(iend - ip) || lit > static_cast<size_t>(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == iend) {
+            break;      // the last sequence has literals only
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - base)) {
+            return -1;
+        }
+
+        size_t ml = token & 15;
+        if (ml == 15 && GetLength(&ip, iend, &ml) != 0) {
+            return -1;
+        }
+        ml += LZ4_MIN_MATCH;
+        if (ml > static_cast<size_t>(oend - op)) {
+            return -1;
+        }
+
+        const uint8_t* ref = op - offset;
+        if (offset >= ml) {
+            memcpy(op, ref, ml);
+            op += ml;
+        } else {
+            // overlapping, a run
+            while (ml--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == oend ? 0 : -1;
+}
+
+struct CompressorTable {
+    Compressor* c[COMPRESS_TYPE_MAX];
+
+    CompressorTable() {
+        memset(c, 0, sizeof(c));
+        c[COMPRESS_LZ4] = new Lz4Compressor;
+    }
+};
+
+static CompressorTable* Table() {
+    // never destroyed, like RAFT_METRICS()
+    static CompressorTable* table = new CompressorTable;
+    return table;
+}
+
+void RegisterCompressor(Compressor* c) {
+    int type = c->type();
+    if (type <= COMPRESS_NONE || type >= COMPRESS_TYPE_MAX) {
+        LOG_ERROR(RAFT_LOG(), "RegisterCompressor, bad type:%d, name:%s\n", type, c->name());
+        delete c;
+        return;
+    }
+
+    CompressorTable* table = Table();
+    delete table->c[type];
+    table->c[type] = c;
+}
+
+const Compressor* GetCompressor(int type) {
+    if (type <= COMPRESS_NONE || type >= COMPRESS_TYPE_MAX) {
+        return NULL;
+    }
+    return Table()->c[type];
+}
+
+int CompressorType(const std::string& name) {
+    if (name.empty() || name == "none") {
+        return COMPRESS_NONE;
+    }
+
+    CompressorTable* table = Table();
+    for (int i = COMPRESS_NONE + 1; i < COMPRESS_TYPE_MAX; i++) {
+        if (table->c[i] && name == table->c[i]->name()) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+uint32_t SupportedCompressors() {
+    uint32_t mask = 1 << COMPRESS_NONE;
+
+    CompressorTable* table = Table();
+    for (int i = COMPRESS_NONE + 1; i < COMPRESS_TYPE_MAX; i++) {
+        if (table->c[i]) {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+int EncodeCompressedFrame(const Compressor* c, uint16_t type, uint64_t term, const char* raw, uint32_t len,
+                          IoChain* out, Slab* slab, uint64_t group) {
+    static Counter* raw_bytes = RAFT_METRICS()->GetCounter("dc_compress_raw_bytes");
+    static Counter* out_bytes = RAFT_METRICS()->GetCounter("dc_compress_out_bytes");
+    static Counter* skipped = RAFT_METRICS()->GetCounter("dc_compress_skipped");
+
+    Buffer* buf = Buffer::Create(sizeof(FrameHeader) + sizeof(uint32_t) + c->Bound(len), slab);
+    char* body = buf->data() + sizeof(FrameHeader);
+    memcpy(body, &len, sizeof(len));
+
+    size_t n = c->Compress(raw, len, body + sizeof(uint32_t));
+    if (n == 0 || sizeof(uint32_t) + n > len - len / COMPRESS_MIN_GAIN) {
+        buf->Release();
+        skipped->Add(1);
+        return -1;
+    }
+
+    uint32_t length = sizeof(uint32_t) + n;
+    EncodeFrameHeader(type, term, length, buf->data(), group);
+    uint16_t flags = c->type();
+    memcpy(buf->data() + offsetof(FrameHeader, flags), &flags, sizeof(flags));
+
+    out->Append(buf, 0, sizeof(FrameHeader) + length);
+    buf->Release();
+
+    raw_bytes->Add(len);
+    out_bytes->Add(length);
+    return 0;
+}
+
+int DecompressBody(const MessageView& msg, std::string* plain, const char** body, uint32_t* length) {
+    int type = msg.header.flags & FRAME_FLAG_COMPRESS_MASK;
+    if (type == COMPRESS_NONE) {
+        *body = msg.body;
+        *length = msg.length;
+        return 0;
+    }
+
+    const Compressor* c = GetCompressor(type);
+    uint32_t raw_len = 0;
+    if (!c || msg.length < sizeof(raw_len)) {
+        LOG_ERROR(RAFT_LOG(), "DecompressBody, bad frame, type:%d, length:%u\n", type, msg.length);
+        return -1;
+    }
+    memcpy(&raw_len, msg.body, sizeof(raw_len));
+    if (raw_len > MAX_FRAME_LENGTH) {
+        LOG_ERROR(RAFT_LOG(), "DecompressBody, too long, type:%d, raw length:%u\n", type, raw_len);
+        return -1;
+    }
+
+    plain->resize(raw_len);
+    if (c->Decompress(msg.body + sizeof(raw_len), msg.length - sizeof(raw_len), &(*plain)[0], raw_len) != 0) {
+        LOG_ERROR(RAFT_LOG(), "DecompressBody, broken body, type:%d, length:%u, raw length:%u\n", type, msg.length, raw_len);
+        return -1;
+    }
+
+    *body = plain->data();
+    *length = raw_len;
+    return 0;
+}
+
+}   // namespace dc
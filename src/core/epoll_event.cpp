@@ -1,4 +1,5 @@
 #include "epoll_event.h"
+#include "log.h"
 
 #include <unistd.h>
 #include <errno.h>
@@ -11,7 +12,9 @@ namespace dc {
 EpollEvent::EpollEvent(bool isEPOLLET)
     : epoll_fd_(-1)
     , events_(NULL)
-    , isEPOLLET_(isEPOLLET) {
+    , isEPOLLET_(isEPOLLET)
+    , wakeups_(RAFT_METRICS()->GetCounter("dc_epoll_wakeups"))
+    , wakeup_events_(RAFT_METRICS()->GetHistogram("dc_epoll_events_per_wakeup")) {
 }
 
 EpollEvent::~EpollEvent() {
@@ -28,7 +31,7 @@ EpollEvent::~EpollEvent() {
 int EpollEvent::Initialize() {
     epoll_fd_ = epoll_create(EVENT_SIZE);
     if (epoll_fd_ < 0) {
-        fprintf(stderr, "epoll_create error: %d, %s\n", errno, strerror(errno));
+        LOG_ERROR(RAFT_LOG(), "epoll_create error: %d, %s\n", errno, strerror(errno));
         return errno;
     }
 
@@ -38,51 +41,58 @@ int EpollEvent::Initialize() {
 }
 
 int EpollEvent::AddEvent(int fd, EventHandler* efd, uint32_t events) {
+    EH* eh = fd_eh_.Slot(fd);
+    if (!eh) {
+        return -1;
+    }
 
     epoll_event ee;
-    ee.events = isEPOLLET_ ? events : events | EPOLLET;
-    ee.data.fd = fd;
+    ee.events = isEPOLLET_ ? events | EPOLLET : events;
+    ee.data.ptr = eh;
 
-    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ee); 
+    int op = eh->efd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int ret = epoll_ctl(epoll_fd_, op, fd, &ee); 
 
     if (ret == 0) {
-        EH eh = {ee, efd};
-        fd_eh_[fd] = eh;   
+        eh->fd = fd;
+        eh->ee = ee;
+        eh->efd = efd;
     }
 
     return ret;
 }
 
 int EpollEvent::ModEvent(int fd, uint32_t events) {
-    std::map<int, EH>::iterator it = fd_eh_.find(fd);
-    if (it == fd_eh_.end()) {
-        fprintf(stderr, "fd not in epoll, can not mod, fd: %d\n", fd);
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
+        LOG_ERROR(RAFT_LOG(), "fd not in epoll, can not mod, fd: %d\n", fd);
         return -1;
     }
 
-    it->second.ee.events = events;
+    eh->ee.events = isEPOLLET_ ? events | EPOLLET : events;
 
-    return  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &it->second.ee); 
+    return  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &eh->ee); 
 }
 
 int EpollEvent::RemodEvent(int fd) {
-    std::map<int, EH>::iterator it = fd_eh_.find(fd);
-    if (it == fd_eh_.end()) {
-        fprintf(stderr, "fd not in epoll, can not mod, fd: %d\n", fd);
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
+        LOG_ERROR(RAFT_LOG(), "fd not in epoll, can not mod, fd: %d\n", fd);
         return -1;
     }
 
-    return  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &it->second.ee); 
+    return  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &eh->ee); 
 }
 
 int EpollEvent::DelEvent(int fd) {
-    std::map<int, EH>::iterator it = fd_eh_.find(fd);
-    if (it == fd_eh_.end()) {
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
         return 0;
     } else {
-        int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &it->second.ee); 
+        int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &eh->ee); 
         if (ret == 0) {
-            fd_eh_.erase(fd);
+            // events of fd later in this Wait() batch see efd NULL and are dropped
+            eh->efd = NULL;
         }
         return ret;
     }
@@ -91,16 +101,21 @@ int EpollEvent::DelEvent(int fd) {
 int EpollEvent::Wait(int timeout) {
     int nfds = epoll_wait(epoll_fd_, events_, EVENT_SIZE, timeout); 
 
+    if (nfds >= 0) {
+        wakeups_->Add();
+        wakeup_events_->Record(nfds);
+    }
+
     for (int i = 0; i < nfds; i++) {
-        std::map<int, EH>::iterator it = fd_eh_.find(events_[i].data.fd);
+        EH* eh = static_cast<EH*>(events_[i].data.ptr);
         
         if (events_[i].events & (EPOLLERR|EPOLLHUP)) {
-            fprintf(stderr, "EPOLLERR | EPOLLHUP fd: %d\n", events_[i].data.fd);
+            LOG_ERROR(RAFT_LOG(), "EPOLLERR | EPOLLHUP fd: %d\n", eh->fd);
 
-            if (it != fd_eh_.end() && it->second.efd) {
+            if (eh->efd) {
                 //int err = events_[i].events & EPOLLERR ? EPOLLERR : (events_[i].events & EPOLLHUP)
                 std::string error = strerror(errno);
-                it->second.efd->OnError(it->second.ee.data.fd, events_[i].events, errno, error);
+                eh->efd->OnError(eh->fd, events_[i].events, errno, error);
             }
         }
 
@@ -111,19 +126,19 @@ int EpollEvent::Wait(int timeout) {
         }
 
         if (events_[i].events & EPOLLIN) {
-            if (it != fd_eh_.end() && it->second.efd) {
-                it->second.efd->OnRead(it->second.ee.data.fd, events_[i].events);
+            if (eh->efd) {
+                eh->efd->OnRead(eh->fd, events_[i].events);
             }
         }
 
         if (events_[i].events & EPOLLOUT) {
-            if (it != fd_eh_.end() && it->second.efd) {
-                it->second.efd->OnWrite(it->second.ee.data.fd, events_[i].events);
+            if (eh->efd) {
+                eh->efd->OnWrite(eh->fd, events_[i].events);
             }
         }
     }
 
-    return 0;
+    return nfds;
 }
 
 }  // namespace dc
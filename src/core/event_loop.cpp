@@ -0,0 +1,28 @@
+#include "event_loop.h"
+#include "log.h"
+#include "epoll_event.h"
+#include "uring_event.h"
+
+
+namespace dc {
+
+EventLoop* CreateEventLoop(EVENT_LOOP_TYPE type, bool isEPOLLET) {
+    if (type == LOOP_URING) {
+        UringEvent* uring = new UringEvent();
+        if (uring->Initialize() == 0) {
+            return uring;
+        }
+        delete uring;
+        LOG_WARNING(RAFT_LOG(), "io_uring not usable, fall back to epoll\n");
+    }
+
+    EpollEvent* epoll = new EpollEvent(isEPOLLET);
+    if (epoll->Initialize() != 0) {
+        delete epoll;
+        return NULL;
+    }
+
+    return epoll;
+}
+
+}  // namespace dc
@@ -0,0 +1,143 @@
+#include "io_chain.h"
+
+#include <unistd.h>
+#include <new>
+#include <algorithm>
+
+namespace dc {
+
+Buffer* Buffer::Create(size_t size, Slab* slab) {
+    if (slab) {
+        void* p = slab->Alloc(sizeof(Buffer) + size);
+        if (p) {
+            Buffer* buf = new (p) Buffer;
+            buf->data_ = reinterpret_cast<char*>(buf + 1);
+            buf->size_ = size;
+            buf->pooled_ = true;
+            return buf;
+        }
+    }
+
+    Buffer* buf = new Buffer;
+    buf->str_.resize(size);
+    buf->data_ = &buf->str_[0];
+    buf->size_ = size;
+    return buf;
+}
+
+Buffer* Buffer::Adopt(std::string& s) {
+    Buffer* buf = new Buffer;
+    buf->str_.swap(s);
+    buf->data_ = &buf->str_[0];
+    buf->size_ = buf->str_.size();
+    return buf;
+}
+
+Buffer* Buffer::File(int fd) {
+    Buffer* buf = new Buffer;
+    buf->fd_ = fd;
+    return buf;
+}
+
+Buffer::~Buffer() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+}
+
+void Buffer::Destroy() {
+    if (pooled_) {
+        this->~Buffer();
+        Slab::Free(this);
+    } else {
+        delete this;
+    }
+}
+
+IoChain::IoChain()
+    : bytes_(0) {
+}
+
+IoChain::~IoChain() {
+    Clear();
+}
+
+void IoChain::Append(Buffer* buf, size_t offset, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    buf->AddRef();
+    BufferSlice slice = {buf, offset, len};
+    slices_.push_back(slice);
+    bytes_ += len;
+}
+
+void IoChain::Append(const char* data, size_t len, Slab* slab) {
+    if (len == 0) {
+        return;
+    }
+
+    Buffer* buf = Buffer::Create(len, slab);
+    std::copy(data, data + len, buf->data());
+    BufferSlice slice = {buf, 0, len};
+    slices_.push_back(slice);
+    bytes_ += len;
+}
+
+void IoChain::Splice(IoChain& other) {
+    slices_.insert(slices_.end(), other.slices_.begin(), other.slices_.end());
+    bytes_ += other.bytes_;
+
+    other.slices_.clear();
+    other.bytes_ = 0;
+}
+
+int IoChain::FillIovec(struct iovec* iov, int max) const {
+    int n = 0;
+    std::deque<BufferSlice>::const_iterator it;
+    for (it = slices_.begin(); it != slices_.end() && n < max && it->buf->fd() == -1; it++, n++) {
+        iov[n].iov_base = it->buf->data() + it->offset;
+        iov[n].iov_len = it->len;
+    }
+    return n;
+}
+
+bool IoChain::FrontFile(int* fd, uint64_t* offset, size_t* len) const {
+    if (slices_.empty() || slices_.front().buf->fd() == -1) {
+        return false;
+    }
+
+    const BufferSlice& slice = slices_.front();
+    *fd = slice.buf->fd();
+    *offset = slice.offset;
+    *len = slice.len;
+    return true;
+}
+
+void IoChain::Consume(size_t n) {
+    bytes_ -= n;
+    while (n > 0 && !slices_.empty()) {
+        BufferSlice& slice = slices_.front();
+        if (n < slice.len) {
+            slice.offset += n;
+            slice.len -= n;
+            return;
+        }
+
+        n -= slice.len;
+        slice.buf->Release();
+        slices_.pop_front();
+    }
+}
+
+void IoChain::Clear() {
+    std::deque<BufferSlice>::iterator it;
+    for (it = slices_.begin(); it != slices_.end(); it++) {
+        it->buf->Release();
+    }
+    slices_.clear();
+    bytes_ = 0;
+}
+
+}   // namespace dc
@@ -0,0 +1,176 @@
+#include "metrics_server.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+namespace dc {
+
+class MetricsServer::Conn : public SocketFdHandler {
+public:
+    Conn(MetricsServer* server, int fd, uint32_t ip, int port, SocketEvent* se)
+        : SocketFdHandler(ip, port, se, fd)
+        , accepted_ms(se->now_ms())
+        , answered(false)
+        , closed(false)
+        , server_(server) {
+    }
+
+    virtual int OnRecv(RingBuffer& recvBuf);
+
+    virtual void OnError(int fd, int err, std::string& error) {
+        (void)fd;
+        (void)err;
+        (void)error;
+        closed = true;      // SocketEvent closes the fd
+    }
+
+    int fd() const { return fd_; }
+
+    uint64_t accepted_ms;
+    bool answered;
+    bool closed;
+
+private:
+    MetricsServer* server_;
+};
+
+class MetricsServer::ReapTimer : public Timer {
+public:
+    ReapTimer(MetricsServer* server)
+        : server_(server) {
+    }
+
+    virtual void OnTimer() {
+        server_->Reap();
+    }
+
+private:
+    MetricsServer* server_;
+};
+
+int MetricsServer::Conn::OnRecv(RingBuffer& recvBuf) {
+    if (answered) {
+        recvBuf.Consume(recvBuf.Readable());
+        return 0;
+    }
+
+    const char* req = recvBuf.ReadPtr();
+    size_t len = recvBuf.Readable();
+    const char* end = static_cast<const char*>(memmem(req, len, "\r\n\r\n", 4));
+    if (!end) {
+        if (len > METRICS_MAX_REQUEST) {
+            LOG_WARNING(RAFT_LOG(), "MetricsServer, request too long, fd:%d, len:%zu\n", fd_, len);
+            closed = true;
+            return -1;
+        }
+        return 0;
+    }
+
+    static const char path[] = "GET /metrics";
+    size_t plen = sizeof(path) - 1;
+    bool found = len > plen && memcmp(req, path, plen) == 0
+                 && (req[plen] == ' ' || req[plen] == '?');
+
+    std::string body;
+    if (found) {
+        server_->registry_->Render(&body);
+    } else {
+        body = "not found, try GET /metrics\n";
+    }
+
+    char head[256];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %s\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\n"
+             "Connection: close\r\n\r\n",
+             found ? "200 OK" : "404 Not Found", body.size());
+
+    std::string resp(head);
+    resp.append(body);
+    Send(resp);
+
+    answered = true;
+    recvBuf.Consume(len);
+    return 0;
+}
+
+MetricsServer::MetricsServer(SocketEvent* se, MetricsRegistry* registry)
+    : se_(se)
+    , registry_(registry ? registry : RAFT_METRICS())
+    , listen_fd_(-1)
+    , timer_(new ReapTimer(this)) {
+}
+
+MetricsServer::~MetricsServer() {
+    for (size_t i = 0; i < conns_.size(); i++) {
+        Close(conns_[i]);
+    }
+    conns_.clear();
+
+    if (listen_fd_ != -1) {
+        se_->DelSocket(listen_fd_);
+        listen_fd_ = -1;
+    }
+
+    delete timer_;
+}
+
+int MetricsServer::Listen(std::string& ip_str, int port) {
+    listen_fd_ = se_->AddListenSocket(ip_str, port, SOCKET_READ|SOCKET_ERROR, this);
+    if (listen_fd_ < 0) {
+        LOG_ERROR(RAFT_LOG(), "MetricsServer, listen fail, ip:%s, port:%d\n", ip_str.c_str(), port);
+        return -1;
+    }
+
+    LOG_INFO(RAFT_LOG(), "MetricsServer, listen on %s:%d\n", ip_str.c_str(), port);
+    return 0;
+}
+
+void MetricsServer::OnAccept(int fd, uint32_t ip, int port) {
+    Conn* conn = new Conn(this, fd, ip, port, se_);
+    if (se_->AddSocket(fd, conn) != 0) {
+        LOG_ERROR(RAFT_LOG(), "MetricsServer, AddSocket fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+        se_->DelSocket(fd);
+        delete conn;
+        return;
+    }
+    conns_.push_back(conn);
+
+    if (!timer_->pending()) {
+        se_->timer_wheel()->Add(timer_, se_->now_ms() + METRICS_REAP_MS);
+    }
+}
+
+void MetricsServer::Close(Conn* conn) {
+    if (!conn->closed) {
+        se_->DelSocket(conn->fd());
+    }
+    delete conn;
+}
+
+void MetricsServer::Reap() {
+    uint64_t now = se_->now_ms();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < conns_.size(); i++) {
+        Conn* conn = conns_[i];
+        bool done = conn->closed
+                    || (conn->answered && conn->sendChain().empty())
+                    || (!conn->answered && now >= conn->accepted_ms + METRICS_IDLE_MS);
+        if (done) {
+            Close(conn);
+        } else {
+            conns_[kept++] = conn;
+        }
+    }
+    conns_.resize(kept);
+
+    if (!conns_.empty()) {
+        se_->timer_wheel()->Add(timer_, now + METRICS_REAP_MS);
+    }
+}
+
+}   // namespace dc
@@ -0,0 +1,255 @@
+#include "reactor.h"
+#include "log.h"
+
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+namespace dc {
+
+static uint64_t NowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+class AddSocketTask : public Task {
+public:
+    AddSocketTask(SocketEvent* se, int fd, SocketFdHandler* sfd)
+        : se_(se), fd_(fd), sfd_(sfd) {
+    }
+
+    virtual void Run() {
+        sfd_->SetSocketEvent(se_);
+        if (se_->AddSocket(fd_, sfd_) != 0) {
+            LOG_ERROR(RAFT_LOG(), "Reactor, AddSocket fail, fd:%d, errno:%d, error:%s\n", fd_, errno, strerror(errno));
+        }
+    }
+
+private:
+    SocketEvent* se_;
+    int fd_;
+    SocketFdHandler* sfd_;
+};
+
+class AddConnectionTask : public Task {
+public:
+    AddConnectionTask(SocketEvent* se, const std::string& ip_str, int port, SocketFdHandler* sfd)
+        : se_(se), ip_str_(ip_str), port_(port), sfd_(sfd) {
+    }
+
+    virtual void Run() {
+        sfd_->SetSocketEvent(se_);
+        se_->AddConnection(ip_str_, port_, sfd_);
+    }
+
+private:
+    SocketEvent* se_;
+    std::string ip_str_;
+    int port_;
+    SocketFdHandler* sfd_;
+};
+
+Reactor::Reactor(SocketEvent* se, int cpu)
+    : se_(se)
+    , cpu_(cpu)
+    , wake_fd_(-1)
+    , wakeup_(false)
+    , stop_(false)
+    , thread_id_(std::thread::id()) {
+}
+
+Reactor::~Reactor() {
+    Stop();
+    Join();
+
+    if (wake_fd_ != -1) {
+        se_->event_loop()->DelEvent(wake_fd_);
+        close(wake_fd_);
+    }
+}
+
+int Reactor::Initialize() {
+    if (se_->Initialize() != 0) {
+        return -1;
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        LOG_ERROR(RAFT_LOG(), "Reactor, eventfd error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (se_->event_loop()->AddEvent(wake_fd_, this, EPOLLIN) != 0) {
+        LOG_ERROR(RAFT_LOG(), "Reactor, AddEvent eventfd error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int Reactor::Start() {
+    stop_ = false;
+    thread_ = std::thread(&Reactor::Run, this);
+    return 0;
+}
+
+void Reactor::Stop() {
+    stop_ = true;
+    if (wake_fd_ != -1) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {
+            LOG_ERROR(RAFT_LOG(), "Reactor, wake up error: %d, %s\n", errno, strerror(errno));
+        }
+    }
+}
+
+void Reactor::Join() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void Reactor::Run() {
+    // before anything runs on the loop, InLoop() is never wrong on it
+    thread_id_.store(std::this_thread::get_id(), std::memory_order_release);
+
+    if (cpu_ >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            LOG_ERROR(RAFT_LOG(), "Reactor, pin to cpu %d fail: %d, %s\n", cpu_, ret, strerror(ret));
+        }
+    }
+
+    se_->slab()->Bind();
+
+    while (!stop_) {
+        se_->Wait(NowMs(), REACTOR_WAIT_MS);
+    }
+
+    RunTasks();
+}
+
+void Reactor::Post(Task* task) {
+    tasks_.Push(task);
+
+    // only the first Post() after the loop woke up pays the write()
+    if (!wakeup_.exchange(true, std::memory_order_acq_rel)) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {
+            LOG_ERROR(RAFT_LOG(), "Reactor, wake up error: %d, %s\n", errno, strerror(errno));
+        }
+    }
+}
+
+void Reactor::RunTasks() {
+    Task* task;
+    while ((task = tasks_.Pop()) != NULL) {
+        task->Run();
+        delete task;
+    }
+}
+
+void Reactor::OnRead(int fd, uint32_t events) {
+    (void)events;
+
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) > 0) {
+    }
+
+    // clear before draining, a Post() racing with the drain wakes us again
+    wakeup_.store(false, std::memory_order_release);
+    RunTasks();
+}
+
+void Reactor::OnWrite(int fd, uint32_t events) {
+    (void)fd;
+    (void)events;
+}
+
+void Reactor::OnError(int fd, uint32_t events, int err, std::string& error) {
+    (void)events;
+    LOG_ERROR(RAFT_LOG(), "Reactor, OnError fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+}
+
+void Reactor::AddSocket(int fd, SocketFdHandler* sfd) {
+    Post(new AddSocketTask(se_, fd, sfd));
+}
+
+void Reactor::AddConnection(const std::string& ip_str, int port, SocketFdHandler* sfd) {
+    Post(new AddConnectionTask(se_, ip_str, port, sfd));
+}
+
+ReactorPool::ReactorPool()
+    : next_(0) {
+}
+
+ReactorPool::~ReactorPool() {
+    Stop();
+    for (size_t i = 0; i < reactors_.size(); i++) {
+        delete reactors_[i];
+    }
+    reactors_.clear();
+}
+
+int ReactorPool::AddReactor(SocketEvent* se, int cpu) {
+    Reactor* reactor = new Reactor(se, cpu);
+    if (reactor->Initialize() != 0) {
+        delete reactor;
+        return -1;
+    }
+
+    reactors_.push_back(reactor);
+    return 0;
+}
+
+int ReactorPool::Start() {
+    for (size_t i = 0; i < reactors_.size(); i++) {
+        if (reactors_[i]->Start() != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ReactorPool::Stop() {
+    for (size_t i = 0; i < reactors_.size(); i++) {
+        reactors_[i]->Stop();
+    }
+    for (size_t i = 0; i < reactors_.size(); i++) {
+        reactors_[i]->Join();
+    }
+}
+
+Reactor* ReactorPool::Next() {
+    if (reactors_.empty()) {
+        return NULL;
+    }
+    return reactors_[next_.fetch_add(1, std::memory_order_relaxed) % reactors_.size()];
+}
+
+Reactor* ReactorPool::AddSocket(int fd, SocketFdHandler* sfd) {
+    Reactor* reactor = Next();
+    if (reactor) {
+        reactor->AddSocket(fd, sfd);
+    }
+    return reactor;
+}
+
+Reactor* ReactorPool::AddConnection(const std::string& ip_str, int port, SocketFdHandler* sfd) {
+    Reactor* reactor = Next();
+    if (reactor) {
+        reactor->AddConnection(ip_str, port, sfd);
+    }
+    return reactor;
+}
+
+}   // namespace dc
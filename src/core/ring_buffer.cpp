@@ -0,0 +1,103 @@
+#include "ring_buffer.h"
+#include "log.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace dc {
+
+RingBuffer::RingBuffer(size_t init_size)
+    : init_size_(init_size)
+    , base_(NULL)
+    , capacity_(0)
+    , read_(0)
+    , write_(0) {
+}
+
+RingBuffer::~RingBuffer() {
+    if (base_) {
+        Unmap(base_, capacity_);
+        base_ = NULL;
+    }
+}
+
+char* RingBuffer::Map(size_t size) {
+    int fd = memfd_create("dc_ring_buffer", MFD_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR(RAFT_LOG(), "RingBuffer, memfd_create error: %d, %s\n", errno, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        LOG_ERROR(RAFT_LOG(), "RingBuffer, ftruncate error: %d, %s\n", errno, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    // reserve 2 * size of address space, then map the same pages twice into it
+    void* addr = mmap(NULL, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(RAFT_LOG(), "RingBuffer, mmap reserve error: %d, %s\n", errno, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    char* base = static_cast<char*>(addr);
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        LOG_ERROR(RAFT_LOG(), "RingBuffer, mmap mirror error: %d, %s\n", errno, strerror(errno));
+        munmap(base, size * 2);
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+    return base;
+}
+
+void RingBuffer::Unmap(char* base, size_t size) {
+    munmap(base, size * 2);
+}
+
+int RingBuffer::Reserve(size_t n) {
+    if (base_ && Writable() >= n) {
+        return 0;
+    }
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t capacity = capacity_ ? capacity_ : init_size_;
+    while (capacity - Readable() < n) {
+        capacity *= 2;
+    }
+    capacity = (capacity + page - 1) / page * page;
+
+    char* base = Map(capacity);
+    if (!base) {
+        return -1;
+    }
+
+    size_t readable = Readable();
+    if (base_) {
+        memcpy(base, ReadPtr(), readable);
+        Unmap(base_, capacity_);
+    }
+
+    base_ = base;
+    capacity_ = capacity;
+    read_ = 0;
+    write_ = readable;
+
+    return 0;
+}
+
+void RingBuffer::Consume(size_t n) {
+    read_ += n;
+    if (read_ >= capacity_) {
+        read_ -= capacity_;
+        write_ -= capacity_;
+    }
+}
+
+}   // namespace dc
@@ -0,0 +1,155 @@
+#include "slab.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+namespace dc {
+
+Slab::Slab(size_t chunk_size)
+    : chunk_size_(chunk_size < (1u << SLAB_MAX_SHIFT) ? (1u << SLAB_MAX_SHIFT) : chunk_size)
+    , owner_(std::this_thread::get_id())
+    , allocs_(0)
+    , hits_(0)
+    , misses_(0)
+    , large_(0)
+    , chunks_count_(0)
+    , frees_(0)
+    , remote_frees_(0) {
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        classes_[i].local = NULL;
+        classes_[i].remote = NULL;
+        classes_[i].carve = NULL;
+        classes_[i].carve_end = NULL;
+    }
+}
+
+Slab::~Slab() {
+    SlabStats s = stats();
+    if (s.in_use > 0) {
+        LOG_WARNING(RAFT_LOG(), "Slab, destroyed with blocks in use, in_use:%" PRIu64 "\n", s.in_use);
+    }
+
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        free(chunks_[i]);
+    }
+    chunks_.clear();
+}
+
+Slab::Block* Slab::Carve(uint32_t cls) {
+    Class& c = classes_[cls];
+    size_t size = static_cast<size_t>(1) << (cls + SLAB_MIN_SHIFT);
+
+    if (c.carve == NULL || c.carve + size > c.carve_end) {
+        char* chunk = static_cast<char*>(malloc(chunk_size_));
+        if (!chunk) {
+            return NULL;
+        }
+        chunks_.push_back(chunk);
+        Bump(chunks_count_);
+        c.carve = chunk;
+        c.carve_end = chunk + chunk_size_;
+    }
+
+    Block* b = reinterpret_cast<Block*>(c.carve);
+    c.carve += size;
+    return b;
+}
+
+void* Slab::Alloc(size_t size) {
+    size_t need = size + sizeof(Block);
+    uint32_t cls = 0;
+    while (cls < SLAB_CLASSES && (static_cast<size_t>(1) << (cls + SLAB_MIN_SHIFT)) < need) {
+        cls++;
+    }
+
+    Block* b = NULL;
+    if (cls == SLAB_CLASSES) {
+        b = static_cast<Block*>(malloc(need));
+        if (!b) {
+            return NULL;
+        }
+        Bump(large_);
+    } else {
+        Class& c = classes_[cls];
+        if (!c.local) {
+            // whatever other threads gave back since last time
+            c.local = c.remote.exchange(NULL, std::memory_order_acquire);
+        }
+
+        if (c.local) {
+            b = reinterpret_cast<Block*>(c.local);
+            c.local = c.local->next;
+            Bump(hits_);
+        } else {
+            b = Carve(cls);
+            if (!b) {
+                return NULL;
+            }
+            Bump(misses_);
+        }
+    }
+
+    Bump(allocs_);
+    b->slab = this;
+    b->cls = cls;
+    return b + 1;
+}
+
+void Slab::Free(void* p) {
+    if (!p) {
+        return;
+    }
+
+    Block* b = static_cast<Block*>(p) - 1;
+    b->slab->Release(b);
+}
+
+void Slab::Release(Block* b) {
+    bool owner = std::this_thread::get_id() == owner_;
+    if (owner) {
+        Bump(frees_);
+    } else {
+        remote_frees_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (b->cls == SLAB_CLASSES) {
+        free(b);
+        return;
+    }
+
+    Class& c = classes_[b->cls];
+    FreeNode* node = reinterpret_cast<FreeNode*>(b);
+    if (owner) {
+        node->next = c.local;
+        c.local = node;
+        return;
+    }
+
+    // push only, the owner takes the whole list at once: no ABA
+    FreeNode* head = c.remote.load(std::memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!c.remote.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+}
+
+SlabStats Slab::stats() const {
+    SlabStats s;
+    s.allocs = allocs_.load(std::memory_order_relaxed);
+    s.hits = hits_.load(std::memory_order_relaxed);
+    s.misses = misses_.load(std::memory_order_relaxed);
+    s.large = large_.load(std::memory_order_relaxed);
+    s.remote_frees = remote_frees_.load(std::memory_order_relaxed);
+    s.chunks = chunks_count_.load(std::memory_order_relaxed);
+    uint64_t freed = frees_.load(std::memory_order_relaxed) + s.remote_frees;
+    s.in_use = s.allocs > freed ? s.allocs - freed : 0;
+    return s;
+}
+
+double Slab::hit_rate() const {
+    uint64_t hits = hits_.load(std::memory_order_relaxed);
+    uint64_t total = hits + misses_.load(std::memory_order_relaxed);
+    return total ? static_cast<double>(hits) / total : 0;
+}
+
+}   // namespace dc
@@ -1,5 +1,10 @@
 #include "socket_event.h"
+#include "log.h"
+#include "uring_event.h"
 
+#include <linux/io_uring.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -8,180 +13,636 @@
 namespace dc {
 
 void SocketFdHandler::Send(std::string& sendBuf) {
-    sendBuf_.append(sendBuf, 0, sendBuf.size());
+    sendChain_.Append(sendBuf.data(), sendBuf.size(), se_ ? se_->slab() : NULL);
     if (se_) {
         se_->RemodSocketEvent(fd_);
     } 
 };
 
+void SocketFdHandler::Send(IoChain& chain) {
+    sendChain_.Splice(chain);
+    if (se_) {
+        se_->RemodSocketEvent(fd_);
+    }
+}
+
+void SocketFdHandler::SendNow() {
+    if (se_ && fd_ >= 0 && !sendChain_.empty()) {
+        se_->SendNow(fd_);
+    }
+}
+
 void SocketFdHandler::SetFd(int fd) {
     fd_ = fd;
 }
 
+int SocketFdHandler::OnRecv(RingBuffer& recvBuf) {
+    MessageView msg;
+    while (1) {
+        DECODE_RESULT ret = DecodeFrame(recvBuf, &msg);
+        if (ret == DECODE_AGAIN) {
+            return 0;
+        } else if (ret == DECODE_ERROR) {
+            LOG_ERROR(RAFT_LOG(), "SocketFdHandler, bad frame, fd:%d, magic:%x, length:%u\n", fd_, msg.header.magic, msg.header.length);
+            return -1;
+        }
+
+        OnMessage(msg);
+        recvBuf.Consume(sizeof(FrameHeader) + msg.length);
+    }
+}
+
+void SocketFdHandler::OnMessage(const MessageView& msg) {
+    LOG_WARNING(RAFT_LOG(), "SocketFdHandler, message not handled, fd:%d, type:%u\n", fd_, msg.header.type);
+}
+
+
+class SocketEvent::ConnectTimer : public Timer {
+public:
+    ConnectTimer(SocketEvent* se, int fd)
+        : se_(se), fd_(fd) {
+    }
+
+    virtual void OnTimer() {
+        se_->OnConnectTimeout(fd_);
+    }
+
+private:
+    SocketEvent* se_;
+    int fd_;
+};
+
+/*
+ * the io_uring ops of one fd. it outlives DelSocket() until the kernel
+ * has answered every op: a Sendmsg still reads the slices it was given,
+ * they are kept in chain_ after the handler is gone
+ */
+class SocketEvent::UringSocket {
+public:
+    enum OP {
+        OP_ACCEPT = 0,
+        OP_RECV,
+        OP_SEND
+    };
+
+    class Op : public Completion {
+    public:
+        Op(UringSocket* us, OP op) : us_(us), op_(op) {}
+
+        virtual void OnComplete(int res, uint32_t flags) {
+            us_->se_->OnUringComplete(us_, op_, res, flags);
+        }
+
+    private:
+        UringSocket* us_;
+        OP op_;
+    };
+
+    UringSocket(SocketEvent* se, int fd)
+        : se_(se)
+        , fd_(fd)
+        , closed_(false)
+        , accepting_(false)
+        , receiving_(false)
+        , sending_(false)
+        , accept_(this, OP_ACCEPT)
+        , recv_(this, OP_RECV)
+        , send_(this, OP_SEND) {
+        memset(&msg_, 0, sizeof(msg_));
+        msg_.msg_iov = iov_;
+        se_->uring_sockets_++;
+    }
+
+    ~UringSocket() {
+        se_->uring_sockets_--;
+    }
+
+    bool idle() const { return !accepting_ && !receiving_ && !sending_; }
+
+    SocketEvent* se_;
+    int fd_;
+    bool closed_;           // DelSocket()'ed, waiting for the kernel
+    bool accepting_;        // multishot Accept armed
+    bool receiving_;        // multishot Recv armed
+    bool sending_;          // a Sendmsg in flight
+    Op accept_;
+    Op recv_;
+    Op send_;
+
+    IoChain chain_;
+    struct iovec iov_[SEND_IOV_MAX];
+    msghdr msg_;
+};
 
-SocketEvent::SocketEvent(TCP_UDP type, bool isEPOLLET)
+// err of a failed send, -4: a file slice could not be finished
+static std::string SendError(int err) {
+    return err == -4 ? "send file truncated." : strerror(err);
+}
+
+SocketEvent::SocketEvent(TCP_UDP type, bool isEPOLLET, EVENT_LOOP_TYPE loop_type)
     : socket_type_(type)
-    , epoll_event_(isEPOLLET) {
-    recvBuf_.reserve(4096);
+    , isEPOLLET_(isEPOLLET)
+    , loop_type_(loop_type)
+    , loop_(NULL)
+    , ring_(NULL)
+    , uring_sockets_(0)
+    , now_ms_(0)
+    , sent_bytes_(RAFT_METRICS()->GetCounter("dc_socket_sent_bytes"))
+    , recv_bytes_(RAFT_METRICS()->GetCounter("dc_socket_recv_bytes")) {
 }
 
 SocketEvent::~SocketEvent() {
-    std::map<int, SocketInfo>::iterator it;
-    for (it = fd_si_.begin(); it != fd_si_.end(); it++) {
-        DelSocket(it->second.fd);
+    if (!loop_) {
+        return;
     }
+
+    for (int fd = 0; fd < fd_si_.limit(); fd++) {
+        SocketInfo* info = fd_si_.Get(fd);
+        if (info->state != STATE_DEFAULT) {
+            DelSocket(fd);
+        }
+    }
+
+    // the kernel answers the cancels of DelSocket(), then the ops can go
+    for (int i = 0; i < 100 && uring_sockets_ > 0; i++) {
+        loop_->Wait(10);
+    }
+    if (uring_sockets_ > 0) {
+        LOG_WARNING(RAFT_LOG(), "SocketEvent, io_uring ops not answered, leak them, sockets:%d\n", uring_sockets_);
+    }
+
+    delete loop_;
+    loop_ = NULL;
 }
 
 int SocketEvent::Initialize() {
-    if (epoll_event_.Initialize() != 0) {
+    loop_ = CreateEventLoop(loop_type_, isEPOLLET_);
+    if (!loop_) {
         return -1;
     }
+
+    if (loop_->type() == LOOP_URING) {
+        UringEvent* ring = static_cast<UringEvent*>(loop_);
+        if (ring->SetupBufferRing(URING_RECV_BUFFERS, RECV_CHUNK_SIZE) == 0) {
+            ring_ = ring;
+        } else {
+            LOG_WARNING(RAFT_LOG(), "SocketEvent, no io_uring buffer ring, sockets stay readiness based\n");
+        }
+    }
     return 0;
 }
 
 void SocketEvent::OnRead(int fd, uint32_t events) {
-    std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-    if (it == fd_si_.end()) {
-        fprintf(stderr, "SocketEvent, fd OnRead but not in fd_si_ map, remove it, fd:%d\n", fd);
-        epoll_event_.DelEvent(fd);
+    (void)events;
+
+    SocketInfo* info = fd_si_.Get(fd);
+    if (!info || info->state == STATE_DEFAULT) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, fd OnRead but not in fd_si_, remove it, fd:%d\n", fd);
+        loop_->DelEvent(fd);
         return;
     }
 
-    if (it->second.type == TYPE_LISTEN) {
-        sockaddr_in cli_addr;
-        socklen_t cli_len;
-        int cli_fd = accept(fd, (sockaddr *)&cli_addr, &cli_len);
+    if (info->type == TYPE_LISTEN) {
+        Acceptor* acceptor = info->acceptor ? info->acceptor : this;
 
-        if (cli_fd < 0) {
-            fprintf(stderr, "SocketEvent, accept error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
-        } else {
-            reinterpret_cast<SocketEvent*>(it->second.handler)->OnAccept(cli_fd, cli_addr.sin_addr.s_addr, cli_addr.sin_port);
-        }
+        // accept until EAGAIN, EPOLLET tells once for the whole backlog
+        while (1) {
+            sockaddr_in cli_addr;
+            socklen_t cli_len = sizeof(cli_addr);
+            int cli_fd = accept(fd, (sockaddr *)&cli_addr, &cli_len);
 
-    } else if (it->second.type == TYPE_CONNECT && it->second.state == STATE_CONNECT) {  // 连接成功
+            if (cli_fd >= 0) {
+                acceptor->OnAccept(cli_fd, cli_addr.sin_addr.s_addr, ntohs(cli_addr.sin_port));
+            } else if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    LOG_ERROR(RAFT_LOG(), "SocketEvent, accept error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+                }
+                break;
+            }
+        }
 
-        int err = 0;
-        socklen_t len = sizeof(err);
-        int status = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
-        if (status == 0) {              // connect success
-            it->second.state = STATE_READWRITE;
+    } else if (info->type == TYPE_CONNECT && info->state == STATE_CONNECT) {  // 连接成功
+        OnConnect(fd, info);
+        if (info->state == STATE_READWRITE) {
             OnRead(fd, SOCKET_READ);
-        } else {
-            std::string error = strerror(err);
-            it->second.handler->OnError(fd, err, error);
         }
 
-        events = events & SOCKET_READ & SOCKET_WRITE & SOCKET_ERROR;
-        int ret = epoll_event_.AddEvent(fd, this, events);
-        if (ret != 0) {
-            fprintf(stderr, "SocketEvent, fd OnRead AddEvent error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
-        }
+    } else if (info->handler && !info->uring) {     // LOOP_URING: its Recv brings the bytes
+        SocketFdHandler* handler = info->handler;
+        RingBuffer& recvBuf = handler->recvBuf();
+        bool closed = false;
+        int err = 0;
+        std::string error;
+        uint64_t received = 0;
+
+        /*
+         * drain the socket, EPOLLET will not tell again. frames are cut
+         * after every recv, so recvBuf holds one chunk and the partial
+         * frame at its end, not all a fast peer sent since the last wakeup
+         */
+        while (!closed) {
+            if (recvBuf.Reserve(RECV_CHUNK_SIZE) != 0) {
+                LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead recv buffer alloc fail, fd:%d\n", fd);
+                closed = true;
+                break;
+            }
 
-    } else {
-        int count = recv(fd, const_cast<char*>(recvBuf_.data()), recvBuf_.capacity(), MSG_PEEK);
-        if (count < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-                int retry = 0;
-                do {
-                    count = recv(fd, const_cast<char*>(recvBuf_.data()), recvBuf_.capacity(), MSG_PEEK);
-                    retry++;
-                } while (retry < 2 && count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
-
-                if (count > 0) {
-                    it->second.handler->OnRecv(recvBuf_);
+            int count = recv(fd, recvBuf.WritePtr(), recvBuf.Writable(), 0);
+            if (count > 0) {
+                recvBuf.Produce(count);
+                received += count;
+
+                if (handler->OnRecv(recvBuf) != 0) {
+                    LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead bad frame, close fd, fd:%d\n", fd);
+                    closed = true;
+                } else if (info->state == STATE_DEFAULT || info->handler != handler) {
+                    // the handler closed it from OnMessage()
+                    break;
                 }
-
+            } else if (count == 0) {
+                LOG_INFO(RAFT_LOG(), "SocketEvent, OnRead recv ret:0, close fd, fd:%d\n", fd);
+                err = -3;
+                error = "connection interrupt when recv.";
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             } else {
-                fprintf(stderr, "SocketEvent, OnRead recv error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
-            }
-        } else if (count == 0) {
-            if (it->second.handler) {
-                std::string error("connection interrupt when recv.");
-                it->second.handler->OnError(fd, -3, error);
+                LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead recv error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+                err = errno;
+                error = strerror(errno);
+                break;
             }
+        }
+
+        recv_bytes_->Add(received);
+        if (info->state == STATE_DEFAULT || info->handler != handler) {
+            return;     // the handler may be deleted too
+        }
+        if (handler->recv_bytes()) {
+            handler->recv_bytes()->Add(received);
+        }
 
-            DelSocket(it->second.fd); 
-            fprintf(stderr, "SocketEvent, OnRead recv ret:0, close fd, fd:%d\n", fd);
-        } else if (it->second.handler) {
-            it->second.handler->OnRecv(recvBuf_);
+        if (err != 0) {
+            handler->OnError(fd, err, error);
+            closed = true;
+        }
+
+        if (closed) {
+            DelSocket(fd);
         }
     }
 }
 
 void SocketEvent::OnWrite(int fd, uint32_t events) {
-    std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-    if (it == fd_si_.end()) {
-        fprintf(stderr, "SocketEvent, fd OnWrite but not in fd_si_ map, remove it, fd:%d\n", fd);
-        epoll_event_.DelEvent(fd);
+    (void)events;
+
+    SocketInfo* info = fd_si_.Get(fd);
+    if (!info || info->state == STATE_DEFAULT) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, fd OnWrite but not in fd_si_, remove it, fd:%d\n", fd);
+        loop_->DelEvent(fd);
         return;
     }
 
-    if (it->second.type == TYPE_CONNECT && it->second.state == STATE_CONNECT) {     // 连接成功
+    if (info->type == TYPE_CONNECT && info->state == STATE_CONNECT) {     // 连接成功
+        OnConnect(fd, info);
+        if (info->state != STATE_READWRITE) {
+            return;
+        }
+    }
 
+    SocketFdHandler* handler = info->handler;
+    if (handler && info->uring) {
+        UringSend(fd, info);
+    } else if (handler) {
+        IoChain& sendChain = handler->sendChain();
+        uint64_t sent = 0;
         int err = 0;
-        socklen_t len = sizeof(err);
-        int status = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
-        if (status == 0) {              // connect success
-            it->second.state = STATE_READWRITE;
-        } else {
-            std::string error = strerror(err);
-            it->second.handler->OnError(fd, err, error);
+        while (!sendChain.empty()) {
+            int file_fd;
+            uint64_t file_offset;
+            size_t file_len;
+            if (sendChain.FrontFile(&file_fd, &file_offset, &file_len)) {
+                err = SendFileSlices(fd, sendChain, &sent);
+                if (err != 0 || sendChain.FrontFile(&file_fd, &file_offset, &file_len)) {
+                    break;      // EAGAIN, or closing
+                }
+                continue;
+            }
+
+            struct iovec iov[SEND_IOV_MAX];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = sendChain.FillIovec(iov, SEND_IOV_MAX);
+
+            ssize_t count = sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    LOG_ERROR(RAFT_LOG(), "SocketEvent, OnWrite send error, close fd, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+                    err = errno;
+                }
+                break;
+            }
+
+            // partial send only moves the offset of the first slice
+            sendChain.Consume(count);
+            sent += count;
         }
 
-        events = events & SOCKET_READ & SOCKET_WRITE & SOCKET_ERROR;
-        int ret = epoll_event_.AddEvent(fd, this, events);
-        if (ret != 0) {
-            fprintf(stderr, "SocketEvent, fd OnWrite AddEvent error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+        sent_bytes_->Add(sent);
+        if (handler->sent_bytes()) {
+            handler->sent_bytes()->Add(sent);
+        }
+
+        // EPIPE, ECONNRESET ...: the peer is gone, nothing more will be sent
+        if (err != 0) {
+            std::string error = SendError(err);
+            handler->OnError(fd, err, error);
+            DelSocket(fd);
         }
     }
+}
 
-    SocketFdHandler* handler = it->second.handler;
-    if (handler) {
-        std::string& sendBuf = handler->sendBuf();
-        int count = send(fd, sendBuf.c_str(), sendBuf.size(), 0);
+/*
+ * sendfile() the file slices at the head of chain, file bytes go page
+ * cache -> socket, never through user space. stops at a memory slice or
+ * EAGAIN. return 0, else the error to close the connection with
+ */
+int SocketEvent::SendFileSlices(int fd, IoChain& chain, uint64_t* sent) {
+    int file_fd;
+    uint64_t file_offset;
+    size_t file_len;
+    while (chain.FrontFile(&file_fd, &file_offset, &file_len)) {
+        off_t offset = file_offset;
+        ssize_t count = sendfile(fd, file_fd, &offset, file_len);
         if (count < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-                int retry = 0;
-                do {
-                    count = send(fd, sendBuf.c_str(), sendBuf.size(), 0);
-                    retry++;
-                } while (retry < 2 && count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
-
-                if (count > 0) {
-                    it->second.handler->OnRecv(recvBuf_);
-                }
-
-            } else {
-                fprintf(stderr, "SocketEvent, OnWrite send error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
             }
-        } else if (static_cast<unsigned int>(count) < sendBuf.size()) {
-            std::string leftBuf(sendBuf, count, sendBuf.size() - count);
-            sendBuf.swap(leftBuf);
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, sendfile error, close fd, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+            return errno;
+        } else if (count == 0) {
+            // file shrank under the slice, the frame can not be finished
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, sendfile eof, close fd, fd:%d\n", fd);
+            return -4;
+        }
+
+        chain.Consume(count);
+        *sent += count;
+    }
+    return 0;
+}
+
+int SocketEvent::UringStart(int fd, SocketInfo* info) {
+    UringSocket* us = new UringSocket(this, fd);
+    int ret = 0;
+    if (info->type == TYPE_LISTEN) {
+        ret = ring_->Accept(fd, &us->accept_);
+        us->accepting_ = (ret == 0);
+    } else if (info->events & SOCKET_READ) {
+        ret = ring_->Recv(fd, &us->recv_);
+        us->receiving_ = (ret == 0);
+    }
+
+    if (ret != 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, io_uring sq full, fd:%d\n", fd);
+        delete us;
+        return -1;
+    }
+    info->uring = us;
+    return 0;
+}
+
+void SocketEvent::UringClose(SocketInfo* info) {
+    UringSocket* us = info->uring;
+    info->uring = NULL;
+    us->closed_ = true;
+
+    if (us->accepting_) {
+        ring_->Cancel(&us->accept_);
+    }
+    if (us->receiving_) {
+        ring_->Cancel(&us->recv_);
+    }
+    if (us->sending_) {
+        // the kernel still reads these slices, keep their Buffers
+        if (info->handler) {
+            us->chain_.Splice(info->handler->sendChain());
+        }
+        ring_->Cancel(&us->send_);
+    }
+
+    // the fd is closed next, the ops must not see a reused number
+    ring_->Submit();
+    if (us->idle()) {
+        delete us;
+    }
+}
+
+// queue a Sendmsg of the memory slices at the head of the send chain
+bool SocketEvent::UringQueueSend(int fd, SocketInfo* info) {
+    UringSocket* us = info->uring;
+    IoChain& sendChain = info->handler->sendChain();
+    if (us->sending_ || sendChain.empty()) {
+        return false;
+    }
+
+    us->msg_.msg_iovlen = sendChain.FillIovec(us->iov_, SEND_IOV_MAX);
+    if (us->msg_.msg_iovlen == 0) {
+        return false;       // a file slice first
+    }
+    if (ring_->Sendmsg(fd, &us->msg_, MSG_NOSIGNAL, &us->send_) != 0) {
+        loop_->RemodEvent(fd);      // sq full, the write poll retries
+        return false;
+    }
+    us->sending_ = true;
+    return true;
+}
+
+void SocketEvent::UringSend(int fd, SocketInfo* info) {
+    UringSocket* us = info->uring;
+    SocketFdHandler* handler = info->handler;
+    if (us->sending_ || !handler) {
+        return;
+    }
+
+    uint64_t sent = 0;
+    int err = SendFileSlices(fd, handler->sendChain(), &sent);
+    sent_bytes_->Add(sent);
+    if (handler->sent_bytes()) {
+        handler->sent_bytes()->Add(sent);
+    }
+
+    if (err != 0) {
+        std::string error = SendError(err);
+        handler->OnError(fd, err, error);
+        DelSocket(fd);
+        return;
+    }
+    UringQueueSend(fd, info);
+}
+
+void SocketEvent::OnUringComplete(UringSocket* us, int op, int res, uint32_t flags) {
+    bool ended = op == UringSocket::OP_SEND || !(flags & IORING_CQE_F_MORE);
+    int fd = us->fd_;
+    SocketInfo* info = fd_si_.Get(fd);
+
+    if (us->closed_ || !info || info->uring != us) {
+        // answers to a closed fd, give back what they carry
+        if (op == UringSocket::OP_ACCEPT && res >= 0) {
+            close(res);
+        } else if (op == UringSocket::OP_RECV && (flags & IORING_CQE_F_BUFFER)) {
+            uint16_t bid;
+            ring_->BufferOf(flags, &bid);
+            ring_->RecycleBuffer(bid);
+        }
+    } else if (op == UringSocket::OP_ACCEPT) {
+        OnUringAccept(fd, info, res);
+    } else if (op == UringSocket::OP_RECV) {
+        OnUringRecv(fd, info, res, flags);
+    } else {
+        OnUringSend(fd, info, res);
+    }
+
+    // cleared after the callback, so DelSocket() from it keeps us alive
+    if (ended) {
+        if (op == UringSocket::OP_ACCEPT) {
+            us->accepting_ = false;
+        } else if (op == UringSocket::OP_RECV) {
+            us->receiving_ = false;
         } else {
-            //sendBuf.clear();
+            us->sending_ = false;
+            us->chain_.Clear();
+        }
+    }
+
+    if (us->closed_) {
+        if (us->idle()) {
+            delete us;
+        }
+        return;
+    }
+
+    // the kernel dropped a multishot op (no buffer, overflow ...), arm it again
+    int ret = 0;
+    if (info->type == TYPE_LISTEN && !us->accepting_) {
+        ret = ring_->Accept(fd, &us->accept_);
+        us->accepting_ = (ret == 0);
+    } else if (info->type != TYPE_LISTEN && (info->events & SOCKET_READ) && !us->receiving_) {
+        ret = ring_->Recv(fd, &us->recv_);
+        us->receiving_ = (ret == 0);
+    }
+    if (ret != 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, io_uring op not armed again, fd:%d\n", fd);
+    }
+
+    if (op == UringSocket::OP_SEND && res >= 0) {
+        UringSend(fd, info);
+    }
+}
+
+void SocketEvent::OnUringAccept(int fd, SocketInfo* info, int res) {
+    if (res < 0) {
+        if (res != -ECANCELED) {
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, accept error, fd:%d, errno:%d, error:%s\n", fd, -res, strerror(-res));
         }
+        return;
+    }
+
+    sockaddr_in cli_addr;
+    socklen_t cli_len = sizeof(cli_addr);
+    memset(&cli_addr, 0, sizeof(cli_addr));
+    getpeername(res, (sockaddr *)&cli_addr, &cli_len);
+
+    Acceptor* acceptor = info->acceptor ? info->acceptor : this;
+    acceptor->OnAccept(res, cli_addr.sin_addr.s_addr, ntohs(cli_addr.sin_port));
+}
+
+void SocketEvent::OnUringRecv(int fd, SocketInfo* info, int res, uint32_t flags) {
+    SocketFdHandler* handler = info->handler;
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        uint16_t bid;
+        char* data = ring_->BufferOf(flags, &bid);
+        RingBuffer& recvBuf = handler->recvBuf();
+        bool ok = recvBuf.Reserve(res) == 0;
+        if (ok) {
+            memcpy(recvBuf.WritePtr(), data, res);
+            recvBuf.Produce(res);
+        }
+        ring_->RecycleBuffer(bid);
+
+        recv_bytes_->Add(res);
+        if (handler->recv_bytes()) {
+            handler->recv_bytes()->Add(res);
+        }
+
+        if (!ok) {
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead recv buffer alloc fail, fd:%d\n", fd);
+            DelSocket(fd);
+        } else if (handler->OnRecv(recvBuf) != 0 && info->state != STATE_DEFAULT) {
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead bad frame, close fd, fd:%d\n", fd);
+            DelSocket(fd);
+        }
+    } else if (res == 0) {
+        LOG_INFO(RAFT_LOG(), "SocketEvent, OnRead recv ret:0, close fd, fd:%d\n", fd);
+        std::string error = "connection interrupt when recv.";
+        handler->OnError(fd, -3, error);
+        DelSocket(fd);
+    } else if (res != -ENOBUFS && res != -EAGAIN && res != -EINTR) {
+        // ENOBUFS: every ring buffer is taken, the Recv is armed again
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, OnRead recv error, fd:%d, errno:%d, error:%s\n", fd, -res, strerror(-res));
+        std::string error = strerror(-res);
+        handler->OnError(fd, -res, error);
+        DelSocket(fd);
+    }
+}
+
+void SocketEvent::OnUringSend(int fd, SocketInfo* info, int res) {
+    SocketFdHandler* handler = info->handler;
+    if (res >= 0) {
+        // partial send only moves the offset of the first slice
+        handler->sendChain().Consume(res);
+        sent_bytes_->Add(res);
+        if (handler->sent_bytes()) {
+            handler->sent_bytes()->Add(res);
+        }
+    } else if (res == -EAGAIN || res == -EINTR) {
+        loop_->RemodEvent(fd);      // the write poll sends the rest
+    } else {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, OnWrite send error, close fd, fd:%d, errno:%d, error:%s\n", fd, -res, strerror(-res));
+        std::string error = strerror(-res);
+        handler->OnError(fd, -res, error);
+        DelSocket(fd);
     }
 }
 
 void SocketEvent::OnError(int fd, uint32_t events, int err, std::string& error) {
-    std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-    if (it == fd_si_.end()) {
-        fprintf(stderr, "SocketEvent, fd OnWrite but not in fd_si_ map, remove it, fd:%d\n", fd);
-        epoll_event_.DelEvent(fd);
+    SocketInfo* info = fd_si_.Get(fd);
+    if (!info || info->state == STATE_DEFAULT) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, fd OnWrite but not in fd_si_, remove it, fd:%d\n", fd);
+        loop_->DelEvent(fd);
         return;
     }
 
-    SocketFdHandler* handler = it->second.handler;
+    SocketFdHandler* handler = info->handler;
     if (handler) {
         handler->OnError(fd, err, error);
-        fprintf(stderr, "SocketEvent, OnError fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, OnError fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
     }
 }
 
 /*
 void SocketEvent::OnAccept(int fd, uint32_t ip, int port) {
     if (fd < 0) {
-        fprintf(stderr, "SocketEvent, fd OnAccept fd < 0, fd:%d\n", fd);
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, fd OnAccept fd < 0, fd:%d\n", fd);
         return;
     }
 
@@ -189,12 +650,12 @@ void SocketEvent::OnAccept(int fd, uint32_t ip, int port) {
     
     int ret = AddSocket(fd, phandler);
     if (ret != 0) {
-        fprintf(stderr, "SocketEvent, OnAccept, AddSocket fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, OnAccept, AddSocket fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
     }
 }
 */
 
-int SocketEvent::AddListenSocket(std::string& ip_str, int port, uint32_t events) {
+int SocketEvent::AddListenSocket(std::string& ip_str, int port, uint32_t events, Acceptor* acceptor) {
     struct sockaddr_in addr;
     bzero(&addr, sizeof(addr));
     addr.sin_family = AF_INET;
@@ -202,24 +663,36 @@ int SocketEvent::AddListenSocket(std::string& ip_str, int port, uint32_t events)
     addr.sin_port=htons(port);
 
     int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, socket fail, errno:%d, error:%s\n", errno, strerror(errno));
+        return -1;
+    }
     
     SetNonBlocking(fd);
 
-    bind(fd, (sockaddr *)&addr, sizeof(addr));
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 
-    listen(fd, LISTENQUEUE);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, LISTENQUEUE) != 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, bind/listen fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    events = events & (SOCKET_READ | SOCKET_WRITE | SOCKET_ERROR);
+    SocketInfo si = {fd, TYPE_LISTEN, STATE_LISTEN, NULL, NULL, events, acceptor, NULL}; 
+    *fd_si_.Slot(fd) = si; 
 
-    events = events & SOCKET_READ & SOCKET_WRITE & SOCKET_ERROR;
-    int ret = epoll_event_.AddEvent(fd, this, events);
+    // LOOP_URING: the multishot Accept takes the backlog, no poll
+    int ret = ring_ ? UringStart(fd, fd_si_.Get(fd)) : loop_->AddEvent(fd, this, events);
     if (ret != 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, AddEvent fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+        fd_si_.Get(fd)->state = STATE_DEFAULT;
         close(fd);
-        fprintf(stderr, "SocketEvent, AddEvent fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+        return -1;
     }
 
-    SocketInfo si = {fd, TYPE_LISTEN, STATE_LISTEN, NULL, 0}; 
-    fd_si_[fd] = si; 
-
-    return ret;
+    return fd;
 }
 
 int SocketEvent::AddConnection(std::string& ip_str, int port, SocketFdHandler* sfd, uint32_t events) {
@@ -232,49 +705,75 @@ int SocketEvent::AddConnection(std::string& ip_str, int port, SocketFdHandler* s
     int fd = socket(AF_INET, SOCK_STREAM, 0);
 
     SetNonBlocking(fd);
+    SetNoDelay(fd);
 
     int ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
 
     if (ret == 0) {     // 连接成功, 本地连接可能出现
-        events = events & SOCKET_READ & SOCKET_WRITE & SOCKET_ERROR;
-        int ret = epoll_event_.AddEvent(fd, this, events);
+        events = events & (SOCKET_READ | SOCKET_WRITE | SOCKET_ERROR);
+        int ret = loop_->AddEvent(fd, this, PollEvents(events));
         if (ret != 0) {
             close(fd);
 
-            fprintf(stderr, "SocketEvent, AddConnection fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, AddConnection fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
             return -1;
         }
 
         sfd->SetFd(fd);
          
-        SocketInfo si = {fd, TYPE_CONNECT, STATE_READWRITE, sfd, 0}; 
-        fd_si_[fd] = si; 
-
-        //sfd->OnRecv(recvBuf_);
+        SocketInfo si = {fd, TYPE_CONNECT, STATE_READWRITE, sfd, NULL, events, NULL, NULL}; 
+        *fd_si_.Slot(fd) = si; 
 
+        if (ring_ && UringStart(fd, fd_si_.Get(fd)) != 0) {
+            DelSocket(fd);
+            return -1;
+        }
         return 0;
     } else if (errno == EINPROGRESS) {      // 正在建立连接
+        // writable when the connect is done, or failed
+        if (loop_->AddEvent(fd, this, SOCKET_WRITE | SOCKET_ERROR) != 0) {
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, AddConnection AddEvent fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+            close(fd);
+            return -1;
+        }
+
         sfd->SetFd(fd);
 
-        SocketInfo si = {fd, TYPE_CONNECT, STATE_CONNECT, sfd, now_ms_ + timeout_ms_ + CONNECT_TIMEOUT_MS};
-        fd_si_[fd] = si; 
+        Timer* timer = new ConnectTimer(this, fd);
+        timer_wheel_.Add(timer, now_ms_ + CONNECT_TIMEOUT_MS);
 
-        connect_fds_.push(fd); 
+        SocketInfo si = {fd, TYPE_CONNECT, STATE_CONNECT, sfd, timer, events & (SOCKET_READ | SOCKET_WRITE | SOCKET_ERROR), NULL, NULL};
+        *fd_si_.Slot(fd) = si; 
 
         return -2;
     } else {
-        fprintf(stderr, "SocketEvent, AddConnection fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, AddConnection fail, ip:%s, port:%d, errno:%d, error:%s\n", ip_str.c_str(), port, errno, strerror(errno));
         return -1;
     }
 }
 
 int SocketEvent::DelSocket(int fd) {
-    int ret = epoll_event_.DelEvent(fd);
-    if (ret != 0) {
-        fprintf(stderr, "SocketEvent, DelSocket fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+    SocketInfo* info = fd_si_.Get(fd);
+    bool polled = !info || !info->uring || info->type != TYPE_LISTEN;
+    if (info && info->uring) {
+        UringClose(info);
     }
 
-    fd_si_.erase(fd);
+    if (polled && loop_->DelEvent(fd) != 0) {
+        LOG_ERROR(RAFT_LOG(), "SocketEvent, DelSocket fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+    }
+
+    if (info) {
+        // unsent bytes die with the fd, their blocks go back to slab_ now
+        if (info->type != TYPE_LISTEN && info->handler) {
+            info->handler->sendChain().Clear();
+        }
+        info->state = STATE_DEFAULT;
+        if (info->connect_timer) {
+            delete info->connect_timer;
+            info->connect_timer = NULL;
+        }
+    }
 
     close(fd);
 
@@ -282,62 +781,141 @@ int SocketEvent::DelSocket(int fd) {
 }
 
 int SocketEvent::Wait(uint64_t now_ms, int timeout_ms) {
-    timeout_ms_ = timeout_ms;
+    if (now_ms_ == 0) {
+        timer_wheel_.Initialize(now_ms);
+    }
     now_ms_ = now_ms;
 
-    while (1) {
-        if (connect_fds_.size() <= 0) {
-            break;
-        }
+    timer_wheel_.Advance(now_ms);
 
-        int fd = connect_fds_.front();
-        std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-        if (it == fd_si_.end()) {
-            connect_fds_.pop();
-            continue;
-        }
+    int next = timer_wheel_.NextTimeout(now_ms);
+    if (next >= 0 && (timeout_ms < 0 || next < timeout_ms)) {
+        timeout_ms = next;
+    }
 
-        if (it->second.expired_time_ms < now_ms) {
-            if (it->second.handler) {
-                std::string error = "connect timeout.";
-                it->second.handler->OnError(fd, -2, error);
-            } 
-            fd_si_.erase(it);
-            connect_fds_.pop();
-            continue;
+    return loop_->Wait(timeout_ms);
+}
+
+void SocketEvent::OnConnect(int fd, SocketInfo* info) {
+    if (info->connect_timer) {
+        delete info->connect_timer;
+        info->connect_timer = NULL;
+    }
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    int status = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (status == 0 && err == 0) {              // connect success
+        info->state = STATE_READWRITE;
+        if (loop_->ModEvent(fd, PollEvents(info->events)) != 0) {
+            LOG_ERROR(RAFT_LOG(), "SocketEvent, OnConnect ModEvent error, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
         }
-        break;
-    };
+        if (!ring_ || UringStart(fd, info) == 0) {
+            return;
+        }
+        err = ENOMEM;
+        status = 0;
+    }
 
-    return epoll_event_.Wait(timeout_ms);
+    if (status != 0) {
+        err = errno;
+    }
+    std::string error = strerror(err);
+    if (info->handler) {
+        info->handler->OnError(fd, err, error);
+    }
+    DelSocket(fd);
+}
+
+void SocketEvent::OnConnectTimeout(int fd) {
+    SocketInfo* info = fd_si_.Get(fd);
+    if (!info || info->state != STATE_CONNECT) {
+        return;
+    }
+
+    // the timer is running, DelSocket must not delete it
+    delete info->connect_timer;
+    info->connect_timer = NULL;
+
+    if (info->handler) {
+        std::string error = "connect timeout.";
+        info->handler->OnError(fd, -2, error);
+    }
+    DelSocket(fd);
 }
 
 SocketFdHandler* SocketEvent::GetHandler(int fd) {
-    std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-    if (it == fd_si_.end()) {
+    SocketInfo* info = fd_si_.Get(fd);
+    if (!info || info->state == STATE_DEFAULT) {
         return NULL;
     }
 
-    return it->second.handler;
+    return info->handler;
 }
 
 int SocketEvent::RemodSocketEvent(int fd) {
-    return epoll_event_.RemodEvent(fd); 
+    SocketInfo* info = fd_si_.Get(fd);
+    if (info && info->uring && info->state == STATE_READWRITE && info->handler) {
+        // memory slices go out by Sendmsg, sendfile() needs the write poll
+        int file_fd;
+        uint64_t file_offset;
+        size_t file_len;
+        if (!info->handler->sendChain().FrontFile(&file_fd, &file_offset, &file_len)) {
+            UringQueueSend(fd, info);
+            return 0;
+        }
+    }
+    return loop_->RemodEvent(fd); 
+}
+
+void SocketEvent::SendNow(int fd) {
+    SocketInfo* info = fd_si_.Get(fd);
+    if (info && info->state == STATE_READWRITE && info->handler) {
+        OnWrite(fd, SOCKET_WRITE);
+    }
 }
 
 int SocketEvent::AddSocket(int fd, SocketFdHandler* sfd, uint32_t events) {
-    std::map<int, SocketInfo>::iterator it = fd_si_.find(fd);
-    if (it != fd_si_.end()) {
+    SocketInfo* info = fd_si_.Get(fd);
+    if (info && info->state != STATE_DEFAULT) {
         return -1;
     }
 
     SetNonBlocking(fd);
+    SetNoDelay(fd);
 
-    SocketInfo si = {fd, TYPE_ACCEPT, STATE_READWRITE, sfd, 0}; 
-    fd_si_[fd] = si; 
+    SocketInfo si = {fd, TYPE_ACCEPT, STATE_READWRITE, sfd, NULL, events & (SOCKET_READ | SOCKET_WRITE | SOCKET_ERROR), NULL, NULL}; 
+    *fd_si_.Slot(fd) = si; 
 
-    events = events & SOCKET_READ & SOCKET_WRITE & SOCKET_ERROR;
-    return epoll_event_.AddEvent(fd, this, events);
+    events = events & (SOCKET_READ | SOCKET_WRITE | SOCKET_ERROR);
+    if (loop_->AddEvent(fd, this, PollEvents(events)) != 0) {
+        fd_si_.Get(fd)->state = STATE_DEFAULT;
+        return -1;
+    }
+    if (ring_ && UringStart(fd, fd_si_.Get(fd)) != 0) {
+        loop_->DelEvent(fd);
+        fd_si_.Get(fd)->state = STATE_DEFAULT;
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t SocketEvent::PollEvents(uint32_t events) const {
+    // LOOP_URING: the multishot Recv reads, the poll only writes
+    return ring_ ? (events & ~SOCKET_READ) : events;
+}
+
+int SocketEvent::SetNoDelay(int fd) {
+    if (socket_type_ != SOCKET_TCP) {
+        return 0;
+    }
+    // a frame is one sendmsg, Nagle would hold it for the peer's delayed ack
+    int on = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0) {
+        LOG_WARNING(RAFT_LOG(), "SocketEvent, TCP_NODELAY fail, fd:%d, errno:%d, error:%s\n", fd, errno, strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
 int SocketEvent::SetNonBlocking(int fd) {
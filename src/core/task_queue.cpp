@@ -0,0 +1,57 @@
+#include "task_queue.h"
+
+namespace dc {
+
+TaskQueue::TaskQueue()
+    : head_(&stub_)
+    , tail_(&stub_) {
+}
+
+TaskQueue::~TaskQueue() {
+    Task* task;
+    while ((task = Pop()) != NULL) {
+        delete task;
+    }
+}
+
+void TaskQueue::Push(Task* task) {
+    task->next_.store(NULL, std::memory_order_relaxed);
+    Task* prev = head_.exchange(task, std::memory_order_acq_rel);
+    prev->next_.store(task, std::memory_order_release);
+}
+
+Task* TaskQueue::Pop() {
+    Task* tail = tail_;
+    Task* next = tail->next_.load(std::memory_order_acquire);
+
+    if (tail == &stub_) {
+        if (!next) {
+            return NULL;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next_.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+
+    if (tail != head_.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+
+    // tail is the last one, put stub behind it so it can be taken
+    Push(&stub_);
+
+    next = tail->next_.load(std::memory_order_acquire);
+    if (next) {
+        tail_ = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+}   // namespace dc
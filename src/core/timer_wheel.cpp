@@ -0,0 +1,222 @@
+#include "timer_wheel.h"
+
+#include <string.h>
+
+namespace dc {
+
+Timer::Timer()
+    : prev_(NULL)
+    , next_(NULL)
+    , head_(NULL)
+    , l0_index_(-1)
+    , expire_ms_(0)
+    , wheel_(NULL) {
+}
+
+Timer::~Timer() {
+    if (wheel_) {
+        wheel_->Cancel(this);
+    }
+}
+
+TimerWheel::TimerWheel()
+    : cur_ms_(0)
+    , count_(0)
+    , firing_(NULL) {
+    memset(l0_, 0, sizeof(l0_));
+    memset(ln_, 0, sizeof(ln_));
+    memset(l0_bitmap_, 0, sizeof(l0_bitmap_));
+}
+
+TimerWheel::~TimerWheel() {
+    // leave the timers not pending, they may outlive the wheel
+    for (int i = 0; i < TW_L0_SIZE; i++) {
+        while (l0_[i]) {
+            Unlink(l0_[i]);
+        }
+    }
+    for (int l = 0; l < TW_LEVELS - 1; l++) {
+        for (int i = 0; i < TW_LN_SIZE; i++) {
+            while (ln_[l][i]) {
+                Unlink(ln_[l][i]);
+            }
+        }
+    }
+}
+
+void TimerWheel::Initialize(uint64_t now_ms) {
+    cur_ms_ = now_ms;
+}
+
+void TimerWheel::Link(Timer* timer) {
+    uint64_t expire = timer->expire_ms_ < cur_ms_ ? cur_ms_ : timer->expire_ms_;
+    uint64_t delta = expire - cur_ms_;
+
+    Timer** head;
+    timer->l0_index_ = -1;
+    if (delta < TW_L0_SIZE) {
+        int index = expire & (TW_L0_SIZE - 1);
+        head = &l0_[index];
+        timer->l0_index_ = index;
+        l0_bitmap_[index >> 6] |= 1ULL << (index & 63);
+    } else {
+        int level = 0;
+        int shift = TW_L0_BITS;
+        while (level < TW_LEVELS - 2 && delta >= (1ULL << (shift + TW_LN_BITS))) {
+            level++;
+            shift += TW_LN_BITS;
+        }
+        if (delta >= (1ULL << (shift + TW_LN_BITS))) {
+            // too far, park in the last slot of the top level, re-added on cascade
+            expire = cur_ms_ + (1ULL << (shift + TW_LN_BITS)) - 1;
+        }
+        head = &ln_[level][(expire >> shift) & (TW_LN_SIZE - 1)];
+    }
+
+    timer->head_ = head;
+    timer->prev_ = NULL;
+    timer->next_ = *head;
+    if (*head) {
+        (*head)->prev_ = timer;
+    }
+    *head = timer;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+    if (timer->prev_) {
+        timer->prev_->next_ = timer->next_;
+    } else {
+        *timer->head_ = timer->next_;
+        if (!timer->next_ && timer->l0_index_ >= 0) {
+            l0_bitmap_[timer->l0_index_ >> 6] &= ~(1ULL << (timer->l0_index_ & 63));
+        }
+    }
+    if (timer->next_) {
+        timer->next_->prev_ = timer->prev_;
+    }
+
+    timer->prev_ = NULL;
+    timer->next_ = NULL;
+    timer->head_ = NULL;
+    timer->wheel_ = NULL;
+    count_--;
+}
+
+void TimerWheel::Add(Timer* timer, uint64_t expire_ms) {
+    if (timer->wheel_) {
+        timer->wheel_->Cancel(timer);
+    }
+
+    timer->expire_ms_ = expire_ms;
+    timer->wheel_ = this;
+    count_++;
+    Link(timer);
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+    if (timer->wheel_ != this) {
+        return;
+    }
+    Unlink(timer);
+}
+
+void TimerWheel::Cascade(int level, int index) {
+    Timer* timer = ln_[level][index];
+    ln_[level][index] = NULL;
+
+    while (timer) {
+        Timer* next = timer->next_;
+        Link(timer);
+        timer = next;
+    }
+}
+
+// first non empty level 0 slot in [from, TW_L0_SIZE), -1 if none
+int TimerWheel::NextL0Slot(int from) {
+    for (int w = from >> 6; w < TW_L0_SIZE / 64; w++) {
+        uint64_t bits = l0_bitmap_[w];
+        if (w == (from >> 6)) {
+            bits &= ~0ULL << (from & 63);
+        }
+        if (bits) {
+            return (w << 6) + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+void TimerWheel::Advance(uint64_t now_ms) {
+    if (count_ == 0) {
+        if (cur_ms_ <= now_ms) {
+            cur_ms_ = now_ms + 1;
+        }
+        return;
+    }
+
+    while (cur_ms_ <= now_ms) {
+        int index = cur_ms_ & (TW_L0_SIZE - 1);
+
+        if (index == 0) {
+            // move the upper level slot that starts now down, top level first
+            int shift = TW_L0_BITS;
+            int level = 0;
+            while (level < TW_LEVELS - 2 && ((cur_ms_ >> shift) & (TW_LN_SIZE - 1)) == 0) {
+                level++;
+                shift += TW_LN_BITS;
+            }
+            for (; level >= 0; level--, shift -= TW_LN_BITS) {
+                Cascade(level, (cur_ms_ >> shift) & (TW_LN_SIZE - 1));
+            }
+        }
+
+        // move the slot to firing_, so OnTimer() may Add / Cancel any timer
+        firing_ = l0_[index];
+        l0_[index] = NULL;
+        l0_bitmap_[index >> 6] &= ~(1ULL << (index & 63));
+
+        Timer* timer;
+        for (timer = firing_; timer; timer = timer->next_) {
+            timer->head_ = &firing_;
+            timer->l0_index_ = -1;
+        }
+
+        uint64_t cur = cur_ms_;
+        cur_ms_ = cur + 1;          // added again from OnTimer() goes to a later slot
+        while (firing_) {
+            timer = firing_;
+            Unlink(timer);
+            timer->OnTimer();
+        }
+
+        // jump to the next non empty slot, or the next cascade
+        int next = index + 1 < TW_L0_SIZE ? NextL0Slot(index + 1) : -1;
+        uint64_t target = next >= 0 ? (cur - index + next) : ((cur | (TW_L0_SIZE - 1)) + 1);
+        cur_ms_ = target <= now_ms ? target : now_ms + 1;
+    }
+}
+
+int TimerWheel::NextTimeout(uint64_t now_ms) {
+    if (count_ == 0) {
+        return -1;
+    }
+
+    int index = cur_ms_ & (TW_L0_SIZE - 1);
+
+    // a slot boundary not processed yet cascades at cur_ms_, else the first
+    // non empty slot of this level 0 round, else the next cascade
+    uint64_t deadline;
+    int next;
+    if (index == 0) {
+        deadline = cur_ms_;
+    } else if ((next = NextL0Slot(index)) >= 0) {
+        deadline = cur_ms_ - index + next;
+    } else {
+        deadline = (cur_ms_ | (TW_L0_SIZE - 1)) + 1;
+    }
+    if (deadline <= now_ms) {
+        return 0;
+    }
+    return static_cast<int>(deadline - now_ms);
+}
+
+}   // namespace dc
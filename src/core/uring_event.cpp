@@ -0,0 +1,582 @@
+#include "uring_event.h"
+#include "log.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+
+namespace dc {
+
+/*
+ * user_data
+ *   Completion*             : low 2 bits 0
+ *   fd << 32 | gen << 2 | 1 : readiness poll of fd
+ *   2                       : poll remove / cancel, result dropped
+ */
+#define UD_POLL 1
+#define UD_IGNORE 2
+#define GEN_MASK 0x3fffffff
+
+// multishot poll came with rsrc tags (5.13), the timeout of Wait needs ext arg
+#define URING_REQUIRED_FEATURES (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)
+
+static int io_uring_setup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags, void* arg, size_t argsz) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+static inline uint64_t PollData(int fd, uint32_t gen) {
+    return (static_cast<uint64_t>(fd) << 32) | ((gen & GEN_MASK) << 2) | UD_POLL;
+}
+
+UringEvent::UringEvent(uint32_t entries)
+    : entries_(entries)
+    , ring_fd_(-1)
+    , sq_ptr_(NULL)
+    , sq_len_(0)
+    , cq_ptr_(NULL)
+    , cq_len_(0)
+    , sqes_(NULL)
+    , sqes_len_(0)
+    , sq_head_(NULL)
+    , sq_tail_(NULL)
+    , sq_array_(NULL)
+    , sq_mask_(0)
+    , sq_entries_(0)
+    , sq_local_tail_(0)
+    , to_submit_(0)
+    , cq_head_(NULL)
+    , cq_tail_(NULL)
+    , cq_mask_(0)
+    , cqes_(NULL)
+    , buf_ring_(NULL)
+    , buf_ring_len_(0)
+    , bufs_(NULL)
+    , buf_count_(0)
+    , buf_size_(0)
+    , submitted_(0)
+    , enters_(0) {
+}
+
+UringEvent::~UringEvent() {
+    if (sqes_) {
+        munmap(sqes_, sqes_len_);
+    }
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_len_);
+    }
+    if (sq_ptr_) {
+        munmap(sq_ptr_, sq_len_);
+    }
+    if (ring_fd_ != -1) {
+        close(ring_fd_);
+    }
+    // after the ring is gone, the kernel no longer writes into them
+    if (buf_ring_) {
+        munmap(buf_ring_, buf_ring_len_);
+    }
+    if (bufs_) {
+        delete [] bufs_;
+    }
+}
+
+int UringEvent::Initialize() {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+
+    ring_fd_ = io_uring_setup(entries_, &p);
+    if (ring_fd_ < 0 && errno == EINVAL) {
+        // before 5.19
+        memset(&p, 0, sizeof(p));
+        ring_fd_ = io_uring_setup(entries_, &p);
+    }
+    if (ring_fd_ < 0) {
+        LOG_ERROR(RAFT_LOG(), "io_uring_setup error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if ((p.features & URING_REQUIRED_FEATURES) != URING_REQUIRED_FEATURES) {
+        LOG_ERROR(RAFT_LOG(), "io_uring features 0x%x lack 0x%x\n", p.features, URING_REQUIRED_FEATURES);
+        return -1;
+    }
+
+    sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_len_ = cq_len_ = sq_len_ > cq_len_ ? sq_len_ : cq_len_;
+    }
+
+    sq_ptr_ = mmap(NULL, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = NULL;
+        LOG_ERROR(RAFT_LOG(), "io_uring mmap sq error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(NULL, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            cq_ptr_ = NULL;
+            LOG_ERROR(RAFT_LOG(), "io_uring mmap cq error: %d, %s\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG_ERROR(RAFT_LOG(), "io_uring mmap sqes error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = p.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    return 0;
+}
+
+io_uring_sqe* UringEvent::GetSqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_) {
+        // sq full, hand the batch to the kernel now
+        if (Enter(to_submit_, 0, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= sq_entries_) {
+            return NULL;
+        }
+    }
+
+    unsigned index = sq_local_tail_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+
+    sq_local_tail_++;
+    to_submit_++;
+
+    return sqe;
+}
+
+int UringEvent::Enter(uint32_t submit, uint32_t wait, int timeout) {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+
+    if (wait > 0) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    } else if (submit == 0) {
+        return 0;
+    }
+
+    enters_++;
+    int ret = io_uring_enter(ring_fd_, submit, wait, flags,
+                             wait > 0 ? &arg : NULL, wait > 0 ? sizeof(arg) : 0);
+    if (ret < 0) {
+        if (errno == ETIME || errno == EINTR) {
+            ret = 0;
+        } else {
+            LOG_ERROR(RAFT_LOG(), "io_uring_enter error: %d, %s\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    // whatever the kernel consumed is submitted
+    unsigned pending = sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    submitted_ += to_submit_ - pending;
+    to_submit_ = pending;
+
+    return ret;
+}
+
+int UringEvent::Arm(EH* eh) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    eh->gen = (eh->gen + 1) & GEN_MASK;
+    eh->armed = true;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = eh->fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = eh->events;
+    sqe->user_data = PollData(eh->fd, eh->gen);
+
+    return 0;
+}
+
+int UringEvent::Disarm(EH* eh) {
+    if (!eh->armed) {
+        return 0;
+    }
+
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = PollData(eh->fd, eh->gen);
+    sqe->user_data = UD_IGNORE;
+
+    // cqes of the old poll still in the ring are dropped by gen
+    eh->gen = (eh->gen + 1) & GEN_MASK;
+    eh->armed = false;
+
+    return 0;
+}
+
+int UringEvent::AddEvent(int fd, EventHandler* efd, uint32_t events) {
+    EH* eh = fd_eh_.Slot(fd);
+    if (!eh) {
+        return -1;
+    }
+
+    if (eh->efd && Disarm(eh) != 0) {
+        return -1;
+    }
+
+    eh->fd = fd;
+    eh->events = events;
+    eh->efd = efd;
+
+    return Arm(eh);
+}
+
+int UringEvent::ModEvent(int fd, uint32_t events) {
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
+        LOG_ERROR(RAFT_LOG(), "fd not in io_uring, can not mod, fd: %d\n", fd);
+        return -1;
+    }
+
+    if (Disarm(eh) != 0) {
+        return -1;
+    }
+    eh->events = events;
+
+    return Arm(eh);
+}
+
+int UringEvent::RemodEvent(int fd) {
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
+        LOG_ERROR(RAFT_LOG(), "fd not in io_uring, can not mod, fd: %d\n", fd);
+        return -1;
+    }
+
+    // a new poll checks the current state, so a still writable fd is reported again
+    if (Disarm(eh) != 0) {
+        return -1;
+    }
+
+    return Arm(eh);
+}
+
+int UringEvent::DelEvent(int fd) {
+    EH* eh = fd_eh_.Get(fd);
+    if (!eh || !eh->efd) {
+        return 0;
+    }
+
+    if (Disarm(eh) != 0) {
+        return -1;
+    }
+    eh->efd = NULL;
+
+    // the poll holds a file reference, drop it before the caller close()s
+    return Enter(to_submit_, 0, 0) < 0 ? -1 : 0;
+}
+
+int UringEvent::Wait(int timeout) {
+    if (Enter(to_submit_, 1, timeout) < 0) {
+        return -1;
+    }
+
+    int n = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        for (; head != tail; head++) {
+            io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+
+            // free the slot first, the handler may prepare more sqes
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+            Dispatch(user_data, res, flags);
+            n++;
+        }
+        tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+
+    return n;
+}
+
+void UringEvent::Dispatch(uint64_t user_data, int res, uint32_t flags) {
+    if (user_data == UD_IGNORE) {
+        return;
+    }
+
+    if ((user_data & 3) == UD_POLL) {
+        int fd = static_cast<int>(user_data >> 32);
+        uint32_t gen = static_cast<uint32_t>(user_data >> 2) & GEN_MASK;
+
+        EH* eh = fd_eh_.Get(fd);
+        if (!eh || !eh->efd || !eh->armed || eh->gen != gen) {
+            return;     // removed or re-armed since
+        }
+        DispatchPoll(eh, res, flags);
+        return;
+    }
+
+    reinterpret_cast<Completion*>(user_data)->OnComplete(res, flags);
+}
+
+void UringEvent::DispatchPoll(EH* eh, int res, uint32_t flags) {
+    int fd = eh->fd;
+    uint32_t gen = eh->gen;
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        eh->armed = false;
+    }
+
+    if (res < 0) {
+        LOG_ERROR(RAFT_LOG(), "io_uring poll error fd: %d, %s\n", fd, strerror(-res));
+        std::string error = strerror(-res);
+        eh->efd->OnError(fd, EPOLLERR, -res, error);
+    } else {
+        uint32_t events = static_cast<uint32_t>(res);
+
+        if (events & (EPOLLERR|EPOLLHUP)) {
+            LOG_ERROR(RAFT_LOG(), "EPOLLERR | EPOLLHUP fd: %d\n", fd);
+
+            std::string error = strerror(errno);
+            eh->efd->OnError(fd, events, errno, error);
+
+            if ((events & (EPOLLIN|EPOLLOUT)) == 0) {
+                // since nginx do this way
+                events |= EPOLLIN | EPOLLOUT;
+            }
+        }
+
+        // handlers may DelEvent / re-add the fd, check the slot each time
+        if ((events & EPOLLIN) && eh->efd && eh->gen == gen) {
+            eh->efd->OnRead(fd, events);
+        }
+
+        if ((events & EPOLLOUT) && eh->efd && eh->gen == gen) {
+            eh->efd->OnWrite(fd, events);
+        }
+    }
+
+    // multishot poll ended (overflow, error), arm again if still wanted
+    if (eh->efd && eh->gen == gen && !eh->armed) {
+        Arm(eh);
+    }
+}
+
+int UringEvent::Writev(int fd, const iovec* iov, int iovcnt, uint64_t offset, Completion* c, bool link) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(iov);
+    sqe->len = iovcnt;
+    sqe->off = offset;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = reinterpret_cast<uint64_t>(c);
+
+    return 0;
+}
+
+int UringEvent::Fsync(int fd, bool datasync, Completion* c, bool link) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = reinterpret_cast<uint64_t>(c);
+
+    return 0;
+}
+
+int UringEvent::Sendmsg(int fd, const msghdr* msg, int flags, Completion* c) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = flags;
+    sqe->user_data = reinterpret_cast<uint64_t>(c);
+
+    return 0;
+}
+
+int UringEvent::Accept(int listen_fd, Completion* c) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = reinterpret_cast<uint64_t>(c);
+
+    return 0;
+}
+
+int UringEvent::Recv(int fd, Completion* c) {
+    if (!buf_ring_) {
+        LOG_ERROR(RAFT_LOG(), "io_uring Recv without buffer ring, fd: %d\n", fd);
+        return -1;
+    }
+
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = reinterpret_cast<uint64_t>(c);
+
+    return 0;
+}
+
+int UringEvent::Cancel(Completion* c) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(c);
+    sqe->user_data = UD_IGNORE;
+
+    return 0;
+}
+
+int UringEvent::Submit() {
+    return Enter(to_submit_, 0, 0) < 0 ? -1 : 0;
+}
+
+int UringEvent::SetupBufferRing(uint32_t count, uint32_t size) {
+    if (buf_ring_ || count == 0 || (count & (count - 1)) || count > 32768) {
+        return -1;
+    }
+
+    buf_ring_len_ = count * sizeof(io_uring_buf);
+    void* ring = mmap(NULL, buf_ring_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        LOG_ERROR(RAFT_LOG(), "io_uring buffer ring mmap error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = count;
+    reg.bgid = 0;
+
+    if (io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        LOG_ERROR(RAFT_LOG(), "io_uring register buffer ring error: %d, %s\n", errno, strerror(errno));
+        munmap(ring, buf_ring_len_);
+        return -1;
+    }
+
+    buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+    bufs_ = new char[static_cast<size_t>(count) * size];
+    buf_count_ = count;
+    buf_size_ = size;
+
+    for (uint32_t i = 0; i < count; i++) {
+        RecycleBuffer(static_cast<uint16_t>(i));
+    }
+
+    return 0;
+}
+
+char* UringEvent::BufferOf(uint32_t cqe_flags, uint16_t* bid) {
+    if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+        return NULL;
+    }
+
+    *bid = static_cast<uint16_t>(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+    return bufs_ + static_cast<size_t>(*bid) * buf_size_;
+}
+
+void UringEvent::RecycleBuffer(uint16_t bid) {
+    // not buf_ring_->bufs, in C++ the uapi flex array is not at offset 0
+    uint16_t tail = buf_ring_->tail;
+    io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(buf_ring_) + (tail & (buf_count_ - 1));
+
+    buf->addr = reinterpret_cast<uint64_t>(bufs_ + static_cast<size_t>(bid) * buf_size_);
+    buf->len = buf_size_;
+    buf->bid = bid;
+
+    __atomic_store_n(&buf_ring_->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+}  // namespace dc
@@ -0,0 +1,302 @@
+#include "apply_pipeline.h"
+#include "log.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+
+namespace dcraft {
+
+ApplyPipeline::ApplyPipeline(Fsm* fsm, LogStore* store, uint32_t ring_size, uint32_t workers)
+    : fsm_(fsm)
+    , store_(store)
+    , reads_(NULL)
+    , snapshotter_(NULL)
+    , snapshot_entries_(0)
+    , ee_(NULL)
+    , slab_(NULL)
+    , ring_(ring_size ? ring_size : DEFAULT_APPLY_RING)
+    , submitted_index_(0)
+    , apply_fd_(-1)
+    , done_fd_(-1)
+    , sleeping_(false)
+    , notified_(false)
+    , stop_(false)
+    , applied_index_(0)
+    , snapshot_index_(0)
+    , batch_gen_(0)
+    , batch_left_(0)
+    , workers_stop_(false)
+    , apply_us_(dc::RAFT_METRICS()->GetHistogram("raft_commit_apply_us")) {
+    for (uint32_t i = 0; i < workers; i++) {
+        workers_.push_back(new Worker());
+    }
+}
+
+ApplyPipeline::~ApplyPipeline() {
+    Stop();
+
+    // submitted, never applied
+    size_t left = ring_.Readable();
+    for (size_t i = 0; i < left; i++) {
+        ring_.At(i)->data->Release();
+    }
+    ring_.Pop(left);
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        delete workers_[i];
+    }
+    workers_.clear();
+
+    if (done_fd_ != -1) {
+        if (ee_) {
+            ee_->DelEvent(done_fd_);
+        }
+        close(done_fd_);
+        done_fd_ = -1;
+    }
+    if (apply_fd_ != -1) {
+        close(apply_fd_);
+        apply_fd_ = -1;
+    }
+}
+
+void ApplyPipeline::SetSnapshotter(Snapshotter* snapshotter, uint64_t snapshot_entries) {
+    snapshotter_ = snapshotter;
+    snapshot_entries_ = snapshot_entries;
+}
+
+int ApplyPipeline::Initialize(dc::EventLoop* ee, uint64_t applied_index) {
+    submitted_index_ = applied_index;
+    applied_index_ = applied_index;
+    snapshot_index_ = applied_index;
+
+    apply_fd_ = eventfd(0, EFD_CLOEXEC);
+    done_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (apply_fd_ < 0 || done_fd_ < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, eventfd error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    // NULL: the caller polls applied_index()
+    ee_ = ee;
+    if (ee_ && ee_->AddEvent(done_fd_, this, EPOLLIN) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, AddEvent eventfd error: %d, %s\n", errno, strerror(errno));
+        ee_ = NULL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        Worker* w = workers_[i];
+        w->thread = std::thread(&ApplyPipeline::RunWorker, this, w);
+    }
+    thread_ = std::thread(&ApplyPipeline::Run, this);
+
+    return 0;
+}
+
+void ApplyPipeline::Wake(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, wake up error: %d, %s\n", errno, strerror(errno));
+    }
+}
+
+uint64_t ApplyPipeline::Submit(uint64_t commit_index) {
+    uint64_t n = 0;
+    uint64_t now = submitted_index_ < commit_index ? dc::NowUs() : 0;
+    while (submitted_index_ < commit_index) {
+        Item* slot = ring_.Reserve();
+        if (!slot) {
+            break;      // apply is behind, the rest goes next tick
+        }
+        slot->index = submitted_index_ + 1;
+        if (store_->Get(slot->index, slab_, &slot->term, &slot->data) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, get entry fail, index:%" PRIu64 "\n", submitted_index_ + 1);
+            break;
+        }
+        slot->submit_us = now;
+        ring_.Commit();
+        submitted_index_++;
+        n++;
+    }
+
+    // pairs with the fence in Run(), either it sees the entries or we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (n > 0 && sleeping_.exchange(false)) {
+        Wake(apply_fd_);
+    }
+
+    return n;
+}
+
+void ApplyPipeline::Stop() {
+    if (thread_.joinable()) {
+        stop_ = true;
+        Wake(apply_fd_);
+        thread_.join();
+    }
+
+    // the apply thread is gone, no batch is waiting for the workers
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        workers_stop_ = true;
+    }
+    work_cv_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        if (workers_[i]->thread.joinable()) {
+            workers_[i]->thread.join();
+        }
+    }
+}
+
+void ApplyPipeline::Run() {
+    while (!stop_) {
+        size_t n = ring_.Readable();
+        if (n == 0) {
+            sleeping_ = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring_.Readable() == 0 && !stop_) {
+                uint64_t count;
+                if (read(apply_fd_, &count, sizeof(count)) < 0 && errno != EINTR) {
+                    LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, read eventfd error: %d, %s\n", errno, strerror(errno));
+                }
+            }
+            sleeping_ = false;
+            continue;
+        }
+
+        if (n > APPLY_BATCH_ENTRIES) {
+            n = APPLY_BATCH_ENTRIES;
+        }
+        if (workers_.empty()) {
+            ApplySerial(n);
+        } else {
+            Retire(ApplyParallel(n));
+        }
+    }
+}
+
+void ApplyPipeline::Retire(size_t n) {
+    const Item* last = ring_.At(n - 1);
+    uint64_t index = last->index;
+    uint64_t term = last->term;
+    uint64_t now = dc::NowUs();
+    for (size_t i = 0; i < n; i++) {
+        apply_us_->Record(now - ring_.At(i)->submit_us);
+        ring_.At(i)->data->Release();
+    }
+    ring_.Pop(n);
+
+    Publish(index, term);
+}
+
+void ApplyPipeline::ApplyOne(const Item& item) {
+    if (fsm_->Apply(item.index, item.data->data(), item.data->size()) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, apply fail, index:%" PRIu64 "\n", item.index);
+    }
+}
+
+void ApplyPipeline::ApplySerial(size_t n) {
+    // entry by entry, a slow Apply() still lets reads and Submit() move
+    for (size_t i = 0; i < n; i++) {
+        ApplyOne(*ring_.At(0));
+        Retire(1);
+    }
+}
+
+size_t ApplyPipeline::ApplyParallel(size_t n) {
+    size_t i = 0;
+    for (; i < n; i++) {
+        const Item* e = ring_.At(i);
+        uint64_t key = fsm_->Key(e->data->data(), e->data->size());
+        if (key == FSM_KEY_BARRIER) {
+            break;
+        }
+        workers_[key % workers_.size()]->entries.push_back(e);
+    }
+
+    if (i == 0) {
+        // barrier at the head, everything before it is applied
+        ApplyOne(*ring_.At(0));
+        return 1;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    batch_left_ = workers_.size();
+    batch_gen_++;
+    work_cv_.notify_all();
+    done_cv_.wait(lock, [this]() { return batch_left_ == 0; });
+
+    return i;
+}
+
+void ApplyPipeline::RunWorker(Worker* w) {
+    uint64_t gen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [this, gen]() { return batch_gen_ != gen || workers_stop_; });
+            if (batch_gen_ == gen) {
+                return;
+            }
+            gen = batch_gen_;
+        }
+
+        for (size_t i = 0; i < w->entries.size(); i++) {
+            ApplyOne(*w->entries[i]);
+        }
+        w->entries.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--batch_left_ == 0) {
+            done_cv_.notify_one();
+        }
+    }
+}
+
+void ApplyPipeline::Publish(uint64_t index, uint64_t term) {
+    applied_index_.store(index, std::memory_order_release);
+
+    // only the first batch after the loop woke up pays the write()
+    if (!notified_.exchange(true, std::memory_order_acq_rel)) {
+        Wake(done_fd_);
+    }
+
+    // the Fsm is quiet between two entries / batches, a snapshot may start here
+    if (snapshotter_ && snapshot_entries_ && index - snapshot_index_ >= snapshot_entries_) {
+        if (snapshotter_->Start(index, term) != 1) {
+            snapshot_index_ = index;    // started, or failed and retried an interval later
+        }
+    }
+}
+
+void ApplyPipeline::OnRead(int fd, uint32_t events) {
+    (void)events;
+
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) > 0) {
+    }
+
+    // clear before reading the index, a Publish() racing with us wakes us again
+    notified_.exchange(false, std::memory_order_acq_rel);
+    if (reads_) {
+        reads_->OnApplied(applied_index());
+    }
+}
+
+void ApplyPipeline::OnWrite(int fd, uint32_t events) {
+    (void)fd;
+    (void)events;
+}
+
+void ApplyPipeline::OnError(int fd, uint32_t events, int err, std::string& error) {
+    (void)events;
+    LOG_ERROR(dc::RAFT_LOG(), "ApplyPipeline, OnError fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+}
+
+}   // namespace dcraft
@@ -0,0 +1,386 @@
+#include "election.h"
+#include "log.h"
+#include "file_util.h"
+#include "crc32c.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+namespace dcraft {
+
+// a slot of raft.meta
+struct ElectionMeta {
+    uint32_t magic;
+    uint32_t crc;           // of the fields after it
+    uint64_t seq;           // the higher valid slot wins
+    uint64_t term;
+    uint64_t vote;
+};
+
+static uint32_t MetaCrc(const ElectionMeta& meta) {
+    return dc::Crc32c(0, &meta.seq, sizeof(meta) - offsetof(ElectionMeta, seq));
+}
+
+Election::Election(LogStore* store, LogReplicate* replicate, uint64_t self_id, const std::string& dir,
+                   uint32_t election_timeout_ms, bool pre_vote, bool check_quorum)
+    : store_(store)
+    , replicate_(replicate)
+    , listener_(NULL)
+    , self_id_(self_id)
+    , path_(dir + "/" + ELECTION_META_FILE)
+    , timeout_ms_(election_timeout_ms ? election_timeout_ms : 1)
+    , pre_vote_(pre_vote)
+    , check_quorum_(check_quorum)
+    , role_(ROLE_FOLLOWER)
+    , term_(0)
+    , vote_(0)
+    , leader_id_(0)
+    , timer_start_ms_(0)
+    , timer_ms_(0)
+    , leader_seen_ms_(0)
+    , seed_(static_cast<unsigned int>(self_id ^ dc::NowUs()))
+    , fd_(-1)
+    , meta_seq_(0)
+    , elections_(dc::RAFT_METRICS()->GetCounter("raft_elections"))
+    , pre_vote_fails_(dc::RAFT_METRICS()->GetCounter("raft_pre_vote_fails"))
+    , quorum_losses_(dc::RAFT_METRICS()->GetCounter("raft_check_quorum_step_downs")) {
+}
+
+Election::~Election() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void Election::AddPeer(uint64_t id) {
+    Peer p = {false, 0};
+    peers_[id] = p;
+}
+
+void Election::RemovePeer(uint64_t id) {
+    peers_.erase(id);
+}
+
+int Election::Initialize(uint64_t now_ms) {
+    if (LoadMeta() != 0) {
+        return -1;
+    }
+
+    role_ = ROLE_FOLLOWER;
+    leader_id_ = 0;
+    ResetTimer(now_ms);
+    return 0;
+}
+
+int Election::LoadMeta() {
+    if (dc::MakeDirs(path_.substr(0, path_.rfind('/'))) != 0) {
+        return -1;
+    }
+
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Election, open meta fail, path:%s, errno:%d, error:%s\n", path_.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    // a torn write only breaks the slot being written, the other one holds
+    for (int i = 0; i < 2; i++) {
+        ElectionMeta meta;
+        if (dc::PreadFull(fd_, &meta, sizeof(meta), i * ELECTION_META_SLOT) != 0
+            || meta.magic != ELECTION_META_MAGIC || meta.crc != MetaCrc(meta)) {
+            continue;
+        }
+        if (meta.seq > meta_seq_) {
+            meta_seq_ = meta.seq;
+            term_ = meta.term;
+            vote_ = meta.vote;
+        }
+    }
+    return 0;
+}
+
+int Election::SaveMeta() {
+    ElectionMeta meta;
+    meta.magic = ELECTION_META_MAGIC;
+    meta.seq = meta_seq_ + 1;
+    meta.term = term_;
+    meta.vote = vote_;
+    meta.crc = MetaCrc(meta);
+
+    if (pwrite(fd_, &meta, sizeof(meta), (meta.seq & 1) * ELECTION_META_SLOT) != static_cast<ssize_t>(sizeof(meta))
+        || fdatasync(fd_) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Election, save meta fail, path:%s, errno:%d, error:%s\n", path_.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    meta_seq_ = meta.seq;
+    return 0;
+}
+
+void Election::ResetTimer(uint64_t now_ms) {
+    timer_start_ms_ = now_ms;
+    timer_ms_ = timeout_ms_ + rand_r(&seed_) % timeout_ms_;
+}
+
+bool Election::InLease(uint64_t now_ms) const {
+    return check_quorum_ && leader_id_ != 0 && now_ms - leader_seen_ms_ < timeout_ms_;
+}
+
+bool Election::LogUpToDate(uint64_t last_index, uint64_t last_term) {
+    uint64_t my_index = store_->last_index();
+    uint64_t my_term = store_->Term(my_index);
+    return last_term > my_term || (last_term == my_term && last_index >= my_index);
+}
+
+int Election::OnMessageTerm(uint64_t term, uint64_t from_leader, uint64_t now_ms) {
+    if (term < term_) {
+        return -1;
+    }
+
+    if (term > term_ || (from_leader && (role_ != ROLE_FOLLOWER || leader_id_ != from_leader))) {
+        BecomeFollower(term, from_leader, now_ms);
+    }
+    if (from_leader) {
+        timer_start_ms_ = now_ms;
+        leader_seen_ms_ = now_ms;
+    }
+    return 0;
+}
+
+void Election::OnRequestVote(const RequestVoteRequest& req, uint64_t now_ms) {
+    if (req.term > term_ && InLease(now_ms)) {
+        // a leader is alive, the candidate times out
+        return;
+    }
+
+    if (!req.pre_vote && req.term > term_) {
+        BecomeFollower(req.term, 0, now_ms);
+    }
+
+    RequestVoteResponse resp;
+    resp.term = term_;
+    resp.from_id = self_id_;
+    resp.granted = false;
+    resp.pre_vote = req.pre_vote;
+
+    bool up_to_date = LogUpToDate(req.last_log_index, req.last_log_term);
+    if (req.pre_vote) {
+        resp.granted = req.term > term_ && up_to_date;
+        if (resp.granted) {
+            resp.term = req.term;
+        }
+    } else if (req.term == term_ && (vote_ == 0 || vote_ == req.candidate_id) && up_to_date) {
+        uint64_t vote = vote_;
+        vote_ = req.candidate_id;
+        if (vote == 0 && SaveMeta() != 0) {
+            vote_ = 0;      // a vote that is not durable may be given twice
+        } else {
+            resp.granted = true;
+            ResetTimer(now_ms);
+        }
+    }
+
+    LogReplicate::Follower* f = replicate_->GetFollower(req.candidate_id);
+    if (!f || !f->conn) {
+        return;
+    }
+    sendBuf_.clear();
+    EncodeRequestVoteResp(resp, &sendBuf_, replicate_->group());
+    f->conn->Send(sendBuf_);
+}
+
+void Election::OnRequestVoteResponse(const RequestVoteResponse& resp, uint64_t now_ms) {
+    if (resp.term > term_ && !(resp.pre_vote && resp.granted)) {
+        BecomeFollower(resp.term, 0, now_ms);
+        return;
+    }
+
+    if (resp.pre_vote ? role_ != ROLE_PRE_CANDIDATE || (resp.granted && resp.term != term_ + 1)
+                      : role_ != ROLE_CANDIDATE || resp.term != term_) {
+        return;     // of an older round
+    }
+
+    std::map<uint64_t, Peer>::iterator it = peers_.find(resp.from_id);
+    if (it == peers_.end()) {
+        return;
+    }
+    it->second.vote = resp.granted ? 1 : -1;
+    Tally(now_ms);
+}
+
+void Election::OnPeerActive(uint64_t id) {
+    std::map<uint64_t, Peer>::iterator it = peers_.find(id);
+    if (it != peers_.end()) {
+        it->second.active = true;
+    }
+}
+
+void Election::Tick(uint64_t now_ms) {
+    if (role_ == ROLE_LEADER) {
+        if (!check_quorum_ || now_ms - leader_seen_ms_ < timeout_ms_) {
+            return;
+        }
+
+        uint32_t active = 1;
+        std::map<uint64_t, Peer>::iterator it;
+        for (it = peers_.begin(); it != peers_.end(); it++) {
+            if (it->second.active) {
+                active++;
+            }
+            it->second.active = false;
+        }
+        if (active >= Quorum()) {
+            leader_seen_ms_ = now_ms;
+            return;
+        }
+
+        LOG_WARNING(dc::RAFT_LOG(), "Election, quorum lost, step down, term:%" PRIu64 ", active:%u\n", term_, active);
+        quorum_losses_->Add(1);
+        BecomeFollower(term_, 0, now_ms);
+        return;
+    }
+
+    if (now_ms - timer_start_ms_ >= timer_ms_) {
+        Campaign(now_ms);
+    }
+}
+
+void Election::Campaign(uint64_t now_ms) {
+    if (!pre_vote_) {
+        StartElection(now_ms);
+        return;
+    }
+
+    if (role_ == ROLE_PRE_CANDIDATE) {
+        pre_vote_fails_->Add(1);   // the last round got no majority in time
+    }
+    role_ = ROLE_PRE_CANDIDATE;
+    leader_id_ = 0;
+    ResetTimer(now_ms);
+
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        it->second.vote = 0;
+    }
+    SendRequestVote(true, term_ + 1);
+    Tally(now_ms);
+}
+
+void Election::StartElection(uint64_t now_ms) {
+    term_++;
+    vote_ = self_id_;
+    leader_id_ = 0;
+    ResetTimer(now_ms);
+    if (SaveMeta() != 0) {
+        role_ = ROLE_FOLLOWER;      // retried at the next timeout
+        return;
+    }
+
+    role_ = ROLE_CANDIDATE;
+    elections_->Add(1);
+    LOG_INFO(dc::RAFT_LOG(), "Election, campaign, id:%" PRIu64 ", term:%" PRIu64 "\n", self_id_, term_);
+    if (listener_) {
+        listener_->OnBecomeFollower(term_, 0);
+    }
+
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        it->second.vote = 0;
+    }
+    SendRequestVote(false, term_);
+    Tally(now_ms);
+}
+
+void Election::SendRequestVote(bool pre_vote, uint64_t term) {
+    RequestVoteRequest req;
+    req.term = term;
+    req.candidate_id = self_id_;
+    req.last_log_index = store_->last_index();
+    req.last_log_term = store_->Term(req.last_log_index);
+    req.pre_vote = pre_vote;
+
+    sendBuf_.clear();
+    EncodeRequestVote(req, &sendBuf_, replicate_->group());
+
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        LogReplicate::Follower* f = replicate_->GetFollower(it->first);
+        if (f && f->conn) {
+            f->conn->Send(sendBuf_);
+        }
+    }
+}
+
+void Election::Tally(uint64_t now_ms) {
+    uint32_t granted = 1;       // self
+    uint32_t rejected = 0;
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        if (it->second.vote > 0) {
+            granted++;
+        } else if (it->second.vote < 0) {
+            rejected++;
+        }
+    }
+
+    if (granted >= Quorum()) {
+        if (role_ == ROLE_PRE_CANDIDATE) {
+            StartElection(now_ms);
+        } else {
+            BecomeLeader(now_ms);
+        }
+        return;
+    }
+
+    // a majority can not be reached any more
+    if (rejected > peers_.size() + 1 - Quorum()) {
+        if (role_ == ROLE_PRE_CANDIDATE) {
+            pre_vote_fails_->Add(1);
+        }
+        BecomeFollower(term_, 0, now_ms);
+    }
+}
+
+void Election::BecomeFollower(uint64_t term, uint64_t leader_id, uint64_t now_ms) {
+    bool changed = term != term_ || role_ != ROLE_FOLLOWER || leader_id != leader_id_;
+    if (term > term_) {
+        term_ = term;
+        vote_ = 0;
+        SaveMeta();     // failing keeps the old term on disk, no vote is given in it
+    }
+
+    role_ = ROLE_FOLLOWER;
+    leader_id_ = leader_id;
+    ResetTimer(now_ms);
+    if (leader_id) {
+        leader_seen_ms_ = now_ms;
+    }
+
+    if (changed && listener_) {
+        listener_->OnBecomeFollower(term_, leader_id_);
+    }
+}
+
+void Election::BecomeLeader(uint64_t now_ms) {
+    role_ = ROLE_LEADER;
+    leader_id_ = self_id_;
+    leader_seen_ms_ = now_ms;
+
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        it->second.active = false;
+    }
+
+    LOG_INFO(dc::RAFT_LOG(), "Election, leader, id:%" PRIu64 ", term:%" PRIu64 "\n", self_id_, term_);
+    if (listener_) {
+        listener_->OnBecomeLeader(term_);
+    }
+}
+
+}   // namespace dcraft
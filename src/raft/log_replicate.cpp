@@ -0,0 +1,488 @@
+#include "log_replicate.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace dcraft {
+
+LogReplicate::LogReplicate(LogStore* store, uint64_t self_id,
+                           uint32_t batch_entries, uint64_t batch_bytes)
+    : store_(store)
+    , self_id_(self_id)
+    , term_(0)
+    , commit_index_(0)
+    , read_seq_(0)
+    , group_(0)
+    , batcher_(NULL)
+    , slab_(NULL)
+    , batch_entries_(batch_entries)
+    , batch_bytes_(batch_bytes)
+    , compress_type_(dc::COMPRESS_NONE)
+    , compress_min_bytes_(DEFAULT_COMPRESS_MIN_BYTES)
+    , snapshot_index_(0)
+    , snapshot_term_(0)
+    , commit_us_(dc::RAFT_METRICS()->GetHistogram("raft_propose_commit_us")) {
+}
+
+LogReplicate::~LogReplicate() {
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        StopSnapshot(&it->second);
+    }
+}
+
+int LogReplicate::AddFollower(uint64_t id, dc::SocketFdHandler* conn,
+                              uint32_t max_inflight_msgs, uint64_t max_inflight_bytes) {
+    if (followers_.find(id) != followers_.end()) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogReplicate, follower exist, id:%" PRIu64 "\n", id);
+        return -1;
+    }
+
+    Follower f;
+    f.id = id;
+    f.conn = conn;
+    f.state = STATE_PROBE;
+    f.next_index = store_->last_index() + 1;
+    f.match_index = 0;
+    f.probe_prev = 0;
+    f.read_seq = 0;
+    f.max_inflight_msgs = max_inflight_msgs ? max_inflight_msgs : DEFAULT_INFLIGHT_MSGS;
+    f.max_inflight_bytes = max_inflight_bytes ? max_inflight_bytes : DEFAULT_INFLIGHT_BYTES;
+    f.inflight_bytes = 0;
+    f.snapshot = NULL;
+    f.codecs = 0;
+    f.compressor = NULL;
+
+    char labels[64];
+    snprintf(labels, sizeof(labels), "peer=\"%" PRIu64 "\"", id);
+    f.rtt_us = dc::RAFT_METRICS()->GetHistogram("raft_append_rtt_us", labels);
+    f.sent_bytes = dc::RAFT_METRICS()->GetCounter("raft_peer_sent_bytes", labels);
+    f.recv_bytes = dc::RAFT_METRICS()->GetCounter("raft_peer_recv_bytes", labels);
+    if (conn) {
+        conn->SetCounters(f.sent_bytes, f.recv_bytes);
+    }
+
+    followers_[id] = f;
+
+    return 0;
+}
+
+int LogReplicate::RemoveFollower(uint64_t id) {
+    Follower* f = GetFollower(id);
+    if (f) {
+        StopSnapshot(f);
+        followers_.erase(id);
+    }
+    return 0;
+}
+
+LogReplicate::Follower* LogReplicate::GetFollower(uint64_t id) {
+    std::map<uint64_t, Follower>::iterator it = followers_.find(id);
+    if (it == followers_.end()) {
+        return NULL;
+    }
+    return &it->second;
+}
+
+void LogReplicate::ResetFollower(uint64_t id, dc::SocketFdHandler* conn) {
+    Follower* f = GetFollower(id);
+    if (!f) {
+        return;
+    }
+
+    f->conn = conn;
+    if (conn) {
+        conn->SetCounters(f->sent_bytes, f->recv_bytes);
+    }
+    f->codecs = 0;              // plain until the hello on the new connection
+    SetCompressor(f);
+    f->inflight.clear();
+    f->inflight_bytes = 0;
+
+    if (f->state == STATE_SNAPSHOT) {
+        // resume the transfer from what the follower has synced
+        f->snapshot->Rewind();
+        return;
+    }
+
+    f->state = STATE_PROBE;
+    f->next_index = f->match_index + 1;
+}
+
+void LogReplicate::Reset(uint64_t term) {
+    term_ = term;
+
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        Follower& f = it->second;
+        StopSnapshot(&f);
+        f.state = STATE_PROBE;
+        f.next_index = store_->last_index() + 1;
+        f.match_index = 0;
+        f.read_seq = 0;
+        f.inflight.clear();
+        f.inflight_bytes = 0;
+    }
+
+    proposed_.clear();
+}
+
+int LogReplicate::SendBatch(Follower* f) {
+    AppendEntriesRequest req;
+    req.term = term_;
+    req.leader_id = self_id_;
+    req.prev_log_index = f->next_index - 1;
+    req.prev_log_term = 0;
+    req.leader_commit = commit_index_;
+    req.read_seq = read_seq_;
+
+    if (req.prev_log_index > 0) {
+        req.prev_log_term = store_->Term(req.prev_log_index);
+        if (req.prev_log_term == 0) {
+            // compacted, the follower needs a snapshot
+            LOG_ERROR(dc::RAFT_LOG(), "LogReplicate, prev log not in store, id:%" PRIu64 ", index:%" PRIu64 "\n", f->id, req.prev_log_index);
+            return -1;
+        }
+    }
+
+    uint64_t bytes = 0;
+    uint64_t last = store_->last_index();
+    sendEntries_.clear();
+    for (uint64_t i = f->next_index; i <= last && sendEntries_.size() < batch_entries_ && bytes < batch_bytes_; i++) {
+        EntryBuffer e = {i, 0, NULL, 0};
+        if (store_->Get(i, slab_, &e.term, &e.data, &e.crc) != 0) {
+            break;
+        }
+        sendEntries_.push_back(e);
+        bytes += e.data->size();
+    }
+
+    if (sendEntries_.empty()) {
+        // unreadable, an empty AppendEntries would pass for an ack of nothing
+        LOG_ERROR(dc::RAFT_LOG(), "LogReplicate, read entry fail, id:%" PRIu64 ", index:%" PRIu64 "\n", f->id, f->next_index);
+        return -2;
+    }
+
+    if (f->compressor && bytes >= compress_min_bytes_) {
+        EncodeAppendEntries(req, sendEntries_, f->compressor, &compressScratch_, &sendChain_, slab_, group_);
+    } else {
+        EncodeAppendEntries(req, sendEntries_, &sendChain_, slab_, group_);
+    }
+    f->conn->Send(sendChain_);
+
+    // the send queue holds its own refs
+    for (size_t i = 0; i < sendEntries_.size(); i++) {
+        sendEntries_[i].data->Release();
+    }
+
+    Inflight in = {req.prev_log_index + sendEntries_.size(), bytes, dc::NowUs()};
+    f->inflight.push_back(in);
+    f->inflight_bytes += bytes;
+
+    f->probe_prev = req.prev_log_index;
+    f->next_index = in.last_index + 1;      // optimistic, rewind on reject
+    return 0;
+}
+
+int LogReplicate::StartSnapshot(Follower* f) {
+    if (snapshot_path_.empty()) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogReplicate, no snapshot to send, id:%" PRIu64 "\n", f->id);
+        return -1;
+    }
+
+    SnapshotSender* sender = new SnapshotSender(self_id_);
+    sender->set_group(group_);
+    sender->set_compressor(f->compressor, slab_);
+    if (sender->Open(snapshot_path_, snapshot_index_, snapshot_term_) != 0) {
+        delete sender;
+        return -1;
+    }
+
+    LOG_INFO(dc::RAFT_LOG(), "LogReplicate, send snapshot, id:%" PRIu64 ", index:%" PRIu64 ", size:%" PRIu64 "\n",
+             f->id, snapshot_index_, sender->size());
+
+    f->snapshot = sender;
+    f->state = STATE_SNAPSHOT;
+    f->inflight.clear();
+    f->inflight_bytes = 0;
+
+    sender->Pump(f->conn, term_);
+    return 0;
+}
+
+void LogReplicate::StopSnapshot(Follower* f) {
+    if (f->snapshot) {
+        delete f->snapshot;
+        f->snapshot = NULL;
+    }
+}
+
+void LogReplicate::SendTo(Follower* f) {
+    if (!f->conn) {
+        return;
+    }
+
+    if (f->state == STATE_SNAPSHOT) {
+        f->snapshot->Pump(f->conn, term_);
+        return;
+    }
+
+    uint64_t last = store_->last_index();
+
+    if (f->state == STATE_PROBE) {
+        if (f->inflight.empty() && f->next_index <= last && SendBatch(f) == -1) {
+            StartSnapshot(f);
+        }
+        return;
+    }
+
+    while (f->next_index <= last
+           && f->inflight.size() < f->max_inflight_msgs
+           && f->inflight_bytes < f->max_inflight_bytes) {
+        int ret = SendBatch(f);
+        if (ret == -1) {
+            StartSnapshot(f);
+        }
+        if (ret != 0) {
+            break;      // -2: retried by the next Replicate() / ack
+        }
+    }
+}
+
+void LogReplicate::Replicate() {
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        SendTo(&it->second);
+        if (it->second.conn) {
+            it->second.conn->SendNow();
+        }
+    }
+}
+
+void LogReplicate::set_compress(int type, uint32_t min_bytes) {
+    if (type != dc::COMPRESS_NONE && !dc::GetCompressor(type)) {
+        LOG_WARNING(dc::RAFT_LOG(), "LogReplicate, unknown compress type:%d\n", type);
+        type = dc::COMPRESS_NONE;
+    }
+    compress_type_ = type;
+    compress_min_bytes_ = min_bytes;
+
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        SetCompressor(&it->second);
+    }
+}
+
+void LogReplicate::OnHello(const Hello& hello) {
+    Follower* f = GetFollower(hello.from_id);
+    if (f) {
+        f->codecs = hello.codecs;
+        SetCompressor(f);
+    }
+}
+
+void LogReplicate::SetCompressor(Follower* f) {
+    f->compressor = NULL;
+    if (compress_type_ != dc::COMPRESS_NONE && (f->codecs & (1u << compress_type_))) {
+        f->compressor = dc::GetCompressor(compress_type_);
+    }
+    if (f->snapshot) {
+        f->snapshot->set_compressor(f->compressor, slab_);
+    }
+}
+
+void LogReplicate::OnAppendEntriesResponse(const AppendEntriesResponse& resp) {
+    if (resp.term != term_) {
+        return;     // stale, or a newer term the Raft must handle
+    }
+
+    Follower* f = GetFollower(resp.from_id);
+    if (!f) {
+        return;
+    }
+
+    // a reject in our term still acknowledges us as leader
+    if (resp.read_seq > f->read_seq) {
+        f->read_seq = resp.read_seq;
+    }
+
+    if (f->state == STATE_SNAPSHOT) {
+        return;
+    }
+
+    if (resp.success) {
+        if (resp.match_index > f->match_index) {
+            f->match_index = resp.match_index;
+        }
+        if (f->next_index <= f->match_index) {
+            f->next_index = f->match_index + 1;
+        }
+
+        uint64_t now = f->inflight.empty() ? 0 : dc::NowUs();
+        while (!f->inflight.empty() && f->inflight.front().last_index <= f->match_index) {
+            f->rtt_us->Record(now - f->inflight.front().send_us);
+            f->inflight_bytes -= f->inflight.front().bytes;
+            f->inflight.pop_front();
+        }
+
+        if (f->state == STATE_PROBE && !f->inflight.empty()) {
+            return;     // a heartbeat ack, the probe is still unanswered
+        }
+
+        f->state = STATE_PIPELINE;
+        SendTo(f);
+        return;
+    }
+
+    // reject, only the newest probe matters, older pipelined ones are stale
+    if (resp.prev_log_index < f->match_index
+        || (f->state == STATE_PROBE && resp.prev_log_index != f->probe_prev)) {
+        return;
+    }
+
+    uint64_t next = std::min(resp.prev_log_index, resp.hint_index + 1);
+    f->next_index = std::max(next, f->match_index + 1);
+    f->state = STATE_PROBE;
+    f->inflight.clear();
+    f->inflight_bytes = 0;
+
+    SendTo(f);
+}
+
+void LogReplicate::Heartbeat() {
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        Follower& f = it->second;
+        if (batcher_) {
+            HeartbeatItem item = {group_, term_, std::min(commit_index_, f.match_index), read_seq_};
+            batcher_->AddHeartbeat(f.id, item);
+            continue;
+        }
+        if (!f.conn || f.state == STATE_SNAPSHOT) {
+            continue;
+        }
+
+        AppendEntriesRequest req;
+        req.term = term_;
+        req.leader_id = self_id_;
+        req.prev_log_index = f.match_index;
+        req.prev_log_term = 0;
+        req.leader_commit = std::min(commit_index_, f.match_index);
+        req.read_seq = read_seq_;
+
+        if (req.prev_log_index > 0) {
+            req.prev_log_term = store_->Term(req.prev_log_index);
+            if (req.prev_log_term == 0) {
+                continue;   // compacted, the next SendTo() starts a snapshot
+            }
+        }
+
+        sendEntries_.clear();
+        EncodeAppendEntries(req, sendEntries_, &sendChain_, slab_, group_);
+        f.conn->Send(sendChain_);
+    }
+}
+
+void LogReplicate::OnHeartbeatResponse(uint64_t from_id, const HeartbeatRespItem& resp) {
+    if (resp.term != term_ || !resp.success) {
+        return;     // a newer term is for the Raft to handle
+    }
+
+    Follower* f = GetFollower(from_id);
+    if (f && resp.read_seq > f->read_seq) {
+        f->read_seq = resp.read_seq;
+    }
+}
+
+uint64_t LogReplicate::ReadQuorumSeq() {
+    std::vector<uint64_t> seqs;
+    seqs.push_back(read_seq_);
+
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        seqs.push_back(it->second.read_seq);
+    }
+
+    std::sort(seqs.begin(), seqs.end(), std::greater<uint64_t>());
+    return seqs[seqs.size() / 2];
+}
+
+void LogReplicate::SetSnapshot(const std::string& path, uint64_t last_index, uint64_t last_term) {
+    snapshot_path_ = path;
+    snapshot_index_ = last_index;
+    snapshot_term_ = last_term;
+}
+
+void LogReplicate::OnInstallSnapshotResponse(const InstallSnapshotResponse& resp) {
+    if (resp.term != term_) {
+        return;
+    }
+
+    Follower* f = GetFollower(resp.from_id);
+    if (!f || f->state != STATE_SNAPSHOT) {
+        return;
+    }
+
+    int ret = f->snapshot->OnResponse(resp);
+    if (ret < 0) {
+        return;     // answer to an older transfer
+    }
+
+    if (ret == 0) {
+        f->snapshot->Pump(f->conn, term_);
+        return;
+    }
+
+    uint64_t index = f->snapshot->last_index();
+    StopSnapshot(f);
+
+    if (index > f->match_index) {
+        f->match_index = index;
+    }
+    f->next_index = f->match_index + 1;
+    f->state = STATE_PROBE;
+
+    SendTo(f);
+}
+
+uint64_t LogReplicate::CommitIndex() {
+    std::vector<uint64_t> matches;
+    matches.push_back(store_->durable_index());
+
+    std::map<uint64_t, Follower>::iterator it;
+    for (it = followers_.begin(); it != followers_.end(); it++) {
+        matches.push_back(it->second.match_index);
+    }
+
+    std::sort(matches.begin(), matches.end(), std::greater<uint64_t>());
+    uint64_t index = matches[matches.size() / 2];
+    // followers may be ahead of our fsync, apply only what survives our crash
+    if (index > store_->durable_index()) {
+        index = store_->durable_index();
+    }
+
+    if (index > commit_index_ && store_->Term(index) == term_) {
+        commit_index_ = index;
+
+        uint64_t now = proposed_.empty() ? 0 : dc::NowUs();
+        while (!proposed_.empty() && proposed_.front().index <= commit_index_) {
+            commit_us_->Record(now - proposed_.front().us);
+            proposed_.pop_front();
+        }
+    }
+
+    return commit_index_;
+}
+
+void LogReplicate::Proposed(uint64_t index) {
+    if (proposed_.size() < PROPOSAL_STAMPS_MAX) {
+        Stamp s = {index, dc::NowUs()};
+        proposed_.push_back(s);
+    }
+}
+
+}   // namespace dcraft
@@ -0,0 +1,1141 @@
+#include "log_store.h"
+#include "log.h"
+#include "file_util.h"
+#include "uring_event.h"
+#include "io_chain.h"
+#include "shared_wal.h"
+#include "tail_cache.h"
+#include "metrics.h"
+#include "crc32c.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <thread>
+#include <atomic>
+
+namespace dcraft {
+
+uint32_t EntryCrc(uint64_t index, uint64_t term, const char* data, uint32_t len) {
+    EntryHeader header;
+    header.index = index;
+    header.term = term;
+    header.len = len;
+    uint32_t crc = dc::Crc32c(0, &header, offsetof(EntryHeader, crc));
+    return dc::Crc32c(crc, data, len);
+}
+
+// one sqe of FlushAsync(), write (expect bytes) or fdatasync (expect 0)
+class LogStore::FlushOp : public dc::Completion {
+public:
+    FlushOp(LogStore* store, uint64_t expect)
+        : store_(store), expect_(expect) {
+    }
+
+    virtual void OnComplete(int res, uint32_t flags) {
+        (void)flags;
+        bool ok = res >= 0 && static_cast<uint64_t>(res) == expect_;
+        if (!ok) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, async flush op fail, res:%d, expect:%" PRIu64 "\n", res, expect_);
+        }
+
+        LogStore* store = store_;
+        delete this;
+        store->OnFlushOp(ok);
+    }
+
+    iovec iov;
+
+private:
+    LogStore* store_;
+    uint64_t expect_;
+};
+
+LogStore::LogStore(const std::string& dir, uint64_t segment_size)
+    : dir_(dir)
+    , segment_size_(segment_size)
+    , first_index_(1)
+    , last_index_(0)
+    , durable_index_(0)
+    , base_index_(0)
+    , base_term_(0)
+    , dir_dirty_(false)
+    , recover_threads_(DEFAULT_RECOVER_THREADS)
+    , recover_verify_(false)
+    , wal_(NULL)
+    , group_(0)
+    , replaying_(false)
+    , cache_(NULL)
+    , cache_slab_(NULL)
+    , inflight_ops_(0)
+    , inflight_index_(0)
+    , inflight_failed_(false)
+    , inflight_us_(0)
+    , fsync_us_(dc::RAFT_METRICS()->GetHistogram("raft_fsync_us", "file=\"segment\"")) {
+}
+
+LogStore::~LogStore() {
+    Flush();
+
+    if (wal_) {
+        wal_->Unregister(group_);
+    }
+
+    for (size_t i = 0; i < segments_.size(); i++) {
+        CloseSegment(segments_[i]);
+        delete segments_[i];
+    }
+    segments_.clear();
+}
+
+int LogStore::SetWal(SharedWal* wal, uint64_t group) {
+    if (wal->Register(group, this) != 0) {
+        return -1;
+    }
+    wal_ = wal;
+    group_ = group;
+    return 0;
+}
+
+void LogStore::SetTailCache(TailCache* cache, dc::Slab* slab) {
+    cache_ = cache;
+    cache_slab_ = slab;
+}
+
+int LogStore::Initialize() {
+    if (dc::MakeDirs(dir_) != 0) {
+        return -1;
+    }
+
+    std::vector<std::string> names;
+    if (dc::ListDir(dir_, &names) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < names.size(); i++) {
+        const std::string& name = names[i];
+        size_t suffix_len = strlen(LOG_SEGMENT_SUFFIX);
+        if (name.size() <= suffix_len || name.compare(name.size() - suffix_len, suffix_len, LOG_SEGMENT_SUFFIX) != 0) {
+            continue;
+        }
+
+        Segment* seg = new Segment;
+        seg->first_index = strtoull(name.c_str(), NULL, 10);
+        seg->fd = -1;
+        seg->file_size = 0;
+        seg->path = SegmentPath(seg->first_index, LOG_SEGMENT_SUFFIX);
+        seg->idx_fd = -1;
+        seg->index = NULL;
+        seg->count = 0;
+        seg->capacity = 0;
+        seg->idx_path = SegmentPath(seg->first_index, LOG_INDEX_SUFFIX);
+        seg->sealed = false;
+        seg->torn = false;
+        segments_.push_back(seg);
+    }
+
+    // a segment only touches its own files, take them from the back so the
+    // scan of the last one overlaps the sealed ones
+    size_t total = segments_.size();
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto recover = [this, total, &next, &failed]() {
+        size_t n;
+        while (!failed.load(std::memory_order_relaxed) && (n = next.fetch_add(1)) < total) {
+            size_t i = total - 1 - n;
+            if (RecoverSegment(segments_[i], i + 1 == total) != 0) {
+                failed.store(true, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < recover_threads_ && i < total; i++) {
+        threads.push_back(std::thread(recover));
+    }
+    recover();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    if (failed.load() || RecoverTornSegments() != 0) {
+        return -1;
+    }
+
+    for (size_t i = 1; i < segments_.size(); i++) {
+        Segment* prev = segments_[i - 1];
+        if (prev->first_index + prev->count != segments_[i]->first_index) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, segment not continuous, path:%s\n", segments_[i]->path.c_str());
+            return -1;
+        }
+    }
+
+    if (!segments_.empty()) {
+        Segment* back = segments_.back();
+        first_index_ = segments_.front()->first_index;
+        last_index_ = back->first_index + back->count - 1;
+        durable_index_ = last_index_;
+    }
+
+    return 0;
+}
+
+int LogStore::OpenIndex(Segment* seg, bool create) {
+    int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : (O_RDWR | O_CREAT);
+    seg->idx_fd = open(seg->idx_path.c_str(), flags, 0644);
+    if (seg->idx_fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, open index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(seg->idx_fd, &st) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, fstat index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    seg->capacity = st.st_size / sizeof(IndexItem);
+    if (seg->capacity == 0) {
+        seg->capacity = INDEX_INIT_CAPACITY;
+        if (ftruncate(seg->idx_fd, seg->capacity * sizeof(IndexItem)) != 0) {     // sparse, zero filled
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, ftruncate index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    void* addr = mmap(NULL, seg->capacity * sizeof(IndexItem), PROT_READ | PROT_WRITE, MAP_SHARED, seg->idx_fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, mmap index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    seg->index = static_cast<IndexItem*>(addr);
+
+    return 0;
+}
+
+int LogStore::GrowIndex(Segment* seg) {
+    uint64_t capacity = seg->capacity * 2;
+    if (ftruncate(seg->idx_fd, capacity * sizeof(IndexItem)) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, grow index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    void* addr = mremap(seg->index, seg->capacity * sizeof(IndexItem), capacity * sizeof(IndexItem), MREMAP_MAYMOVE);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, mremap index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    seg->index = static_cast<IndexItem*>(addr);
+    seg->capacity = capacity;
+    return 0;
+}
+
+int LogStore::SealSegment(Segment* seg) {
+    // with a wal the data was only written, a sealed segment is never checked again
+    if (wal_ && fdatasync(seg->fd) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, fdatasync segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    if (seg->count == seg->capacity && GrowIndex(seg) != 0) {
+        return -1;
+    }
+
+    // the records are durable before the seal record vouching for them
+    if (msync(seg->index, seg->capacity * sizeof(IndexItem), MS_SYNC) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, seal index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    // shrink to exact size, the seal record last
+    IndexItem seal = {seg->file_size, INDEX_SEALED_TERM};
+    seg->index[seg->count] = seal;
+    if (msync(seg->index, seg->capacity * sizeof(IndexItem), MS_SYNC) != 0
+        || ftruncate(seg->idx_fd, (seg->count + 1) * sizeof(IndexItem)) != 0
+        || fdatasync(seg->idx_fd) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, seal index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    // pages beyond it are gone, keep the mapping size in step
+    void* addr = mremap(seg->index, seg->capacity * sizeof(IndexItem), (seg->count + 1) * sizeof(IndexItem), 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, mremap index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    seg->capacity = seg->count + 1;
+    seg->sealed = true;
+
+    return 0;
+}
+
+void LogStore::CloseSegment(Segment* seg) {
+    if (seg->index) {
+        munmap(seg->index, seg->capacity * sizeof(IndexItem));
+        seg->index = NULL;
+    }
+    if (seg->idx_fd != -1) {
+        close(seg->idx_fd);
+        seg->idx_fd = -1;
+    }
+    if (seg->fd != -1) {
+        close(seg->fd);
+        seg->fd = -1;
+    }
+}
+
+int LogStore::RecoverSegment(Segment* seg, bool is_last) {
+    seg->fd = open(seg->path.c_str(), O_RDWR);
+    if (seg->fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, open segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(seg->fd, &st) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, fstat segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    seg->file_size = st.st_size;
+
+    if (OpenIndex(seg, false) != 0) {
+        return -1;
+    }
+
+    if (!is_last) {
+        // sealed: the seal record closes the idx and matches the segment
+        if (seg->capacity > 0) {
+            const IndexItem& seal = seg->index[seg->capacity - 1];
+            if (seal.term == INDEX_SEALED_TERM && seal.offset == seg->file_size) {
+                seg->count = seg->capacity - 1;
+                seg->sealed = true;
+                if (CheckIndexTail(seg) == 0) {
+                    return recover_verify_ ? VerifySegment(seg) : 0;
+                }
+            }
+        }
+
+        // not sealed before a crash (never msync'ed, may have holes), lost
+        // or stale: rebuild it from the segment, RecoverTornSegments() seals it
+        LOG_WARNING(dc::RAFT_LOG(), "LogStore, rebuild index, path:%s\n", seg->idx_path.c_str());
+        seg->count = 0;
+        seg->sealed = false;
+        if (ScanSegment(seg, 0) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, segment corrupt, path:%s\n", seg->path.c_str());
+            return -1;
+        }
+        seg->torn = seg->file_size != static_cast<uint64_t>(st.st_size);
+        return 0;
+    }
+
+    // active segment: idx pages may hit disk in any order, and any entry
+    // of the last batch may be torn, not only the last one. parse it all
+    // and rebuild the records, the scan stops at the first bad crc
+    seg->count = 0;
+    if (ScanSegment(seg, 0) != 0) {
+        return -1;
+    }
+
+    // clear stale records after count
+    for (uint64_t i = seg->count; i < seg->capacity; i++) {
+        if (seg->index[i].term != 0) {
+            memset(&seg->index[i], 0, sizeof(IndexItem));
+        }
+    }
+
+    if (seg->file_size != static_cast<uint64_t>(st.st_size)) {
+        // torn write at the tail
+        LOG_WARNING(dc::RAFT_LOG(), "LogStore, truncate torn tail, path:%s, offset:%" PRIu64 ", size:%" PRIu64 "\n",
+                    seg->path.c_str(), seg->file_size, static_cast<uint64_t>(st.st_size));
+        if (ftruncate(seg->fd, seg->file_size) != 0 || fdatasync(seg->fd) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, truncate segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * the non-last segments RecoverSegment() left unsealed. a batch that rolled
+ * over segments is written to all of them before the first seal, so a torn
+ * one means the crash came before that batch was durable: the segment is
+ * cut at its last good entry and the later ones, all unsealed, are dropped.
+ * a sealed segment after a torn one is damage, not a crash
+ */
+int LogStore::RecoverTornSegments() {
+    size_t total = segments_.size();
+    size_t torn = total;
+    for (size_t i = 0; i + 1 < total; i++) {
+        if (segments_[i]->torn) {
+            torn = i;
+            break;
+        }
+    }
+
+    for (size_t i = torn + 1; i < total; i++) {
+        if (segments_[i]->sealed) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, segment corrupt, sealed segment after it, path:%s\n", segments_[torn]->path.c_str());
+            return -1;
+        }
+    }
+
+    if (torn < total) {
+        Segment* seg = segments_[torn];
+        LOG_WARNING(dc::RAFT_LOG(), "LogStore, truncate torn tail, drop %zu later segments, path:%s, offset:%" PRIu64 "\n",
+                    total - torn - 1, seg->path.c_str(), seg->file_size);
+
+        while (segments_.size() > torn + 1) {
+            Segment* later = segments_.back();
+            CloseSegment(later);
+            if (unlink(later->path.c_str()) != 0 || unlink(later->idx_path.c_str()) != 0) {
+                LOG_ERROR(dc::RAFT_LOG(), "LogStore, unlink segment fail, path:%s, errno:%d, error:%s\n", later->path.c_str(), errno, strerror(errno));
+                return -1;
+            }
+            delete later;
+            segments_.pop_back();
+        }
+
+        // the active segment now, its records after count are stale
+        for (uint64_t i = seg->count; i < seg->capacity; i++) {
+            memset(&seg->index[i], 0, sizeof(IndexItem));
+        }
+        if (ftruncate(seg->fd, seg->file_size) != 0 || fdatasync(seg->fd) != 0 || dc::FsyncDir(dir_) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, truncate segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+        seg->torn = false;
+    }
+
+    // rebuilt complete ones before it
+    for (size_t i = 0; i + 1 < segments_.size(); i++) {
+        if (!segments_[i]->sealed && SealSegment(segments_[i]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * drop idx records at the tail that do not match the segment,
+ * return 0 if the last record ends exactly at file_size
+ */
+int LogStore::CheckIndexTail(Segment* seg) {
+    while (seg->count > 0) {
+        const IndexItem& item = seg->index[seg->count - 1];
+        EntryHeader header;
+        if (item.offset + sizeof(header) <= seg->file_size
+            && dc::PreadFull(seg->fd, &header, sizeof(header), item.offset) == 0
+            && header.index == seg->first_index + seg->count - 1
+            && header.term == item.term
+            && item.offset + sizeof(header) + header.len <= seg->file_size) {
+            return item.offset + sizeof(header) + header.len == seg->file_size ? 0 : -1;
+        }
+        seg->count--;
+    }
+
+    return seg->file_size == 0 ? 0 : -1;
+}
+
+/*
+ * sealed segment, every idx record points at its entry and the entry
+ * matches its crc. a synced entry can not be torn, a mismatch is damage
+ */
+int LogStore::VerifySegment(Segment* seg) {
+    if (seg->file_size == 0) {
+        return 0;
+    }
+
+    void* addr = mmap(NULL, seg->file_size, PROT_READ, MAP_PRIVATE, seg->fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, mmap segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    madvise(addr, seg->file_size, MADV_SEQUENTIAL);
+
+    const char* base = static_cast<const char*>(addr);
+    uint64_t offset = 0;
+    uint64_t i = 0;
+    for (; i < seg->count; i++) {
+        EntryHeader header;
+        const IndexItem& item = seg->index[i];
+        if (item.offset != offset || offset + sizeof(header) > seg->file_size) {
+            break;
+        }
+        memcpy(&header, base + offset, sizeof(header));
+        if (header.index != seg->first_index + i || header.term != item.term
+            || offset + sizeof(header) + header.len > seg->file_size
+            || EntryCrc(header.index, header.term, base + offset + sizeof(header), header.len) != header.crc) {
+            break;
+        }
+        offset += sizeof(header) + header.len;
+    }
+    munmap(addr, seg->file_size);
+
+    if (i != seg->count || offset != seg->file_size) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, sealed segment corrupt, path:%s, index:%" PRIu64 ", offset:%" PRIu64 "\n",
+                  seg->path.c_str(), seg->first_index + i, offset);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * parse entries from offset, fill idx records, file_size is set to the end
+ * of the last complete entry whose crc matches
+ */
+int LogStore::ScanSegment(Segment* seg, uint64_t offset) {
+    uint64_t size = seg->file_size;
+    if (offset >= size) {
+        seg->file_size = offset;
+        return 0;
+    }
+
+    void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, seg->fd, 0);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, mmap segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    const char* base = static_cast<const char*>(addr);
+    while (offset + sizeof(EntryHeader) <= size) {
+        EntryHeader header;
+        memcpy(&header, base + offset, sizeof(header));
+        if (header.index != seg->first_index + seg->count
+            || header.term == 0
+            || offset + sizeof(header) + header.len > size) {
+            break;
+        }
+        if (EntryCrc(header.index, header.term, base + offset + sizeof(header), header.len) != header.crc) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, entry crc mismatch, path:%s, index:%" PRIu64 ", offset:%" PRIu64 "\n",
+                      seg->path.c_str(), header.index, offset);
+            break;
+        }
+
+        if (seg->count == seg->capacity && GrowIndex(seg) != 0) {
+            ret = -1;
+            break;
+        }
+
+        IndexItem item = {offset, header.term};
+        seg->index[seg->count++] = item;
+        offset += sizeof(header) + header.len;
+    }
+    munmap(addr, size);
+
+    seg->file_size = offset;
+    return ret;
+}
+
+std::string LogStore::SegmentPath(uint64_t first_index, const char* suffix) {
+    char name[64];
+    snprintf(name, sizeof(name), "%020" PRIu64 "%s", first_index, suffix);
+    return dir_ + "/" + name;
+}
+
+LogStore::Segment* LogStore::NewSegment(uint64_t first_index) {
+    Segment* seg = new Segment;
+    seg->first_index = first_index;
+    seg->file_size = 0;
+    seg->path = SegmentPath(first_index, LOG_SEGMENT_SUFFIX);
+    seg->idx_fd = -1;
+    seg->index = NULL;
+    seg->count = 0;
+    seg->capacity = 0;
+    seg->idx_path = SegmentPath(first_index, LOG_INDEX_SUFFIX);
+    seg->sealed = false;
+
+    seg->fd = open(seg->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (seg->fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, create segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        delete seg;
+        return NULL;
+    }
+
+    if (OpenIndex(seg, true) != 0) {
+        CloseSegment(seg);
+        delete seg;
+        return NULL;
+    }
+
+    segments_.push_back(seg);
+
+    dir_dirty_ = true;
+    return seg;
+}
+
+LogStore::Segment* LogStore::FindSegment(uint64_t index) {
+    if (index < first_index_ || index > last_index_) {
+        return NULL;
+    }
+
+    // segments are few, binary search by first_index
+    size_t lo = 0, hi = segments_.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (segments_[mid]->first_index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return segments_[lo];
+}
+
+uint64_t LogStore::Append(uint64_t term, const char* data, uint32_t len) {
+    return Append(term, data, len, EntryCrc(last_index_ + 1, term, data, len));
+}
+
+uint64_t LogStore::Append(uint64_t term, const char* data, uint32_t len, uint32_t crc) {
+    if (term == 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, Append term 0\n");
+        return 0;
+    }
+
+    Segment* seg = segments_.empty() ? NULL : segments_.back();
+    uint64_t need = sizeof(EntryHeader) + len;
+
+    if (!seg || (seg->count > 0 && seg->file_size + seg->inflight.size() + seg->pending.size() + need > segment_size_)) {
+        seg = NewSegment(last_index_ + 1);      // the old one is sealed at next Flush()
+        if (!seg) {
+            return 0;
+        }
+    }
+
+    if (seg->count == seg->capacity && GrowIndex(seg) != 0) {
+        return 0;
+    }
+
+    EntryHeader header;
+    header.index = last_index_ + 1;
+    header.term = term;
+    header.len = len;
+    header.crc = crc;
+
+    IndexItem item = {seg->file_size + seg->inflight.size() + seg->pending.size(), term};
+    seg->index[seg->count++] = item;
+
+    seg->pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    seg->pending.append(data, len);
+
+    if (wal_ && !replaying_) {
+        wal_->Append(group_, header.index, term, data, len, header.crc);
+    }
+
+    if (cache_) {
+        dc::Buffer* buf = dc::Buffer::Create(len, cache_slab_);
+        memcpy(buf->data(), data, len);
+        cache_->Put(header.index, term, buf, header.crc);
+        buf->Release();
+    }
+
+    last_index_ = header.index;
+    return last_index_;
+}
+
+int LogStore::FlushSegment(Segment* seg) {
+    if (seg->pending.empty()) {
+        return 0;
+    }
+
+    if (pwrite(seg->fd, seg->pending.data(), seg->pending.size(), seg->file_size) != static_cast<ssize_t>(seg->pending.size())) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, write segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    if (!wal_) {
+        uint64_t begin = dc::NowUs();
+        if (fdatasync(seg->fd) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, fdatasync segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+        fsync_us_->Record(dc::NowUs() - begin);
+    }
+
+    seg->file_size += seg->pending.size();
+    seg->pending.clear();
+    return 0;
+}
+
+int LogStore::Flush() {
+    if (!HasPending()) {
+        return 0;
+    }
+
+    if (flushing()) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, Flush while async flush in flight\n");
+        return -1;
+    }
+
+    // the wal first, it makes the batch durable (and those of other groups)
+    if (wal_ && wal_->Flush() != 0) {
+        return -1;
+    }
+
+    // only the tail segments have pending data, normally one
+    size_t begin = segments_.size();
+    while (begin > 0 && (!segments_[begin - 1]->pending.empty() || !segments_[begin - 1]->inflight.empty())) {
+        begin--;
+        Segment* seg = segments_[begin];
+        if (!seg->inflight.empty()) {       // left by a failed FlushAsync()
+            seg->inflight.append(seg->pending);
+            seg->pending.swap(seg->inflight);
+            seg->inflight.clear();
+        }
+    }
+
+    for (size_t i = begin; i < segments_.size(); i++) {
+        if (FlushSegment(segments_[i]) != 0) {
+            return -1;
+        }
+    }
+
+    // segments rolled over in this batch
+    for (size_t i = segments_.size() - 1; i > 0 && !segments_[i - 1]->sealed; i--) {
+        if (SealSegment(segments_[i - 1]) != 0) {
+            return -1;
+        }
+    }
+
+    if (dir_dirty_) {
+        if (dc::FsyncDir(dir_) != 0) {
+            return -1;
+        }
+        dir_dirty_ = false;
+    }
+
+    durable_index_ = last_index_;
+    return 0;
+}
+
+int LogStore::FlushAsync(dc::UringEvent* ring) {
+    if (flushing()) {
+        return 1;
+    }
+    if (!HasPending()) {
+        return 0;
+    }
+    if (wal_) {
+        return Flush();     // the wal fsync is shared, nothing to overlap here
+    }
+
+    inflight_index_ = last_index_;
+    inflight_failed_ = false;
+    inflight_us_ = dc::NowUs();
+
+    // a failed batch left inflight stays in front of pending
+    size_t begin = segments_.size();
+    while (begin > 0 && (!segments_[begin - 1]->pending.empty() || !segments_[begin - 1]->inflight.empty())) {
+        begin--;
+    }
+
+    for (size_t i = begin; i < segments_.size(); i++) {
+        Segment* seg = segments_[i];
+        if (seg->inflight.empty()) {
+            seg->inflight.swap(seg->pending);
+        } else {
+            seg->inflight.append(seg->pending);
+            seg->pending.clear();
+        }
+
+        FlushOp* write = new FlushOp(this, seg->inflight.size());
+        write->iov.iov_base = &seg->inflight[0];
+        write->iov.iov_len = seg->inflight.size();
+        FlushOp* sync = new FlushOp(this, 0);
+
+        // fdatasync only runs if the write is complete
+        if (ring->Writev(seg->fd, &write->iov, 1, seg->file_size, write, true) != 0) {
+            delete write;
+            delete sync;
+            inflight_failed_ = true;
+            continue;
+        }
+        inflight_ops_++;
+
+        if (ring->Fsync(seg->fd, true, sync) != 0) {
+            delete sync;
+            inflight_failed_ = true;
+            continue;
+        }
+        inflight_ops_++;
+    }
+
+    if (inflight_ops_ == 0) {
+        // nothing could be queued, finish with pwrite() now
+        FinishFlush();
+        return durable_index_ == inflight_index_ ? 0 : -1;
+    }
+
+    return 0;
+}
+
+void LogStore::OnFlushOp(bool ok) {
+    if (!ok) {
+        inflight_failed_ = true;
+    }
+
+    if (--inflight_ops_ == 0) {
+        FinishFlush();
+    }
+}
+
+void LogStore::FinishFlush() {
+    for (size_t i = 0; i < segments_.size(); i++) {
+        Segment* seg = segments_[i];
+        if (seg->inflight.empty()) {
+            continue;
+        }
+
+        if (inflight_failed_) {
+            // short write or error somewhere, write the whole batch again
+            if (pwrite(seg->fd, seg->inflight.data(), seg->inflight.size(), seg->file_size) != static_cast<ssize_t>(seg->inflight.size())
+                || fdatasync(seg->fd) != 0) {
+                LOG_ERROR(dc::RAFT_LOG(), "LogStore, rewrite segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+                return;     // stays inflight, not durable
+            }
+        }
+
+        seg->file_size += seg->inflight.size();
+        std::string().swap(seg->inflight);
+    }
+
+    // segments rolled over, all data written
+    for (size_t i = segments_.size() - 1; i > 0 && !segments_[i - 1]->sealed; i--) {
+        Segment* seg = segments_[i - 1];
+        if (!seg->pending.empty() || SealSegment(seg) != 0) {
+            return;
+        }
+    }
+
+    if (dir_dirty_) {
+        if (dc::FsyncDir(dir_) != 0) {
+            return;
+        }
+        dir_dirty_ = false;
+    }
+
+    durable_index_ = inflight_index_;
+    // submit -> durable, the write and the sync overlap with the loop
+    fsync_us_->Record(dc::NowUs() - inflight_us_);
+}
+
+int LogStore::Get(uint64_t index, LogEntry* entry) {
+    dc::Buffer* cached = NULL;
+    if (cache_ && cache_->Get(index, &entry->term, &cached)) {
+        entry->index = index;
+        entry->data.assign(cached->data(), cached->size());
+        cached->Release();
+        return 0;
+    }
+
+    Segment* seg = FindSegment(index);
+    if (!seg) {
+        return -1;
+    }
+
+    const IndexItem& item = seg->index[index - seg->first_index];
+    EntryHeader header;
+
+    if (item.offset >= seg->file_size) {    // still in inflight / pending batch
+        uint64_t rel = item.offset - seg->file_size;
+        const char* p = rel < seg->inflight.size()
+                        ? seg->inflight.data() + rel
+                        : seg->pending.data() + (rel - seg->inflight.size());
+        memcpy(&header, p, sizeof(header));
+        entry->data.assign(p + sizeof(header), header.len);
+    } else {
+        if (dc::PreadFull(seg->fd, &header, sizeof(header), item.offset) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, read header fail, path:%s, index:%" PRIu64 "\n", seg->path.c_str(), index);
+            return -1;
+        }
+        entry->data.resize(header.len);
+        if (header.len > 0
+            && dc::PreadFull(seg->fd, &entry->data[0], header.len, item.offset + sizeof(header)) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, read data fail, path:%s, index:%" PRIu64 "\n", seg->path.c_str(), index);
+            return -1;
+        }
+        if (CheckEntry(seg, index, header, entry->data.data()) != 0) {
+            return -1;
+        }
+    }
+
+    entry->index = header.index;
+    entry->term = header.term;
+    return 0;
+}
+
+int LogStore::Get(uint64_t index, dc::Slab* slab, uint64_t* term, dc::Buffer** data, uint32_t* crc) {
+    uint32_t cached_crc = 0;
+    if (cache_ && cache_->Get(index, term, data, &cached_crc)) {
+        if (crc) {
+            *crc = cached_crc;
+        }
+        return 0;       // shared, no copy
+    }
+
+    Segment* seg = FindSegment(index);
+    if (!seg) {
+        return -1;
+    }
+
+    const IndexItem& item = seg->index[index - seg->first_index];
+    EntryHeader header;
+    dc::Buffer* buf = NULL;
+
+    if (item.offset >= seg->file_size) {    // still in inflight / pending batch
+        uint64_t rel = item.offset - seg->file_size;
+        const char* p = rel < seg->inflight.size()
+                        ? seg->inflight.data() + rel
+                        : seg->pending.data() + (rel - seg->inflight.size());
+        memcpy(&header, p, sizeof(header));
+        buf = dc::Buffer::Create(header.len, slab);
+        memcpy(buf->data(), p + sizeof(header), header.len);
+    } else {
+        if (dc::PreadFull(seg->fd, &header, sizeof(header), item.offset) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, read header fail, path:%s, index:%" PRIu64 "\n", seg->path.c_str(), index);
+            return -1;
+        }
+        buf = dc::Buffer::Create(header.len, slab);
+        if (header.len > 0
+            && dc::PreadFull(seg->fd, buf->data(), header.len, item.offset + sizeof(header)) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, read data fail, path:%s, index:%" PRIu64 "\n", seg->path.c_str(), index);
+            buf->Release();
+            return -1;
+        }
+        if (CheckEntry(seg, index, header, buf->data()) != 0) {
+            buf->Release();
+            return -1;
+        }
+    }
+
+    *term = header.term;
+    *data = buf;
+    if (crc) {
+        *crc = header.crc;
+    }
+    return 0;
+}
+
+int LogStore::CheckEntry(Segment* seg, uint64_t index, const EntryHeader& header, const char* data) {
+    if (header.index != index || EntryCrc(header.index, header.term, data, header.len) != header.crc) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, entry corrupt, path:%s, index:%" PRIu64 ", header index:%" PRIu64 "\n",
+                  seg->path.c_str(), index, header.index);
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t LogStore::Term(uint64_t index) {
+    Segment* seg = FindSegment(index);
+    if (!seg) {
+        return index == base_index_ ? base_term_ : 0;
+    }
+    return seg->index[index - seg->first_index].term;
+}
+
+int LogStore::TruncateSuffix(uint64_t index) {
+    if (index > last_index_) {
+        return 0;
+    }
+    if (index < first_index_) {
+        index = first_index_;
+    }
+
+    if (cache_) {
+        cache_->Truncate(index);
+    }
+
+    // replayed before the entries after it, synced by the Flush() below
+    if (wal_ && !replaying_) {
+        wal_->Truncate(group_, index);
+    }
+
+    if (Flush() != 0) {
+        return -1;
+    }
+
+    while (!segments_.empty()) {
+        Segment* seg = segments_.back();
+        if (seg->first_index < index) {
+            break;
+        }
+
+        CloseSegment(seg);
+        if (unlink(seg->path.c_str()) != 0 || unlink(seg->idx_path.c_str()) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, unlink segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+        delete seg;
+        segments_.pop_back();
+        dir_dirty_ = true;
+    }
+
+    if (!segments_.empty()) {
+        Segment* seg = segments_.back();
+        if (seg->sealed) {
+            // unsealed on disk before it changes, a restart rebuilds its idx
+            memset(&seg->index[seg->count], 0, sizeof(IndexItem));
+            if (msync(seg->index, seg->capacity * sizeof(IndexItem), MS_SYNC) != 0) {
+                LOG_ERROR(dc::RAFT_LOG(), "LogStore, unseal index fail, path:%s, errno:%d, error:%s\n", seg->idx_path.c_str(), errno, strerror(errno));
+                return -1;
+            }
+            seg->sealed = false;    // active again, idx grows on next Append
+        }
+
+        uint64_t keep = index - seg->first_index;
+        if (keep < seg->count) {
+            uint64_t offset = seg->index[keep].offset;
+            if (ftruncate(seg->fd, offset) != 0 || fdatasync(seg->fd) != 0) {
+                LOG_ERROR(dc::RAFT_LOG(), "LogStore, truncate segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+                return -1;
+            }
+            memset(&seg->index[keep], 0, (seg->count - keep) * sizeof(IndexItem));
+            seg->count = keep;
+            seg->file_size = offset;
+        }
+    }
+
+    if (dir_dirty_) {
+        if (dc::FsyncDir(dir_) != 0) {
+            return -1;
+        }
+        dir_dirty_ = false;
+    }
+
+    last_index_ = index - 1;
+    durable_index_ = last_index_;
+    return 0;
+}
+
+int LogStore::Sync() {
+    for (size_t i = 0; i < segments_.size(); i++) {
+        Segment* seg = segments_[i];
+        if (seg->sealed) {
+            continue;   // synced when sealed
+        }
+        if (fdatasync(seg->fd) != 0
+            || msync(seg->index, seg->capacity * sizeof(IndexItem), MS_SYNC) != 0
+            || fdatasync(seg->idx_fd) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, sync segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int LogStore::Replay(uint64_t index, uint64_t term, const char* data, uint32_t len) {
+    if (index <= base_index_ || index < first_index_) {
+        return 0;       // inside the snapshot
+    }
+
+    if (index <= last_index_) {
+        if (Term(index) == term) {
+            return 0;   // the store kept it
+        }
+        if (ReplayTruncate(index) != 0) {
+            return -1;
+        }
+    }
+
+    if (index != last_index_ + 1) {
+        LOG_ERROR(dc::RAFT_LOG(), "LogStore, replay gap, dir:%s, index:%" PRIu64 ", last:%" PRIu64 "\n", dir_.c_str(), index, last_index_);
+        return -1;
+    }
+
+    replaying_ = true;
+    uint64_t ret = Append(term, data, len);
+    replaying_ = false;
+
+    return ret == index ? 0 : -1;
+}
+
+int LogStore::ReplayTruncate(uint64_t index) {
+    replaying_ = true;
+    int ret = TruncateSuffix(index);
+    replaying_ = false;
+    return ret;
+}
+
+int LogStore::Compact(uint64_t index, uint64_t term) {
+    if (index < base_index_) {
+        return 0;
+    }
+    base_index_ = index;
+    base_term_ = term;
+
+    // the next segment starts inside the snapshot, so does all of this one.
+    // only synced, sealed segments, the tail is never dropped here
+    while (segments_.size() > 1) {
+        Segment* seg = segments_.front();
+        Segment* next = segments_[1];
+        if (next->first_index > index + 1 || !seg->sealed
+            || !seg->pending.empty() || !seg->inflight.empty()) {
+            break;
+        }
+
+        CloseSegment(seg);
+        if (unlink(seg->path.c_str()) != 0 || unlink(seg->idx_path.c_str()) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "LogStore, unlink segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            delete seg;
+            segments_.erase(segments_.begin());
+            return -1;
+        }
+        delete seg;
+        segments_.erase(segments_.begin());
+        dir_dirty_ = true;
+    }
+
+    if (index >= last_index_ && !flushing()) {
+        // nothing in the log is needed any more
+        while (!segments_.empty()) {
+            Segment* seg = segments_.back();
+            CloseSegment(seg);
+            if (unlink(seg->path.c_str()) != 0 || unlink(seg->idx_path.c_str()) != 0) {
+                LOG_ERROR(dc::RAFT_LOG(), "LogStore, unlink segment fail, path:%s, errno:%d, error:%s\n", seg->path.c_str(), errno, strerror(errno));
+            }
+            delete seg;
+            segments_.pop_back();
+        }
+        dir_dirty_ = true;
+
+        // the next Append() starts a segment at index + 1, an old one back
+        // from a crash next to it would leave a hole Initialize() rejects
+        if (dc::FsyncDir(dir_) != 0) {
+            return -1;
+        }
+        dir_dirty_ = false;
+
+        last_index_ = index;
+        durable_index_ = index;
+        first_index_ = index + 1;
+        if (cache_) {
+            cache_->Clear();
+        }
+        return 0;
+    }
+
+    // durable now, a crash can not bring first_index() back below this
+    if (dir_dirty_) {
+        if (dc::FsyncDir(dir_) != 0) {
+            return -1;
+        }
+        dir_dirty_ = false;
+    }
+
+    first_index_ = segments_.empty() ? last_index_ + 1 : segments_.front()->first_index;
+    if (cache_) {
+        cache_->Compact(first_index_ - 1);
+    }
+    return 0;
+}
+
+}   // namespace dcraft
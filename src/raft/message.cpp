@@ -0,0 +1,484 @@
+#include "message.h"
+#include "log.h"
+
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+namespace dcraft {
+
+static void PutU64(std::string* out, uint64_t v) {
+    out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void PutU32(std::string* out, uint32_t v) {
+    out->append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+// write the frame header first, patch length when the body is done
+static size_t BeginFrame(uint16_t type, uint64_t term, uint64_t group, std::string* out) {
+    size_t begin = out->size();
+    dc::EncodeFrameHeader(type, term, 0, out, group);
+    return begin;
+}
+
+static void EndFrame(size_t begin, std::string* out) {
+    uint32_t length = out->size() - begin - sizeof(dc::FrameHeader);
+    memcpy(&(*out)[begin + offsetof(dc::FrameHeader, length)], &length, sizeof(length));
+}
+
+// reader over [p, end), fail sticky
+struct Reader {
+    const char* p;
+    const char* end;
+    bool fail;
+
+    uint64_t U64() {
+        uint64_t v = 0;
+        if (end - p < static_cast<long>(sizeof(v))) {
+            fail = true;
+            return 0;
+        }
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+
+    uint32_t U32() {
+        uint32_t v = 0;
+        if (end - p < static_cast<long>(sizeof(v))) {
+            fail = true;
+            return 0;
+        }
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return v;
+    }
+};
+
+static void PutAppendEntriesFixed(const AppendEntriesRequest& req, uint32_t n, std::string* out) {
+    PutU64(out, req.leader_id);
+    PutU64(out, req.prev_log_index);
+    PutU64(out, req.prev_log_term);
+    PutU64(out, req.leader_commit);
+    PutU64(out, req.read_seq);
+    PutU32(out, n);
+}
+
+void EncodeAppendEntries(const AppendEntriesRequest& req, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_APPEND_ENTRIES, req.term, group, out);
+
+    PutAppendEntriesFixed(req, req.entries.size(), out);
+
+    for (size_t i = 0; i < req.entries.size(); i++) {
+        const LogEntry& e = req.entries[i];
+        PutU64(out, e.index);
+        PutU64(out, e.term);
+        PutU32(out, e.data.size());
+        PutU32(out, EntryCrc(e.index, e.term, e.data.data(), e.data.size()));
+        out->append(e.data);
+    }
+
+    EndFrame(begin, out);
+}
+
+// fixed width writer into a Buffer sized up front
+struct Writer {
+    char* p;
+
+    void U64(uint64_t v) {
+        memcpy(p, &v, sizeof(v));
+        p += sizeof(v);
+    }
+
+    void U32(uint32_t v) {
+        memcpy(p, &v, sizeof(v));
+        p += sizeof(v);
+    }
+};
+
+#define APPEND_ENTRIES_FIXED (sizeof(uint64_t) * 5 + sizeof(uint32_t))
+#define ENTRY_HEADER_SIZE (sizeof(uint64_t) * 2 + sizeof(uint32_t) * 2)
+
+void EncodeAppendEntries(const AppendEntriesRequest& req, const std::vector<EntryBuffer>& entries,
+                         dc::IoChain* out, dc::Slab* slab, uint64_t group) {
+    // meta = frame header, fixed fields, entry headers, the data of
+    // entries[i] is spliced in right after its header
+    size_t meta_len = sizeof(dc::FrameHeader) + APPEND_ENTRIES_FIXED + entries.size() * ENTRY_HEADER_SIZE;
+    size_t length = APPEND_ENTRIES_FIXED + entries.size() * ENTRY_HEADER_SIZE;
+    for (size_t i = 0; i < entries.size(); i++) {
+        length += entries[i].data->size();
+    }
+
+    dc::Buffer* meta = dc::Buffer::Create(meta_len, slab);
+    dc::EncodeFrameHeader(MSG_APPEND_ENTRIES, req.term, length, meta->data(), group);
+
+    Writer w = {meta->data() + sizeof(dc::FrameHeader)};
+    w.U64(req.leader_id);
+    w.U64(req.prev_log_index);
+    w.U64(req.prev_log_term);
+    w.U64(req.leader_commit);
+    w.U64(req.read_seq);
+    w.U32(entries.size());
+
+    size_t prev = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const EntryBuffer& e = entries[i];
+        w.U64(e.index);
+        w.U64(e.term);
+        w.U32(e.data->size());
+        w.U32(e.crc);
+
+        size_t cut = w.p - meta->data();
+        out->Append(meta, prev, cut - prev);
+        out->Append(e.data, 0, e.data->size());
+        prev = cut;
+    }
+    out->Append(meta, prev, meta_len - prev);
+    meta->Release();
+}
+
+int EncodeAppendEntries(const AppendEntriesRequest& req, const std::vector<EntryBuffer>& entries,
+                        const dc::Compressor* c, std::string* scratch,
+                        dc::IoChain* out, dc::Slab* slab, uint64_t group) {
+    scratch->clear();
+    PutAppendEntriesFixed(req, entries.size(), scratch);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const EntryBuffer& e = entries[i];
+        PutU64(scratch, e.index);
+        PutU64(scratch, e.term);
+        PutU32(scratch, e.data->size());
+        PutU32(scratch, e.crc);
+        scratch->append(e.data->data(), e.data->size());
+    }
+
+    if (dc::EncodeCompressedFrame(c, MSG_APPEND_ENTRIES, req.term, scratch->data(), scratch->size(),
+                                  out, slab, group) == 0) {
+        return 1;
+    }
+
+    EncodeAppendEntries(req, entries, out, slab, group);
+    return 0;
+}
+
+int DecodeAppendEntries(const dc::MessageView& msg, AppendEntriesView* req) {
+    const char* body = NULL;
+    uint32_t length = 0;
+    if (dc::DecompressBody(msg, &req->plain, &body, &length) != 0) {
+        return -1;
+    }
+
+    Reader r = {body, body + length, false};
+    req->term = msg.header.term;
+    req->leader_id = r.U64();
+    req->prev_log_index = r.U64();
+    req->prev_log_term = r.U64();
+    req->leader_commit = r.U64();
+    req->read_seq = r.U64();
+    uint32_t n = r.U32();
+    if (r.fail || n > (r.end - r.p) / ENTRY_HEADER_SIZE) {
+        return -1;
+    }
+
+    req->entries.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        EntryView& e = req->entries[i];
+        e.index = r.U64();
+        e.term = r.U64();
+        e.len = r.U32();
+        e.crc = r.U32();
+        if (r.fail || r.end - r.p < static_cast<long>(e.len)) {
+            return -1;
+        }
+        e.data = r.p;
+        r.p += e.len;
+
+        // the leader's copy, corrupted in its memory or on the way
+        if (EntryCrc(e.index, e.term, e.data, e.len) != e.crc) {
+            LOG_ERROR(dc::RAFT_LOG(), "DecodeAppendEntries, entry crc mismatch, leader:%" PRIu64 ", index:%" PRIu64 "\n",
+                      req->leader_id, e.index);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void EncodeAppendEntriesResp(const AppendEntriesResponse& resp, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_APPEND_ENTRIES_RESP, resp.term, group, out);
+
+    PutU64(out, resp.from_id);
+    PutU64(out, resp.prev_log_index);
+    PutU64(out, resp.match_index);
+    PutU64(out, resp.hint_index);
+    PutU64(out, resp.read_seq);
+    PutU32(out, resp.success ? 1 : 0);
+
+    EndFrame(begin, out);
+}
+
+int DecodeAppendEntriesResp(const dc::MessageView& msg, AppendEntriesResponse* resp) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    resp->term = msg.header.term;
+    resp->from_id = r.U64();
+    resp->prev_log_index = r.U64();
+    resp->match_index = r.U64();
+    resp->hint_index = r.U64();
+    resp->read_seq = r.U64();
+    resp->success = r.U32() != 0;
+
+    return r.fail ? -1 : 0;
+}
+
+static void PutInstallSnapshotFixed(const InstallSnapshotRequest& req, std::string* out) {
+    PutU64(out, req.leader_id);
+    PutU64(out, req.last_index);
+    PutU64(out, req.last_term);
+    PutU64(out, req.total);
+    PutU64(out, req.offset);
+    PutU32(out, req.seq);
+    PutU32(out, req.len);
+}
+
+void EncodeInstallSnapshot(const InstallSnapshotRequest& req, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_INSTALL_SNAPSHOT, req.term, group, out);
+
+    PutInstallSnapshotFixed(req, out);
+
+    uint32_t length = out->size() - begin - sizeof(dc::FrameHeader) + req.len;
+    memcpy(&(*out)[begin + offsetof(dc::FrameHeader, length)], &length, sizeof(length));
+}
+
+int EncodeInstallSnapshot(const InstallSnapshotRequest& req, const char* data,
+                          const dc::Compressor* c, std::string* scratch,
+                          dc::IoChain* out, dc::Slab* slab, uint64_t group) {
+    scratch->clear();
+    PutInstallSnapshotFixed(req, scratch);
+    scratch->append(data, req.len);
+
+    return dc::EncodeCompressedFrame(c, MSG_INSTALL_SNAPSHOT, req.term, scratch->data(), scratch->size(),
+                                     out, slab, group);
+}
+
+int DecodeInstallSnapshot(const dc::MessageView& msg, InstallSnapshotView* req) {
+    const char* body = NULL;
+    uint32_t length = 0;
+    if (dc::DecompressBody(msg, &req->plain, &body, &length) != 0) {
+        return -1;
+    }
+
+    Reader r = {body, body + length, false};
+    req->term = msg.header.term;
+    req->leader_id = r.U64();
+    req->last_index = r.U64();
+    req->last_term = r.U64();
+    req->total = r.U64();
+    req->offset = r.U64();
+    req->seq = r.U32();
+    req->len = r.U32();
+    if (r.fail || r.end - r.p != static_cast<long>(req->len)) {
+        return -1;
+    }
+    req->data = r.p;
+
+    return 0;
+}
+
+void EncodeInstallSnapshotResp(const InstallSnapshotResponse& resp, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_INSTALL_SNAPSHOT_RESP, resp.term, group, out);
+
+    PutU64(out, resp.from_id);
+    PutU64(out, resp.last_index);
+    PutU64(out, resp.next_offset);
+    PutU32(out, resp.seq);
+    PutU32(out, (resp.success ? 1 : 0) | (resp.done ? 2 : 0));
+
+    EndFrame(begin, out);
+}
+
+int DecodeInstallSnapshotResp(const dc::MessageView& msg, InstallSnapshotResponse* resp) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    resp->term = msg.header.term;
+    resp->from_id = r.U64();
+    resp->last_index = r.U64();
+    resp->next_offset = r.U64();
+    resp->seq = r.U32();
+    uint32_t flags = r.U32();
+    resp->success = (flags & 1) != 0;
+    resp->done = (flags & 2) != 0;
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeRequestVote(const RequestVoteRequest& req, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_REQUEST_VOTE, req.term, group, out);
+
+    PutU64(out, req.candidate_id);
+    PutU64(out, req.last_log_index);
+    PutU64(out, req.last_log_term);
+    PutU32(out, req.pre_vote ? 1 : 0);
+
+    EndFrame(begin, out);
+}
+
+int DecodeRequestVote(const dc::MessageView& msg, RequestVoteRequest* req) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    req->term = msg.header.term;
+    req->candidate_id = r.U64();
+    req->last_log_index = r.U64();
+    req->last_log_term = r.U64();
+    req->pre_vote = r.U32() != 0;
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeRequestVoteResp(const RequestVoteResponse& resp, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_REQUEST_VOTE_RESP, resp.term, group, out);
+
+    PutU64(out, resp.from_id);
+    PutU32(out, resp.granted ? 1 : 0);
+    PutU32(out, resp.pre_vote ? 1 : 0);
+
+    EndFrame(begin, out);
+}
+
+int DecodeRequestVoteResp(const dc::MessageView& msg, RequestVoteResponse* resp) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    resp->term = msg.header.term;
+    resp->from_id = r.U64();
+    resp->granted = r.U32() != 0;
+    resp->pre_vote = r.U32() != 0;
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeReadIndex(const ReadIndexRequest& req, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_READ_INDEX, req.term, group, out);
+
+    PutU64(out, req.from_id);
+    PutU64(out, req.ctx);
+
+    EndFrame(begin, out);
+}
+
+int DecodeReadIndex(const dc::MessageView& msg, ReadIndexRequest* req) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    req->term = msg.header.term;
+    req->from_id = r.U64();
+    req->ctx = r.U64();
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeReadIndexResp(const ReadIndexResponse& resp, std::string* out, uint64_t group) {
+    size_t begin = BeginFrame(MSG_READ_INDEX_RESP, resp.term, group, out);
+
+    PutU64(out, resp.from_id);
+    PutU64(out, resp.ctx);
+    PutU64(out, resp.read_index);
+    PutU32(out, resp.success ? 1 : 0);
+
+    EndFrame(begin, out);
+}
+
+int DecodeReadIndexResp(const dc::MessageView& msg, ReadIndexResponse* resp) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    resp->term = msg.header.term;
+    resp->from_id = r.U64();
+    resp->ctx = r.U64();
+    resp->read_index = r.U64();
+    resp->success = r.U32() != 0;
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeHeartbeatBatch(const HeartbeatBatch& batch, std::string* out) {
+    size_t begin = BeginFrame(MSG_HEARTBEAT_BATCH, 0, 0, out);
+
+    PutU64(out, batch.from_id);
+    PutU32(out, batch.items.size());
+    for (size_t i = 0; i < batch.items.size(); i++) {
+        const HeartbeatItem& item = batch.items[i];
+        PutU64(out, item.group);
+        PutU64(out, item.term);
+        PutU64(out, item.commit);
+        PutU64(out, item.read_seq);
+    }
+
+    EndFrame(begin, out);
+}
+
+int DecodeHeartbeatBatch(const dc::MessageView& msg, HeartbeatBatch* batch) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    batch->from_id = r.U64();
+    uint32_t n = r.U32();
+    if (r.fail || n > msg.length / (sizeof(uint64_t) * 4)) {
+        return -1;
+    }
+
+    batch->items.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        HeartbeatItem& item = batch->items[i];
+        item.group = r.U64();
+        item.term = r.U64();
+        item.commit = r.U64();
+        item.read_seq = r.U64();
+    }
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeHeartbeatBatchResp(const HeartbeatBatchResp& batch, std::string* out) {
+    size_t begin = BeginFrame(MSG_HEARTBEAT_BATCH_RESP, 0, 0, out);
+
+    PutU64(out, batch.from_id);
+    PutU32(out, batch.items.size());
+    for (size_t i = 0; i < batch.items.size(); i++) {
+        const HeartbeatRespItem& item = batch.items[i];
+        PutU64(out, item.group);
+        PutU64(out, item.term);
+        PutU64(out, item.read_seq);
+        PutU32(out, item.success ? 1 : 0);
+    }
+
+    EndFrame(begin, out);
+}
+
+int DecodeHeartbeatBatchResp(const dc::MessageView& msg, HeartbeatBatchResp* batch) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    batch->from_id = r.U64();
+    uint32_t n = r.U32();
+    if (r.fail || n > msg.length / (sizeof(uint64_t) * 3 + sizeof(uint32_t))) {
+        return -1;
+    }
+
+    batch->items.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        HeartbeatRespItem& item = batch->items[i];
+        item.group = r.U64();
+        item.term = r.U64();
+        item.read_seq = r.U64();
+        item.success = r.U32() != 0;
+    }
+
+    return r.fail ? -1 : 0;
+}
+
+void EncodeHello(const Hello& hello, std::string* out) {
+    size_t begin = BeginFrame(MSG_HELLO, 0, 0, out);
+
+    PutU64(out, hello.from_id);
+    PutU32(out, hello.codecs);
+
+    EndFrame(begin, out);
+}
+
+int DecodeHello(const dc::MessageView& msg, Hello* hello) {
+    Reader r = {msg.body, msg.body + msg.length, false};
+    hello->from_id = r.U64();
+    hello->codecs = r.U32();
+
+    return r.fail ? -1 : 0;
+}
+
+}   // namespace dcraft
@@ -0,0 +1,201 @@
+#include "multi_raft.h"
+#include "log.h"
+
+#include <inttypes.h>
+
+namespace dcraft {
+
+MultiRaft::MultiRaft(uint64_t self_id)
+    : self_id_(self_id)
+    , heartbeat_frames_(0)
+    , heartbeat_items_(0) {
+}
+
+MultiRaft::~MultiRaft() {
+}
+
+int MultiRaft::AddPeer(uint64_t node_id, dc::SocketFdHandler* conn) {
+    if (peers_.find(node_id) != peers_.end()) {
+        LOG_ERROR(dc::RAFT_LOG(), "MultiRaft, peer exist, id:%" PRIu64 "\n", node_id);
+        return -1;
+    }
+
+    Peer& peer = peers_[node_id];
+    peer.conn = conn;
+    peer.codecs = 0;
+    peer.batch.from_id = self_id_;
+    SendHello(conn);
+    return 0;
+}
+
+void MultiRaft::ResetPeer(uint64_t node_id, dc::SocketFdHandler* conn) {
+    std::map<uint64_t, Peer>::iterator it = peers_.find(node_id);
+    if (it != peers_.end()) {
+        it->second.conn = conn;
+        it->second.codecs = 0;
+        SendHello(conn);
+    }
+}
+
+uint32_t MultiRaft::PeerCodecs(uint64_t node_id) {
+    std::map<uint64_t, Peer>::iterator it = peers_.find(node_id);
+    return it == peers_.end() ? 0 : it->second.codecs;
+}
+
+void MultiRaft::SendHello(dc::SocketFdHandler* conn) {
+    if (!conn) {
+        return;
+    }
+
+    Hello hello = {self_id_, dc::SupportedCompressors()};
+    sendBuf_.clear();
+    EncodeHello(hello, &sendBuf_);
+    conn->Send(sendBuf_);
+}
+
+void MultiRaft::OnHello(uint64_t from_id, const dc::MessageView& msg) {
+    Hello hello;
+    if (DecodeHello(msg, &hello) != 0) {
+        LOG_WARNING(dc::RAFT_LOG(), "MultiRaft, bad hello, from:%" PRIu64 "\n", from_id);
+        return;
+    }
+
+    std::map<uint64_t, Peer>::iterator it = peers_.find(from_id);
+    if (it != peers_.end()) {
+        it->second.codecs = hello.codecs;
+    }
+
+    std::unordered_map<uint64_t, RaftGroup*>::iterator g;
+    for (g = groups_.begin(); g != groups_.end(); g++) {
+        g->second->OnMessage(from_id, msg);
+    }
+}
+
+dc::SocketFdHandler* MultiRaft::GetPeer(uint64_t node_id) {
+    std::map<uint64_t, Peer>::iterator it = peers_.find(node_id);
+    return it == peers_.end() ? NULL : it->second.conn;
+}
+
+int MultiRaft::AddGroup(uint64_t group, RaftGroup* g) {
+    if (!groups_.insert(std::make_pair(group, g)).second) {
+        LOG_ERROR(dc::RAFT_LOG(), "MultiRaft, group exist, group:%" PRIu64 "\n", group);
+        return -1;
+    }
+    return 0;
+}
+
+int MultiRaft::RemoveGroup(uint64_t group) {
+    groups_.erase(group);
+    return 0;
+}
+
+RaftGroup* MultiRaft::GetGroup(uint64_t group) {
+    std::unordered_map<uint64_t, RaftGroup*>::iterator it = groups_.find(group);
+    return it == groups_.end() ? NULL : it->second;
+}
+
+void MultiRaft::Dispatch(uint64_t from_id, const dc::MessageView& msg) {
+    switch (msg.header.type) {
+    case MSG_HEARTBEAT_BATCH:
+        OnHeartbeatBatch(from_id, msg);
+        return;
+    case MSG_HEARTBEAT_BATCH_RESP:
+        OnHeartbeatBatchResp(from_id, msg);
+        return;
+    case MSG_HELLO:
+        OnHello(from_id, msg);
+        return;
+    default:
+        break;
+    }
+
+    RaftGroup* g = GetGroup(msg.header.group);
+    if (!g) {
+        return;     // not created here yet, or removed, the sender retries
+    }
+    g->OnMessage(from_id, msg);
+}
+
+void MultiRaft::OnHeartbeatBatch(uint64_t from_id, const dc::MessageView& msg) {
+    if (DecodeHeartbeatBatch(msg, &recvBatch_) != 0) {
+        LOG_WARNING(dc::RAFT_LOG(), "MultiRaft, bad heartbeat batch, from:%" PRIu64 "\n", from_id);
+        return;
+    }
+
+    sendResp_.from_id = self_id_;
+    sendResp_.items.clear();
+    for (size_t i = 0; i < recvBatch_.items.size(); i++) {
+        const HeartbeatItem& item = recvBatch_.items[i];
+        RaftGroup* g = GetGroup(item.group);
+        if (!g) {
+            continue;
+        }
+
+        HeartbeatRespItem resp = {item.group, 0, 0, false};
+        g->OnHeartbeat(from_id, item, &resp);
+        sendResp_.items.push_back(resp);
+    }
+
+    dc::SocketFdHandler* conn = GetPeer(from_id);
+    if (!conn || sendResp_.items.empty()) {
+        return;
+    }
+
+    sendBuf_.clear();
+    EncodeHeartbeatBatchResp(sendResp_, &sendBuf_);
+    conn->Send(sendBuf_);
+}
+
+void MultiRaft::OnHeartbeatBatchResp(uint64_t from_id, const dc::MessageView& msg) {
+    if (DecodeHeartbeatBatchResp(msg, &recvResp_) != 0) {
+        LOG_WARNING(dc::RAFT_LOG(), "MultiRaft, bad heartbeat batch resp, from:%" PRIu64 "\n", from_id);
+        return;
+    }
+
+    for (size_t i = 0; i < recvResp_.items.size(); i++) {
+        const HeartbeatRespItem& resp = recvResp_.items[i];
+        RaftGroup* g = GetGroup(resp.group);
+        if (g) {
+            g->OnHeartbeatResponse(from_id, resp);
+        }
+    }
+}
+
+void MultiRaft::AddHeartbeat(uint64_t to_id, const HeartbeatItem& item) {
+    std::map<uint64_t, Peer>::iterator it = peers_.find(to_id);
+    if (it == peers_.end()) {
+        return;
+    }
+    it->second.batch.items.push_back(item);
+}
+
+void MultiRaft::Tick(uint64_t now_ms) {
+    std::unordered_map<uint64_t, RaftGroup*>::iterator it;
+    for (it = groups_.begin(); it != groups_.end(); it++) {
+        it->second->OnTick(now_ms);
+    }
+
+    FlushHeartbeats();
+}
+
+void MultiRaft::FlushHeartbeats() {
+    std::map<uint64_t, Peer>::iterator it;
+    for (it = peers_.begin(); it != peers_.end(); it++) {
+        Peer& peer = it->second;
+        if (peer.batch.items.empty()) {
+            continue;
+        }
+
+        if (peer.conn) {
+            sendBuf_.clear();
+            EncodeHeartbeatBatch(peer.batch, &sendBuf_);
+            peer.conn->Send(sendBuf_);
+
+            heartbeat_frames_++;
+            heartbeat_items_ += peer.batch.items.size();
+        }
+        peer.batch.items.clear();
+    }
+}
+
+}   // namespace dcraft
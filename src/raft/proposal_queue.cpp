@@ -0,0 +1,176 @@
+#include "proposal_queue.h"
+#include "log.h"
+
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace dcraft {
+
+ProposalQueue::ProposalQueue(LogStore* store, LogReplicate* replicate,
+                             uint32_t max_entries, uint64_t max_bytes,
+                             uint32_t linger_us, bool adaptive)
+    : store_(store)
+    , replicate_(replicate)
+    , ee_(NULL)
+    , ring_(NULL)
+    , max_entries_(max_entries)
+    , max_bytes_(max_bytes)
+    , linger_us_(linger_us)
+    , adaptive_(adaptive)
+    , timer_fd_(-1)
+    , timer_armed_(false)
+    , entries_(0)
+    , bytes_(0)
+    , avg_batch_x8_(8)
+    , deferred_(false) {
+}
+
+ProposalQueue::~ProposalQueue() {
+    if (timer_fd_ != -1) {
+        if (ee_) {
+            ee_->DelEvent(timer_fd_);
+        }
+        close(timer_fd_);
+    }
+}
+
+int ProposalQueue::Initialize(dc::EventLoop* ee) {
+    ee_ = ee;
+    if (ee_->type() == dc::LOOP_URING) {
+        ring_ = static_cast<dc::UringEvent*>(ee_);
+    }
+
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ProposalQueue, timerfd_create error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (ee_->AddEvent(timer_fd_, this, EPOLLIN) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ProposalQueue, AddEvent error: %d, %s\n", errno, strerror(errno));
+        close(timer_fd_);
+        timer_fd_ = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+bool ProposalQueue::UseLinger() const {
+    if (linger_us_ == 0 || timer_fd_ == -1) {
+        return false;
+    }
+    // average below 2 proposals per batch, nobody to wait for
+    return !adaptive_ || avg_batch_x8_ >= 16;
+}
+
+int ProposalQueue::ArmTimer() {
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = linger_us_ / 1000000;
+    its.it_value.tv_nsec = (linger_us_ % 1000000) * 1000;
+
+    if (timerfd_settime(timer_fd_, 0, &its, NULL) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "ProposalQueue, timerfd_settime error: %d, %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    timer_armed_ = true;
+    return 0;
+}
+
+void ProposalQueue::DisarmTimer() {
+    if (!timer_armed_) {
+        return;
+    }
+
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    timerfd_settime(timer_fd_, 0, &its, NULL);
+    timer_armed_ = false;
+}
+
+uint64_t ProposalQueue::Propose(uint64_t term, const char* data, uint32_t len) {
+    uint64_t index = store_->Append(term, data, len);
+    if (index == 0) {
+        return 0;
+    }
+
+    entries_++;
+    bytes_ += len;
+
+    if (replicate_) {
+        replicate_->Proposed(index);
+    }
+
+    if (entries_ >= max_entries_ || bytes_ >= max_bytes_) {
+        Flush();
+    } else if (!timer_armed_ && UseLinger()) {
+        ArmTimer();
+    }
+
+    return index;
+}
+
+int ProposalQueue::Flush() {
+    DisarmTimer();
+
+    if (entries_ > 0) {
+        // ewma, 1/8 weight for the new batch
+        avg_batch_x8_ = avg_batch_x8_ - (avg_batch_x8_ >> 3) + entries_;
+        entries_ = 0;
+        bytes_ = 0;
+
+        // on the wire before the local fsync starts, see LogReplicate::Replicate()
+        if (replicate_) {
+            replicate_->Replicate();
+        }
+    } else if (!deferred_) {
+        return 0;
+    }
+
+    if (!ring_) {
+        deferred_ = false;
+        return store_->Flush();
+    }
+
+    int ret = store_->FlushAsync(ring_);
+    if (ret == 1) {
+        deferred_ = true;       // one async flush at a time, next Tick()
+        return 0;
+    }
+    deferred_ = false;
+    return ret;
+}
+
+void ProposalQueue::Tick() {
+    if ((entries_ > 0 && !timer_armed_) || (deferred_ && !store_->flushing())) {
+        Flush();
+    }
+}
+
+void ProposalQueue::OnRead(int fd, uint32_t events) {
+    (void)events;
+
+    uint64_t expirations;
+    while (read(fd, &expirations, sizeof(expirations)) > 0) {
+    }
+
+    timer_armed_ = false;
+    Flush();
+}
+
+void ProposalQueue::OnWrite(int fd, uint32_t events) {
+    (void)fd;
+    (void)events;
+}
+
+void ProposalQueue::OnError(int fd, uint32_t events, int err, std::string& error) {
+    (void)events;
+    LOG_ERROR(dc::RAFT_LOG(), "ProposalQueue, OnError fd:%d, errno:%d, error:%s\n", fd, err, error.c_str());
+}
+
+}   // namespace dcraft
@@ -0,0 +1,282 @@
+#include "read_index.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+namespace dcraft {
+
+ReadIndex::ReadIndex(LogStore* store, LogReplicate* replicate, uint64_t self_id,
+                     uint32_t election_timeout_ms, bool lease, uint32_t timeout_ms)
+    : store_(store)
+    , replicate_(replicate)
+    , self_id_(self_id)
+    , timeout_ms_(timeout_ms ? timeout_ms : DEFAULT_READ_TIMEOUT_MS)
+    , lease_(lease)
+    , lease_ms_(static_cast<uint64_t>(election_timeout_ms) * (100 - READ_LEASE_DRIFT_PERCENT) / 100)
+    , leader_(false)
+    , term_(0)
+    , leader_conn_(NULL)
+    , read_seq_(0)
+    , lease_expire_ms_(0)
+    , ctx_(0)
+    , applied_index_(0) {
+}
+
+ReadIndex::~ReadIndex() {
+    FailAll(READ_ERR_NOT_LEADER);
+}
+
+uint64_t ReadIndex::pending() const {
+    uint64_t n = pending_.size() + unsent_.size() + waiting_.size();
+
+    std::map<uint64_t, Forward>::const_iterator it;
+    for (it = forwards_.begin(); it != forwards_.end(); it++) {
+        n += it->second.cbs.size();
+    }
+    return n;
+}
+
+void ReadIndex::FailAll(int err) {
+    std::deque<Pending> pending;
+    pending.swap(pending_);
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].cb) {
+            pending[i].cb->OnReadFail(err);
+        }
+    }
+
+    std::vector<ReadCallback*> unsent;
+    unsent.swap(unsent_);
+    for (size_t i = 0; i < unsent.size(); i++) {
+        unsent[i]->OnReadFail(err);
+    }
+
+    std::map<uint64_t, Forward> forwards;
+    forwards.swap(forwards_);
+    std::map<uint64_t, Forward>::iterator it;
+    for (it = forwards.begin(); it != forwards.end(); it++) {
+        for (size_t i = 0; i < it->second.cbs.size(); i++) {
+            it->second.cbs[i]->OnReadFail(err);
+        }
+    }
+
+    rounds_.clear();
+}
+
+void ReadIndex::BecomeLeader(uint64_t term) {
+    FailAll(READ_ERR_NOT_LEADER);
+
+    leader_ = true;
+    term_ = term;
+    leader_conn_ = NULL;
+    lease_expire_ms_ = 0;   // the lease starts with the first round of this term
+}
+
+void ReadIndex::BecomeFollower(uint64_t term, dc::SocketFdHandler* leader_conn) {
+    if (leader_ || term != term_ || leader_conn != leader_conn_) {
+        FailAll(READ_ERR_NOT_LEADER);
+    }
+
+    leader_ = false;
+    term_ = term;
+    leader_conn_ = leader_conn;
+    lease_expire_ms_ = 0;
+}
+
+bool ReadIndex::CommittedInTerm() const {
+    return store_->Term(replicate_->commit_index()) == term_;
+}
+
+int ReadIndex::Read(ReadCallback* cb, uint64_t now_ms) {
+    if (!leader_) {
+        if (!leader_conn_) {
+            return -1;
+        }
+        unsent_.push_back(cb);
+        return 0;
+    }
+
+    if (lease_valid(now_ms) && CommittedInTerm()) {
+        Pending p = {read_seq_, 0, cb, 0, 0};
+        Release(p, replicate_->commit_index());
+        return 0;
+    }
+
+    // confirmed by the next round, Tick() starts it
+    Pending p = {read_seq_ + 1, now_ms + timeout_ms_, cb, self_id_, 0};
+    pending_.push_back(p);
+    return 0;
+}
+
+void ReadIndex::OnReadIndexRequest(const ReadIndexRequest& req, uint64_t now_ms) {
+    if (!leader_ || req.term != term_) {
+        Reply(req.from_id, req.ctx, 0, false);
+        return;
+    }
+
+    if (lease_valid(now_ms) && CommittedInTerm()) {
+        Reply(req.from_id, req.ctx, replicate_->commit_index(), true);
+        return;
+    }
+
+    Pending p = {read_seq_ + 1, now_ms + timeout_ms_, NULL, req.from_id, req.ctx};
+    pending_.push_back(p);
+}
+
+void ReadIndex::OnReadIndexResponse(const ReadIndexResponse& resp) {
+    std::map<uint64_t, Forward>::iterator it = forwards_.find(resp.ctx);
+    if (it == forwards_.end()) {
+        return;     // timed out
+    }
+
+    std::vector<ReadCallback*> cbs;
+    cbs.swap(it->second.cbs);
+    forwards_.erase(it);
+
+    for (size_t i = 0; i < cbs.size(); i++) {
+        if (!resp.success) {
+            cbs[i]->OnReadFail(READ_ERR_NOT_LEADER);
+            continue;
+        }
+        Pending p = {0, 0, cbs[i], self_id_, 0};
+        Release(p, resp.read_index);
+    }
+
+    Ready();
+}
+
+void ReadIndex::Reply(uint64_t from_id, uint64_t ctx, uint64_t read_index, bool success) {
+    LogReplicate::Follower* f = replicate_->GetFollower(from_id);
+    if (!f || !f->conn) {
+        return;     // the follower times the batch out
+    }
+
+    ReadIndexResponse resp;
+    resp.term = term_;
+    resp.from_id = self_id_;
+    resp.ctx = ctx;
+    resp.read_index = read_index;
+    resp.success = success;
+
+    sendBuf_.clear();
+    EncodeReadIndexResp(resp, &sendBuf_, replicate_->group());
+    f->conn->Send(sendBuf_);
+}
+
+void ReadIndex::Release(const Pending& p, uint64_t read_index) {
+    if (!p.cb) {
+        Reply(p.from_id, p.ctx, read_index, true);
+        return;
+    }
+
+    // ordered by read index, ties keep arrival order
+    Waiting w = {read_index, p.cb};
+    std::deque<Waiting>::iterator it = waiting_.end();
+    while (it != waiting_.begin() && (it - 1)->read_index > read_index) {
+        it--;
+    }
+    waiting_.insert(it, w);
+}
+
+void ReadIndex::StartRound(uint64_t now_ms) {
+    read_seq_++;
+    replicate_->set_read_seq(read_seq_);
+    replicate_->Heartbeat();
+
+    Round r = {read_seq_, now_ms};
+    rounds_.push_back(r);
+}
+
+void ReadIndex::Confirm() {
+    uint64_t confirmed = replicate_->ReadQuorumSeq();
+
+    while (!rounds_.empty() && rounds_.front().seq <= confirmed) {
+        uint64_t expire = rounds_.front().sent_ms + lease_ms_;
+        if (lease_ && expire > lease_expire_ms_) {
+            lease_expire_ms_ = expire;
+        }
+        rounds_.pop_front();
+    }
+
+    if (!CommittedInTerm()) {
+        return;     // hold them until the term's first entry commits
+    }
+
+    uint64_t commit = replicate_->commit_index();
+    while (!pending_.empty() && pending_.front().seq <= confirmed) {
+        Pending p = pending_.front();
+        pending_.pop_front();
+        Release(p, commit);
+    }
+}
+
+void ReadIndex::Tick(uint64_t now_ms) {
+    if (leader_) {
+        bool queued = !pending_.empty() && pending_.back().seq > read_seq_;
+        // renew the lease before it runs out, one round in flight is enough
+        bool renew = lease_ && rounds_.empty() && now_ms + lease_ms_ / 2 >= lease_expire_ms_;
+        if (queued || renew) {
+            StartRound(now_ms);
+        }
+
+        Confirm();
+
+        while (!pending_.empty() && pending_.front().deadline_ms <= now_ms) {
+            Pending p = pending_.front();
+            pending_.pop_front();
+            if (p.cb) {
+                p.cb->OnReadFail(READ_ERR_TIMEOUT);
+            } else {
+                Reply(p.from_id, p.ctx, 0, false);
+            }
+        }
+
+        // rounds a majority never acked, e.g. sent to a partition
+        while (!rounds_.empty() && rounds_.front().sent_ms + timeout_ms_ <= now_ms) {
+            rounds_.pop_front();
+        }
+    } else {
+        if (!unsent_.empty() && leader_conn_) {
+            Forward& fw = forwards_[++ctx_];
+            fw.deadline_ms = now_ms + timeout_ms_;
+            fw.cbs.swap(unsent_);
+
+            ReadIndexRequest req;
+            req.term = term_;
+            req.from_id = self_id_;
+            req.ctx = ctx_;
+
+            sendBuf_.clear();
+            EncodeReadIndex(req, &sendBuf_, replicate_->group());
+            leader_conn_->Send(sendBuf_);
+        }
+
+        while (!forwards_.empty() && forwards_.begin()->second.deadline_ms <= now_ms) {
+            std::vector<ReadCallback*> cbs;
+            cbs.swap(forwards_.begin()->second.cbs);
+            forwards_.erase(forwards_.begin());
+            for (size_t i = 0; i < cbs.size(); i++) {
+                cbs[i]->OnReadFail(READ_ERR_TIMEOUT);
+            }
+        }
+    }
+
+    Ready();
+}
+
+void ReadIndex::OnApplied(uint64_t applied_index) {
+    if (applied_index > applied_index_) {
+        applied_index_ = applied_index;
+    }
+    Ready();
+}
+
+void ReadIndex::Ready() {
+    while (!waiting_.empty() && waiting_.front().read_index <= applied_index_) {
+        Waiting w = waiting_.front();
+        waiting_.pop_front();
+        w.cb->OnReadReady(w.read_index);
+    }
+}
+
+}   // namespace dcraft
@@ -0,0 +1,113 @@
+#include "recovery.h"
+#include "log.h"
+#include "snapshot.h"
+#include "file_util.h"
+#include "metrics.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <thread>
+
+namespace dcraft {
+
+Recovery::Recovery(Fsm* fsm, LogStore* store, const std::string& snapshot_path)
+    : fsm_(fsm)
+    , store_(store)
+    , snapshot_path_(snapshot_path)
+    , snapshot_index_(0)
+    , snapshot_term_(0)
+    , snapshot_us_(0)
+    , log_us_(0) {
+}
+
+Recovery::~Recovery() {
+}
+
+int Recovery::Run() {
+    uint64_t begin = dc::NowUs();
+
+    int snapshot_ret = 0;
+    std::thread loader([this, &snapshot_ret]() {
+        snapshot_ret = LoadSnapshot();
+    });
+
+    int log_ret = store_->Initialize();
+    log_us_ = dc::NowUs() - begin;
+
+    loader.join();
+    if (snapshot_ret != 0 || log_ret != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Recovery, fail, snapshot:%d, log:%d\n", snapshot_ret, log_ret);
+        return -1;
+    }
+
+    if (CutLog() != 0) {
+        return -1;
+    }
+
+    LOG_INFO(dc::RAFT_LOG(), "Recovery, done, snapshot:%" PRIu64 " (%" PRIu64 " us), log:%" PRIu64 "-%" PRIu64
+             " (%" PRIu64 " us), total:%" PRIu64 " us\n",
+             snapshot_index_, snapshot_us_, store_->first_index(), store_->last_index(), log_us_, dc::NowUs() - begin);
+    return 0;
+}
+
+int Recovery::LoadSnapshot() {
+    uint64_t begin = dc::NowUs();
+
+    int fd = open(snapshot_path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        LOG_ERROR(dc::RAFT_LOG(), "Recovery, open snapshot fail, path:%s, errno:%d, error:%s\n", snapshot_path_.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    // the log before it may be gone, a bad snapshot can not be skipped
+    SnapshotHeader header;
+    if (VerifySnapshot(fd) != 0 || dc::PreadFull(fd, &header, sizeof(header), 0) != 0
+        || lseek(fd, sizeof(header), SEEK_SET) != static_cast<off_t>(sizeof(header))) {
+        LOG_ERROR(dc::RAFT_LOG(), "Recovery, bad snapshot, path:%s\n", snapshot_path_.c_str());
+        close(fd);
+        return -1;
+    }
+
+    int ret = fsm_->LoadSnapshot(fd);
+    close(fd);
+    if (ret != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Recovery, load snapshot fail, path:%s, index:%" PRIu64 "\n", snapshot_path_.c_str(), header.last_index);
+        return -1;
+    }
+
+    snapshot_index_ = header.last_index;
+    snapshot_term_ = header.last_term;
+    snapshot_us_ = dc::NowUs() - begin;
+    return 0;
+}
+
+int Recovery::CutLog() {
+    if (snapshot_index_ == 0) {
+        return 0;
+    }
+
+    if (store_->first_index() > snapshot_index_ + 1 && store_->last_index() >= store_->first_index()) {
+        LOG_ERROR(dc::RAFT_LOG(), "Recovery, log gap after snapshot, snapshot:%" PRIu64 ", first:%" PRIu64 "\n",
+                  snapshot_index_, store_->first_index());
+        return -1;
+    }
+
+    // another history than the snapshot's from snapshot_index_ on, none of
+    // it counts. the wal is not open yet, nothing is logged
+    uint64_t term = store_->Term(snapshot_index_);
+    if (term != 0 && term != snapshot_term_ && store_->ReplayTruncate(snapshot_index_) != 0) {
+        return -1;
+    }
+
+    // Compact() drops the log up to the snapshot once it is older than it
+    return store_->Compact(snapshot_index_, snapshot_term_);
+}
+
+}   // namespace dcraft
@@ -0,0 +1,265 @@
+#include "shared_wal.h"
+#include "log.h"
+#include "file_util.h"
+#include "crc32c.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+namespace dcraft {
+
+// the fields before crc, chained after the crc of the entry
+static uint32_t WalRecordCrc(const WalRecord& rec, uint32_t entry_crc) {
+    return dc::Crc32c(entry_crc, &rec, offsetof(WalRecord, crc));
+}
+
+SharedWal::SharedWal(const std::string& dir, uint64_t segment_size)
+    : dir_(dir)
+    , segment_size_(segment_size)
+    , fd_(-1)
+    , seq_(0)
+    , file_size_(0)
+    , checkpointing_(false)
+    , syncs_(0)
+    , fsync_us_(dc::RAFT_METRICS()->GetHistogram("raft_fsync_us", "file=\"wal\"")) {
+}
+
+SharedWal::~SharedWal() {
+    Flush();
+
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+std::string SharedWal::FilePath(uint64_t seq) {
+    char name[32];
+    snprintf(name, sizeof(name), "%020" PRIu64 WAL_FILE_SUFFIX, seq);
+    return dir_ + "/" + name;
+}
+
+int SharedWal::Register(uint64_t group, LogStore* store) {
+    if (stores_.find(group) != stores_.end()) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, group exist, group:%" PRIu64 "\n", group);
+        return -1;
+    }
+    stores_[group] = store;
+    return 0;
+}
+
+void SharedWal::Unregister(uint64_t group) {
+    stores_.erase(group);
+}
+
+int SharedWal::Initialize() {
+    if (dc::MakeDirs(dir_) != 0) {
+        return -1;
+    }
+
+    std::vector<std::string> names;
+    if (dc::ListDir(dir_, &names) != 0) {
+        return -1;
+    }
+
+    // names are zero padded, sorted is replay order
+    uint64_t last_seq = 0;
+    size_t suffix_len = strlen(WAL_FILE_SUFFIX);
+    for (size_t i = 0; i < names.size(); i++) {
+        const std::string& name = names[i];
+        if (name.size() <= suffix_len || name.compare(name.size() - suffix_len, suffix_len, WAL_FILE_SUFFIX) != 0) {
+            continue;
+        }
+
+        if (Replay(dir_ + "/" + name) != 0) {
+            return -1;
+        }
+        last_seq = strtoull(name.c_str(), NULL, 10);
+    }
+
+    if (OpenFile(last_seq + 1) != 0) {
+        return -1;
+    }
+
+    // what was replayed is now in the stores, the old files can go
+    return Checkpoint();
+}
+
+int SharedWal::Replay(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, open fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, fstat fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    std::string buf;
+    buf.resize(st.st_size);
+    if (st.st_size > 0 && dc::PreadFull(fd, &buf[0], buf.size(), 0) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, read fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    uint64_t offset = 0;
+    uint64_t records = 0;
+    while (offset + sizeof(WalRecord) <= buf.size()) {
+        WalRecord rec;
+        memcpy(&rec, buf.data() + offset, sizeof(rec));
+        if (rec.magic != WAL_MAGIC || offset + sizeof(rec) + rec.len > buf.size()) {
+            break;
+        }
+        const char* data = buf.data() + offset + sizeof(rec);
+        if (WalRecordCrc(rec, EntryCrc(rec.index, rec.term, data, rec.len)) != rec.crc) {
+            LOG_ERROR(dc::RAFT_LOG(), "SharedWal, record crc mismatch, path:%s, offset:%" PRIu64 "\n", path.c_str(), offset);
+            break;
+        }
+        offset += sizeof(rec) + rec.len;
+        records++;
+
+        std::map<uint64_t, LogStore*>::iterator it = stores_.find(rec.group);
+        if (it == stores_.end()) {
+            continue;   // group removed
+        }
+
+        int ret = rec.term == 0
+                  ? it->second->ReplayTruncate(rec.index)
+                  : it->second->Replay(rec.index, rec.term, data, rec.len);
+        if (ret != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "SharedWal, replay fail, path:%s, group:%" PRIu64 ", index:%" PRIu64 "\n",
+                      path.c_str(), rec.group, rec.index);
+            return -1;
+        }
+    }
+
+    if (offset != buf.size()) {
+        // torn or corrupt tail, it was never synced so never acked
+        LOG_WARNING(dc::RAFT_LOG(), "SharedWal, drop torn tail, path:%s, offset:%" PRIu64 ", size:%zu\n", path.c_str(), offset, buf.size());
+    }
+    LOG_INFO(dc::RAFT_LOG(), "SharedWal, replayed %" PRIu64 " records, path:%s\n", records, path.c_str());
+    return 0;
+}
+
+int SharedWal::OpenFile(uint64_t seq) {
+    std::string path = FilePath(seq);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, create fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+    if (dc::FsyncDir(dir_) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    fd_ = fd;
+    seq_ = seq;
+    file_size_ = 0;
+    return 0;
+}
+
+void SharedWal::Append(uint64_t group, uint64_t index, uint64_t term, const char* data, uint32_t len,
+                       uint32_t entry_crc) {
+    WalRecord rec;
+    rec.magic = WAL_MAGIC;
+    rec.len = len;
+    rec.group = group;
+    rec.index = index;
+    rec.term = term;
+    rec.crc = WalRecordCrc(rec, entry_crc);
+    rec.reserved = 0;
+
+    pending_.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+    pending_.append(data, len);
+}
+
+void SharedWal::Truncate(uint64_t group, uint64_t index) {
+    Append(group, index, 0, NULL, 0, EntryCrc(index, 0, NULL, 0));
+}
+
+int SharedWal::Flush() {
+    if (pending_.empty()) {
+        return 0;
+    }
+
+    uint64_t begin = dc::NowUs();
+    if (pwrite(fd_, pending_.data(), pending_.size(), file_size_) != static_cast<ssize_t>(pending_.size())
+        || fdatasync(fd_) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SharedWal, write fail, path:%s, errno:%d, error:%s\n", FilePath(seq_).c_str(), errno, strerror(errno));
+        return -1;
+    }
+    fsync_us_->Record(dc::NowUs() - begin);
+    file_size_ += pending_.size();
+    pending_.clear();
+    syncs_++;
+
+    if (file_size_ >= segment_size_ && !checkpointing_) {
+        if (OpenFile(seq_ + 1) != 0) {
+            return -1;
+        }
+        // failing here keeps the old files, retried at the next roll
+        Checkpoint();
+    }
+
+    return 0;
+}
+
+int SharedWal::Checkpoint() {
+    checkpointing_ = true;
+
+    int ret = 0;
+    std::map<uint64_t, LogStore*>::iterator it;
+    for (it = stores_.begin(); it != stores_.end() && ret == 0; it++) {
+        if (it->second->Flush() != 0 || it->second->Sync() != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "SharedWal, checkpoint fail, group:%" PRIu64 "\n", it->first);
+            ret = -1;
+        }
+    }
+
+    checkpointing_ = false;
+    if (ret != 0) {
+        return -1;
+    }
+
+    std::vector<std::string> names;
+    if (dc::ListDir(dir_, &names) != 0) {
+        return -1;
+    }
+
+    size_t suffix_len = strlen(WAL_FILE_SUFFIX);
+    for (size_t i = 0; i < names.size(); i++) {
+        const std::string& name = names[i];
+        if (name.size() <= suffix_len || name.compare(name.size() - suffix_len, suffix_len, WAL_FILE_SUFFIX) != 0
+            || strtoull(name.c_str(), NULL, 10) >= seq_) {
+            continue;
+        }
+
+        std::string path = dir_ + "/" + name;
+        if (unlink(path.c_str()) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "SharedWal, unlink fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        }
+    }
+
+    return dc::FsyncDir(dir_);
+}
+
+}   // namespace dcraft
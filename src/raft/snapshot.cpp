@@ -0,0 +1,399 @@
+#include "snapshot.h"
+#include "log.h"
+#include "file_util.h"
+#include "crc32c.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+namespace dcraft {
+
+int ReadSnapshotHeader(const std::string& path, SnapshotHeader* header) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int ret = dc::PreadFull(fd, header, sizeof(*header), 0);
+    close(fd);
+
+    if (ret != 0 || header->magic != SNAPSHOT_MAGIC) {
+        LOG_ERROR(dc::RAFT_LOG(), "ReadSnapshotHeader, bad snapshot, path:%s\n", path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+#define SNAPSHOT_CRC_READ (64 * 1024)
+
+static int PayloadCrc(int fd, uint32_t* crc) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+        return -1;
+    }
+
+    char buf[SNAPSHOT_CRC_READ];
+    uint64_t offset = sizeof(SnapshotHeader);
+    uint32_t c = 0;
+    while (offset < static_cast<uint64_t>(st.st_size)) {
+        size_t n = st.st_size - offset < sizeof(buf) ? st.st_size - offset : sizeof(buf);
+        if (dc::PreadFull(fd, buf, n, offset) != 0) {
+            return -1;
+        }
+        c = dc::Crc32c(c, buf, n);
+        offset += n;
+    }
+
+    *crc = c;
+    return 0;
+}
+
+int SealSnapshot(int fd) {
+    uint32_t crc = 0;
+    if (PayloadCrc(fd, &crc) != 0
+        || pwrite(fd, &crc, sizeof(crc), offsetof(SnapshotHeader, crc)) != static_cast<ssize_t>(sizeof(crc))) {
+        return -1;
+    }
+    return 0;
+}
+
+int VerifySnapshot(int fd) {
+    SnapshotHeader header;
+    uint32_t crc = 0;
+    if (dc::PreadFull(fd, &header, sizeof(header), 0) != 0 || header.magic != SNAPSHOT_MAGIC
+        || PayloadCrc(fd, &crc) != 0) {
+        return -1;
+    }
+    if (crc != header.crc) {
+        LOG_ERROR(dc::RAFT_LOG(), "VerifySnapshot, crc mismatch, index:%" PRIu64 ", crc:%08x, expect:%08x\n",
+                  header.last_index, crc, header.crc);
+        return -1;
+    }
+    return 0;
+}
+
+SnapshotSender::SnapshotSender(uint64_t self_id, uint32_t chunk_size, uint32_t window)
+    : self_id_(self_id)
+    , group_(0)
+    , chunk_size_(chunk_size ? chunk_size : SNAPSHOT_CHUNK_SIZE)
+    , window_(window ? window : SNAPSHOT_WINDOW)
+    , file_(NULL)
+    , size_(0)
+    , last_index_(0)
+    , last_term_(0)
+    , next_offset_(0)
+    , acked_offset_(0)
+    , tail_sent_(false)
+    , seq_(0)
+    , compressor_(NULL)
+    , slab_(NULL) {
+}
+
+SnapshotSender::~SnapshotSender() {
+    if (file_) {
+        file_->Release();
+        file_ = NULL;
+    }
+}
+
+int SnapshotSender::Open(const std::string& path, uint64_t last_index, uint64_t last_term) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotSender, open fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotSender, fstat fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (file_) {
+        file_->Release();
+    }
+    file_ = dc::Buffer::File(fd);
+    size_ = st.st_size;
+    last_index_ = last_index;
+    last_term_ = last_term;
+
+    next_offset_ = 0;
+    acked_offset_ = 0;
+    tail_sent_ = false;
+    seq_++;
+
+    return 0;
+}
+
+int SnapshotSender::Pump(dc::SocketFdHandler* conn, uint64_t term) {
+    if (!file_ || !conn) {
+        return 0;
+    }
+
+    int n = 0;
+    while (!tail_sent_ && next_offset_ - acked_offset_ < static_cast<uint64_t>(chunk_size_) * window_) {
+        uint64_t len = size_ - next_offset_;
+        if (len > chunk_size_) {
+            len = chunk_size_;
+        }
+
+        InstallSnapshotRequest req;
+        req.term = term;
+        req.leader_id = self_id_;
+        req.last_index = last_index_;
+        req.last_term = last_term_;
+        req.total = size_;
+        req.offset = next_offset_;
+        req.seq = seq_;
+        req.len = len;
+
+        if (!compressor_ || SendCompressed(req, conn) != 0) {
+            meta_.clear();
+            EncodeInstallSnapshot(req, &meta_, group_);
+            chain_.Append(meta_.data(), meta_.size());
+            chain_.Append(file_, next_offset_, len);
+            conn->Send(chain_);
+        }
+
+        next_offset_ += len;
+        tail_sent_ = next_offset_ == size_;
+        n++;
+    }
+
+    return n;
+}
+
+int SnapshotSender::SendCompressed(const InstallSnapshotRequest& req, dc::SocketFdHandler* conn) {
+    chunk_.resize(req.len);
+    if (req.len > 0 && dc::PreadFull(file_->fd(), &chunk_[0], req.len, req.offset) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotSender, pread fail, offset:%" PRIu64 ", len:%u, errno:%d, error:%s\n",
+                  req.offset, req.len, errno, strerror(errno));
+        return -1;
+    }
+
+    if (EncodeInstallSnapshot(req, chunk_.data(), compressor_, &scratch_, &chain_, slab_, group_) != 0) {
+        return -1;
+    }
+    conn->Send(chain_);
+    return 0;
+}
+
+int SnapshotSender::OnResponse(const InstallSnapshotResponse& resp) {
+    if (!file_ || resp.last_index != last_index_) {
+        return -1;
+    }
+
+    if (resp.success) {
+        if (resp.next_offset > acked_offset_) {
+            acked_offset_ = resp.next_offset;
+        }
+        return resp.done ? 1 : 0;
+    }
+
+    // rejects of chunks sent before the last rewind carry an old seq
+    if (resp.seq != seq_) {
+        return 0;
+    }
+
+    LOG_INFO(dc::RAFT_LOG(), "SnapshotSender, follower %" PRIu64 " resumes at %" PRIu64 " of %" PRIu64 "\n",
+             resp.from_id, resp.next_offset, size_);
+
+    acked_offset_ = resp.next_offset < size_ ? resp.next_offset : size_;
+    next_offset_ = acked_offset_;
+    tail_sent_ = false;
+    seq_++;
+
+    return 0;
+}
+
+void SnapshotSender::Rewind() {
+    next_offset_ = acked_offset_;
+    tail_sent_ = false;
+    seq_++;
+}
+
+SnapshotReceiver::SnapshotReceiver(const std::string& dir, const std::string& file)
+    : dir_(dir)
+    , file_(file)
+    , fd_(-1)
+    , last_index_(0)
+    , last_term_(0)
+    , size_(0)
+    , installed_index_(0)
+    , installed_term_(0) {
+}
+
+SnapshotReceiver::~SnapshotReceiver() {
+    ClosePartial();
+}
+
+void SnapshotReceiver::ClosePartial() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+    partial_path_.clear();
+    last_index_ = 0;
+    last_term_ = 0;
+    size_ = 0;
+}
+
+void SnapshotReceiver::RemoveStalePartials(const std::string& keep) {
+    std::vector<std::string> names;
+    if (dc::ListDir(dir_, &names) != 0) {
+        return;
+    }
+
+    size_t suffix_len = strlen(SNAPSHOT_PARTIAL_SUFFIX);
+    for (size_t i = 0; i < names.size(); i++) {
+        const std::string& name = names[i];
+        if (name.size() <= suffix_len
+            || name.compare(0, file_.size(), file_) != 0
+            || name.compare(name.size() - suffix_len, suffix_len, SNAPSHOT_PARTIAL_SUFFIX) != 0) {
+            continue;
+        }
+
+        std::string path = dir_ + "/" + name;
+        if (path != keep) {
+            unlink(path.c_str());
+        }
+    }
+}
+
+int SnapshotReceiver::OpenPartial(uint64_t last_index, uint64_t last_term) {
+    ClosePartial();
+
+    if (dc::MakeDirs(dir_) != 0) {
+        return -1;
+    }
+
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%" PRIu64 "_%" PRIu64 SNAPSHOT_PARTIAL_SUFFIX, last_index, last_term);
+    std::string path = dir_ + "/" + file_ + suffix;
+
+    // only the snapshot being received is worth resuming
+    RemoveStalePartials(path);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, open fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    // everything in it was fdatasync'ed before it was acked
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, fstat fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    fd_ = fd;
+    partial_path_ = path;
+    last_index_ = last_index;
+    last_term_ = last_term;
+    size_ = st.st_size;
+
+    return 0;
+}
+
+int SnapshotReceiver::OnChunk(const InstallSnapshotView& req, uint64_t self_id, InstallSnapshotResponse* resp) {
+    resp->term = req.term;
+    resp->from_id = self_id;
+    resp->last_index = req.last_index;
+    resp->seq = req.seq;
+    resp->success = false;
+    resp->done = false;
+    resp->next_offset = 0;
+
+    if (req.last_index == installed_index_ && req.last_term == installed_term_) {
+        // chunk resent after the last one was acked
+        resp->success = true;
+        resp->done = true;
+        resp->next_offset = req.total;
+        return 0;
+    }
+
+    if (fd_ == -1 || req.last_index != last_index_ || req.last_term != last_term_) {
+        if (OpenPartial(req.last_index, req.last_term) != 0) {
+            return -1;
+        }
+    }
+
+    if (size_ > req.total) {
+        // not the file we think it is, start over
+        if (ftruncate(fd_, 0) != 0) {
+            ClosePartial();
+            return -1;
+        }
+        size_ = 0;
+    }
+
+    resp->next_offset = size_;
+
+    if (req.offset != size_ || req.offset + req.len > req.total) {
+        return 0;
+    }
+
+    if (req.len > 0) {
+        ssize_t n = pwrite(fd_, req.data, req.len, req.offset);
+        if (n != static_cast<ssize_t>(req.len) || fdatasync(fd_) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, write fail, path:%s, errno:%d, error:%s\n", partial_path_.c_str(), errno, strerror(errno));
+            // a short write may have extended the file, size_ is still what is synced
+            if (ftruncate(fd_, size_) != 0) {
+                ClosePartial();
+            }
+            return -1;
+        }
+        size_ += req.len;
+    }
+
+    resp->success = true;
+    resp->next_offset = size_;
+
+    if (size_ < req.total) {
+        return 0;
+    }
+
+    std::string path = dir_ + "/" + file_;
+    if (req.len == 0 && fdatasync(fd_) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, fdatasync fail, path:%s, errno:%d, error:%s\n", partial_path_.c_str(), errno, strerror(errno));
+        resp->success = false;
+        return -1;
+    }
+    if (VerifySnapshot(fd_) != 0) {
+        // corrupt on the leader's disk or on the way, start over
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, bad snapshot, path:%s, index:%" PRIu64 "\n", partial_path_.c_str(), req.last_index);
+        resp->success = false;
+        resp->next_offset = 0;
+        if (ftruncate(fd_, 0) != 0) {
+            ClosePartial();
+            return -1;
+        }
+        size_ = 0;
+        return 0;
+    }
+    if (rename(partial_path_.c_str(), path.c_str()) != 0 || dc::FsyncDir(dir_) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "SnapshotReceiver, install fail, path:%s, errno:%d, error:%s\n", path.c_str(), errno, strerror(errno));
+        resp->success = false;
+        return -1;
+    }
+
+    ClosePartial();
+    installed_index_ = req.last_index;
+    installed_term_ = req.last_term;
+    resp->done = true;
+
+    return 1;
+}
+
+}   // namespace dcraft
@@ -0,0 +1,201 @@
+#include "snapshotter.h"
+#include "log.h"
+#include "file_util.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+
+namespace dcraft {
+
+static uint64_t NowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Snapshotter::Snapshotter(Fsm* fsm, LogStore* store, const std::string& dir, const std::string& file,
+                         uint64_t keep_entries)
+    : fsm_(fsm)
+    , store_(store)
+    , dir_(dir)
+    , file_(file)
+    , keep_entries_(keep_entries)
+    , running_(false)
+    , fd_(-1)
+    , index_(0)
+    , term_(0)
+    , start_ms_(0)
+    , pid_(-1)
+    , result_(0)
+    , last_index_(0)
+    , last_term_(0) {
+    SnapshotHeader header;
+    if (ReadSnapshotHeader(path(), &header) == 0) {
+        last_index_ = header.last_index;
+        last_term_ = header.last_term;
+    }
+}
+
+Snapshotter::~Snapshotter() {
+    if (pid_ != -1) {
+        int status;
+        waitpid(pid_, &status, 0);
+        pid_ = -1;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+int Snapshotter::Start(uint64_t index, uint64_t term) {
+    if (running_) {
+        return 1;
+    }
+    if (index <= last_index_) {
+        return 0;
+    }
+
+    if (dc::MakeDirs(dir_) != 0) {
+        return -1;
+    }
+
+    std::string tmp = path() + SNAPSHOT_TMP_SUFFIX;
+    fd_ = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, open fail, path:%s, errno:%d, error:%s\n", tmp.c_str(), errno, strerror(errno));
+        return -1;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.last_index = index;
+    header.last_term = term;
+
+    // the writer appends the payload from here
+    if (dc::WriteFull(fd_, &header, sizeof(header)) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, write header fail, path:%s, errno:%d, error:%s\n", tmp.c_str(), errno, strerror(errno));
+        Abort();
+        return -1;
+    }
+
+    index_ = index;
+    term_ = term;
+    start_ms_ = NowMs();
+
+    FsmView* view = fsm_->Checkpoint();
+    if (view) {
+        result_ = 1;
+        int fd = fd_;
+        std::atomic<int>* result = &result_;
+        thread_ = std::thread([view, fd, result]() {
+            int ret = view->Save(fd) == 0 && SealSnapshot(fd) == 0 && fdatasync(fd) == 0 ? 0 : -1;
+            delete view;
+            result->store(ret, std::memory_order_release);
+        });
+    } else {
+        pid_ = fork();
+        if (pid_ < 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, fork fail, errno:%d, error:%s\n", errno, strerror(errno));
+            pid_ = -1;
+            Abort();
+            return -1;
+        }
+
+        if (pid_ == 0) {
+            // child, the image of the moment of fork, parent pages are copied on write
+            int ret = fsm_->SaveSnapshot(fd_) == 0 && SealSnapshot(fd_) == 0 && fdatasync(fd_) == 0 ? 0 : 1;
+            _exit(ret);
+        }
+    }
+
+    running_ = true;
+    return 0;
+}
+
+int Snapshotter::Poll() {
+    if (!running_) {
+        return 0;
+    }
+
+    if (pid_ != -1) {
+        int status;
+        pid_t ret = waitpid(pid_, &status, WNOHANG);
+        if (ret == 0) {
+            return 0;
+        }
+        pid_ = -1;
+        if (ret < 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, waitpid fail, errno:%d, error:%s\n", errno, strerror(errno));
+            return Finish(false);
+        }
+        return Finish(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    int result = result_.load(std::memory_order_acquire);
+    if (result == 1) {
+        return 0;
+    }
+    thread_.join();
+    return Finish(result == 0);
+}
+
+void Snapshotter::Abort() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+    std::string tmp = path() + SNAPSHOT_TMP_SUFFIX;
+    unlink(tmp.c_str());
+    running_ = false;
+}
+
+int Snapshotter::Finish(bool ok) {
+    if (!ok) {
+        LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, writer fail, index:%" PRIu64 "\n", index_);
+        Abort();
+        return -1;
+    }
+
+    close(fd_);
+    fd_ = -1;
+
+    std::string tmp = path() + SNAPSHOT_TMP_SUFFIX;
+    if (rename(tmp.c_str(), path().c_str()) != 0 || dc::FsyncDir(dir_) != 0) {
+        LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, install fail, path:%s, errno:%d, error:%s\n", path().c_str(), errno, strerror(errno));
+        unlink(tmp.c_str());
+        running_ = false;
+        return -1;
+    }
+
+    last_index_ = index_;
+    last_term_ = term_;
+    // after last_index_, Start() on the apply thread reads it once it sees false
+    running_ = false;
+
+    // the snapshot is durable, the log before it can go
+    if (index_ > keep_entries_) {
+        uint64_t index = index_ - keep_entries_;
+        uint64_t term = keep_entries_ == 0 ? term_ : store_->Term(index);
+        if (store_->Compact(index, term) != 0) {
+            LOG_ERROR(dc::RAFT_LOG(), "Snapshotter, compact log fail, index:%" PRIu64 "\n", index);
+        }
+    }
+
+    LOG_INFO(dc::RAFT_LOG(), "Snapshotter, snapshot done, index:%" PRIu64 ", term:%" PRIu64 ", cost:%" PRIu64 "ms\n",
+             last_index_, last_term_, NowMs() - start_ms_);
+    return 1;
+}
+
+}   // namespace dcraft
@@ -0,0 +1,129 @@
+#include "tail_cache.h"
+
+namespace dcraft {
+
+TailCache::TailCache(uint64_t max_bytes, uint32_t max_entries)
+    : max_bytes_(max_bytes)
+    , slots_(NULL)
+    , mask_(0)
+    , first_(1)
+    , last_(0)
+    , hits_(0)
+    , misses_(0)
+    , hit_bytes_(0)
+    , evictions_(0)
+    , entries_(0)
+    , bytes_(0) {
+    uint64_t n = 1;
+    while (n < max_entries) {
+        n <<= 1;
+    }
+    slots_ = new Slot[n]();
+    mask_ = n - 1;
+}
+
+TailCache::~TailCache() {
+    Clear();
+    delete [] slots_;
+}
+
+void TailCache::PopFront() {
+    Slot& s = slots_[first_ & mask_];
+    Bump(bytes_, -s.data->size());
+    Bump(entries_, -1);
+    s.data->Release();
+    s.data = NULL;
+    first_++;
+}
+
+void TailCache::PopBack() {
+    Slot& s = slots_[last_ & mask_];
+    Bump(bytes_, -s.data->size());
+    Bump(entries_, -1);
+    s.data->Release();
+    s.data = NULL;
+    last_--;
+}
+
+void TailCache::Put(uint64_t index, uint64_t term, dc::Buffer* data, uint32_t crc) {
+    if (first_ <= last_ && index != last_ + 1) {
+        Clear();
+    }
+    if (first_ > last_) {
+        first_ = index;
+        last_ = index - 1;
+    }
+
+    // room for one more slot and for the bytes, the entry itself always fits
+    uint64_t size = data->size();
+    while (first_ <= last_
+           && (last_ + 1 - first_ > mask_ || bytes_.load(std::memory_order_relaxed) + size > max_bytes_)) {
+        PopFront();
+        Bump(evictions_, 1);
+    }
+
+    data->AddRef();
+    Slot& s = slots_[index & mask_];
+    s.term = term;
+    s.data = data;
+    s.crc = crc;
+    last_ = index;
+    Bump(bytes_, size);
+    Bump(entries_, 1);
+}
+
+bool TailCache::Get(uint64_t index, uint64_t* term, dc::Buffer** data, uint32_t* crc) {
+    if (index < first_ || index > last_) {
+        Bump(misses_, 1);
+        return false;
+    }
+
+    const Slot& s = slots_[index & mask_];
+    s.data->AddRef();
+    *term = s.term;
+    *data = s.data;
+    if (crc) {
+        *crc = s.crc;
+    }
+
+    Bump(hits_, 1);
+    Bump(hit_bytes_, s.data->size());
+    return true;
+}
+
+void TailCache::Truncate(uint64_t index) {
+    while (first_ <= last_ && last_ >= index) {
+        PopBack();
+    }
+}
+
+void TailCache::Compact(uint64_t index) {
+    while (first_ <= last_ && first_ <= index) {
+        PopFront();
+    }
+}
+
+void TailCache::Clear() {
+    while (first_ <= last_) {
+        PopFront();
+    }
+}
+
+TailCacheStats TailCache::stats() const {
+    TailCacheStats s;
+    s.hits = hits_.load(std::memory_order_relaxed);
+    s.misses = misses_.load(std::memory_order_relaxed);
+    s.hit_bytes = hit_bytes_.load(std::memory_order_relaxed);
+    s.evictions = evictions_.load(std::memory_order_relaxed);
+    s.entries = entries_.load(std::memory_order_relaxed);
+    s.bytes = bytes_.load(std::memory_order_relaxed);
+    return s;
+}
+
+double TailCache::hit_rate() const {
+    uint64_t hits = hits_.load(std::memory_order_relaxed);
+    uint64_t total = hits + misses_.load(std::memory_order_relaxed);
+    return total ? static_cast<double>(hits) / total : 0;
+}
+
+}   // namespace dcraft
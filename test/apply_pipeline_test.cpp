@@ -0,0 +1,268 @@
+#include "apply_pipeline.h"
+#include "log_store.h"
+#include "slab.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dcraft;
+
+namespace {
+
+uint64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * entries are "<key>:<n>", "!" is a barrier. Apply() blocks while the
+ * gate is closed
+ */
+class Recorder : public Fsm {
+public:
+    Recorder() : open_(true), entered_(0), bad_barriers_(0) {}
+
+    virtual int Apply(uint64_t index, const char* data, uint32_t len) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entered_++;
+        entered_cv_.notify_all();
+        gate_cv_.wait(lock, [this]() { return open_; });
+
+        std::string s(data, len);
+        if (s == "!") {
+            // everything before it is applied, nothing after
+            if (applied_.size() != index - 1) {
+                bad_barriers_++;
+            }
+            barriers_.push_back(index);
+        } else {
+            uint64_t key = strtoull(s.c_str(), NULL, 10);
+            by_key_[key].push_back(index);
+            // every barrier before the entry is done
+            for (uint64_t b = index - 1; b > 0 && b + 50 > index; b--) {
+                if (barrier_at_.count(b) && std::find(barriers_.begin(), barriers_.end(), b) == barriers_.end()) {
+                    bad_barriers_++;
+                }
+            }
+        }
+        applied_.push_back(index);
+        return 0;
+    }
+
+    virtual uint64_t Key(const char* data, uint32_t len) {
+        std::string s(data, len);
+        return s == "!" ? FSM_KEY_BARRIER : strtoull(s.c_str(), NULL, 10);
+    }
+
+    virtual int SaveSnapshot(int) { return 0; }
+    virtual int LoadSnapshot(int) { return 0; }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = false;
+    }
+
+    void Open() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = true;
+        gate_cv_.notify_all();
+    }
+
+    // the apply thread is inside Apply()
+    void WaitEntered() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entered_cv_.wait(lock, [this]() { return entered_ > 0; });
+    }
+
+    std::vector<uint64_t> applied() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return applied_;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable gate_cv_;
+    std::condition_variable entered_cv_;
+    bool open_;
+    int entered_;
+    int bad_barriers_;
+    std::vector<uint64_t> applied_;
+    std::vector<uint64_t> barriers_;
+    std::set<uint64_t> barrier_at_;
+    std::map<uint64_t, std::vector<uint64_t> > by_key_;
+};
+
+class ApplyPipelineTest : public ::testing::Test {
+protected:
+    ApplyPipelineTest() : store_(dir_.Join("log")) {}
+
+    virtual void SetUp() {
+        ASSERT_EQ(0, store_.Initialize());
+        loop_.reset(dc::CreateEventLoop(dc::LOOP_EPOLL, true));
+        ASSERT_TRUE(loop_.get() != NULL);
+        slab_.Bind();
+    }
+
+    void Append(const std::string& data) {
+        ASSERT_GT(store_.Append(1, data.data(), data.size()), 0u);
+    }
+
+    void AppendN(uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            Append("0");
+        }
+        ASSERT_EQ(0, store_.Flush());
+    }
+
+    // run the loop until applied_index() reaches index, or 5 s
+    bool WaitApplied(ApplyPipeline* p, uint64_t index) {
+        uint64_t deadline = NowMs() + 5000;
+        while (p->applied_index() < index) {
+            if (NowMs() >= deadline || loop_->Wait(10) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    dctest::TempDir dir_;
+    LogStore store_;
+    dc::Slab slab_;
+    std::unique_ptr<dc::EventLoop> loop_;
+    Recorder fsm_;
+};
+
+}   // namespace
+
+TEST_F(ApplyPipelineTest, SerialInLogOrder) {
+    AppendN(100);
+    {
+        ApplyPipeline p(&fsm_, &store_);
+        p.SetSlab(&slab_);
+        ASSERT_EQ(0, p.Initialize(loop_.get(), 0));
+
+        EXPECT_EQ(60u, p.Submit(60));
+        EXPECT_EQ(0u, p.Submit(60));        // nothing new
+        EXPECT_EQ(60u, p.submitted_index());
+        ASSERT_TRUE(WaitApplied(&p, 60));
+
+        // the apply thread is asleep now, a Submit() wakes it
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_EQ(40u, p.Submit(100));
+        ASSERT_TRUE(WaitApplied(&p, 100));
+        EXPECT_EQ(0u, p.queued());
+    }
+
+    std::vector<uint64_t> applied = fsm_.applied();
+    ASSERT_EQ(100u, applied.size());
+    for (uint64_t i = 0; i < applied.size(); i++) {
+        EXPECT_EQ(i + 1, applied[i]);
+    }
+    EXPECT_EQ(0u, slab_.stats().in_use);
+}
+
+// a full ring only stops Submit(), the rest goes once the apply thread catches up
+TEST_F(ApplyPipelineTest, FullRingStopsSubmit) {
+    AppendN(10);
+    ApplyPipeline p(&fsm_, &store_, 4);
+    p.SetSlab(&slab_);
+    ASSERT_EQ(0, p.Initialize(loop_.get(), 0));
+
+    fsm_.Close();
+    EXPECT_EQ(4u, p.Submit(10));
+    fsm_.WaitEntered();
+    EXPECT_EQ(0u, p.Submit(10));        // entry 1 is still in its slot
+    EXPECT_EQ(4u, p.queued());
+    EXPECT_EQ(0u, p.applied_index());
+
+    fsm_.Open();
+    uint64_t deadline = NowMs() + 5000;
+    while (p.submitted_index() < 10 && NowMs() < deadline) {
+        p.Submit(10);
+        loop_->Wait(1);
+    }
+    ASSERT_TRUE(WaitApplied(&p, 10));
+    EXPECT_EQ(10u, fsm_.applied().size());
+}
+
+// entries of a key in log order on one worker, a barrier alone between batches
+TEST_F(ApplyPipelineTest, ParallelKeepsKeyOrderAndBarriers) {
+    const uint64_t kEntries = 1000;
+    for (uint64_t i = 1; i <= kEntries; i++) {
+        if (i % 50 == 0) {
+            Append("!");
+            fsm_.barrier_at_.insert(i);
+        } else {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%llu:%llu", static_cast<unsigned long long>(i % 7),
+                     static_cast<unsigned long long>(i));
+            Append(buf);
+        }
+    }
+    ASSERT_EQ(0, store_.Flush());
+
+    ApplyPipeline p(&fsm_, &store_, 4096, 4);
+    p.SetSlab(&slab_);
+    ASSERT_EQ(0, p.Initialize(loop_.get(), 0));
+    EXPECT_EQ(kEntries, p.Submit(kEntries));
+
+    // applied_index only ever moves forward
+    uint64_t last = 0;
+    uint64_t deadline = NowMs() + 5000;
+    while (p.applied_index() < kEntries && NowMs() < deadline) {
+        uint64_t now = p.applied_index();
+        EXPECT_GE(now, last);
+        last = now;
+        loop_->Wait(1);
+    }
+    ASSERT_EQ(kEntries, p.applied_index());
+
+    EXPECT_EQ(kEntries, fsm_.applied().size());
+    EXPECT_EQ(kEntries / 50, fsm_.barriers_.size());
+    EXPECT_EQ(0, fsm_.bad_barriers_);
+    for (std::map<uint64_t, std::vector<uint64_t> >::iterator it = fsm_.by_key_.begin(); it != fsm_.by_key_.end(); it++) {
+        const std::vector<uint64_t>& indexes = it->second;
+        for (size_t i = 1; i < indexes.size(); i++) {
+            EXPECT_LT(indexes[i - 1], indexes[i]) << "key " << it->first;
+        }
+    }
+}
+
+// Stop() ends after the batch in hand, the entries still queued are released
+TEST_F(ApplyPipelineTest, StopWithEntriesQueued) {
+    AppendN(APPLY_BATCH_ENTRIES + 44);
+    {
+        ApplyPipeline p(&fsm_, &store_, 1024);
+        p.SetSlab(&slab_);
+        ASSERT_EQ(0, p.Initialize(loop_.get(), 0));
+        // asleep, the whole Submit() below is its first batch
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        fsm_.Close();
+        EXPECT_EQ(APPLY_BATCH_ENTRIES + 44u, p.Submit(APPLY_BATCH_ENTRIES + 44));
+        fsm_.WaitEntered();
+
+        std::thread stopper([&p]() { p.Stop(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        fsm_.Open();
+        stopper.join();
+
+        EXPECT_EQ(static_cast<uint64_t>(APPLY_BATCH_ENTRIES), p.applied_index());
+        EXPECT_EQ(44u, p.queued());
+        EXPECT_GT(slab_.stats().in_use, 0u);
+    }
+
+    EXPECT_EQ(static_cast<size_t>(APPLY_BATCH_ENTRIES), fsm_.applied().size());
+    EXPECT_EQ(0u, slab_.stats().in_use);
+}
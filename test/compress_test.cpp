@@ -0,0 +1,201 @@
+#include "compress.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace dc;
+
+namespace {
+
+std::string Random(size_t len, unsigned seed) {
+    std::string s(len, '\0');
+    srand(seed);
+    for (size_t i = 0; i < len; i++) {
+        s[i] = static_cast<char>(rand());
+    }
+    return s;
+}
+
+// short runs of a few symbols, what log entries of one client look like
+std::string Runs(size_t len, unsigned seed) {
+    std::string s;
+    srand(seed);
+    while (s.size() < len) {
+        s.append(1 + rand() % 40, static_cast<char>('a' + rand() % 4));
+    }
+    s.resize(len);
+    return s;
+}
+
+// a random block repeated at distance, beyond the 64K window too
+std::string Repeat(size_t len, size_t period, unsigned seed) {
+    std::string block = Random(period, seed);
+    std::string s;
+    while (s.size() < len) {
+        s += block;
+    }
+    s.resize(len);
+    return s;
+}
+
+std::string Compress(const Compressor& c, const std::string& raw) {
+    std::string out(c.Bound(raw.size()), '\0');
+    size_t n = c.Compress(raw.data(), raw.size(), &out[0]);
+    EXPECT_GT(n, 0u);
+    EXPECT_LE(n, out.size());
+    out.resize(n);
+    return out;
+}
+
+int Decompress(const Compressor& c, const std::string& z, size_t raw_len, std::string* out) {
+    out->assign(raw_len, '\0');
+    return c.Decompress(z.data(), z.size(), &(*out)[0], raw_len);
+}
+
+void ExpectRoundTrip(const std::string& raw) {
+    Lz4Compressor c;
+    std::string z = Compress(c, raw);
+    std::string out;
+    ASSERT_EQ(0, Decompress(c, z, raw.size(), &out)) << "len " << raw.size();
+    EXPECT_TRUE(out == raw) << "len " << raw.size();
+}
+
+}   // namespace
+
+TEST(CompressTest, Lz4RoundTripShort) {
+    // around LZ4_MFLIMIT (12): no match may start in the last 12 bytes
+    for (size_t len = 0; len <= 64; len++) {
+        ExpectRoundTrip(std::string(len, 'x'));
+        ExpectRoundTrip(Random(len, static_cast<unsigned>(len)));
+        ExpectRoundTrip(Runs(len, static_cast<unsigned>(len)));
+    }
+    ExpectRoundTrip("abcdabcdabcd");
+    ExpectRoundTrip("abcdabcdabcda");
+}
+
+TEST(CompressTest, Lz4RoundTripSizesAndPatterns) {
+    size_t sizes[] = {100, 255, 256, 270, 1000, 4096, 65535, 65536, 65537, 100000, 1 << 20};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t len = sizes[i];
+        ExpectRoundTrip(std::string(len, '\0'));
+        ExpectRoundTrip(Random(len, static_cast<unsigned>(i)));
+        ExpectRoundTrip(Runs(len, static_cast<unsigned>(i)));
+        ExpectRoundTrip(Repeat(len, 7, static_cast<unsigned>(i)));
+        ExpectRoundTrip(Repeat(len, 1000, static_cast<unsigned>(i)));
+        ExpectRoundTrip(Repeat(len, 70000, static_cast<unsigned>(i)));
+        // compressible head, random tail and the other way round
+        ExpectRoundTrip(std::string(len / 2, 'a') + Random(len - len / 2, static_cast<unsigned>(i)));
+        ExpectRoundTrip(Random(len / 2, static_cast<unsigned>(i)) + std::string(len - len / 2, 'a'));
+    }
+}
+
+TEST(CompressTest, Lz4Shrinks) {
+    Lz4Compressor c;
+    std::string runs = Runs(65536, 1);
+    EXPECT_LT(Compress(c, runs).size(), runs.size() / 4);
+    std::string zeros(1 << 20, '\0');
+    EXPECT_LT(Compress(c, zeros).size(), zeros.size() / 200);
+
+    // incompressible stays within Bound()
+    std::string random = Random(1 << 20, 2);
+    EXPECT_LE(Compress(c, random).size(), c.Bound(random.size()));
+}
+
+// the LZ4 block end rules, a stock decoder relies on them: the last 5
+// bytes are literals, no match starts within the last 12
+TEST(CompressTest, Lz4BlockEndRules) {
+    Lz4Compressor c;
+    for (size_t len = 13; len < 3000; len += 37) {
+        std::string raw = Repeat(len, 5, static_cast<unsigned>(len));
+        std::string z = Compress(c, raw);
+
+        const uint8_t* ip = reinterpret_cast<const uint8_t*>(z.data());
+        const uint8_t* iend = ip + z.size();
+        size_t pos = 0;
+        size_t last_lit = 0;
+        while (ip < iend) {
+            uint8_t token = *ip++;
+            size_t lit = token >> 4;
+            if (lit == 15) {
+                do { lit += *ip; } while (*ip++ == 255);
+            }
+            ip += lit;
+            pos += lit;
+            last_lit = lit;
+            if (ip == iend) {
+                break;
+            }
+            EXPECT_LE(pos + 12, len) << "len " << len;
+            ip += 2;
+            size_t ml = token & 15;
+            if (ml == 15) {
+                do { ml += *ip; } while (*ip++ == 255);
+            }
+            pos += ml + 4;
+        }
+        EXPECT_EQ(len, pos);
+        EXPECT_GE(last_lit, 5u) << "len " << len;
+    }
+}
+
+TEST(CompressTest, Lz4WrongRawLengthRejected) {
+    Lz4Compressor c;
+    std::string raw = Runs(5000, 3);
+    std::string z = Compress(c, raw);
+    std::string out;
+    EXPECT_EQ(-1, Decompress(c, z, raw.size() - 1, &out));
+    EXPECT_EQ(-1, Decompress(c, z, raw.size() + 1, &out));
+    EXPECT_EQ(-1, Decompress(c, z, 0, &out));
+}
+
+TEST(CompressTest, Lz4TruncatedRejected) {
+    Lz4Compressor c;
+    std::string raw = Runs(3000, 4) + Random(500, 4) + Runs(3000, 5);
+    std::string z = Compress(c, raw);
+    std::string out;
+    for (size_t n = 0; n < z.size(); n++) {
+        EXPECT_EQ(-1, Decompress(c, z.substr(0, n), raw.size(), &out)) << "prefix " << n;
+    }
+}
+
+TEST(CompressTest, Lz4CorruptedStaysInBounds) {
+    Lz4Compressor c;
+    std::string raw = Runs(3000, 6) + Repeat(3000, 300, 6);
+    std::string z = Compress(c, raw);
+
+    // any byte, any value: -1 or some output of exactly raw_len, never past it
+    srand(7);
+    for (int i = 0; i < 20000; i++) {
+        std::string bad = z;
+        bad[rand() % bad.size()] ^= static_cast<char>(1 + rand() % 255);
+        std::string out(raw.size() + 64, '\x5a');
+        int ret = c.Decompress(bad.data(), bad.size(), &out[0], raw.size());
+        EXPECT_TRUE(ret == 0 || ret == -1);
+        EXPECT_EQ(std::string(64, '\x5a'), out.substr(raw.size())) << "iteration " << i;
+    }
+
+    // a match before the start of the output
+    std::string bad;
+    bad += static_cast<char>(0x10);     // 1 literal, match len 4
+    bad += 'a';
+    bad += static_cast<char>(2);        // offset 2 > 1 byte written
+    bad += static_cast<char>(0);
+    bad += static_cast<char>(0x00);
+    std::string out;
+    EXPECT_EQ(-1, Decompress(c, bad, 5, &out));
+
+    // offset 0
+    bad[2] = 0;
+    EXPECT_EQ(-1, Decompress(c, bad, 5, &out));
+}
+
+TEST(CompressTest, Registry) {
+    EXPECT_EQ(COMPRESS_NONE, CompressorType("none"));
+    EXPECT_EQ(COMPRESS_LZ4, CompressorType("lz4"));
+    EXPECT_EQ(-1, CompressorType("zip"));
+    EXPECT_TRUE(GetCompressor(COMPRESS_NONE) == NULL);
+    ASSERT_TRUE(GetCompressor(COMPRESS_LZ4) != NULL);
+    EXPECT_EQ(COMPRESS_LZ4, GetCompressor(COMPRESS_LZ4)->type());
+    EXPECT_TRUE(SupportedCompressors() & (1u << COMPRESS_LZ4));
+}
@@ -0,0 +1,99 @@
+#include "crc32c.h"
+#include "log_store.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+using namespace dc;
+
+namespace {
+
+// bit at a time, the definition
+uint32_t Reference(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+std::string Random(size_t len, unsigned seed) {
+    std::string s(len, '\0');
+    srand(seed);
+    for (size_t i = 0; i < len; i++) {
+        s[i] = static_cast<char>(rand());
+    }
+    return s;
+}
+
+}   // namespace
+
+TEST(Crc32cTest, KnownVectors) {
+    EXPECT_EQ(0u, Crc32c(0, "", 0));
+    EXPECT_EQ(0xe3069283u, Crc32c(0, "123456789", 9));
+
+    // RFC 3720 B.4
+    char buf[32];
+    memset(buf, 0, sizeof(buf));
+    EXPECT_EQ(0x8a9136aau, Crc32c(0, buf, sizeof(buf)));
+    memset(buf, 0xff, sizeof(buf));
+    EXPECT_EQ(0x62a8ab43u, Crc32c(0, buf, sizeof(buf)));
+    for (int i = 0; i < 32; i++) {
+        buf[i] = static_cast<char>(i);
+    }
+    EXPECT_EQ(0x46dd794eu, Crc32c(0, buf, sizeof(buf)));
+}
+
+// whichever of Crc32cImpl() runs here, on the short path and on the
+// 3 stream path past CRC32C_LONG, at every alignment
+TEST(Crc32cTest, MatchesReferenceAcrossSizesAndAlignments) {
+    std::string data = Random(3 * 8192 * 2 + 64, 1);
+    size_t sizes[] = {0, 1, 3, 7, 8, 9, 15, 16, 63, 255, 256, 257, 767, 768, 769,
+                      4096, 8191, 8192, 8193, 3 * 8192 - 1, 3 * 8192, 3 * 8192 + 1, 3 * 8192 * 2};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (size_t align = 0; align < 8; align++) {
+            const char* p = data.data() + align;
+            EXPECT_EQ(Reference(0, p, sizes[i]), Crc32c(0, p, sizes[i]))
+                << Crc32cImpl() << " len " << sizes[i] << " align " << align;
+        }
+    }
+}
+
+TEST(Crc32cTest, Chained) {
+    std::string data = Random(100000, 2);
+    uint32_t whole = Crc32c(0, data.data(), data.size());
+    size_t cuts[] = {0, 1, 13, 8192, 30000, 99999, 100000};
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        uint32_t crc = Crc32c(0, data.data(), cuts[i]);
+        EXPECT_EQ(whole, Crc32c(crc, data.data() + cuts[i], data.size() - cuts[i])) << "cut " << cuts[i];
+    }
+}
+
+// EntryCrc() is the crc of index, term, len, then data
+TEST(Crc32cTest, EntryCrc) {
+    std::string data = Random(300, 3);
+    dcraft::EntryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.index = 42;
+    header.term = 7;
+    header.len = static_cast<uint32_t>(data.size());
+
+    std::string bytes(reinterpret_cast<const char*>(&header), offsetof(dcraft::EntryHeader, crc));
+    bytes += data;
+    uint32_t crc = dcraft::EntryCrc(42, 7, data.data(), header.len);
+    EXPECT_EQ(Reference(0, bytes.data(), bytes.size()), crc);
+
+    // every field is covered
+    EXPECT_NE(crc, dcraft::EntryCrc(43, 7, data.data(), header.len));
+    EXPECT_NE(crc, dcraft::EntryCrc(42, 8, data.data(), header.len));
+    EXPECT_NE(crc, dcraft::EntryCrc(42, 7, data.data(), header.len - 1));
+    data[150] ^= 1;
+    EXPECT_NE(crc, dcraft::EntryCrc(42, 7, data.data(), header.len));
+}
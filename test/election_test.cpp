@@ -0,0 +1,257 @@
+#include "election.h"
+#include "log_store.h"
+#include "log_replicate.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+const uint32_t kTimeout = 100;          // campaigns within [100, 200) ms
+const uint64_t kSelf = 1;
+
+class Listener : public ElectionListener {
+public:
+    Listener() : leader_term_(0), followers_(0) {}
+
+    virtual void OnBecomeLeader(uint64_t term) { leader_term_ = term; }
+    virtual void OnBecomeFollower(uint64_t, uint64_t) { followers_++; }
+
+    uint64_t leader_term_;
+    int followers_;
+};
+
+/*
+ * node 1 of a 3 node group (2 and 3 are peers), no connections: what it
+ * sends goes nowhere, the test plays the answers
+ */
+class Node {
+public:
+    Node(const std::string& dir, bool pre_vote, bool check_quorum, int peers = 2)
+        : store_(dir + "/log")
+        , replicate_(&store_, kSelf)
+        , election_(&store_, &replicate_, kSelf, dir, kTimeout, pre_vote, check_quorum) {
+        EXPECT_EQ(0, store_.Initialize());
+        election_.SetListener(&listener_);
+        for (int i = 0; i < peers; i++) {
+            election_.AddPeer(kSelf + 1 + i);
+        }
+        EXPECT_EQ(0, election_.Initialize(0));
+    }
+
+    LogStore store_;
+    LogReplicate replicate_;
+    Election election_;
+    Listener listener_;
+};
+
+RequestVoteResponse Vote(uint64_t term, uint64_t from, bool granted, bool pre_vote) {
+    RequestVoteResponse resp;
+    resp.term = term;
+    resp.from_id = from;
+    resp.granted = granted;
+    resp.pre_vote = pre_vote;
+    return resp;
+}
+
+RequestVoteRequest Ask(uint64_t term, uint64_t candidate, bool pre_vote) {
+    RequestVoteRequest req;
+    req.term = term;
+    req.candidate_id = candidate;
+    req.last_log_index = 0;
+    req.last_log_term = 0;
+    req.pre_vote = pre_vote;
+    return req;
+}
+
+// pre-vote, then the vote of peer 2, at now
+void ElectLeader(Node* n, uint64_t now) {
+    n->election_.Tick(now);
+    ASSERT_EQ(Election::ROLE_PRE_CANDIDATE, n->election_.role());
+    uint64_t term = n->election_.term();
+    n->election_.OnRequestVoteResponse(Vote(term + 1, 2, true, true), now);
+    ASSERT_EQ(Election::ROLE_CANDIDATE, n->election_.role());
+    n->election_.OnRequestVoteResponse(Vote(term + 1, 2, true, false), now);
+    ASSERT_EQ(Election::ROLE_LEADER, n->election_.role());
+}
+
+}   // namespace
+
+TEST(ElectionTest, PreVoteThenVoteMakesLeader) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+
+    n.election_.Tick(kTimeout - 1);
+    EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+
+    // the pre-vote round moves no term
+    n.election_.Tick(2 * kTimeout);
+    EXPECT_EQ(Election::ROLE_PRE_CANDIDATE, n.election_.role());
+    EXPECT_EQ(0u, n.election_.term());
+
+    n.election_.OnRequestVoteResponse(Vote(1, 3, true, true), 2 * kTimeout);
+    EXPECT_EQ(Election::ROLE_CANDIDATE, n.election_.role());
+    EXPECT_EQ(1u, n.election_.term());
+    EXPECT_EQ(kSelf, n.election_.vote());
+
+    // a late pre-vote answer of the last round changes nothing
+    n.election_.OnRequestVoteResponse(Vote(1, 2, true, true), 2 * kTimeout);
+    EXPECT_EQ(Election::ROLE_CANDIDATE, n.election_.role());
+
+    n.election_.OnRequestVoteResponse(Vote(1, 2, true, false), 2 * kTimeout);
+    EXPECT_TRUE(n.election_.leader());
+    EXPECT_EQ(kSelf, n.election_.leader_id());
+    EXPECT_EQ(1u, n.listener_.leader_term_);
+}
+
+// partitioned: its pre-votes never get an answer, the term stays
+TEST(ElectionTest, PartitionedNodeKeepsItsTerm) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+
+    for (uint64_t now = 0; now < 100 * kTimeout; now += kTimeout / 4) {
+        n.election_.Tick(now);
+    }
+    EXPECT_EQ(Election::ROLE_PRE_CANDIDATE, n.election_.role());
+    EXPECT_EQ(0u, n.election_.term());
+
+    // rejected by both: back to follower, still term 0
+    n.election_.OnRequestVoteResponse(Vote(0, 2, false, true), 100 * kTimeout);
+    n.election_.OnRequestVoteResponse(Vote(0, 3, false, true), 100 * kTimeout);
+    EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+    EXPECT_EQ(0u, n.election_.term());
+
+    // without Pre-Vote every timeout bumps the term
+    dctest::TempDir dir2;
+    Node old(dir2.path(), false, true);
+    for (uint64_t now = 0; now < 100 * kTimeout; now += kTimeout / 4) {
+        old.election_.Tick(now);
+    }
+    EXPECT_EQ(Election::ROLE_CANDIDATE, old.election_.role());
+    EXPECT_GE(old.election_.term(), 40u);
+}
+
+// in touch with a leader, (pre-)votes of a higher term are ignored
+TEST(ElectionTest, FollowerInLeaseIgnoresVotes) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+
+    ASSERT_EQ(0, n.election_.OnMessageTerm(3, 2, 1000));
+    EXPECT_EQ(2u, n.election_.leader_id());
+    EXPECT_EQ(3u, n.election_.term());
+
+    n.election_.OnRequestVote(Ask(9, 3, false), 1000 + kTimeout - 1);
+    EXPECT_EQ(3u, n.election_.term());
+    EXPECT_EQ(0u, n.election_.vote());
+    EXPECT_EQ(2u, n.election_.leader_id());
+
+    // the leader is gone for a timeout: the vote is given
+    n.election_.OnRequestVote(Ask(9, 3, false), 1000 + kTimeout);
+    EXPECT_EQ(9u, n.election_.term());
+    EXPECT_EQ(3u, n.election_.vote());
+
+    // a stale leader is told its term is old
+    EXPECT_EQ(-1, n.election_.OnMessageTerm(3, 2, 1000 + kTimeout));
+}
+
+TEST(ElectionTest, NoLeaseWithoutCheckQuorum) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, false);
+
+    ASSERT_EQ(0, n.election_.OnMessageTerm(3, 2, 1000));
+    n.election_.OnRequestVote(Ask(9, 3, false), 1001);
+    EXPECT_EQ(9u, n.election_.term());
+    EXPECT_EQ(3u, n.election_.vote());
+}
+
+// answering a pre-vote moves neither term nor vote
+TEST(ElectionTest, PreVoteRequestChangesNothing) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+
+    n.election_.OnRequestVote(Ask(5, 3, true), 10);
+    EXPECT_EQ(0u, n.election_.term());
+    EXPECT_EQ(0u, n.election_.vote());
+    EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+}
+
+TEST(ElectionTest, CheckQuorumStepsDown) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+    ElectLeader(&n, 2 * kTimeout);
+    uint64_t term = n.election_.term();
+
+    // peer 2 answered within each timeout: a majority with self
+    uint64_t now = 2 * kTimeout;
+    for (int i = 0; i < 5; i++) {
+        n.election_.OnPeerActive(2);
+        now += kTimeout;
+        n.election_.Tick(now);
+        EXPECT_TRUE(n.election_.leader()) << "round " << i;
+    }
+
+    // nobody for a whole timeout: step down, no new term
+    now += kTimeout;
+    n.election_.Tick(now);
+    EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+    EXPECT_EQ(term, n.election_.term());
+    EXPECT_EQ(0u, n.election_.leader_id());
+
+    // without CheckQuorum a leader never steps down by itself
+    dctest::TempDir dir2;
+    Node old(dir2.path(), true, false);
+    ElectLeader(&old, 2 * kTimeout);
+    old.election_.Tick(100 * kTimeout);
+    EXPECT_TRUE(old.election_.leader());
+}
+
+TEST(ElectionTest, HigherTermResponseMakesFollower) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true);
+    ElectLeader(&n, 2 * kTimeout);
+
+    n.election_.OnRequestVoteResponse(Vote(7, 3, false, false), 3 * kTimeout);
+    EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+    EXPECT_EQ(7u, n.election_.term());
+    EXPECT_EQ(0u, n.election_.vote());
+}
+
+TEST(ElectionTest, SingleNodeElectsItself) {
+    dctest::TempDir dir;
+    Node n(dir.path(), true, true, 0);
+    n.election_.Tick(2 * kTimeout);
+    EXPECT_TRUE(n.election_.leader());
+    EXPECT_EQ(1u, n.election_.term());
+}
+
+TEST(ElectionTest, TermAndVoteSurviveRestart) {
+    dctest::TempDir dir;
+    {
+        Node n(dir.path(), true, true);
+        ASSERT_EQ(0, n.election_.OnMessageTerm(4, 0, 10));
+        n.election_.OnRequestVote(Ask(4, 3, false), 10);
+        EXPECT_EQ(3u, n.election_.vote());
+    }
+    {
+        Node n(dir.path(), true, true);
+        EXPECT_EQ(4u, n.election_.term());
+        EXPECT_EQ(3u, n.election_.vote());
+        EXPECT_EQ(Election::ROLE_FOLLOWER, n.election_.role());
+
+        // voted in term 4 already, not for another one
+        n.election_.OnRequestVote(Ask(4, 2, false), 20);
+        EXPECT_EQ(3u, n.election_.vote());
+    }
+
+    // a torn write of the newer slot (the vote, slot 0): the term of the older one holds
+    char c = 0x5a;
+    ASSERT_TRUE(dctest::WriteAt(dir.Join(ELECTION_META_FILE), 16, &c, 1));
+    {
+        Node n(dir.path(), true, true);
+        EXPECT_EQ(4u, n.election_.term());
+        EXPECT_EQ(0u, n.election_.vote());
+    }
+}
@@ -0,0 +1,117 @@
+#include "epoll_event.h"
+
+#include <gtest/gtest.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using namespace dc;
+
+namespace {
+
+// counts reads, optionally removes another fd from the loop on its first
+class Handler : public EventHandler {
+public:
+    Handler() : loop_(NULL), del_fd_(-1), reads_(0) {}
+
+    virtual void OnRead(int fd, uint32_t) {
+        reads_++;
+        uint64_t v;
+        while (read(fd, &v, sizeof(v)) > 0) {
+        }
+        if (del_fd_ >= 0) {
+            loop_->DelEvent(del_fd_);
+            del_fd_ = -1;
+        }
+    }
+
+    virtual void OnWrite(int, uint32_t) {}
+    virtual void OnError(int, uint32_t, int, std::string&) {}
+
+    EventLoop* loop_;
+    int del_fd_;
+    int reads_;
+};
+
+void Signal(int fd) {
+    uint64_t v = 1;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(v)), write(fd, &v, sizeof(v)));
+}
+
+}   // namespace
+
+// a closed fd's number comes back, its events go to the new handler only
+TEST(EpollEventTest, ReusedFdGoesToTheNewHandler) {
+    EpollEvent loop(true);
+    ASSERT_EQ(0, loop.Initialize());
+
+    Handler old_handler, new_handler;
+    int fd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_EQ(0, loop.AddEvent(fd, &old_handler, EPOLLIN));
+    Signal(fd);
+    EXPECT_EQ(1, loop.Wait(100));
+    EXPECT_EQ(1, old_handler.reads_);
+
+    ASSERT_EQ(0, loop.DelEvent(fd));
+    close(fd);
+
+    int again = eventfd(0, EFD_NONBLOCK);
+    ASSERT_EQ(fd, again);
+    ASSERT_EQ(0, loop.AddEvent(again, &new_handler, EPOLLIN));
+    Signal(again);
+    EXPECT_EQ(1, loop.Wait(100));
+    EXPECT_EQ(1, old_handler.reads_);
+    EXPECT_EQ(1, new_handler.reads_);
+    close(again);
+}
+
+// fds far past the first chunk of the table
+TEST(EpollEventTest, HighFdsAreDispatched) {
+    EpollEvent loop(true);
+    ASSERT_EQ(0, loop.Initialize());
+
+    Handler h;
+    int fds[3];
+    int high[3] = {FD_SLAB_CHUNK_SIZE + 1, FD_SLAB_CHUNK_SIZE * 3, FD_SLAB_CHUNK_SIZE * 3 + 9};
+    for (int i = 0; i < 3; i++) {
+        fds[i] = eventfd(0, EFD_NONBLOCK);
+        ASSERT_EQ(high[i], dup2(fds[i], high[i]));
+        close(fds[i]);
+        ASSERT_EQ(0, loop.AddEvent(high[i], &h, EPOLLIN));
+    }
+
+    for (int i = 0; i < 3; i++) {
+        Signal(high[i]);
+    }
+    EXPECT_EQ(3, loop.Wait(100));
+    EXPECT_EQ(3, h.reads_);
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(0, loop.DelEvent(high[i]));
+        close(high[i]);
+    }
+}
+
+// an fd removed by a handler earlier in the same Wait() batch is not dispatched
+TEST(EpollEventTest, RemovedInTheBatchIsDropped) {
+    EpollEvent loop(true);
+    ASSERT_EQ(0, loop.Initialize());
+
+    Handler a, b;
+    int fa = eventfd(0, EFD_NONBLOCK);
+    int fb = eventfd(0, EFD_NONBLOCK);
+    a.loop_ = b.loop_ = &loop;
+    a.del_fd_ = fb;
+    b.del_fd_ = fa;
+    ASSERT_EQ(0, loop.AddEvent(fa, &a, EPOLLIN));
+    ASSERT_EQ(0, loop.AddEvent(fb, &b, EPOLLIN));
+
+    // both ready in one epoll_wait, whichever runs first removes the other
+    Signal(fa);
+    Signal(fb);
+    EXPECT_EQ(2, loop.Wait(100));
+    EXPECT_EQ(1, a.reads_ + b.reads_);
+
+    close(fa);
+    close(fb);
+}
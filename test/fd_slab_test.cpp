@@ -0,0 +1,52 @@
+#include "fd_slab.h"
+
+#include <gtest/gtest.h>
+
+using namespace dc;
+
+namespace {
+
+struct Slot {
+    int fd;
+    void* ptr;
+};
+
+}   // namespace
+
+TEST(FdSlabTest, SlotsAreAllocatedByChunk) {
+    FdSlab<Slot> slab;
+    EXPECT_TRUE(slab.Get(0) == NULL);
+    EXPECT_TRUE(slab.Get(-1) == NULL);
+    EXPECT_TRUE(slab.Slot(-1) == NULL);
+    EXPECT_EQ(0, slab.limit());
+
+    // value initialized, the whole chunk is there
+    Slot* s = slab.Slot(5);
+    ASSERT_TRUE(s != NULL);
+    EXPECT_EQ(0, s->fd);
+    EXPECT_TRUE(s->ptr == NULL);
+    EXPECT_EQ(FD_SLAB_CHUNK_SIZE, slab.limit());
+    EXPECT_TRUE(slab.Get(FD_SLAB_CHUNK_SIZE - 1) != NULL);
+    EXPECT_TRUE(slab.Get(FD_SLAB_CHUNK_SIZE) == NULL);
+}
+
+// a slot kept in epoll_event.data.ptr stays put while the table grows
+TEST(FdSlabTest, GrowthNeverMovesASlot) {
+    FdSlab<Slot> slab;
+    Slot* low = slab.Slot(3);
+    low->fd = 3;
+
+    int high = FD_SLAB_CHUNK_SIZE * 4 + 7;
+    Slot* s = slab.Slot(high);
+    ASSERT_TRUE(s != NULL);
+    s->fd = high;
+    EXPECT_EQ(FD_SLAB_CHUNK_SIZE * 5, slab.limit());
+
+    EXPECT_EQ(low, slab.Get(3));
+    EXPECT_EQ(3, slab.Get(3)->fd);
+    EXPECT_EQ(s, slab.Get(high));
+    EXPECT_EQ(s, slab.Slot(high));
+
+    // the chunks between are there too, empty
+    EXPECT_EQ(0, slab.Get(FD_SLAB_CHUNK_SIZE * 2)->fd);
+}
@@ -0,0 +1,182 @@
+#include "log_replicate.h"
+#include "log_store.h"
+#include "test_util.h"
+#include "uring_event.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+const uint64_t kSelf = 1;
+const uint64_t kPeer = 2;
+
+// a follower connection without a socket, frames pile up in sendChain()
+class Conn : public dc::SocketFdHandler {
+public:
+    Conn() : dc::SocketFdHandler(0, 0, NULL) {}
+
+    virtual void OnError(int, int, std::string&) {}
+};
+
+void AppendN(LogStore* store, uint64_t term, uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+        ASSERT_GT(store->Append(term, "entry", 5), 0u);
+    }
+    ASSERT_EQ(0, store->Flush());
+}
+
+AppendEntriesResponse Resp(uint64_t term, uint64_t prev, uint64_t match, uint64_t hint, bool success) {
+    AppendEntriesResponse resp;
+    resp.term = term;
+    resp.from_id = kPeer;
+    resp.prev_log_index = prev;
+    resp.match_index = match;
+    resp.hint_index = hint;
+    resp.read_seq = 0;
+    resp.success = success;
+    return resp;
+}
+
+// leader of term 1 with one follower, 2 entries a batch, 4 batches in flight
+class ReplicateTest : public ::testing::Test {
+protected:
+    ReplicateTest()
+        : store_(dir_.Join("log"))
+        , replicate_(&store_, kSelf, 2) {}
+
+    virtual void SetUp() {
+        ASSERT_EQ(0, store_.Initialize());
+        ASSERT_EQ(0, replicate_.AddFollower(kPeer, &conn_, 4));
+        replicate_.Reset(1);
+        f_ = replicate_.GetFollower(kPeer);
+    }
+
+    dctest::TempDir dir_;
+    LogStore store_;
+    LogReplicate replicate_;
+    Conn conn_;
+    LogReplicate::Follower* f_;
+};
+
+}   // namespace
+
+TEST_F(ReplicateTest, ProbeThenPipelineUpToTheWindow) {
+    AppendN(&store_, 1, 20);
+
+    // one probe until it is answered
+    replicate_.Replicate();
+    replicate_.Replicate();
+    EXPECT_EQ(LogReplicate::STATE_PROBE, f_->state);
+    ASSERT_EQ(1u, f_->inflight.size());
+    EXPECT_EQ(2u, f_->inflight.front().last_index);
+    EXPECT_EQ(3u, f_->next_index);
+    EXPECT_FALSE(conn_.sendChain().empty());
+
+    // the ack opens the window, 4 batches go out without waiting
+    replicate_.OnAppendEntriesResponse(Resp(1, 0, 2, 2, true));
+    EXPECT_EQ(LogReplicate::STATE_PIPELINE, f_->state);
+    EXPECT_EQ(2u, f_->match_index);
+    ASSERT_EQ(4u, f_->inflight.size());
+    EXPECT_EQ(10u, f_->inflight.back().last_index);
+    EXPECT_EQ(11u, f_->next_index);
+
+    // full, nothing more until an ack
+    replicate_.Replicate();
+    EXPECT_EQ(4u, f_->inflight.size());
+    EXPECT_EQ(11u, f_->next_index);
+
+    // every acked batch lets one more out
+    replicate_.OnAppendEntriesResponse(Resp(1, 2, 4, 4, true));
+    EXPECT_EQ(4u, f_->inflight.size());
+    EXPECT_EQ(4u, f_->match_index);
+    EXPECT_EQ(13u, f_->next_index);
+}
+
+TEST_F(ReplicateTest, RejectRewindsToAProbe) {
+    AppendN(&store_, 1, 20);
+    replicate_.Replicate();
+    replicate_.OnAppendEntriesResponse(Resp(1, 0, 2, 2, true));
+    ASSERT_EQ(4u, f_->inflight.size());
+
+    // the batch after 4 does not match, the follower has up to 3
+    replicate_.OnAppendEntriesResponse(Resp(1, 4, 0, 3, false));
+    EXPECT_EQ(LogReplicate::STATE_PROBE, f_->state);
+    ASSERT_EQ(1u, f_->inflight.size());
+    EXPECT_EQ(3u, f_->probe_prev);
+    EXPECT_EQ(5u, f_->inflight.front().last_index);
+    EXPECT_EQ(6u, f_->next_index);
+
+    // rejects of the batches pipelined before it are stale
+    replicate_.OnAppendEntriesResponse(Resp(1, 6, 0, 3, false));
+    EXPECT_EQ(3u, f_->probe_prev);
+    EXPECT_EQ(6u, f_->next_index);
+
+    // never below what is acked
+    replicate_.OnAppendEntriesResponse(Resp(1, 3, 0, 0, false));
+    EXPECT_EQ(2u, f_->probe_prev);
+    EXPECT_EQ(4u, f_->inflight.front().last_index);
+}
+
+TEST_F(ReplicateTest, UnreadableEntryIsNotSent) {
+    AppendN(&store_, 1, 3);
+    replicate_.Replicate();
+    replicate_.OnAppendEntriesResponse(Resp(1, 0, 2, 2, true));
+    replicate_.OnAppendEntriesResponse(Resp(1, 2, 3, 3, true));
+    ASSERT_TRUE(f_->inflight.empty());
+    conn_.sendChain().Clear();
+
+    // the last byte of entry 4 goes bad on disk
+    AppendN(&store_, 1, 1);
+    char name[64];
+    snprintf(name, sizeof(name), "log/%020llu%s", 1ULL, LOG_SEGMENT_SUFFIX);
+    std::string seg = dir_.Join(name);
+    char bad = '#';
+    ASSERT_TRUE(dctest::WriteAt(seg, dctest::FileSize(seg) - 1, &bad, 1));
+
+    // no empty AppendEntries, no Inflight claiming it, however often retried
+    replicate_.Replicate();
+    replicate_.Replicate();
+    EXPECT_TRUE(conn_.sendChain().empty());
+    EXPECT_TRUE(f_->inflight.empty());
+    EXPECT_EQ(4u, f_->next_index);
+    EXPECT_EQ(LogReplicate::STATE_PIPELINE, f_->state);
+}
+
+// followers acking first is not enough, the leader's own fsync bounds it
+TEST_F(ReplicateTest, CommitWaitsForTheLeaderFsync) {
+    std::unique_ptr<dc::EventLoop> loop(dc::CreateEventLoop(dc::LOOP_URING, true));
+    ASSERT_TRUE(loop.get() != NULL);
+    if (loop->type() != dc::LOOP_URING) {
+        GTEST_SKIP() << "no io_uring";
+    }
+
+    // 3 nodes, both followers at 2 before the leader synced anything
+    Conn other;
+    ASSERT_EQ(0, replicate_.AddFollower(kPeer + 1, &other, 4));
+    replicate_.Reset(1);
+    for (uint64_t i = 0; i < 2; i++) {
+        ASSERT_GT(store_.Append(1, "entry", 5), 0u);
+    }
+    replicate_.Replicate();
+    AppendEntriesResponse resp = Resp(1, 0, 2, 2, true);
+    replicate_.OnAppendEntriesResponse(resp);
+    resp.from_id = kPeer + 1;
+    replicate_.OnAppendEntriesResponse(resp);
+    EXPECT_EQ(0u, store_.durable_index());
+    EXPECT_EQ(0u, replicate_.CommitIndex());
+
+    // moves once the leader's write completes
+    dc::UringEvent* ring = static_cast<dc::UringEvent*>(loop.get());
+    ASSERT_EQ(0, store_.FlushAsync(ring));
+    EXPECT_EQ(0u, replicate_.CommitIndex());
+    while (store_.flushing()) {
+        ASSERT_GE(loop->Wait(10), 0);
+    }
+    EXPECT_EQ(2u, store_.durable_index());
+    EXPECT_EQ(2u, replicate_.CommitIndex());
+}
@@ -0,0 +1,377 @@
+#include "log_store.h"
+#include "file_util.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace dcraft;
+
+namespace {
+
+std::string Data(uint64_t index, size_t len) {
+    std::string s(len, 'a' + index % 26);
+    snprintf(&s[0], len, "%llu", static_cast<unsigned long long>(index));
+    return s;
+}
+
+std::string SegPath(const dctest::TempDir& dir, uint64_t first_index) {
+    char name[64];
+    snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(first_index), LOG_SEGMENT_SUFFIX);
+    return dir.Join(name);
+}
+
+std::string IdxPath(const dctest::TempDir& dir, uint64_t first_index) {
+    char name[64];
+    snprintf(name, sizeof(name), "%020llu%s", static_cast<unsigned long long>(first_index), LOG_INDEX_SUFFIX);
+    return dir.Join(name);
+}
+
+// first index of every segment, in order
+std::vector<uint64_t> Segments(const dctest::TempDir& dir) {
+    std::vector<std::string> names;
+    std::vector<uint64_t> firsts;
+    dc::ListDir(dir.path(), &names);
+    for (size_t i = 0; i < names.size(); i++) {
+        if (names[i].find(LOG_SEGMENT_SUFFIX) != std::string::npos) {
+            firsts.push_back(strtoull(names[i].c_str(), NULL, 10));
+        }
+    }
+    std::sort(firsts.begin(), firsts.end());
+    return firsts;
+}
+
+void AppendN(LogStore* store, uint64_t term, uint64_t n, size_t len) {
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t index = store->last_index() + 1;
+        std::string d = Data(index, len);
+        ASSERT_EQ(index, store->Append(term, d.data(), d.size()));
+    }
+    ASSERT_EQ(0, store->Flush());
+}
+
+void ExpectEntries(LogStore* store, uint64_t first, uint64_t last, uint64_t term, size_t len) {
+    for (uint64_t i = first; i <= last; i++) {
+        LogEntry e;
+        ASSERT_EQ(0, store->Get(i, &e)) << "index " << i;
+        EXPECT_EQ(i, e.index);
+        EXPECT_EQ(term, e.term);
+        EXPECT_EQ(Data(i, len), e.data) << "index " << i;
+        EXPECT_EQ(term, store->Term(i));
+    }
+}
+
+}   // namespace
+
+TEST(LogStoreTest, RecoverAfterReopen) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path());
+        ASSERT_EQ(0, store.Initialize());
+        EXPECT_EQ(0u, store.last_index());
+        AppendN(&store, 1, 100, 64);
+        EXPECT_EQ(100u, store.durable_index());
+    }
+
+    LogStore store(dir.path());
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(1u, store.first_index());
+    EXPECT_EQ(100u, store.last_index());
+    ExpectEntries(&store, 1, 100, 1, 64);
+
+    LogEntry e;
+    EXPECT_NE(0, store.Get(101, &e));
+    EXPECT_EQ(0u, store.Term(101));
+}
+
+TEST(LogStoreTest, RecoverManySegments) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 3, 300, 100);
+    }
+
+    for (uint32_t threads = 1; threads <= 4; threads += 3) {
+        LogStore store(dir.path(), 4096);
+        store.set_recover(threads, true);
+        ASSERT_EQ(0, store.Initialize());
+        EXPECT_EQ(300u, store.last_index());
+        ExpectEntries(&store, 1, 300, 3, 100);
+    }
+}
+
+TEST(LogStoreTest, TornTailIsTruncated) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path());
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 10, 32);
+    }
+
+    // half a header after the last entry
+    std::string seg = SegPath(dir, 1);
+    int64_t size = dctest::FileSize(seg);
+    char junk[sizeof(EntryHeader) / 2] = {1, 2, 3};
+    ASSERT_TRUE(dctest::WriteAt(seg, size, junk, sizeof(junk)));
+
+    {
+        LogStore store(dir.path());
+        ASSERT_EQ(0, store.Initialize());
+        EXPECT_EQ(10u, store.last_index());
+        EXPECT_EQ(size, dctest::FileSize(seg));
+        ExpectEntries(&store, 1, 10, 1, 32);
+        AppendN(&store, 1, 1, 32);
+    }
+
+    LogStore store(dir.path());
+    ASSERT_EQ(0, store.Initialize());
+    ExpectEntries(&store, 1, 11, 1, 32);
+}
+
+TEST(LogStoreTest, CorruptTailEntryIsDropped) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path());
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 10, 32);
+    }
+
+    // one byte of the data of entry 10, a torn write the length still covers
+    std::string seg = SegPath(dir, 1);
+    int64_t size = dctest::FileSize(seg);
+    char bad = '#';
+    ASSERT_TRUE(dctest::WriteAt(seg, size - 1, &bad, 1));
+
+    LogStore store(dir.path());
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(9u, store.last_index());
+    EXPECT_EQ(size - static_cast<int64_t>(sizeof(EntryHeader) + 32), dctest::FileSize(seg));
+    ExpectEntries(&store, 1, 9, 1, 32);
+}
+
+TEST(LogStoreTest, TruncateSuffixAcrossSegments) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 200, 100);
+
+        ASSERT_EQ(0, store.TruncateSuffix(20));
+        EXPECT_EQ(19u, store.last_index());
+        EXPECT_EQ(0u, store.Term(20));
+
+        AppendN(&store, 2, 30, 100);
+        EXPECT_EQ(49u, store.last_index());
+        EXPECT_EQ(2u, store.Term(20));
+    }
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(49u, store.last_index());
+    ExpectEntries(&store, 1, 19, 1, 100);
+    ExpectEntries(&store, 20, 49, 2, 100);
+}
+
+TEST(LogStoreTest, AppendRejectsTermZero) {
+    dctest::TempDir dir;
+    LogStore store(dir.path());
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(0u, store.Append(0, "x", 1));
+    EXPECT_EQ(0u, store.last_index());
+}
+
+TEST(LogStoreTest, SealedIndexEndsWithSealRecord) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+    }
+
+    std::vector<uint64_t> segs = Segments(dir);
+    ASSERT_GE(segs.size(), 3u);
+    uint64_t count = segs[1] - segs[0];
+    EXPECT_EQ(static_cast<int64_t>((count + 1) * sizeof(LogStore::IndexItem)), dctest::FileSize(IdxPath(dir, segs[0])));
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    ExpectEntries(&store, 1, 100, 1, 100);
+}
+
+TEST(LogStoreTest, LostIndexIsRebuilt) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+    }
+
+    std::vector<uint64_t> segs = Segments(dir);
+    ASSERT_GE(segs.size(), 3u);
+    ASSERT_EQ(0, unlink(IdxPath(dir, segs[0]).c_str()));
+    ASSERT_TRUE(dctest::Truncate(IdxPath(dir, segs[1]), 0));
+
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        EXPECT_EQ(100u, store.last_index());
+        ExpectEntries(&store, 1, 100, 1, 100);
+    }
+
+    // rebuilt ones are sealed again
+    uint64_t count = segs[1] - segs[0];
+    EXPECT_EQ(static_cast<int64_t>((count + 1) * sizeof(LogStore::IndexItem)), dctest::FileSize(IdxPath(dir, segs[0])));
+}
+
+TEST(LogStoreTest, UnsealedIndexWithHoleIsRebuilt) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+    }
+
+    // a segment rolled over but not sealed before a crash: the idx keeps its
+    // grown size, no seal record, and a page in the middle never hit disk
+    std::vector<uint64_t> segs = Segments(dir);
+    ASSERT_GE(segs.size(), 3u);
+    std::string idx = IdxPath(dir, segs[0]);
+    uint64_t count = segs[1] - segs[0];
+    ASSERT_TRUE(dctest::Truncate(idx, count * sizeof(LogStore::IndexItem)));
+    ASSERT_TRUE(dctest::Truncate(idx, INDEX_INIT_CAPACITY * sizeof(LogStore::IndexItem)));
+    LogStore::IndexItem hole = {0, 0};
+    ASSERT_TRUE(dctest::WriteAt(idx, (count / 2) * sizeof(hole), &hole, sizeof(hole)));
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(100u, store.last_index());
+    ExpectEntries(&store, 1, 100, 1, 100);
+}
+
+// a batch rolled over three segments, the crash came before any seal
+TEST(LogStoreTest, TornSegmentBeforeUnsealedOnesIsCut) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+    }
+
+    std::vector<uint64_t> segs = Segments(dir);
+    ASSERT_GE(segs.size(), 3u);
+    for (size_t i = 0; i + 1 < segs.size(); i++) {
+        uint64_t count = segs[i + 1] - segs[i];
+        ASSERT_TRUE(dctest::Truncate(IdxPath(dir, segs[i]), count * sizeof(LogStore::IndexItem)));
+    }
+
+    // the last entry of the first segment is short of 3 bytes
+    std::string seg = SegPath(dir, segs[0]);
+    int64_t size = dctest::FileSize(seg);
+    ASSERT_TRUE(dctest::Truncate(seg, size - 3));
+
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        EXPECT_EQ(segs[1] - 2, store.last_index());
+        EXPECT_EQ(size - static_cast<int64_t>(sizeof(EntryHeader) + 100), dctest::FileSize(seg));
+        EXPECT_EQ(1u, Segments(dir).size());
+        ExpectEntries(&store, 1, segs[1] - 2, 1, 100);
+        AppendN(&store, 2, 50, 100);
+    }
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(segs[1] + 48, store.last_index());
+    ExpectEntries(&store, 1, segs[1] - 2, 1, 100);
+    ExpectEntries(&store, segs[1] - 1, segs[1] + 48, 2, 100);
+}
+
+// a sealed segment after the torn one was durable, the gap is damage
+TEST(LogStoreTest, TornSegmentBeforeSealedOneFails) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+    }
+
+    std::vector<uint64_t> segs = Segments(dir);
+    ASSERT_GE(segs.size(), 3u);
+    uint64_t count = segs[1] - segs[0];
+    ASSERT_TRUE(dctest::Truncate(IdxPath(dir, segs[0]), count * sizeof(LogStore::IndexItem)));
+    std::string seg = SegPath(dir, segs[0]);
+    int64_t size = dctest::FileSize(seg);
+    ASSERT_TRUE(dctest::Truncate(seg, size - 3));
+
+    LogStore store(dir.path(), 4096);
+    EXPECT_NE(0, store.Initialize());
+    EXPECT_EQ(segs.size(), Segments(dir).size());
+    EXPECT_EQ(size - 3, dctest::FileSize(seg));
+}
+
+TEST(LogStoreTest, CompactDropsCoveredSegments) {
+    dctest::TempDir dir;
+    std::vector<uint64_t> segs;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+        segs = Segments(dir);
+        ASSERT_GE(segs.size(), 3u);
+
+        // the second segment ends at segs[2] - 1, one entry past the snapshot
+        ASSERT_EQ(0, store.Compact(segs[2] - 2, 1));
+        EXPECT_EQ(segs[1], store.first_index());
+        EXPECT_EQ(segs.size() - 1, Segments(dir).size());
+    }
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(segs[1], store.first_index());
+    ExpectEntries(&store, segs[1], 100, 1, 100);
+}
+
+TEST(LogStoreTest, CompactEverythingThenAppend) {
+    dctest::TempDir dir;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+        ASSERT_EQ(0, store.Compact(100, 1));
+        EXPECT_TRUE(Segments(dir).empty());
+        EXPECT_EQ(101u, store.first_index());
+        EXPECT_EQ(1u, store.Term(100));
+        AppendN(&store, 2, 10, 100);
+    }
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(101u, store.first_index());
+    EXPECT_EQ(110u, store.last_index());
+    ExpectEntries(&store, 101, 110, 2, 100);
+}
+
+TEST(LogStoreTest, TruncateIntoSealedSegmentUnsealsIt) {
+    dctest::TempDir dir;
+    std::vector<uint64_t> segs;
+    {
+        LogStore store(dir.path(), 4096);
+        ASSERT_EQ(0, store.Initialize());
+        AppendN(&store, 1, 100, 100);
+
+        segs = Segments(dir);
+        ASSERT_GE(segs.size(), 3u);
+        ASSERT_EQ(0, store.TruncateSuffix(segs[0] + 2));
+        AppendN(&store, 2, 60, 100);
+    }
+
+    LogStore store(dir.path(), 4096);
+    ASSERT_EQ(0, store.Initialize());
+    EXPECT_EQ(segs[0] + 61, store.last_index());
+    ExpectEntries(&store, 1, segs[0] + 1, 1, 100);
+    ExpectEntries(&store, segs[0] + 2, segs[0] + 61, 2, 100);
+}
@@ -0,0 +1,118 @@
+#include "log.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dc;
+
+namespace {
+
+std::vector<std::string> ReadLines(const std::string& path) {
+    std::vector<std::string> lines;
+    std::ifstream in(path.c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// "<date> <time> <level> <tid> t:<thread> n:<seq>", -1 if not such a line
+int Parse(const std::string& line, int* thread, int* seq) {
+    const char* p = strstr(line.c_str(), " t:");
+    if (!p || sscanf(p, " t:%d n:%d", thread, seq) != 2) {
+        return -1;
+    }
+    return 0;
+}
+
+}   // namespace
+
+// the logger is process wide, each test points it at a dir of its own
+
+TEST(LogTest, CleanKeepsEveryLineInThreadOrder) {
+    const int kThreads = 4;
+    const int kLines = 10000;          // ~500 KB a thread, the ring never fills
+    dctest::TempDir dir;
+    RAFT_LOG_INIT(1 << 30, 1, dir.path(), "order.log");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.push_back(std::thread([t]() {
+            for (int i = 0; i < kLines; i++) {
+                LOG_INFO(RAFT_LOG(), "t:%d n:%d\n", t, i);
+            }
+        }));
+    }
+    for (int t = 0; t < kThreads; t++) {
+        threads[t].join();
+    }
+    // still in the ring of this thread when the flusher stops
+    LOG_ERROR(RAFT_LOG(), "t:%d n:%d", kThreads, 0);
+    RAFT_LOG_CLEAN();
+
+    std::vector<int> next(kThreads + 1, 0);
+    std::vector<std::string> lines = ReadLines(dir.Join("order.log"));
+    for (size_t i = 0; i < lines.size(); i++) {
+        int thread = 0;
+        int seq = 0;
+        ASSERT_EQ(0, Parse(lines[i], &thread, &seq)) << lines[i];
+        ASSERT_LE(thread, kThreads);
+        ASSERT_EQ(next[thread], seq) << "thread " << thread;
+        next[thread]++;
+    }
+    for (int t = 0; t < kThreads; t++) {
+        EXPECT_EQ(kLines, next[t]);
+    }
+    EXPECT_EQ(1, next[kThreads]);
+    EXPECT_EQ(static_cast<size_t>(kThreads * kLines + 1), lines.size());
+}
+
+TEST(LogTest, RotatesAtTheSizeLimit) {
+    const uint32_t kFileSize = 4096;
+    const int kLines = 400;
+    dctest::TempDir dir;
+    RAFT_LOG_INIT(kFileSize, 3, dir.path(), "rotate.log");
+
+    for (int i = 0; i < kLines; i++) {
+        LOG_INFO(RAFT_LOG(), "t:0 n:%d %s\n", i, std::string(20, 'x').c_str());
+        if (i % 50 == 0) {
+            RAFT_LOG_FLUSH();
+        }
+    }
+    RAFT_LOG_FLUSH();
+
+    // file, file.1, file.2, the oldest lines are gone
+    std::string path = dir.Join("rotate.log");
+    EXPECT_EQ(-1, dctest::FileSize(path + ".3"));
+    const char* names[] = {".2", ".1", ""};
+
+    int expect = -1;
+    for (int f = 0; f < 3; f++) {
+        std::string p = path + names[f];
+        int64_t size = dctest::FileSize(p);
+        ASSERT_GT(size, 0) << p;
+        EXPECT_LE(size, static_cast<int64_t>(kFileSize)) << p;
+
+        // whole lines only, consecutive across the files
+        std::vector<std::string> lines = ReadLines(p);
+        for (size_t i = 0; i < lines.size(); i++) {
+            int thread = 0;
+            int seq = 0;
+            ASSERT_EQ(0, Parse(lines[i], &thread, &seq)) << lines[i];
+            EXPECT_EQ(std::string(20, 'x'), lines[i].substr(lines[i].size() - 20));
+            if (expect >= 0) {
+                EXPECT_EQ(expect, seq);
+            }
+            expect = seq + 1;
+        }
+    }
+    EXPECT_EQ(kLines, expect);
+    RAFT_LOG_CLEAN();
+}
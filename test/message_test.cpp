@@ -0,0 +1,182 @@
+#include "message.h"
+#include "codec.h"
+#include "ring_buffer.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+// a whole encoded frame as the connection would hand it over
+dc::MessageView View(const std::string& frame) {
+    dc::MessageView msg;
+    memcpy(&msg.header, frame.data(), sizeof(msg.header));
+    msg.body = frame.data() + sizeof(dc::FrameHeader);
+    msg.length = frame.size() - sizeof(dc::FrameHeader);
+    return msg;
+}
+
+AppendEntriesRequest Request(uint32_t n) {
+    AppendEntriesRequest req;
+    req.term = 7;
+    req.leader_id = 1;
+    req.prev_log_index = 10;
+    req.prev_log_term = 6;
+    req.leader_commit = 9;
+    req.read_seq = 3;
+    for (uint32_t i = 0; i < n; i++) {
+        LogEntry e;
+        e.index = 11 + i;
+        e.term = 7;
+        e.data.assign(16 + i, 'a' + i);
+        req.entries.push_back(e);
+    }
+    return req;
+}
+
+// offset of the entry count in the body
+const size_t kCountOffset = sizeof(uint64_t) * 5;
+
+}   // namespace
+
+TEST(MessageTest, AppendEntriesRoundTrip) {
+    AppendEntriesRequest req = Request(3);
+    std::string frame;
+    EncodeAppendEntries(req, &frame, 5);
+
+    dc::MessageView msg = View(frame);
+    EXPECT_EQ(MSG_APPEND_ENTRIES, msg.header.type);
+    EXPECT_EQ(5u, msg.header.group);
+
+    AppendEntriesView view;
+    ASSERT_EQ(0, DecodeAppendEntries(msg, &view));
+    EXPECT_EQ(7u, view.term);
+    EXPECT_EQ(1u, view.leader_id);
+    EXPECT_EQ(10u, view.prev_log_index);
+    EXPECT_EQ(6u, view.prev_log_term);
+    EXPECT_EQ(9u, view.leader_commit);
+    EXPECT_EQ(3u, view.read_seq);
+    ASSERT_EQ(3u, view.entries.size());
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(req.entries[i].index, view.entries[i].index);
+        EXPECT_EQ(req.entries[i].term, view.entries[i].term);
+        EXPECT_EQ(req.entries[i].data, std::string(view.entries[i].data, view.entries[i].len));
+    }
+}
+
+TEST(MessageTest, AppendEntriesTruncatedFrameRejected) {
+    std::string frame;
+    EncodeAppendEntries(Request(3), &frame);
+
+    // every cut short of the whole body: inside the fixed fields, an entry
+    // header or an entry's data
+    for (size_t len = 0; len + sizeof(dc::FrameHeader) < frame.size(); len++) {
+        std::string cut = frame.substr(0, sizeof(dc::FrameHeader) + len);
+        AppendEntriesView view;
+        EXPECT_EQ(-1, DecodeAppendEntries(View(cut), &view)) << "body length " << len;
+    }
+}
+
+TEST(MessageTest, AppendEntriesOversizedCountRejected) {
+    std::string frame;
+    EncodeAppendEntries(Request(2), &frame);
+
+    uint32_t counts[] = {3, 1000, 0x7fffffff, 0xffffffff};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        std::string bad = frame;
+        memcpy(&bad[sizeof(dc::FrameHeader) + kCountOffset], &counts[i], sizeof(counts[i]));
+        AppendEntriesView view;
+        EXPECT_EQ(-1, DecodeAppendEntries(View(bad), &view)) << "count " << counts[i];
+        EXPECT_LE(view.entries.size(), 3u);
+    }
+}
+
+TEST(MessageTest, AppendEntriesCrcMismatchRejected) {
+    std::string frame;
+    EncodeAppendEntries(Request(2), &frame);
+
+    frame[frame.size() - 1] ^= 0x20;
+    AppendEntriesView view;
+    EXPECT_EQ(-1, DecodeAppendEntries(View(frame), &view));
+}
+
+TEST(MessageTest, HeartbeatBatchOversizedCountRejected) {
+    HeartbeatBatch batch;
+    batch.from_id = 2;
+    HeartbeatItem item = {1, 2, 3, 4};
+    batch.items.push_back(item);
+
+    std::string frame;
+    EncodeHeartbeatBatch(batch, &frame);
+
+    HeartbeatBatch out;
+    ASSERT_EQ(0, DecodeHeartbeatBatch(View(frame), &out));
+    ASSERT_EQ(1u, out.items.size());
+    EXPECT_EQ(3u, out.items[0].commit);
+
+    uint32_t n = 0xffffffff;
+    memcpy(&frame[sizeof(dc::FrameHeader) + sizeof(uint64_t)], &n, sizeof(n));
+    EXPECT_EQ(-1, DecodeHeartbeatBatch(View(frame), &out));
+}
+
+TEST(MessageTest, FixedMessagesTruncatedRejected) {
+    RequestVoteRequest vote = {5, 1, 77, 4, true};
+    std::string frame;
+    EncodeRequestVote(vote, &frame);
+
+    RequestVoteRequest out;
+    ASSERT_EQ(0, DecodeRequestVote(View(frame), &out));
+    EXPECT_EQ(5u, out.term);
+    EXPECT_EQ(77u, out.last_log_index);
+    EXPECT_TRUE(out.pre_vote);
+    EXPECT_EQ(-1, DecodeRequestVote(View(frame.substr(0, frame.size() - 1)), &out));
+
+    AppendEntriesResponse resp = {7, 2, 10, 12, 0, 3, true};
+    frame.clear();
+    EncodeAppendEntriesResp(resp, &frame);
+    AppendEntriesResponse resp_out;
+    ASSERT_EQ(0, DecodeAppendEntriesResp(View(frame), &resp_out));
+    EXPECT_EQ(12u, resp_out.match_index);
+    EXPECT_EQ(-1, DecodeAppendEntriesResp(View(frame.substr(0, frame.size() - 4)), &resp_out));
+}
+
+TEST(MessageTest, DecodeFrameRejectsBadHeader) {
+    dc::RingBuffer buf;
+    std::string frame;
+    EncodeAppendEntries(Request(1), &frame);
+
+    // partial header, then partial body: wait for more
+    ASSERT_EQ(0, buf.Reserve(frame.size()));
+    memcpy(buf.WritePtr(), frame.data(), 10);
+    buf.Produce(10);
+    dc::MessageView msg;
+    EXPECT_EQ(dc::DECODE_AGAIN, dc::DecodeFrame(buf, &msg));
+
+    memcpy(buf.WritePtr(), frame.data() + 10, frame.size() - 11);
+    buf.Produce(frame.size() - 11);
+    EXPECT_EQ(dc::DECODE_AGAIN, dc::DecodeFrame(buf, &msg));
+
+    memcpy(buf.WritePtr(), frame.data() + frame.size() - 1, 1);
+    buf.Produce(1);
+    ASSERT_EQ(dc::DECODE_OK, dc::DecodeFrame(buf, &msg));
+    EXPECT_EQ(frame.size() - sizeof(dc::FrameHeader), msg.length);
+    buf.Consume(frame.size());
+
+    // bad magic, then a length over MAX_FRAME_LENGTH
+    std::string bad = frame;
+    bad[0] ^= 0xff;
+    memcpy(buf.WritePtr(), bad.data(), bad.size());
+    buf.Produce(bad.size());
+    EXPECT_EQ(dc::DECODE_ERROR, dc::DecodeFrame(buf, &msg));
+    buf.Consume(bad.size());
+
+    bad = frame;
+    uint32_t length = MAX_FRAME_LENGTH + 1;
+    memcpy(&bad[offsetof(dc::FrameHeader, length)], &length, sizeof(length));
+    memcpy(buf.WritePtr(), bad.data(), bad.size());
+    buf.Produce(bad.size());
+    EXPECT_EQ(dc::DECODE_ERROR, dc::DecodeFrame(buf, &msg));
+}
@@ -0,0 +1,113 @@
+#include "metrics.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+
+using namespace dc;
+
+TEST(MetricsTest, BucketsAreExactBelowSub) {
+    for (uint64_t v = 0; v < HISTOGRAM_SUB; v++) {
+        EXPECT_EQ(v, Histogram::Bucket(v));
+        EXPECT_EQ(v, Histogram::BucketMax(Histogram::Bucket(v)));
+    }
+}
+
+// every value lands in a bucket whose bound holds it within 1/16
+TEST(MetricsTest, BucketBoundsHoldTheValue) {
+    for (uint32_t shift = 0; shift < 64; shift++) {
+        uint64_t base = 1ULL << shift;
+        uint64_t values[] = {base, base + base / 3, base + base / 2, base * 2 - 1};
+        for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+            uint64_t v = values[i];
+            uint32_t b = Histogram::Bucket(v);
+            ASSERT_LT(b, static_cast<uint32_t>(HISTOGRAM_BUCKETS));
+            EXPECT_GE(Histogram::BucketMax(b), v);
+            if (b > 0) {
+                EXPECT_LT(Histogram::BucketMax(b - 1), v);
+            }
+            EXPECT_LE(Histogram::BucketMax(b) - v, v / HISTOGRAM_SUB);
+        }
+    }
+
+    // buckets are ordered and the last one ends at UINT64_MAX
+    for (uint32_t b = 1; b < HISTOGRAM_BUCKETS; b++) {
+        EXPECT_LT(Histogram::BucketMax(b - 1), Histogram::BucketMax(b));
+    }
+    EXPECT_EQ(static_cast<uint32_t>(HISTOGRAM_BUCKETS - 1), Histogram::Bucket(UINT64_MAX));
+    EXPECT_EQ(UINT64_MAX, Histogram::BucketMax(HISTOGRAM_BUCKETS - 1));
+}
+
+TEST(MetricsTest, Percentile) {
+    Histogram h;
+    EXPECT_EQ(0u, h.Percentile(0.5));
+
+    for (uint64_t v = 1; v <= 1000; v++) {
+        h.Record(v);
+    }
+    EXPECT_EQ(1000u, h.count());
+    EXPECT_EQ(500500u, h.sum());
+    EXPECT_EQ(1000u, h.max());
+
+    // the upper bound of the bucket holding the rank, never above max
+    EXPECT_EQ(Histogram::BucketMax(Histogram::Bucket(500)), h.Percentile(0.5));
+    EXPECT_EQ(Histogram::BucketMax(Histogram::Bucket(990)), h.Percentile(0.99));
+    EXPECT_EQ(1000u, h.Percentile(1.0));
+    EXPECT_EQ(1u, h.Percentile(0.0));
+}
+
+TEST(MetricsTest, Render) {
+    MetricsRegistry r;
+    r.GetCounter("b_bytes", "peer=\"2\"")->Add(7);
+    r.GetHistogram("a_us")->Record(3);
+    r.GetCounter("b_bytes", "peer=\"3\"")->Add(1);
+    r.GetHistogram("c_us", "peer=\"2\"")->Record(5);
+
+    // the same name + labels is the same metric
+    EXPECT_EQ(r.GetCounter("b_bytes", "peer=\"2\""), r.GetCounter("b_bytes", "peer=\"2\""));
+
+    std::string out;
+    r.Render(&out);
+    EXPECT_EQ("# TYPE a_us summary\n"
+              "a_us{quantile=\"0.5\"} 3\n"
+              "a_us{quantile=\"0.9\"} 3\n"
+              "a_us{quantile=\"0.99\"} 3\n"
+              "a_us{quantile=\"0.999\"} 3\n"
+              "a_us_sum 3\n"
+              "a_us_count 1\n"
+              "a_us_max 3\n"
+              "# TYPE b_bytes counter\n"
+              "b_bytes{peer=\"2\"} 7\n"
+              "b_bytes{peer=\"3\"} 1\n"
+              "# TYPE c_us summary\n"
+              "c_us{peer=\"2\",quantile=\"0.5\"} 5\n"
+              "c_us{peer=\"2\",quantile=\"0.9\"} 5\n"
+              "c_us{peer=\"2\",quantile=\"0.99\"} 5\n"
+              "c_us{peer=\"2\",quantile=\"0.999\"} 5\n"
+              "c_us_sum{peer=\"2\"} 5\n"
+              "c_us_count{peer=\"2\"} 1\n"
+              "c_us_max{peer=\"2\"} 5\n", out);
+}
+
+// a clash is usable and stays out of the output
+TEST(MetricsTest, TypeClashGetsADummy) {
+    MetricsRegistry r;
+    r.GetCounter("x")->Add(1);
+
+    Histogram* h = r.GetHistogram("x");
+    ASSERT_TRUE(h != NULL);
+    h->Record(10);
+    Histogram* other = r.GetHistogram("x", "peer=\"2\"");
+    EXPECT_EQ(h, other);
+
+    r.GetHistogram("y")->Record(1);
+    Counter* c = r.GetCounter("y", "peer=\"2\"");
+    ASSERT_TRUE(c != NULL);
+    c->Add(5);
+
+    std::string out;
+    r.Render(&out);
+    EXPECT_EQ(std::string::npos, out.find("x_count"));
+    EXPECT_EQ(std::string::npos, out.find("y{peer"));
+    EXPECT_NE(std::string::npos, out.find("x 1\n"));
+}
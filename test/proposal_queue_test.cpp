@@ -0,0 +1,143 @@
+#include "proposal_queue.h"
+#include "log_store.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+
+using namespace dcraft;
+
+namespace {
+
+uint64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a log and a loop, no followers
+class ProposalQueueTest : public ::testing::Test {
+protected:
+    ProposalQueueTest() : store_(dir_.Join("log")) {}
+
+    virtual void SetUp() {
+        ASSERT_EQ(0, store_.Initialize());
+        loop_.reset(dc::CreateEventLoop(dc::LOOP_EPOLL, true));
+        ASSERT_TRUE(loop_.get() != NULL);
+    }
+
+    // run the loop until the log is durable up to index, or 2 s
+    bool WaitDurable(uint64_t index) {
+        uint64_t deadline = NowUs() + 2000000;
+        while (store_.durable_index() < index) {
+            if (NowUs() >= deadline || loop_->Wait(10) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    dctest::TempDir dir_;
+    LogStore store_;
+    std::unique_ptr<dc::EventLoop> loop_;
+};
+
+}   // namespace
+
+TEST_F(ProposalQueueTest, FullBatchFlushesAtOnce) {
+    ProposalQueue q(&store_, NULL, 4, 1024, 100000, false);
+    ASSERT_EQ(0, q.Initialize(loop_.get()));
+
+    for (uint64_t i = 1; i <= 3; i++) {
+        EXPECT_EQ(i, q.Propose(1, "abcd", 4));
+    }
+    q.Tick();                           // the linger is running
+    EXPECT_EQ(0u, store_.durable_index());
+
+    EXPECT_EQ(4u, q.Propose(1, "abcd", 4));
+    EXPECT_EQ(4u, store_.durable_index());
+
+    // max_bytes cuts it too
+    EXPECT_EQ(5u, q.Propose(1, std::string(1024, 'x').data(), 1024));
+    EXPECT_EQ(5u, store_.durable_index());
+}
+
+TEST_F(ProposalQueueTest, LingerFlushesOnTheLoop) {
+    const uint32_t kLingerUs = 5000;
+    ProposalQueue q(&store_, NULL, 256, 1 << 20, kLingerUs, false);
+    ASSERT_EQ(0, q.Initialize(loop_.get()));
+
+    uint64_t begin = NowUs();
+    ASSERT_EQ(1u, q.Propose(1, "a", 1));
+    ASSERT_EQ(2u, q.Propose(1, "b", 1));
+    q.Tick();
+    EXPECT_EQ(0u, store_.durable_index());
+
+    // the timerfd cuts both in one batch
+    ASSERT_TRUE(WaitDurable(2));
+    EXPECT_GE(NowUs() - begin, kLingerUs);
+    EXPECT_EQ(1u, q.avg_batch());       // ewma x8: 8 - 1 + 2 = 9
+}
+
+TEST_F(ProposalQueueTest, AdaptiveLingerFollowsTheBatchSize) {
+    ProposalQueue q(&store_, NULL, 256, 1 << 20, 100000, true);
+    ASSERT_EQ(0, q.Initialize(loop_.get()));
+
+    // one proposal a batch: nobody to wait for, the tick flushes
+    ASSERT_EQ(1u, q.Propose(1, "a", 1));
+    q.Tick();
+    EXPECT_EQ(1u, store_.durable_index());
+    EXPECT_EQ(1u, q.avg_batch());
+
+    // batches of 8 lift the average to 2 and more, then proposals linger
+    uint64_t index = 1;
+    while (q.avg_batch() < 2) {
+        for (int i = 0; i < 8; i++) {
+            index = q.Propose(1, "a", 1);
+        }
+        q.Flush();
+        ASSERT_EQ(index, store_.durable_index());
+    }
+
+    index = q.Propose(1, "a", 1);
+    q.Tick();
+    EXPECT_EQ(index - 1, store_.durable_index());
+    ASSERT_TRUE(WaitDurable(index));
+}
+
+// a batch cut while FlushAsync() runs waits for it, then goes out in order
+TEST_F(ProposalQueueTest, FlushAsyncDefersTheNextBatch) {
+    loop_.reset(dc::CreateEventLoop(dc::LOOP_URING, true));
+    ASSERT_TRUE(loop_.get() != NULL);
+    if (loop_->type() != dc::LOOP_URING) {
+        GTEST_SKIP() << "no io_uring";
+    }
+
+    ProposalQueue q(&store_, NULL, 2, 1 << 20, 0, false);
+    ASSERT_EQ(0, q.Initialize(loop_.get()));
+
+    q.Propose(1, "a", 1);
+    q.Propose(1, "b", 1);
+    EXPECT_TRUE(store_.flushing());
+    EXPECT_EQ(0u, store_.durable_index());
+
+    // the second batch is in the log but not written yet
+    q.Propose(1, "c", 1);
+    q.Propose(1, "d", 1);
+    EXPECT_EQ(4u, store_.last_index());
+    q.Tick();
+    EXPECT_EQ(0u, store_.durable_index());
+
+    // the first completes alone, the next Tick() starts the second
+    while (store_.flushing()) {
+        ASSERT_GE(loop_->Wait(10), 0);
+    }
+    EXPECT_EQ(2u, store_.durable_index());
+    q.Tick();
+    EXPECT_TRUE(store_.flushing());
+    ASSERT_TRUE(WaitDurable(4));
+
+    // nothing left, a tick is a no-op
+    q.Tick();
+    EXPECT_FALSE(store_.flushing());
+}
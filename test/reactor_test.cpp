@@ -0,0 +1,50 @@
+#include "reactor.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace dc;
+
+namespace {
+
+class NoAccept : public SocketEvent {
+public:
+    virtual void OnAccept(int fd, uint32_t ip, int port) { (void)fd; (void)ip; (void)port; }
+};
+
+class InLoopTask : public Task {
+public:
+    InLoopTask(Reactor* r, std::atomic<int>* result) : r_(r), result_(result) {}
+
+    virtual void Run() { result_->store(r_->InLoop() ? 1 : 0); }
+
+private:
+    Reactor* r_;
+    std::atomic<int>* result_;
+};
+
+}   // namespace
+
+TEST(ReactorTest, InLoopOnlyOnTheLoopThread) {
+    NoAccept se;
+    Reactor r(&se);
+    ASSERT_EQ(0, r.Initialize());
+    EXPECT_FALSE(r.InLoop());
+
+    // posted right away, the task may run before Start() returns
+    std::atomic<int> result(-1);
+    r.Post(new InLoopTask(&r, &result));
+    ASSERT_EQ(0, r.Start());
+    EXPECT_FALSE(r.InLoop());
+
+    for (int i = 0; i < 500 && result.load() < 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    EXPECT_EQ(1, result.load());
+
+    r.Stop();
+    r.Join();
+    EXPECT_FALSE(r.InLoop());
+}
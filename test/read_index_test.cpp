@@ -0,0 +1,225 @@
+#include "read_index.h"
+#include "log_store.h"
+#include "log_replicate.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using namespace dcraft;
+
+namespace {
+
+const uint64_t kSelf = 1;
+const uint32_t kElection = 100;         // lease 90 ms after the round is sent
+const uint32_t kTimeout = 1000;
+
+// a follower connection without a socket, frames pile up in sendChain()
+class Conn : public dc::SocketFdHandler {
+public:
+    Conn() : dc::SocketFdHandler(0, 0, NULL) {}
+
+    virtual void OnError(int, int, std::string&) {}
+};
+
+class Reads : public ReadCallback {
+public:
+    virtual void OnReadReady(uint64_t read_index) { ready_.push_back(read_index); }
+    virtual void OnReadFail(int err) { failed_.push_back(err); }
+
+    std::vector<uint64_t> ready_;
+    std::vector<int> failed_;
+};
+
+// node 1, leader of term 2 over peers 2 .. n, index 1 is of term 1
+class Leader {
+public:
+    Leader(const std::string& dir, int nodes, bool lease)
+        : store_(dir + "/log")
+        , replicate_(&store_, kSelf)
+        , reads_(&store_, &replicate_, kSelf, kElection, lease, kTimeout)
+        , conns_(nodes) {
+        EXPECT_EQ(0, store_.Initialize());
+        EXPECT_EQ(1u, store_.Append(1, "a", 1));
+        EXPECT_EQ(0, store_.Flush());
+
+        for (int id = 2; id <= nodes; id++) {
+            EXPECT_EQ(0, replicate_.AddFollower(id, &conns_[id - 1]));
+        }
+        replicate_.Reset(2);
+        reads_.BecomeLeader(2);
+    }
+
+    void Ack(uint64_t from, uint64_t read_seq, uint64_t match) {
+        AppendEntriesResponse resp;
+        resp.term = 2;
+        resp.from_id = from;
+        resp.prev_log_index = match;
+        resp.match_index = match;
+        resp.hint_index = 0;
+        resp.read_seq = read_seq;
+        resp.success = true;
+        replicate_.OnAppendEntriesResponse(resp);
+    }
+
+    // the leader's first entry of term 2, on peers 2 and 3
+    void CommitTermEntry() {
+        uint64_t index = store_.Append(2, "b", 1);
+        ASSERT_EQ(0, store_.Flush());
+        Ack(2, 0, index);
+        Ack(3, 0, index);
+        ASSERT_EQ(index, replicate_.CommitIndex());
+    }
+
+    LogStore store_;
+    LogReplicate replicate_;
+    ReadIndex reads_;
+    std::vector<Conn> conns_;
+};
+
+}   // namespace
+
+TEST(ReadIndexTest, HeldUntilAnEntryOfTheTermCommits) {
+    dctest::TempDir dir;
+    Reads r;
+    Leader l(dir.path(), 3, false);
+
+    // index 1 may be committed by the old leader, it says nothing about term 2
+    ASSERT_EQ(0, l.reads_.Read(&r, 0));
+    l.reads_.Tick(0);
+    l.Ack(2, 1, 1);
+    l.reads_.Tick(1);
+    l.reads_.OnApplied(1);
+    EXPECT_TRUE(r.ready_.empty());
+    EXPECT_EQ(1u, l.reads_.pending());
+
+    l.CommitTermEntry();
+    l.reads_.Tick(2);
+    EXPECT_TRUE(r.ready_.empty());      // confirmed at 2, the Fsm is at 1
+
+    l.reads_.OnApplied(2);
+    ASSERT_EQ(1u, r.ready_.size());
+    EXPECT_EQ(2u, r.ready_[0]);
+    EXPECT_EQ(0u, l.reads_.pending());
+}
+
+TEST(ReadIndexTest, RoundConfirmedByMajority) {
+    dctest::TempDir dir;
+    Reads r;
+    Leader l(dir.path(), 5, false);
+    l.CommitTermEntry();
+    l.reads_.OnApplied(2);
+
+    // the reads of one tick share one round
+    ASSERT_EQ(0, l.reads_.Read(&r, 10));
+    ASSERT_EQ(0, l.reads_.Read(&r, 10));
+    l.reads_.Tick(10);
+
+    // a read after the round was sent needs the next one
+    ASSERT_EQ(0, l.reads_.Read(&r, 11));
+
+    l.Ack(2, 1, 2);
+    l.reads_.Tick(12);
+    EXPECT_TRUE(r.ready_.empty());      // 2 of 5
+
+    l.Ack(3, 1, 2);
+    l.reads_.Tick(13);
+    EXPECT_EQ(2u, r.ready_.size());     // 3 of 5
+    EXPECT_EQ(1u, l.reads_.pending());
+
+    // round 2 started by the Tick(12) above, a stale echo of round 1 does not count
+    l.Ack(4, 1, 2);
+    l.Ack(5, 1, 2);
+    l.reads_.Tick(14);
+    EXPECT_EQ(2u, r.ready_.size());
+
+    l.Ack(2, 2, 2);
+    l.Ack(5, 2, 2);
+    l.reads_.Tick(15);
+    EXPECT_EQ(3u, r.ready_.size());
+    EXPECT_TRUE(r.failed_.empty());
+}
+
+TEST(ReadIndexTest, UnconfirmedReadTimesOut) {
+    dctest::TempDir dir;
+    Reads r;
+    Leader l(dir.path(), 3, false);
+    l.CommitTermEntry();
+
+    ASSERT_EQ(0, l.reads_.Read(&r, 0));
+    l.reads_.Tick(0);
+    l.reads_.Tick(kTimeout - 1);
+    EXPECT_TRUE(r.failed_.empty());
+
+    l.reads_.Tick(kTimeout);
+    ASSERT_EQ(1u, r.failed_.size());
+    EXPECT_EQ(READ_ERR_TIMEOUT, r.failed_[0]);
+    EXPECT_EQ(0u, l.reads_.pending());
+}
+
+TEST(ReadIndexTest, LostLeadershipFailsReads) {
+    dctest::TempDir dir;
+    Reads r;
+    Leader l(dir.path(), 3, false);
+
+    ASSERT_EQ(0, l.reads_.Read(&r, 0));
+    l.reads_.BecomeFollower(3, NULL);
+    ASSERT_EQ(1u, r.failed_.size());
+    EXPECT_EQ(READ_ERR_NOT_LEADER, r.failed_[0]);
+
+    // no leader known, nowhere to send it
+    EXPECT_EQ(-1, l.reads_.Read(&r, 0));
+}
+
+TEST(ReadIndexTest, LeaseSkipsTheRoundUntilItExpires) {
+    dctest::TempDir dir;
+    Reads r;
+    Leader l(dir.path(), 3, true);
+    l.CommitTermEntry();
+    l.reads_.OnApplied(2);
+
+    // no lease before the first round of the term is acked
+    EXPECT_FALSE(l.reads_.lease_valid(0));
+    ASSERT_EQ(0, l.reads_.Read(&r, 0));
+    l.reads_.Tick(0);
+    EXPECT_TRUE(r.ready_.empty());
+
+    l.Ack(2, 1, 2);
+    l.reads_.Tick(5);
+    EXPECT_EQ(1u, r.ready_.size());
+
+    // the lease counts from the round sent at 0, not from its ack at 5
+    uint64_t expire = kElection * (100 - READ_LEASE_DRIFT_PERCENT) / 100;
+    EXPECT_TRUE(l.reads_.lease_valid(expire - 1));
+    EXPECT_FALSE(l.reads_.lease_valid(expire));
+
+    // inside the lease a read takes the commit index without a round
+    ASSERT_EQ(0, l.reads_.Read(&r, 10));
+    l.reads_.Tick(10);
+    EXPECT_EQ(2u, r.ready_.size());
+
+    // past it the read waits for a round again
+    ASSERT_EQ(0, l.reads_.Read(&r, expire));
+    EXPECT_EQ(2u, r.ready_.size());
+    EXPECT_EQ(1u, l.reads_.pending());
+}
+
+TEST(ReadIndexTest, LeaseRenewedBeforeItRunsOut) {
+    dctest::TempDir dir;
+    Leader l(dir.path(), 3, true);
+    l.CommitTermEntry();
+
+    l.reads_.Tick(0);                   // no reads, the lease still wants a round
+    l.Ack(2, 1, 2);
+    l.reads_.Tick(1);
+    uint64_t lease = kElection * (100 - READ_LEASE_DRIFT_PERCENT) / 100;
+    EXPECT_TRUE(l.reads_.lease_valid(lease - 1));
+
+    // half the lease left: the next round goes out, its ack moves the expiry
+    l.reads_.Tick(lease / 2);
+    l.Ack(2, 2, 2);
+    l.reads_.Tick(lease / 2 + 1);
+    EXPECT_TRUE(l.reads_.lease_valid(lease / 2 + lease - 1));
+    EXPECT_FALSE(l.reads_.lease_valid(lease / 2 + lease));
+}
@@ -0,0 +1,181 @@
+#include "recovery.h"
+#include "snapshot.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+const uint64_t kSegmentSize = 4096;
+const uint32_t kLen = 200;              // ~19 entries per segment
+
+class StringFsm : public Fsm {
+public:
+    StringFsm() : loads_(0) {}
+
+    virtual int Apply(uint64_t, const char*, uint32_t) { return 0; }
+    virtual int SaveSnapshot(int) { return 0; }
+
+    virtual int LoadSnapshot(int fd) {
+        loads_++;
+        state_.clear();
+        char buf[256];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            state_.append(buf, n);
+        }
+        return n == 0 ? 0 : -1;
+    }
+
+    std::string state_;
+    int loads_;
+};
+
+std::string Data(uint64_t index) {
+    return std::string(kLen, static_cast<char>('a' + index % 26));
+}
+
+void AppendN(const std::string& dir, uint64_t term, uint64_t n) {
+    LogStore store(dir, kSegmentSize);
+    ASSERT_EQ(0, store.Initialize());
+    for (uint64_t i = 0; i < n; i++) {
+        std::string data = Data(store.last_index() + 1);
+        ASSERT_NE(0u, store.Append(term, data.data(), kLen));
+    }
+    ASSERT_EQ(0, store.Flush());
+}
+
+void WriteSnapshot(const std::string& path, uint64_t index, uint64_t term, const std::string& payload) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.last_index = index;
+    header.last_term = term;
+    ASSERT_EQ(static_cast<ssize_t>(sizeof(header)), write(fd, &header, sizeof(header)));
+    ASSERT_EQ(static_cast<ssize_t>(payload.size()), write(fd, payload.data(), payload.size()));
+    ASSERT_EQ(0, SealSnapshot(fd));
+    close(fd);
+}
+
+// Recovery::Run() of a fresh store, segments checked on 4 threads
+int Recover(const std::string& snapshot, StringFsm* fsm, LogStore* store) {
+    store->set_recover(4, true);
+    Recovery recovery(fsm, store, snapshot);
+    return recovery.Run();
+}
+
+void ExpectEntries(LogStore* store, uint64_t first, uint64_t last, uint64_t term) {
+    for (uint64_t i = first; i <= last; i++) {
+        LogEntry e;
+        ASSERT_EQ(0, store->Get(i, &e)) << "index " << i;
+        EXPECT_EQ(term, e.term);
+        EXPECT_EQ(Data(i), e.data);
+    }
+}
+
+}   // namespace
+
+TEST(RecoveryTest, NoSnapshot) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 100);
+
+    StringFsm fsm;
+    LogStore store(dir.Join("log"), kSegmentSize);
+    ASSERT_EQ(0, Recover(dir.Join("snapshot.dat"), &fsm, &store));
+    EXPECT_EQ(0, fsm.loads_);
+    EXPECT_EQ(1u, store.first_index());
+    EXPECT_EQ(100u, store.last_index());
+    ExpectEntries(&store, 1, 100, 1);
+}
+
+TEST(RecoveryTest, SnapshotInsideLog) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 100);
+    WriteSnapshot(dir.Join("snapshot.dat"), 60, 1, "state at 60");
+
+    StringFsm fsm;
+    LogStore store(dir.Join("log"), kSegmentSize);
+    ASSERT_EQ(0, Recover(dir.Join("snapshot.dat"), &fsm, &store));
+    EXPECT_EQ(1, fsm.loads_);
+    EXPECT_EQ("state at 60", fsm.state_);
+
+    // the segments inside the snapshot are gone, the one holding 60 stays
+    EXPECT_GT(store.first_index(), 1u);
+    EXPECT_LE(store.first_index(), 61u);
+    EXPECT_EQ(100u, store.last_index());
+    EXPECT_EQ(1u, store.Term(60));
+    ExpectEntries(&store, 61, 100, 1);
+}
+
+// the log has another history at the snapshot index: it restarts after it
+TEST(RecoveryTest, SnapshotConflictRestartsLog) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 100);
+    WriteSnapshot(dir.Join("snapshot.dat"), 60, 2, "state at 60");
+
+    for (int round = 0; round < 2; round++) {
+        StringFsm fsm;
+        LogStore store(dir.Join("log"), kSegmentSize);
+        ASSERT_EQ(0, Recover(dir.Join("snapshot.dat"), &fsm, &store)) << "round " << round;
+        EXPECT_EQ(61u, store.first_index());
+        EXPECT_EQ(60u, store.last_index());
+        EXPECT_EQ(2u, store.Term(60));
+        LogEntry e;
+        EXPECT_NE(0, store.Get(60, &e));
+
+        std::string data = Data(61);
+        EXPECT_EQ(61u, store.Append(2, data.data(), kLen));
+        ASSERT_EQ(0, store.Flush());
+        ASSERT_EQ(0, store.TruncateSuffix(61));
+    }
+}
+
+TEST(RecoveryTest, SnapshotBeyondLog) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 10);
+    WriteSnapshot(dir.Join("snapshot.dat"), 30, 1, "");
+
+    StringFsm fsm;
+    LogStore store(dir.Join("log"), kSegmentSize);
+    ASSERT_EQ(0, Recover(dir.Join("snapshot.dat"), &fsm, &store));
+    EXPECT_EQ(31u, store.first_index());
+    EXPECT_EQ(30u, store.last_index());
+    EXPECT_EQ(1u, store.Term(30));
+}
+
+TEST(RecoveryTest, GapAfterSnapshotFails) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 100);
+    {
+        LogStore store(dir.Join("log"), kSegmentSize);
+        ASSERT_EQ(0, store.Initialize());
+        ASSERT_EQ(0, store.Compact(80, 1));
+        ASSERT_GT(store.first_index(), 31u);
+    }
+    WriteSnapshot(dir.Join("snapshot.dat"), 30, 1, "");
+
+    StringFsm fsm;
+    LogStore store(dir.Join("log"), kSegmentSize);
+    EXPECT_EQ(-1, Recover(dir.Join("snapshot.dat"), &fsm, &store));
+}
+
+TEST(RecoveryTest, BadSnapshotFails) {
+    dctest::TempDir dir;
+    AppendN(dir.Join("log"), 1, 100);
+    WriteSnapshot(dir.Join("snapshot.dat"), 60, 1, "state at 60");
+    char c = 'X';
+    ASSERT_TRUE(dctest::WriteAt(dir.Join("snapshot.dat"), sizeof(SnapshotHeader) + 2, &c, 1));
+
+    StringFsm fsm;
+    LogStore store(dir.Join("log"), kSegmentSize);
+    EXPECT_EQ(-1, Recover(dir.Join("snapshot.dat"), &fsm, &store));
+    EXPECT_EQ(0, fsm.loads_);
+}
@@ -0,0 +1,76 @@
+#include "shared_wal.h"
+#include "log_store.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+const uint32_t kLen = 100;
+
+std::string Data(uint64_t index) {
+    return std::string(kLen, static_cast<char>('a' + index % 26));
+}
+
+// 10 entries of group 1 written through a wal in dir/wal
+void WriteWal(const dctest::TempDir& dir) {
+    SharedWal wal(dir.Join("wal"));
+    LogStore store(dir.Join("origin"));
+    ASSERT_EQ(0, store.SetWal(&wal, 1));
+    ASSERT_EQ(0, store.Initialize());
+    ASSERT_EQ(0, wal.Initialize());
+    for (uint64_t i = 1; i <= 10; i++) {
+        std::string data = Data(i);
+        ASSERT_EQ(i, store.Append(1, data.data(), kLen));
+    }
+    ASSERT_EQ(0, store.Flush());
+}
+
+// replay the wal into a store that lost everything, return its last index
+uint64_t ReplayInto(const dctest::TempDir& dir, const std::string& name) {
+    SharedWal wal(dir.Join("wal"));
+    LogStore store(dir.Join(name));
+    EXPECT_EQ(0, store.SetWal(&wal, 1));
+    EXPECT_EQ(0, store.Initialize());
+    EXPECT_EQ(0, wal.Initialize());
+    for (uint64_t i = store.first_index(); i <= store.last_index(); i++) {
+        LogEntry e;
+        EXPECT_EQ(0, store.Get(i, &e));
+        EXPECT_EQ(Data(i), e.data);
+    }
+    return store.last_index();
+}
+
+std::string WalFile(const dctest::TempDir& dir) {
+    return dir.Join("wal/00000000000000000001" WAL_FILE_SUFFIX);
+}
+
+}   // namespace
+
+TEST(SharedWalTest, ReplayRestoresLostEntries) {
+    dctest::TempDir dir;
+    WriteWal(dir);
+    EXPECT_EQ(10 * (sizeof(WalRecord) + kLen), static_cast<uint64_t>(dctest::FileSize(WalFile(dir))));
+    EXPECT_EQ(10u, ReplayInto(dir, "lost"));
+}
+
+// a record that fails its crc ends the replay, like a torn tail
+TEST(SharedWalTest, ReplayStopsAtCorruptRecord) {
+    size_t fields[] = {sizeof(WalRecord) + 1,                   // data, chained entry crc
+                       offsetof(WalRecord, term),               // record fields
+                       offsetof(WalRecord, crc)};               // the crc itself
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        dctest::TempDir dir;
+        WriteWal(dir);
+
+        // record 6 holds index 7
+        uint64_t offset = 6 * (sizeof(WalRecord) + kLen) + fields[i];
+        char c = 0x5a;
+        ASSERT_TRUE(dctest::WriteAt(WalFile(dir), offset, &c, 1));
+        EXPECT_EQ(6u, ReplayInto(dir, "lost")) << "field offset " << fields[i];
+    }
+}
@@ -0,0 +1,107 @@
+#include "slab.h"
+#include "io_chain.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+
+using namespace dc;
+
+namespace {
+
+// a block freed and allocated again comes back only within its size class
+bool SameClass(Slab* slab, size_t a, size_t b) {
+    void* p = slab->Alloc(a);
+    Slab::Free(p);
+    void* q = slab->Alloc(b);
+    Slab::Free(q);
+    return p == q;
+}
+
+}   // namespace
+
+TEST(SlabTest, SizeClasses) {
+    Slab slab;
+    EXPECT_TRUE(SameClass(&slab, 1, 40));
+    EXPECT_FALSE(SameClass(&slab, 1, 100));
+    EXPECT_TRUE(SameClass(&slab, 100, 110));
+    EXPECT_TRUE(SameClass(&slab, 40000, 60000));
+    EXPECT_FALSE(SameClass(&slab, 30000, 60000));
+
+    // every block is 16 byte aligned and usable to its size
+    for (size_t size = 1; size <= 65000; size = size * 3 + 1) {
+        char* p = static_cast<char*>(slab.Alloc(size));
+        ASSERT_TRUE(p != NULL);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) % 16);
+        memset(p, 0xab, size);
+        Slab::Free(p);
+    }
+    EXPECT_EQ(0u, slab.stats().in_use);
+    EXPECT_EQ(0u, slab.stats().large);
+}
+
+TEST(SlabTest, ReuseCountsAsHit) {
+    Slab slab;
+    void* p = slab.Alloc(200);
+    EXPECT_EQ(1u, slab.stats().misses);
+    EXPECT_EQ(1u, slab.stats().chunks);
+    Slab::Free(p);
+
+    void* q = slab.Alloc(200);
+    EXPECT_EQ(p, q);
+    EXPECT_EQ(1u, slab.stats().hits);
+    EXPECT_DOUBLE_EQ(0.5, slab.hit_rate());
+    Slab::Free(q);
+}
+
+// past the biggest class: plain malloc, no chunk
+TEST(SlabTest, OversizeFallsBackToMalloc) {
+    Slab slab;
+    char* p = static_cast<char*>(slab.Alloc(1 << SLAB_MAX_SHIFT));
+    ASSERT_TRUE(p != NULL);
+    memset(p, 1, 1 << SLAB_MAX_SHIFT);
+
+    SlabStats s = slab.stats();
+    EXPECT_EQ(1u, s.large);
+    EXPECT_EQ(0u, s.chunks);
+    EXPECT_EQ(1u, s.in_use);
+
+    Slab::Free(p);
+    EXPECT_EQ(0u, slab.stats().in_use);
+}
+
+// the last Release() of a pooled Buffer gives its block back
+TEST(SlabTest, BufferReleaseReturnsTheBlock) {
+    Slab slab;
+    Buffer* b = Buffer::Create(1000, &slab);
+    ASSERT_TRUE(b != NULL);
+    EXPECT_EQ(1000u, b->size());
+    EXPECT_EQ(1u, slab.stats().in_use);
+
+    b->AddRef();
+    b->Release();
+    EXPECT_EQ(1u, slab.stats().in_use);
+    b->Release();
+    EXPECT_EQ(0u, slab.stats().in_use);
+
+    Buffer* again = Buffer::Create(1000, &slab);
+    EXPECT_EQ(1u, slab.stats().hits);
+    again->Release();
+}
+
+// freed on another thread: a remote free, taken back by the owner's next Alloc()
+TEST(SlabTest, RemoteFreeGoesBackToTheOwner) {
+    Slab slab;
+    Buffer* b = Buffer::Create(300, &slab);
+    std::thread other([b]() { b->Release(); });
+    other.join();
+
+    SlabStats s = slab.stats();
+    EXPECT_EQ(1u, s.remote_frees);
+    EXPECT_EQ(0u, s.in_use);
+
+    Buffer* again = Buffer::Create(300, &slab);
+    EXPECT_EQ(1u, slab.stats().hits);
+    again->Release();
+}
@@ -0,0 +1,89 @@
+#include "snapshot.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+// header with crc 0 and payload, as the Fsm leaves it before SealSnapshot()
+int WriteSnapshot(const std::string& path, const std::string& payload) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.last_index = 100;
+    header.last_term = 3;
+    if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))
+        || write(fd, payload.data(), payload.size()) != static_cast<ssize_t>(payload.size())) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}   // namespace
+
+TEST(SnapshotTest, SealThenVerify) {
+    dctest::TempDir dir;
+    std::string path = dir.Join("snapshot.dat");
+
+    std::string payload;
+    for (int i = 0; i < 200000; i++) {
+        payload += static_cast<char>(i * 31);
+    }
+    int fd = WriteSnapshot(path, payload);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(-1, VerifySnapshot(fd));     // not sealed yet
+    ASSERT_EQ(0, SealSnapshot(fd));
+    EXPECT_EQ(0, VerifySnapshot(fd));
+
+    SnapshotHeader header;
+    ASSERT_EQ(0, ReadSnapshotHeader(path, &header));
+    EXPECT_EQ(100u, header.last_index);
+    EXPECT_EQ(3u, header.last_term);
+    EXPECT_NE(0u, header.crc);
+
+    // a flipped byte anywhere in the payload
+    uint64_t offsets[] = {0, 65535, 65536, payload.size() - 1};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        char c = payload[offsets[i]] ^ 0x40;
+        ASSERT_TRUE(dctest::WriteAt(path, sizeof(header) + offsets[i], &c, 1));
+        EXPECT_EQ(-1, VerifySnapshot(fd)) << "offset " << offsets[i];
+        ASSERT_TRUE(dctest::WriteAt(path, sizeof(header) + offsets[i], &payload[offsets[i]], 1));
+        EXPECT_EQ(0, VerifySnapshot(fd));
+    }
+
+    // a lost tail
+    ASSERT_TRUE(dctest::Truncate(path, sizeof(header) + payload.size() - 1));
+    EXPECT_EQ(-1, VerifySnapshot(fd));
+    close(fd);
+}
+
+TEST(SnapshotTest, EmptyPayloadAndBadMagic) {
+    dctest::TempDir dir;
+    std::string path = dir.Join("snapshot.dat");
+
+    int fd = WriteSnapshot(path, "");
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(0, SealSnapshot(fd));
+    EXPECT_EQ(0, VerifySnapshot(fd));
+
+    uint32_t magic = 0;
+    ASSERT_TRUE(dctest::WriteAt(path, 0, &magic, sizeof(magic)));
+    EXPECT_EQ(-1, VerifySnapshot(fd));
+    SnapshotHeader header;
+    EXPECT_EQ(-1, ReadSnapshotHeader(path, &header));
+    close(fd);
+
+    ASSERT_TRUE(dctest::Truncate(path, sizeof(header) - 1));
+    EXPECT_EQ(-1, ReadSnapshotHeader(path, &header));
+}
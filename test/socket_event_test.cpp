@@ -0,0 +1,298 @@
+#include "socket_event.h"
+#include "codec.h"
+
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dc;
+
+namespace {
+
+class Peer : public SocketFdHandler {
+public:
+    Peer(int fd, SocketEvent* se)
+        : SocketFdHandler(0, 0, se, fd), messages_(0), bytes_(0), errors_(0), err_(0) {}
+
+    virtual void OnMessage(const MessageView& msg) {
+        messages_++;
+        bytes_ += msg.length;
+    }
+
+    virtual void OnError(int, int err, std::string&) {
+        errors_++;
+        err_ = err;
+    }
+
+    int fd() const { return fd_; }
+
+    int messages_;
+    uint64_t bytes_;
+    int errors_;
+    int err_;
+};
+
+// listens on an ephemeral loopback port, a Peer per accepted connection
+class Server : public SocketEvent {
+public:
+    explicit Server(EVENT_LOOP_TYPE type = LOOP_EPOLL)
+        : SocketEvent(SOCKET_TCP, true, type), port_(0) {}
+
+    virtual ~Server() {
+        for (size_t i = 0; i < peers_.size(); i++) {
+            if (GetHandler(peers_[i]->fd()) == peers_[i]) {
+                DelSocket(peers_[i]->fd());
+            }
+            delete peers_[i];
+        }
+    }
+
+    int Listen() {
+        if (Initialize() != 0) {
+            return -1;
+        }
+        std::string ip = "127.0.0.1";
+        int fd = AddListenSocket(ip, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+        return 0;
+    }
+
+    virtual void OnAccept(int fd, uint32_t, int) {
+        Peer* p = new Peer(fd, this);
+        peers_.push_back(p);
+        EXPECT_EQ(0, AddSocket(fd, p));
+    }
+
+    int port_;
+    std::vector<Peer*> peers_;
+};
+
+uint64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// run the loop until done() or 5 s
+bool RunUntil(Server* s, std::function<bool()> done) {
+    uint64_t deadline = NowMs() + 5000;
+    while (!done()) {
+        if (NowMs() >= deadline || s->Wait(NowMs(), 10) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a blocking client
+int Connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool WriteAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+std::string Frames(int n, uint32_t body) {
+    std::string frame;
+    EncodeFrameHeader(1, 0, body, &frame);
+    frame.append(body, 'x');
+
+    std::string all;
+    for (int i = 0; i < n; i++) {
+        all += frame;
+    }
+    return all;
+}
+
+// every case runs on readiness and on completion io
+class SocketEventTest : public ::testing::TestWithParam<EVENT_LOOP_TYPE> {};
+
+}   // namespace
+
+// a peer far ahead of the loop is read chunk by chunk, frames are cut after every recv
+TEST_P(SocketEventTest, ReadCutsFramesAfterEveryRecv) {
+    Server s(GetParam());
+    ASSERT_EQ(0, s.Listen());
+    int c = Connect(s.port_);
+    ASSERT_GE(c, 0);
+    ASSERT_TRUE(RunUntil(&s, [&] { return s.peers_.size() == 1; }));
+
+    const int kFrames = 400;
+    const uint32_t kBody = 2000;
+    std::string all = Frames(kFrames, kBody);
+    bool written = false;
+    std::thread writer([&] { written = WriteAll(c, all); });
+
+    // the socket queues what it can before the loop reads any of it
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Peer* p = s.peers_[0];
+    EXPECT_TRUE(RunUntil(&s, [&] { return p->messages_ == kFrames; }));
+    writer.join();
+    EXPECT_TRUE(written);
+
+    EXPECT_EQ(static_cast<uint64_t>(kFrames) * kBody, p->bytes_);
+    EXPECT_EQ(static_cast<size_t>(RING_BUFFER_INIT_SIZE), p->recvBuf().capacity());
+    close(c);
+}
+
+TEST_P(SocketEventTest, FramesBeforeCloseAreDelivered) {
+    Server s(GetParam());
+    ASSERT_EQ(0, s.Listen());
+    int c = Connect(s.port_);
+    ASSERT_GE(c, 0);
+    ASSERT_TRUE(WriteAll(c, Frames(3, 100)));
+    close(c);
+
+    ASSERT_TRUE(RunUntil(&s, [&] { return s.peers_.size() == 1 && s.peers_[0]->errors_ > 0; }));
+    Peer* p = s.peers_[0];
+    EXPECT_EQ(3, p->messages_);
+    EXPECT_EQ(-3, p->err_);
+    EXPECT_TRUE(s.GetHandler(p->fd()) == NULL);
+}
+
+// slices of several Buffers through a slow reader: every partial sendmsg resumes mid slice
+TEST_P(SocketEventTest, PartialSendsKeepTheByteOrder) {
+    Server s(GetParam());
+    ASSERT_EQ(0, s.Listen());
+    int c = Connect(s.port_);
+    ASSERT_GE(c, 0);
+    ASSERT_TRUE(RunUntil(&s, [&] { return s.peers_.size() == 1; }));
+
+    std::string expect;
+    IoChain chain;
+    for (int i = 0; i < 200; i++) {
+        size_t size = 10000 + i * 397;
+        Buffer* buf = Buffer::Create(size);
+        for (size_t j = 0; j < size; j++) {
+            buf->data()[j] = static_cast<char>((i * 31 + j) % 251);
+        }
+        // a slice from the middle, the Buffer head and tail are never sent
+        chain.Append(buf, 7, size - 11);
+        expect.append(buf->data() + 7, size - 11);
+        buf->Release();
+    }
+
+    Peer* p = s.peers_[0];
+    p->Send(chain);
+    EXPECT_TRUE(chain.empty());
+
+    std::string got;
+    std::atomic<bool> done(false);
+    std::thread reader([&] {
+        char buf[4096];
+        while (got.size() < expect.size()) {
+            ssize_t n = read(c, buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            got.append(buf, n);
+            if (got.size() % 7 == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        done = true;
+    });
+
+    EXPECT_TRUE(RunUntil(&s, [&] { return done.load(); }));
+    reader.join();
+    EXPECT_TRUE(got == expect);
+    EXPECT_TRUE(p->sendChain().empty());
+    EXPECT_EQ(0, p->errors_);
+    close(c);
+}
+
+// the peer reset the connection: the failed send closes it like a failed recv does
+TEST_P(SocketEventTest, HardSendErrorClosesTheConnection) {
+    Server s(GetParam());
+    ASSERT_EQ(0, s.Listen());
+    int c = Connect(s.port_);
+    ASSERT_GE(c, 0);
+    ASSERT_TRUE(RunUntil(&s, [&] { return s.peers_.size() == 1; }));
+
+    linger lg = {1, 0};
+    ASSERT_EQ(0, setsockopt(c, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)));
+    close(c);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // straight to OnWrite before the loop sees the reset, LOOP_URING
+    // learns it from the Sendmsg in the next Wait()
+    Peer* p = s.peers_[0];
+    std::string data = Frames(1, 100);
+    p->Send(data);
+    p->SendNow();
+
+    EXPECT_TRUE(RunUntil(&s, [&] { return p->errors_ > 0; }));
+    EXPECT_EQ(1, p->errors_);
+    EXPECT_TRUE(p->err_ == EPIPE || p->err_ == ECONNRESET);
+    EXPECT_TRUE(s.GetHandler(p->fd()) == NULL);
+}
+
+TEST_P(SocketEventTest, EveryClientIsAcceptedAndRead) {
+    Server s(GetParam());
+    ASSERT_EQ(0, s.Listen());
+
+    const int kClients = 8;
+    std::vector<int> clients;
+    for (int i = 0; i < kClients; i++) {
+        int c = Connect(s.port_);
+        ASSERT_GE(c, 0);
+        ASSERT_TRUE(WriteAll(c, Frames(i + 1, 500)));
+        clients.push_back(c);
+    }
+
+    int expect = kClients * (kClients + 1) / 2;
+    EXPECT_TRUE(RunUntil(&s, [&] {
+        int messages = 0;
+        for (size_t i = 0; i < s.peers_.size(); i++) {
+            messages += s.peers_[i]->messages_;
+        }
+        return messages == expect;
+    }));
+    EXPECT_EQ(static_cast<size_t>(kClients), s.peers_.size());
+
+    // a peer closed from the loop, its ops are cancelled before the fd is reused
+    s.DelSocket(s.peers_[0]->fd());
+    int c = Connect(s.port_);
+    ASSERT_GE(c, 0);
+    ASSERT_TRUE(WriteAll(c, Frames(2, 500)));
+    EXPECT_TRUE(RunUntil(&s, [&] { return s.peers_.size() == kClients + 1 && s.peers_.back()->messages_ == 2; }));
+    EXPECT_EQ(0, s.peers_.back()->errors_);
+
+    close(c);
+    for (size_t i = 0; i < clients.size(); i++) {
+        close(clients[i]);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Loops, SocketEventTest, ::testing::Values(LOOP_EPOLL, LOOP_URING));
@@ -0,0 +1,183 @@
+#include "tail_cache.h"
+#include "log_store.h"
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+
+using namespace dcraft;
+
+namespace {
+
+std::string Data(uint64_t index, size_t len) {
+    std::string s(len, 'a' + index % 26);
+    snprintf(&s[0], len, "%llu", static_cast<unsigned long long>(index));
+    return s;
+}
+
+dc::Buffer* Buf(size_t len) {
+    dc::Buffer* b = dc::Buffer::Create(len);
+    memset(b->data(), 'x', len);
+    return b;
+}
+
+void ExpectEntry(LogStore* store, uint64_t index, uint64_t term, size_t len) {
+    LogEntry e;
+    ASSERT_EQ(0, store->Get(index, &e)) << "index " << index;
+    EXPECT_EQ(index, e.index);
+    EXPECT_EQ(term, e.term);
+    EXPECT_EQ(Data(index, len), e.data);
+}
+
+// 4 KB segments, the cache holds the last 64 entries
+class TailCacheTest : public ::testing::Test {
+protected:
+    TailCacheTest()
+        : cache_(1 << 20, 64)
+        , store_(dir_.path(), 4096) {}
+
+    virtual void SetUp() {
+        store_.SetTailCache(&cache_, NULL);
+        ASSERT_EQ(0, store_.Initialize());
+    }
+
+    void AppendN(uint64_t term, uint64_t n, size_t len) {
+        for (uint64_t i = 0; i < n; i++) {
+            uint64_t index = store_.last_index() + 1;
+            std::string d = Data(index, len);
+            ASSERT_EQ(index, store_.Append(term, d.data(), d.size()));
+        }
+        ASSERT_EQ(0, store_.Flush());
+    }
+
+    dctest::TempDir dir_;
+    TailCache cache_;
+    LogStore store_;
+};
+
+}   // namespace
+
+TEST_F(TailCacheTest, HitsTheTailMissesTheRest) {
+    AppendN(1, 100, 100);
+    TailCacheStats s = cache_.stats();
+    EXPECT_EQ(64u, s.entries);
+    EXPECT_EQ(6400u, s.bytes);
+    EXPECT_EQ(36u, s.evictions);
+
+    // the same entries either way
+    for (uint64_t i = 1; i <= 100; i++) {
+        ExpectEntry(&store_, i, 1, 100);
+    }
+    s = cache_.stats();
+    EXPECT_EQ(64u, s.hits);
+    EXPECT_EQ(36u, s.misses);
+    EXPECT_EQ(6400u, s.hit_bytes);
+    EXPECT_DOUBLE_EQ(0.64, cache_.hit_rate());
+
+    // a hit shares the cached Buffer and its crc, a miss reads a new one
+    uint64_t term = 0;
+    dc::Buffer* hit = NULL;
+    dc::Buffer* again = NULL;
+    uint32_t crc = 0;
+    uint32_t crc_again = 0;
+    ASSERT_EQ(0, store_.Get(100, NULL, &term, &hit, &crc));
+    ASSERT_EQ(0, store_.Get(100, NULL, &term, &again, &crc_again));
+    EXPECT_EQ(hit, again);
+    EXPECT_EQ(crc, crc_again);
+    EXPECT_NE(0u, crc);
+    hit->Release();
+    again->Release();
+
+    dc::Buffer* miss = NULL;
+    ASSERT_EQ(0, store_.Get(1, NULL, &term, &miss));
+    EXPECT_EQ(Data(1, 100), std::string(miss->data(), miss->size()));
+    miss->Release();
+    EXPECT_EQ(37u, cache_.stats().misses);
+}
+
+TEST(TailCacheEvictTest, EvictsAtTheByteCap) {
+    TailCache cache(1000, 64);
+    for (uint64_t i = 1; i <= 20; i++) {
+        dc::Buffer* b = Buf(100);
+        cache.Put(i, 1, b);
+        b->Release();
+    }
+
+    TailCacheStats s = cache.stats();
+    EXPECT_EQ(10u, s.entries);
+    EXPECT_EQ(1000u, s.bytes);
+    EXPECT_EQ(10u, s.evictions);
+
+    uint64_t term = 0;
+    dc::Buffer* held = NULL;
+    EXPECT_FALSE(cache.Get(10, &term, &held));
+    ASSERT_TRUE(cache.Get(11, &term, &held));
+
+    // bigger than the cap: everything else goes, the entry itself stays
+    dc::Buffer* big = Buf(2000);
+    cache.Put(21, 1, big);
+    big->Release();
+    s = cache.stats();
+    EXPECT_EQ(1u, s.entries);
+    EXPECT_EQ(2000u, s.bytes);
+
+    // evicted while held, still valid until released
+    EXPECT_EQ(100u, held->size());
+    EXPECT_EQ('x', held->data()[99]);
+    held->Release();
+
+    // a Put() that is not last + 1 starts over
+    dc::Buffer* b = Buf(10);
+    cache.Put(100, 2, b);
+    b->Release();
+    EXPECT_FALSE(cache.Get(21, &term, &held));
+    ASSERT_TRUE(cache.Get(100, &term, &held));
+    EXPECT_EQ(2u, term);
+    held->Release();
+    EXPECT_EQ(1u, cache.stats().entries);
+}
+
+// a conflicting suffix must not be served from memory after it is rewritten
+TEST_F(TailCacheTest, TruncateSuffixDropsTheTail) {
+    AppendN(1, 20, 100);
+    ASSERT_EQ(0, store_.TruncateSuffix(15));
+    TailCacheStats s = cache_.stats();
+    EXPECT_EQ(14u, s.entries);
+
+    uint64_t term = 0;
+    dc::Buffer* data = NULL;
+    EXPECT_FALSE(cache_.Get(15, &term, &data));
+
+    AppendN(2, 6, 100);
+    for (uint64_t i = 15; i <= 20; i++) {
+        ExpectEntry(&store_, i, 2, 100);
+    }
+    ExpectEntry(&store_, 14, 1, 100);
+    EXPECT_EQ(1u, cache_.stats().misses);
+}
+
+TEST_F(TailCacheTest, CompactDropsTheHead) {
+    AppendN(1, 100, 100);
+    ASSERT_EQ(0, store_.Compact(90, 1));
+    uint64_t first = store_.first_index();
+    ASSERT_GT(first, 37u);              // was cached
+    ASSERT_LE(first, 90u);
+
+    // nothing below first_index() stays cached
+    uint64_t term = 0;
+    dc::Buffer* data = NULL;
+    EXPECT_FALSE(cache_.Get(first - 1, &term, &data));
+    ASSERT_TRUE(cache_.Get(first, &term, &data));
+    data->Release();
+    EXPECT_EQ(100 - first + 1, cache_.stats().entries);
+
+    // past the log, the log and the cache restart empty
+    ASSERT_EQ(0, store_.Compact(200, 1));
+    EXPECT_EQ(0u, cache_.stats().entries);
+    EXPECT_EQ(0u, cache_.stats().bytes);
+    AppendN(2, 3, 100);
+    ASSERT_TRUE(cache_.Get(201, &term, &data));
+    EXPECT_EQ(2u, term);
+    data->Release();
+}
@@ -0,0 +1,61 @@
+#ifndef __DC_RAFT_TEST_UTIL_H__
+#define __DC_RAFT_TEST_UTIL_H__
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <string>
+
+namespace dctest {
+
+// a fresh directory under /tmp, removed with everything in it
+class TempDir {
+public:
+    TempDir() {
+        char tmpl[] = "/tmp/dcraft_test_XXXXXX";
+        path_ = mkdtemp(tmpl) ? tmpl : "";
+    }
+
+    ~TempDir() {
+        if (!path_.empty()) {
+            nftw(path_.c_str(), Remove, 16, FTW_DEPTH | FTW_PHYS);
+        }
+    }
+
+    const std::string& path() const { return path_; }
+    std::string Join(const std::string& name) const { return path_ + "/" + name; }
+
+private:
+    static int Remove(const char* path, const struct stat*, int, struct FTW*) {
+        return remove(path);
+    }
+
+    std::string path_;
+};
+
+inline int64_t FileSize(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// overwrite len bytes at offset, for torn / corrupt files
+inline bool WriteAt(const std::string& path, uint64_t offset, const void* data, size_t len) {
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = pwrite(fd, data, len, offset) == static_cast<ssize_t>(len);
+    close(fd);
+    return ok;
+}
+
+inline bool Truncate(const std::string& path, uint64_t size) {
+    return truncate(path.c_str(), size) == 0;
+}
+
+}   // namespace dctest
+
+#endif  //  __DC_RAFT_TEST_UTIL_H__
@@ -0,0 +1,211 @@
+#include "timer_wheel.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dc;
+
+namespace {
+
+// records the wheel time it fired at, the test sets now before Advance()
+class RecordTimer : public Timer {
+public:
+    RecordTimer() : fired_(0), fired_at_(0), now_(NULL) {}
+
+    virtual void OnTimer() {
+        fired_++;
+        fired_at_ = *now_;
+    }
+
+    int fired_;
+    uint64_t fired_at_;
+    const uint64_t* now_;
+};
+
+class ReaddTimer : public Timer {
+public:
+    ReaddTimer(TimerWheel* wheel, uint64_t period, int times)
+        : wheel_(wheel), period_(period), times_(times), fired_(0) {}
+
+    virtual void OnTimer() {
+        fired_++;
+        if (fired_ < times_) {
+            wheel_->Add(this, expire_ms() + period_);
+        }
+    }
+
+    TimerWheel* wheel_;
+    uint64_t period_;
+    int times_;
+    int fired_;
+};
+
+class CancelTimer : public Timer {
+public:
+    CancelTimer() : other_(NULL), wheel_(NULL), fired_(0) {}
+
+    virtual void OnTimer() {
+        fired_++;
+        wheel_->Cancel(other_);
+    }
+
+    Timer* other_;
+    TimerWheel* wheel_;
+    int fired_;
+};
+
+const uint64_t kBase = 1000003;
+
+}   // namespace
+
+// one timer per delay, on every level boundary and past the top level
+TEST(TimerWheelTest, FiresExactlyAtExpireOnEveryLevel) {
+    uint64_t delays[] = {0, 1, 2, 255, 256, 257, 511, 16383, 16384, 16385,
+                         (1ULL << 20) - 1, 1ULL << 20, (1ULL << 20) + 1,
+                         (1ULL << 26) - 1, 1ULL << 26, (1ULL << 27) + 5};
+
+    for (size_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+        uint64_t d = delays[i];
+        uint64_t now = kBase;
+        TimerWheel wheel;
+        wheel.Initialize(now);
+
+        RecordTimer t;
+        t.now_ = &now;
+        wheel.Add(&t, kBase + d);
+        EXPECT_TRUE(t.pending());
+
+        if (d > 0) {
+            now = kBase + d - 1;
+            wheel.Advance(now);
+            EXPECT_EQ(0, t.fired_) << "delay " << d;
+            EXPECT_TRUE(t.pending()) << "delay " << d;
+        }
+
+        now = kBase + d;
+        wheel.Advance(now);
+        EXPECT_EQ(1, t.fired_) << "delay " << d;
+        EXPECT_FALSE(t.pending());
+        EXPECT_EQ(0u, wheel.size());
+    }
+}
+
+// sleeping NextTimeout() ms at a time, like the loop, never wakes up late
+TEST(TimerWheelTest, NextTimeoutDrivenLoopIsNeverLate) {
+    srand(7);
+    uint64_t now = kBase;
+    TimerWheel wheel;
+    wheel.Initialize(now);
+    EXPECT_EQ(-1, wheel.NextTimeout(now));
+
+    std::vector<RecordTimer> timers(2000);
+    for (size_t i = 0; i < timers.size(); i++) {
+        timers[i].now_ = &now;
+        // mostly short, some minutes away, to cross levels 1 and 2
+        uint64_t d = i % 10 == 0 ? rand() % (20 * 60 * 1000) : rand() % 2000;
+        wheel.Add(&timers[i], kBase + d);
+    }
+
+    while (wheel.size() > 0) {
+        int timeout = wheel.NextTimeout(now);
+        ASSERT_GE(timeout, 0);
+        now += timeout;
+        wheel.Advance(now);
+    }
+
+    for (size_t i = 0; i < timers.size(); i++) {
+        EXPECT_EQ(1, timers[i].fired_);
+        EXPECT_EQ(timers[i].expire_ms(), timers[i].fired_at_) << "timer " << i;
+    }
+}
+
+// big random jumps: a timer fires in the first Advance() that reaches it
+TEST(TimerWheelTest, AdvanceInJumpsFiresEachOnceInTime) {
+    srand(11);
+    uint64_t now = kBase;
+    TimerWheel wheel;
+    wheel.Initialize(now);
+
+    std::vector<RecordTimer> timers(3000);
+    for (size_t i = 0; i < timers.size(); i++) {
+        timers[i].now_ = &now;
+        wheel.Add(&timers[i], kBase + rand() % (40 * 60 * 1000));
+    }
+
+    uint64_t prev = now;
+    while (wheel.size() > 0) {
+        now += rand() % 70000;
+        wheel.Advance(now);
+        for (size_t i = 0; i < timers.size(); i++) {
+            if (timers[i].fired_at_ == now) {
+                EXPECT_GT(timers[i].expire_ms(), prev);
+                EXPECT_LE(timers[i].expire_ms(), now);
+            } else if (timers[i].fired_ == 0) {
+                EXPECT_GT(timers[i].expire_ms(), now);
+            }
+        }
+        prev = now;
+    }
+
+    for (size_t i = 0; i < timers.size(); i++) {
+        EXPECT_EQ(1, timers[i].fired_);
+    }
+}
+
+TEST(TimerWheelTest, CancelAndReaddFromOnTimer) {
+    uint64_t now = kBase;
+    TimerWheel wheel;
+    wheel.Initialize(now);
+
+    // same slot, each cancels the other: whichever fires first, one only
+    CancelTimer a;
+    CancelTimer b;
+    a.other_ = &b;
+    a.wheel_ = &wheel;
+    b.other_ = &a;
+    b.wheel_ = &wheel;
+    wheel.Add(&a, kBase + 300);
+    wheel.Add(&b, kBase + 300);
+
+    ReaddTimer periodic(&wheel, 100, 50);
+    wheel.Add(&periodic, kBase + 100);
+
+    RecordTimer cancelled;
+    cancelled.now_ = &now;
+    wheel.Add(&cancelled, kBase + 20000);
+    wheel.Cancel(&cancelled);
+    EXPECT_FALSE(cancelled.pending());
+
+    {
+        RecordTimer destroyed;
+        destroyed.now_ = &now;
+        wheel.Add(&destroyed, kBase + 50);
+    }
+    EXPECT_EQ(3u, wheel.size());   // a, b, periodic
+
+    now = kBase + 10000;
+    wheel.Advance(now);
+    EXPECT_EQ(1, a.fired_ + b.fired_);
+    EXPECT_FALSE(a.pending());
+    EXPECT_FALSE(b.pending());
+    EXPECT_EQ(50, periodic.fired_);
+    EXPECT_EQ(0, cancelled.fired_);
+    EXPECT_EQ(0u, wheel.size());
+}
+
+TEST(TimerWheelTest, ExpiredOnAddFiresAtNextAdvance) {
+    uint64_t now = kBase;
+    TimerWheel wheel;
+    wheel.Initialize(now);
+    wheel.Advance(now + 500);
+    now += 500;
+
+    RecordTimer t;
+    t.now_ = &now;
+    wheel.Add(&t, kBase);
+    EXPECT_EQ(0, wheel.NextTimeout(now + 1));
+    now++;
+    wheel.Advance(now);
+    EXPECT_EQ(1, t.fired_);
+}